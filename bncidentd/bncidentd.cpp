@@ -198,6 +198,15 @@ class CIdentModule : public CModuleImplementation {
 			SocketPv->Events->Destroy();
 		}
 	}
+
+	const modulesubscription_t *GetSubscriptions(void) {
+		/* the listeners are registered sockets, so we don't need any events */
+		static const modulesubscription_t Subscriptions[] = {
+			{ ModuleEvent_None, NULL }
+		};
+
+		return Subscriptions;
+	}
 };
 
 extern "C" EXPORT CModuleFar *bncGetObject(void) {
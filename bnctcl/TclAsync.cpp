@@ -0,0 +1,484 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "../src/StdAfx.h"
+#include "StdAfx.h"
+#include "TclAsync.h"
+#include "tickleProcs.h"
+
+extern Tcl_Interp* g_Interp;
+
+CTclAsync *g_TclAsync = NULL;
+
+/**
+ * tclasyncevent_t
+ *
+ * A script for the asynchronous interpreter. The event is queued using
+ * Tcl_ThreadQueueEvent, which takes care of the locking.
+ */
+typedef struct tclasyncevent_s {
+	Tcl_Event Header; /**< must be the first member */
+	CTclAsync *Async; /**< the asynchronous interpreter */
+	char *Script; /**< the script (UTF-8), or NULL if the thread should exit */
+} tclasyncevent_t;
+
+/**
+ * TclAsyncPostCmd
+ *
+ * Implements "bncpost <script> ?context?" for the asynchronous interpreter.
+ */
+int TclAsyncPostCmd(ClientData Async, Tcl_Interp *Interp, int objc, Tcl_Obj *const objv[]) {
+	if (objc < 2 || objc > 3) {
+		Tcl_WrongNumArgs(Interp, 1, objv, "script ?context?");
+
+		return TCL_ERROR;
+	}
+
+	((CTclAsync *)Async)->Post(Tcl_GetString(objv[1]), objc > 2 ? Tcl_GetString(objv[2]) : NULL, false);
+
+	return TCL_OK;
+}
+
+/**
+ * TclAsyncEventProc
+ *
+ * Executes a script in the asynchronous interpreter.
+ */
+int TclAsyncEventProc(Tcl_Event *Event, int Flags) {
+	tclasyncevent_t *AsyncEvent = (tclasyncevent_t *)Event;
+	CTclAsync *Async = AsyncEvent->Async;
+
+	if (AsyncEvent->Script == NULL) {
+		Async->m_Shutdown = true;
+
+		return 1;
+	}
+
+	if (Tcl_EvalEx(Async->m_Interp, AsyncEvent->Script, -1, TCL_EVAL_GLOBAL) == TCL_ERROR) {
+		Async->Post(Tcl_GetVar(Async->m_Interp, "errorInfo", TCL_GLOBAL_ONLY), NULL, true);
+	}
+
+	free(AsyncEvent->Script);
+
+	Tcl_MutexLock(&Async->m_Lock);
+	Async->m_Queued--;
+	Tcl_MutexUnlock(&Async->m_Lock);
+
+	return 1;
+}
+
+/**
+ * TclAsyncThread
+ *
+ * The main function of the asynchronous interpreter's thread.
+ */
+Tcl_ThreadCreateType TclAsyncThread(ClientData Cookie) {
+	CTclAsync *Async = (CTclAsync *)Cookie;
+
+	Async->m_Interp = Tcl_CreateInterp();
+
+	if (Tcl_Init(Async->m_Interp) == TCL_ERROR) {
+		Async->Post(Tcl_GetStringResult(Async->m_Interp), NULL, true);
+	}
+
+	Tcl_SetVar(Async->m_Interp, "tcl_interactive", "0", TCL_GLOBAL_ONLY);
+	Tcl_CreateObjCommand(Async->m_Interp, "bncpost", TclAsyncPostCmd, Async, NULL);
+
+	Tcl_MutexLock(&Async->m_Lock);
+	Async->m_Ready = true;
+	Tcl_ConditionNotify(&Async->m_Started);
+	Tcl_MutexUnlock(&Async->m_Lock);
+
+	while (!Async->m_Shutdown) {
+		Tcl_DoOneEvent(TCL_ALL_EVENTS);
+	}
+
+	Tcl_DeleteInterp(Async->m_Interp);
+	Async->m_Interp = NULL;
+
+	Tcl_FinalizeThread();
+
+	TCL_THREAD_CREATE_RETURN;
+}
+
+/**
+ * CTclAsync
+ *
+ * Starts the asynchronous interpreter. Use IsRunning() to find out
+ * whether this was successful.
+ */
+CTclAsync::CTclAsync(void) {
+	m_Running = false;
+	m_Interp = NULL;
+	m_Shutdown = false;
+	m_Lock = NULL;
+	m_Started = NULL;
+	m_Ready = false;
+	m_Queued = 0;
+	m_Posted = NULL;
+	m_Signalled = false;
+	m_Submitted = 0;
+	m_Dropped = 0;
+	m_Dropping = false;
+	m_Wakeup = NULL;
+
+	m_Wakeup = new CWakeupEvent(WakeupCallback, this);
+
+	if (AllocFailed(m_Wakeup)) {
+		return;
+	}
+
+	if (!m_Wakeup->IsValid()) {
+		delete m_Wakeup;
+		m_Wakeup = NULL;
+
+		return;
+	}
+
+	// this fails if Tcl was built without thread support
+	if (Tcl_CreateThread(&m_Thread, TclAsyncThread, this, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+		g_Bouncer->Log("Could not start the asynchronous Tcl interpreter. Tcl might have been built without thread support.");
+
+		return;
+	}
+
+	Tcl_MutexLock(&m_Lock);
+
+	while (!m_Ready) {
+		Tcl_ConditionWait(&m_Started, &m_Lock, NULL);
+	}
+
+	Tcl_MutexUnlock(&m_Lock);
+
+	m_Running = true;
+}
+
+/**
+ * ~CTclAsync
+ *
+ * Stops the asynchronous interpreter. Scripts which are still queued
+ * are executed first.
+ */
+CTclAsync::~CTclAsync(void) {
+	if (m_Running) {
+		tclasyncevent_t *Event = (tclasyncevent_t *)ckalloc(sizeof(tclasyncevent_t));
+		int Result;
+
+		Event->Header.proc = TclAsyncEventProc;
+		Event->Async = this;
+		Event->Script = NULL;
+
+		Tcl_ThreadQueueEvent(m_Thread, (Tcl_Event *)Event, TCL_QUEUE_TAIL);
+		Tcl_ThreadAlert(m_Thread);
+
+		Tcl_JoinThread(m_Thread, &Result);
+	}
+
+	delete m_Wakeup;
+
+	DeliverPosted();
+
+	Tcl_ConditionFinalize(&m_Started);
+	Tcl_MutexFinalize(&m_Lock);
+}
+
+/**
+ * IsRunning
+ *
+ * Returns whether the asynchronous interpreter is available.
+ */
+bool CTclAsync::IsRunning(void) const {
+	return m_Running;
+}
+
+/**
+ * Queue
+ *
+ * Queues a script for the asynchronous interpreter. Returns false if the
+ * interpreter isn't running or if the queue is full.
+ *
+ * @param Script the script (UTF-8)
+ */
+bool CTclAsync::Queue(const char *Script) {
+	tclasyncevent_t *Event;
+	bool Full;
+
+	if (!m_Running) {
+		return false;
+	}
+
+	Tcl_MutexLock(&m_Lock);
+
+	Full = (m_Queued >= TCLASYNC_MAXQUEUE);
+
+	if (!Full) {
+		m_Queued++;
+	}
+
+	Tcl_MutexUnlock(&m_Lock);
+
+	if (Full) {
+		if (!m_Dropping) {
+			g_Bouncer->Log("The queue of the asynchronous Tcl interpreter is full. Events are dropped until it has caught up.");
+		}
+
+		m_Dropping = true;
+		m_Dropped++;
+
+		return false;
+	}
+
+	m_Dropping = false;
+
+	Event = (tclasyncevent_t *)ckalloc(sizeof(tclasyncevent_t));
+	Event->Header.proc = TclAsyncEventProc;
+	Event->Async = this;
+	Event->Script = strdup(Script);
+
+	if (AllocFailed(Event->Script)) {
+		ckfree((char *)Event);
+
+		Tcl_MutexLock(&m_Lock);
+		m_Queued--;
+		Tcl_MutexUnlock(&m_Lock);
+
+		return false;
+	}
+
+	Tcl_ThreadQueueEvent(m_Thread, (Tcl_Event *)Event, TCL_QUEUE_TAIL);
+	Tcl_ThreadAlert(m_Thread);
+
+	m_Submitted++;
+
+	return true;
+}
+
+/**
+ * Post
+ *
+ * Called by the thread to pass a script to the main interpreter.
+ *
+ * @param Script the script (UTF-8)
+ * @param Context the context in which the script should be executed, or NULL
+ * @param Error whether Script is an error message which should be logged instead
+ */
+void CTclAsync::Post(const char *Script, const char *Context, bool Error) {
+	tclasyncpost_t *Item;
+	bool Signal;
+
+	Item = (tclasyncpost_t *)malloc(sizeof(tclasyncpost_t));
+
+	if (Item == NULL) {
+		return;
+	}
+
+	Item->Script = strdup(Script ? Script : "");
+	Item->Context = Context ? strdup(Context) : NULL;
+	Item->Error = Error;
+
+	if (Item->Script == NULL) {
+		free(Item->Context);
+		free(Item);
+
+		return;
+	}
+
+	Tcl_MutexLock(&m_Lock);
+
+	Item->Next = m_Posted;
+	m_Posted = Item;
+
+	Signal = !m_Signalled;
+	m_Signalled = true;
+
+	Tcl_MutexUnlock(&m_Lock);
+
+	if (Signal) {
+		m_Wakeup->Signal();
+	}
+}
+
+/**
+ * DeliverPosted
+ *
+ * Executes the scripts which have been posted by the thread.
+ */
+void CTclAsync::DeliverPosted(void) {
+	tclasyncpost_t *Items, *Item, *Ordered = NULL;
+
+	Tcl_MutexLock(&m_Lock);
+
+	Items = m_Posted;
+	m_Posted = NULL;
+	m_Signalled = false;
+
+	Tcl_MutexUnlock(&m_Lock);
+
+	// restore the order in which the scripts were posted
+	while (Items != NULL) {
+		Item = Items;
+		Items = Item->Next;
+
+		Item->Next = Ordered;
+		Ordered = Item;
+	}
+
+	while (Ordered != NULL) {
+		Item = Ordered;
+		Ordered = Item->Next;
+
+		if (Item->Error) {
+			g_Bouncer->Log("Error in the asynchronous Tcl interpreter: %s", Item->Script);
+		} else if (g_Interp != NULL) {
+			if (Item->Context != NULL) {
+				setctx(Item->Context);
+			}
+
+			if (Tcl_EvalEx(g_Interp, Item->Script, -1, TCL_EVAL_GLOBAL) == TCL_ERROR) {
+				g_Bouncer->Log("Error in a script which was posted by the asynchronous Tcl interpreter: %s",
+					Tcl_GetStringResult(g_Interp));
+			}
+		}
+
+		free(Item->Script);
+		free(Item->Context);
+		free(Item);
+	}
+}
+
+/**
+ * GetQueueLength
+ *
+ * Returns the number of scripts which haven't been executed yet.
+ */
+int CTclAsync::GetQueueLength(void) {
+	int Queued;
+
+	Tcl_MutexLock(&m_Lock);
+	Queued = m_Queued;
+	Tcl_MutexUnlock(&m_Lock);
+
+	return Queued;
+}
+
+/**
+ * GetSubmittedCount
+ *
+ * Returns the number of scripts which have been queued.
+ */
+unsigned int CTclAsync::GetSubmittedCount(void) const {
+	return m_Submitted;
+}
+
+/**
+ * GetDroppedCount
+ *
+ * Returns the number of scripts which have been dropped because the
+ * queue was full.
+ */
+unsigned int CTclAsync::GetDroppedCount(void) const {
+	return m_Dropped;
+}
+
+/**
+ * WakeupCallback
+ *
+ * Called when the thread has woken up the main loop.
+ *
+ * @param Async the asynchronous interpreter
+ */
+void CTclAsync::WakeupCallback(void *Async) {
+	((CTclAsync *)Async)->DeliverPosted();
+}
+
+/**
+ * GetTclAsync
+ *
+ * Returns the asynchronous interpreter, starting it if necessary.
+ */
+CTclAsync *GetTclAsync(void) {
+	if (g_TclAsync == NULL) {
+		g_TclAsync = new CTclAsync();
+
+		if (AllocFailed(g_TclAsync)) {
+			return NULL;
+		}
+	}
+
+	return g_TclAsync->IsRunning() ? g_TclAsync : NULL;
+}
+
+/**
+ * TclAsyncEvalCmd
+ *
+ * Implements "internalasynceval <script>" for the main interpreter: queues
+ * a script (e.g. "source scripts/foo.tcl") for the asynchronous interpreter.
+ */
+static int TclAsyncEvalCmd(ClientData Cookie, Tcl_Interp *Interp, int objc, Tcl_Obj *const objv[]) {
+	CTclAsync *Async;
+
+	if (objc != 2) {
+		Tcl_WrongNumArgs(Interp, 1, objv, "script");
+
+		return TCL_ERROR;
+	}
+
+	Async = GetTclAsync();
+
+	if (Async == NULL) {
+		Tcl_SetObjResult(Interp, Tcl_NewStringObj("The asynchronous interpreter is not available.", -1));
+
+		return TCL_ERROR;
+	}
+
+	Tcl_SetObjResult(Interp, Tcl_NewBooleanObj(Async->Queue(Tcl_GetString(objv[1]))));
+
+	return TCL_OK;
+}
+
+/**
+ * TclAsyncInfoCmd
+ *
+ * Implements "internalasyncinfo" for the main interpreter. Returns a list
+ * containing the number of queued, submitted and dropped scripts, or an
+ * empty list if the asynchronous interpreter hasn't been started.
+ */
+static int TclAsyncInfoCmd(ClientData Cookie, Tcl_Interp *Interp, int objc, Tcl_Obj *const objv[]) {
+	Tcl_Obj *List = Tcl_NewListObj(0, NULL);
+
+	if (g_TclAsync != NULL && g_TclAsync->IsRunning()) {
+		Tcl_ListObjAppendElement(NULL, List, Tcl_NewIntObj(g_TclAsync->GetQueueLength()));
+		Tcl_ListObjAppendElement(NULL, List, Tcl_NewWideIntObj(g_TclAsync->GetSubmittedCount()));
+		Tcl_ListObjAppendElement(NULL, List, Tcl_NewWideIntObj(g_TclAsync->GetDroppedCount()));
+	}
+
+	Tcl_SetObjResult(Interp, List);
+
+	return TCL_OK;
+}
+
+/**
+ * RegisterAsyncCommands
+ *
+ * Registers the commands which control the asynchronous interpreter.
+ */
+void RegisterAsyncCommands(Tcl_Interp *Interp) {
+	Tcl_CreateObjCommand(Interp, "internalasynceval", TclAsyncEvalCmd, NULL, NULL);
+	Tcl_CreateObjCommand(Interp, "internalasyncinfo", TclAsyncInfoCmd, NULL, NULL);
+}
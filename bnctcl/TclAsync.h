@@ -0,0 +1,91 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+/** The maximum number of scripts which may be waiting for the asynchronous interpreter */
+#define TCLASYNC_MAXQUEUE 1024
+
+/**
+ * tclasyncpost_t
+ *
+ * A script which has been posted to the main interpreter by the
+ * asynchronous interpreter (or an error message which should be logged).
+ */
+typedef struct tclasyncpost_s {
+	char *Script; /**< the script (UTF-8) */
+	char *Context; /**< the context for the script, or NULL */
+	bool Error; /**< whether Script is an error message */
+	struct tclasyncpost_s *Next; /**< the next item */
+} tclasyncpost_t;
+
+/**
+ * CTclAsync
+ *
+ * A second Tcl interpreter which runs on its own thread. It's used for
+ * binds which only observe events (see internalasyncbind) and for
+ * scripts which would otherwise block the main loop (e.g. http::geturl).
+ * The interpreter runs Tcl's event loop, so "after" and "fileevent" work
+ * as usual. It can't call any of the bouncer's procs; instead it uses
+ * "bncpost <script> ?context?" to have scripts executed by the main
+ * interpreter.
+ */
+class CTclAsync {
+	Tcl_ThreadId m_Thread; /**< the interpreter's thread */
+	bool m_Running; /**< whether the thread has been started */
+
+	Tcl_Interp *m_Interp; /**< the interpreter, only used by the thread */
+	bool m_Shutdown; /**< whether the thread should exit, only used by the thread */
+
+	Tcl_Mutex m_Lock; /**< protects the fields below */
+	Tcl_Condition m_Started; /**< signalled once the thread is ready */
+	bool m_Ready; /**< whether the thread is ready */
+	int m_Queued; /**< the number of scripts which haven't been executed yet */
+	tclasyncpost_t *m_Posted; /**< scripts for the main interpreter, newest first */
+	bool m_Signalled; /**< whether the main loop has already been woken up */
+
+	CWakeupEvent *m_Wakeup; /**< wakes up the main loop when scripts have been posted */
+
+	unsigned int m_Submitted; /**< the number of scripts which have been queued */
+	unsigned int m_Dropped; /**< the number of scripts which have been dropped */
+	bool m_Dropping; /**< whether we've logged that the queue is full */
+
+	void Post(const char *Script, const char *Context, bool Error);
+	void DeliverPosted(void);
+
+	static void WakeupCallback(void *Async);
+
+	friend Tcl_ThreadCreateType TclAsyncThread(ClientData Async);
+	friend int TclAsyncEventProc(Tcl_Event *Event, int Flags);
+	friend int TclAsyncPostCmd(ClientData Async, Tcl_Interp *Interp, int objc, Tcl_Obj *const objv[]);
+public:
+	CTclAsync(void);
+	virtual ~CTclAsync(void);
+
+	bool IsRunning(void) const;
+	bool Queue(const char *Script);
+
+	int GetQueueLength(void);
+	unsigned int GetSubmittedCount(void) const;
+	unsigned int GetDroppedCount(void) const;
+};
+
+extern CTclAsync *g_TclAsync;
+
+CTclAsync *GetTclAsync(void);
+
+void RegisterAsyncCommands(Tcl_Interp *Interp);
@@ -16,7 +16,6 @@
 # along with this program; if not, write to the Free Software
 # Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
-internalbind modec sbnc:modechange
 internalbind svrconnect sbnc:svrconnect
 internalbind svrdisconnect sbnc:svrdisconnect
 internalbind svrlogon sbnc:svrlogon
@@ -89,31 +88,11 @@ proc sbnc:bindpulse {} {
 	}
 }
 
-proc sbnc:modechange {client parameters} {
-	set source [lindex $parameters 0]
-	set channel [lindex $parameters 1]
-	set mode [lindex $parameters 2]
-	set targ [lindex $parameters 3]
-
-	set hand [finduser $source]
-	set flags $hand
-
-	set nick [sbnc:nickfromhost $source]
-	set host [sbnc:sitefromhost $source]
-
-	if {![onchan $nick $channel]} {
-		set nick ""
-		set host $source
-		set hand "*"
-		set flags $hand
-	}
-
-	sbnc:callbinds "mode" $flags $channel "$channel $mode" $nick $host $hand $channel $mode $targ
-}
-
 proc sbnc:rawserver {client parameters} {
 	if {[llength [binds]] == 0} { return }
 
+	# raw, msg(m), pub(m), notc, ctcp, ctcr, join, part, sign, nick,
+	# kick and mode binds are dispatched by the module itself
 	set source [lindex $parameters 0]
 	set nick [sbnc:nickfromhost $source]
 	set site [sbnc:sitefromhost $source]
@@ -125,63 +104,10 @@ proc sbnc:rawserver {client parameters} {
 	set hand [finduser $source]
 	set flags $hand
 
-	if {[llength [split [lindex $parameters end]]] > 1} {
-		set last ":[lindex $parameters end]"
-	} else {
-		set last [lindex $parameters end]
-	}
-
-	sbnc:callbinds "raw" - "" $verb $source $verb "[join [lrange $parameters 2 end-1]] $last"
-
 	switch $verb {
-		"privmsg" {
-			if {[regexp "\001(\[^ \]+)(| (.*?))\001" $opt foo verb text]} {
-				sbnc:callbinds "ctcp" $flags $targ $verb $nick $site $hand $targ $verb $text
-			} else {
-				if {[validchan $targ] || [botonchan $targ]} {
-					sbnc:callbinds "pub" $flags $targ [lindex [split $opt] 0] $nick $site $hand $targ [join [lrange [split $opt] 1 end]]
-					sbnc:callbinds "pubm" $flags $targ "$targ $opt" $nick $site $hand $targ $opt
-				} else {
-					sbnc:callbinds "msg" $flags "" [lindex [split $opt] 0] $nick $site $hand [join [lrange [split $opt] 1 end]]
-					sbnc:callbinds "msgm" $flags "" $opt $nick $site $hand $opt
-				}
-			}
-		}
-		"notice" {
-			if {[regexp "\001(\[^ \]+)(| (.*?))\001" $opt foo verb text]} {
-				sbnc:callbinds "ctcr" $flags $targ $verb $nick $site $hand $targ $verb $text
-			} else {
-				sbnc:callbinds "notc" $flags $targ $opt $nick $site $hand $opt $targ
-			}
-		}
-		"join" {
-			sbnc:callbinds "join" $flags $targ "$targ $source" $nick $site $hand $targ
-		}
-		"part" {
-			sbnc:callbinds "part" $flags $targ "$targ $source" $nick $site $hand $targ $opt
-		}
-		"quit" {
-			if {![regexp {^\S+\.\S+ \S+\.\S+$} $targ]} {
-				foreach c [internalchannels] {
-					if {[onchan $nick $c]} {
-						sbnc:callbinds "sign" $flags $c "$c $source" $nick $site $hand $c $targ
-					}
-				}
-			}
-		}
 		"topic" {
 			sbnc:callbinds "topc" $flags $targ "$targ $opt" $nick $site $hand $targ $opt
 		}
-		"kick" {
-			sbnc:callbinds "kick" $flags $targ "$targ $opt" $nick $site $hand $targ $opt [lindex $parameters 4]
-		}
-		"nick" {
-			foreach c [internalchannels] {
-				if {[onchan $targ $c]} {
-					sbnc:callbinds "nick" $flags $c "$c $targ" $nick $site $hand $c $targ
-				}
-			}
-		}
 		"wallops" {
 			sbnc:callbinds "wall" - "" $targ $source [join [lrange $parameters 2 end]]
 		}
@@ -292,7 +218,11 @@ proc bind {type flags mask {procname ""}} {
 
 	lappend binds [list $type $flags $mask 0 $procname]
 
-	internalbind server sbnc:rawserver * [getctx]
+	internaleggbind $type $flags $mask $procname [getctx]
+
+	foreach verb {topic wallops invite 471 473 474 475 477} {
+		internalbind server sbnc:rawserver $verb [getctx]
+	}
 
 	if {[string equal -nocase $type "need"] || [string equal -nocase $type "time"]} {
 		internaltimer 60 1 sbnc:bindpulse
@@ -345,8 +275,12 @@ proc unbind {type flags mask procname} {
 
 	set binds $newbinds
 
+	internaleggunbind $type $flags $mask $procname [getctx]
+
 	if {[llength $binds] == 0} {
-		internalunbind server sbnc:rawserver * [getctx]
+		foreach verb {topic wallops invite 471 473 474 475 477} {
+			internalunbind server sbnc:rawserver $verb [getctx]
+		}
 	}
 
 	return $mask
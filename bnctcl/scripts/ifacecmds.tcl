@@ -179,6 +179,12 @@ proc iface:getloglines {} {
 
 registerifacecmd "core" "getloglines" "iface:getloglines"
 
+proc iface:searchlog {words {nick ""} {since 0} {until 0} {offset 0} {count 0}} {
+	return [itype_list_strings [bncsearchlog $words $nick $since $until $offset $count]]
+}
+
+registerifacecmd "core" "searchlog" "iface:searchlog"
+
 proc iface:eraselog {} {
 	set file [open users/[getctx].log w+]
 	close $file
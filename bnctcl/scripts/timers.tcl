@@ -15,6 +15,8 @@
 # along with this program; if not, write to the Free Software
 # Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
+internalbind usrdelete sbnc:timersdelete
+
 proc sbnc:runthistimer {cookie} {
 	set user [lindex $cookie 0]
 	set timerID [lindex $cookie 1]
@@ -145,7 +147,7 @@ proc utimers {} {
 	set temptimers ""
 
 	foreach ut $utimers {
-		lappend temptimers [list [expr [lindex $ut 0] - [clock seconds]] [lindex $ut 1] [lindex $ut 2]]
+		lappend temptimers [list [expr {int(ceil([lindex $ut 0] - [clock seconds]))}] [lindex $ut 1] [lindex $ut 2]]
 	}
 
 	return $temptimers
@@ -163,7 +165,7 @@ proc killtimer {timerID} {
 	if {$idx != -1} {
 		set timers [lreplace $timers $idx $idx]
 
-		internalkilltimer sbnc:runthistimer [list [getctx] $timerID]]
+		internalkilltimer sbnc:runthistimer [list [getctx] $timerID]
 	}
 
 	return
@@ -181,8 +183,13 @@ proc killutimer {timerID} {
 	if {$idx != -1} {
 		set utimers [lreplace $utimers $idx $idx]
 
-		internalkilltimer sbnc:runthisutimer [list [getctx] $timerID]]
+		internalkilltimer sbnc:runthisutimer [list [getctx] $timerID]
 	}
 
 	return
 }
+
+proc sbnc:timersdelete {client} {
+	internalkilltimers sbnc:runthistimer "[list $client] "
+	internalkilltimers sbnc:runthisutimer "[list $client] "
+}
@@ -22,9 +22,16 @@
 
 #include "TclClientSocket.h"
 #include "TclSocket.h"
+#include "TclAsync.h"
 #include "tickle.h"
 #include "tickleProcs.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 class CTclSupport;
 
 CCore* g_Bouncer;
@@ -33,10 +40,107 @@ CTclSupport* g_Tcl;
 bool g_Ret;
 bool g_NoticeUser;
 Tcl_Encoding g_Encoding;
+Tcl_Encoding g_DefaultEncoding;
+CHashtable<Tcl_Encoding, false>* g_UserEncodings;
 int g_ChannelSortValue;
 
-extern tcltimer_t **g_Timers;
-extern int g_TimerCount;
+static CVector<modulesubscription_t> g_Subscriptions;
+
+static void FreeEncoding(Tcl_Encoding Encoding) {
+	Tcl_FreeEncoding(Encoding);
+}
+
+static bool HasBinds(binding_type_e type) {
+	for (int i = 0; i < g_BindCount; i++) {
+		if (g_Binds[i].valid && g_Binds[i].type == type)
+			return true;
+	}
+
+	return false;
+}
+
+static void AddSubscription(module_event_t event, const char* command) {
+	modulesubscription_t subscription;
+
+	subscription.Event = event;
+	subscription.Command = command;
+
+	g_Subscriptions.Insert(subscription);
+}
+
+/* the core only passes us the lines which our binds can match; "server"
+ * binds match any argument, so they need all lines, while most eggdrop-style
+ * binds only need a single IRC command */
+static const modulesubscription_t* GetTclSubscriptions(void) {
+	bool wrapped = HasBinds(Type_PreScript) || HasBinds(Type_PostScript);
+	bool modes = HasBinds(Type_SingleMode);
+
+	g_Subscriptions.Clear();
+
+	if (wrapped || HasBinds(Type_Server))
+		AddSubscription(ModuleEvent_IRCMessage, NULL);
+
+	for (int i = 0; i < g_EggBindCount; i++) {
+		const eggbind_t* bind = &g_EggBinds[i];
+		const char* command = NULL;
+
+		if (!bind->valid)
+			continue;
+
+		switch (bind->type) {
+			case Egg_Raw:
+				if (strpbrk(bind->mask, "*?[\\") == NULL)
+					command = bind->mask;
+
+				break;
+			case Egg_Pub:
+			case Egg_Pubm:
+			case Egg_Msg:
+			case Egg_Msgm:
+			case Egg_Ctcp:
+				command = "PRIVMSG";
+				break;
+			case Egg_Ctcr:
+			case Egg_Notc:
+				command = "NOTICE";
+				break;
+			case Egg_Join:
+				command = "JOIN";
+				break;
+			case Egg_Part:
+				command = "PART";
+				break;
+			case Egg_Sign:
+				command = "QUIT";
+				break;
+			case Egg_Nick:
+				command = "NICK";
+				break;
+			case Egg_Kick:
+				command = "KICK";
+				break;
+			case Egg_Mode:
+				modes = true;
+				continue;
+			default:
+				continue;
+		}
+
+		AddSubscription(ModuleEvent_IRCMessage, command);
+	}
+
+	if (wrapped || HasBinds(Type_Client))
+		AddSubscription(ModuleEvent_ClientMessage, NULL);
+
+	if (modes)
+		AddSubscription(ModuleEvent_ModeChange, NULL);
+
+	AddSubscription(ModuleEvent_ClientCommand, NULL);
+	AddSubscription(ModuleEvent_MainLoop, NULL);
+	AddSubscription(ModuleEvent_None, NULL);
+
+	return g_Subscriptions.GetList();
+}
 
 int Tcl_AppInit(Tcl_Interp *interp) {
 	if (Tcl_Init(interp) == TCL_ERROR)
@@ -52,7 +156,14 @@ class CTclSupport : public CModuleImplementation {
 	void Destroy(void) {
 		CallBinds(Type_Unload, NULL, NULL, 0, NULL);
 
-		Tcl_FreeEncoding(g_Encoding);
+		delete g_TclAsync;
+		g_TclAsync = NULL;
+
+		delete g_UserEncodings;
+		g_UserEncodings = NULL;
+
+		g_Encoding = NULL;
+		Tcl_FreeEncoding(g_DefaultEncoding);
 
 		Tcl_DeleteInterp(g_Interp);
 
@@ -78,13 +189,7 @@ class CTclSupport : public CModuleImplementation {
 
 		delete g_TclClientSockets;
 
-		for (int a = 0; a < g_TimerCount; a++) {
-			if (g_Timers[a]) {
-				g_Timers[a]->timer->Destroy();
-				free(g_Timers[a]->proc);
-				free(g_Timers[a]->param);
-			}
-		}
+		DestroyTclTimers();
 
 		delete this;
 	}
@@ -151,7 +256,11 @@ class CTclSupport : public CModuleImplementation {
 
 		Tcl_SetSystemEncoding(NULL, "ISO8859-1");
 
-		g_Encoding = Tcl_GetEncoding(g_Interp, "ISO8859-1");
+		g_DefaultEncoding = Tcl_GetEncoding(NULL, DEFAULT_TCLENCODING);
+		g_Encoding = g_DefaultEncoding;
+
+		g_UserEncodings = new CHashtable<Tcl_Encoding, false>();
+		g_UserEncodings->RegisterValueDestructor(FreeEncoding);
 
 		g_Interp = Tcl_CreateInterp();
 
@@ -183,11 +292,12 @@ class CTclSupport : public CModuleImplementation {
 		Tcl_EvalFile(g_Interp, "./sbnc.tcl");
 	}
 
-	bool InterceptIRCMessage(CIRCConnection* IRC, int argc, const char** argv) {
+	bool InterceptParsedIRCMessage(CIRCConnection* IRC, const ircmessage_t* Message) {
 		g_Ret = true;
 
 		CallBinds(Type_PreScript, NULL, NULL, 0, NULL);
-		CallBinds(Type_Server, IRC->GetOwner()->GetUsername(), NULL, argc, argv);
+		CallBinds(Type_Server, IRC->GetOwner()->GetUsername(), NULL, Message->ArgC, Message->ArgV);
+		CallEggBinds(IRC, Message);
 		CallBinds(Type_PostScript, NULL, NULL, 0, NULL);
 
 		return g_Ret;
@@ -237,6 +347,8 @@ class CTclSupport : public CModuleImplementation {
 
 	void UserDelete(const char* User) {
 		CallBinds(Type_UsrDelete, User, NULL, 0, NULL);
+
+		FlushUserEncoding(User);
 	}
 
 	void SingleModeChange(CIRCConnection* IRC, const char* Channel, const char* Source,
@@ -250,6 +362,7 @@ class CTclSupport : public CModuleImplementation {
 		const char* argv[4] = { Source, Channel, ModeC, Parameter };
 
 		CallBinds(Type_SingleMode, IRC->GetOwner()->GetUsername(), NULL, Parameter ? 4 : 3, argv);
+		CallEggModeBinds(IRC, Channel, Source, ModeC, Parameter);
 	}
 
 	const char* Command(const char* Cmd, const char* Parameters) {
@@ -310,7 +423,7 @@ class CTclSupport : public CModuleImplementation {
 
 			g_CurrentClient = Client;
 
-			int Code = Tcl_EvalEx(g_Interp, Tcl_UtfToExternalDString(g_Encoding, argvdup[1], -1, &dsScript),
+			int Code = Tcl_EvalEx(g_Interp, UtfToExternal(g_Encoding, argvdup[1], -1, &dsScript),
 				-1, TCL_EVAL_GLOBAL | TCL_EVAL_DIRECT);
 
 			ArgFreeArray(argvdup);
@@ -331,7 +444,7 @@ class CTclSupport : public CModuleImplementation {
 			if (strResult && *strResult) {
 				Tcl_DString dsResult;
 
-				char* Dup = strdup(Tcl_UtfToExternalDString(g_Encoding, strResult, -1, &dsResult));
+				char* Dup = strdup(UtfToExternal(g_Encoding, strResult, -1, &dsResult));
 
 				Tcl_DStringFree(&dsResult);
 
@@ -376,11 +489,17 @@ class CTclSupport : public CModuleImplementation {
 		CallBinds(Type_SetUserTag, NULL, NULL, 2, argv);
 	}
 
+	/* Tcl timers are driven by a deadline (see ScheduleTclTimers), this only
+	 * runs Tcl's own event loop (e.g. for "after" and "fileevent") */
 	bool MainLoop(void) {
 		if (Tcl_DoOneEvent(TCL_ALL_EVENTS | TCL_DONT_WAIT))
 			return true;
 		return false;
 	}
+
+	const modulesubscription_t* GetSubscriptions(void) {
+		return GetTclSubscriptions();
+	}
 public:
 	void RehashInterpreter(void) {
 		CallBinds(Type_PreRehash, NULL, NULL, 0, NULL);
@@ -402,6 +521,194 @@ void RehashInterpreter(void) {
 	g_Tcl->RehashInterpreter();
 }
 
+/* checks whether a string consists of 7-bit characters only; such strings
+ * are the same in UTF-8 and in any ASCII-compatible encoding, so they don't
+ * need to be converted */
+bool IsAscii(const char* string, size_t length) {
+	const unsigned char* p = (const unsigned char*)string;
+	const unsigned char* end = p + length;
+
+#if defined(__AVX2__)
+	while (end - p >= 32) {
+		if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)p)) != 0)
+			return false;
+
+		p += 32;
+	}
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	while (end - p >= 16) {
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)) != 0)
+			return false;
+
+		p += 16;
+	}
+#endif
+
+	while (end - p >= 8) {
+		uint64_t word;
+
+		memcpy(&word, p, sizeof(word));
+
+		if (word & 0x8080808080808080ULL)
+			return false;
+
+		p += 8;
+	}
+
+	while (p < end) {
+		if (*p++ & 0x80)
+			return false;
+	}
+
+	return true;
+}
+
+/* like Tcl_ExternalToUtfDString, but returns the string itself if it doesn't
+ * need to be converted; the DString has to be freed in any case */
+const char* ExternalToUtf(Tcl_Encoding encoding, const char* string, int length, Tcl_DString* ds) {
+	if (string == NULL)
+		string = "";
+
+	if (length < 0)
+		length = strlen(string);
+
+	if (IsAscii(string, length) && memchr(string, '\0', length) == NULL) {
+		Tcl_DStringInit(ds);
+
+		return string;
+	}
+
+	return Tcl_ExternalToUtfDString(encoding, string, length, ds);
+}
+
+/* like Tcl_UtfToExternalDString, but returns the string itself if it doesn't
+ * need to be converted; the DString has to be freed in any case */
+const char* UtfToExternal(Tcl_Encoding encoding, const char* string, int length, Tcl_DString* ds) {
+	if (string == NULL)
+		string = "";
+
+	if (length < 0)
+		length = strlen(string);
+
+	if (IsAscii(string, length) && memchr(string, '\0', length) == NULL) {
+		Tcl_DStringInit(ds);
+
+		return string;
+	}
+
+	return Tcl_UtfToExternalDString(encoding, string, length, ds);
+}
+
+/* creates a new (unreferenced) Tcl object for a string in the specified encoding */
+Tcl_Obj* ExternalToObj(Tcl_Encoding encoding, const char* string, int length) {
+	Tcl_DString ds;
+	Tcl_Obj* obj;
+
+	if (string == NULL)
+		string = "";
+
+	if (length < 0)
+		length = strlen(string);
+
+	if (IsAscii(string, length) && memchr(string, '\0', length) == NULL)
+		return Tcl_NewStringObj(string, length);
+
+	Tcl_ExternalToUtfDString(encoding, string, length, &ds);
+	obj = Tcl_NewStringObj(Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+	Tcl_DStringFree(&ds);
+
+	return obj;
+}
+
+/* IRC needs an encoding which leaves 7-bit characters alone */
+bool IsAsciiCompatible(Tcl_Encoding encoding) {
+	char ascii[128];
+	Tcl_DString ds;
+	bool result;
+
+	for (int i = 0; i < 127; i++)
+		ascii[i] = i + 1;
+
+	ascii[127] = '\0';
+
+	Tcl_ExternalToUtfDString(encoding, ascii, 127, &ds);
+	result = (Tcl_DStringLength(&ds) == 127 && memcmp(Tcl_DStringValue(&ds), ascii, 127) == 0);
+	Tcl_DStringFree(&ds);
+
+	return result;
+}
+
+/* returns the encoding of the user's scripts (user.tclencoding) */
+Tcl_Encoding GetUserEncoding(const char* user) {
+	Tcl_Encoding encoding;
+	CUser* User;
+
+	if (user == NULL || g_UserEncodings == NULL)
+		return g_DefaultEncoding;
+
+	encoding = g_UserEncodings->Get(user);
+
+	if (encoding != NULL)
+		return encoding;
+
+	User = g_Bouncer->GetUser(user);
+
+	if (User == NULL)
+		return g_DefaultEncoding;
+
+	const char* name = User->GetConfig()->ReadString("user.tclencoding");
+
+	if (name == NULL) {
+		encoding = Tcl_GetEncoding(NULL, DEFAULT_TCLENCODING);
+	} else {
+		encoding = Tcl_GetEncoding(NULL, name);
+
+		if (encoding != NULL && !IsAsciiCompatible(encoding)) {
+			Tcl_FreeEncoding(encoding);
+			encoding = NULL;
+		}
+
+		if (encoding == NULL) {
+			g_Bouncer->Log("Unknown Tcl encoding for user %s: %s", user, name);
+
+			encoding = Tcl_GetEncoding(NULL, DEFAULT_TCLENCODING);
+		}
+	}
+
+	if (encoding == NULL)
+		return g_DefaultEncoding;
+
+	if (IsError(g_UserEncodings->Add(user, encoding))) {
+		Tcl_FreeEncoding(encoding);
+
+		return g_DefaultEncoding;
+	}
+
+	return encoding;
+}
+
+/* forgets the cached encoding, e.g. after the user's setting has changed */
+void FlushUserEncoding(const char* user) {
+	if (g_UserEncodings == NULL)
+		return;
+
+	if (g_UserEncodings->Get(user) == g_Encoding)
+		g_Encoding = g_DefaultEncoding;
+
+	g_UserEncodings->Remove(user);
+}
+
+typedef struct bindcandidate_s {
+	int bind;
+	unsigned int serial;
+} bindcandidate_t;
+
+static int CompareBindCandidates(const void *p1, const void *p2) {
+	return ((const bindcandidate_t *)p1)->bind - ((const bindcandidate_t *)p2)->bind;
+}
+
 void CallBinds(binding_type_e type, const char* user, CClientConnection *client, int argc, const char** argv) {
 	Tcl_Obj** listv;
 	CUser *User = NULL;
@@ -410,90 +717,149 @@ void CallBinds(binding_type_e type, const char* user, CClientConnection *client,
 	Tcl_Obj* objv[3];
 	bool lazyConversionDone = false;
 
-	for (int i = 0; i < g_BindCount; i++) {
-		if (g_Binds[i].valid && g_Binds[i].type == type) {
-			Tcl_DString dsProc;
+	bindindex_t *index = &g_BindIndex[type];
+	const bindlist_t *stackLists[32];
+	const bindlist_t **lists = stackLists;
+	int listCount = 0, total = 0;
 
-			if (user && strcasecmp(g_Binds[i].user, user) != 0 && !strcasecmp(g_Binds[i].user, "*") == 0)
-				continue;
+	if (argc + 1 > (int)(sizeof(stackLists) / sizeof(stackLists[0]))) {
+		lists = (const bindlist_t **)malloc(sizeof(bindlist_t *) * (argc + 1));
 
-			bool Match = false;
+		if (lists == NULL)
+			return;
+	}
 
-			if (g_Binds[i].pattern == NULL || strcmp(g_Binds[i].pattern, "*") == 0)
-				Match = true;
+	/* find the binds whose pattern matches one of the arguments */
+	if (index->wildcard.count > 0) {
+		lists[listCount++] = &index->wildcard;
+		total += index->wildcard.count;
+	}
 
-			if (!Match) {
-				for (int a = 0; a < argc; a++) {
-					if (strcasecmp(g_Binds[i].pattern, argv[a]) == 0) {
-					//if (g_Bouncer->Match(g_Binds[i].pattern, argv[a])) {
-						Match = true;
+	if (index->patterns != NULL && index->patterns->GetLength() > 0) {
+		for (int a = 0; a < argc; a++) {
+			const bindlist_t *list = index->patterns->Get(argv[a]);
 
-						break;
-					}
-				}
+			if (list != NULL) {
+				lists[listCount++] = list;
+				total += list->count;
 			}
+		}
+	}
 
-			if (Match) {
-				if (!lazyConversionDone) {
-					if (user) {
-						Tcl_DString dsUser;
+	bindcandidate_t stackCandidates[64];
+	bindcandidate_t *candidates = stackCandidates;
+	int count = 0;
 
-						Tcl_ExternalToUtfDString(g_Encoding, user ? user : "", -1, &dsUser);
-						objv[idx++] = Tcl_NewStringObj(Tcl_DStringValue(&dsUser), Tcl_DStringLength(&dsUser));
-						Tcl_DStringFree(&dsUser);
+	if (total > (int)(sizeof(stackCandidates) / sizeof(stackCandidates[0]))) {
+		candidates = (bindcandidate_t *)malloc(sizeof(bindcandidate_t) * total);
 
-						Tcl_IncrRefCount(objv[idx - 1]);
-					}
+		if (candidates == NULL)
+			total = 0;
+	}
 
-					if (argc) {
-						listv = (Tcl_Obj**)malloc(sizeof(Tcl_Obj*) * argc);
+	if (total == 0) {
+		if (lists != stackLists)
+			free(lists);
 
-						for (int a = 0; a < argc; a++) {
-							Tcl_DString dsString;
+		return;
+	}
 
-							Tcl_ExternalToUtfDString(g_Encoding, argv[a], -1, &dsString);
-							listv[a] = Tcl_NewStringObj(Tcl_DStringValue(&dsString), Tcl_DStringLength(&dsString));
-							Tcl_DStringFree(&dsString);
+	for (int l = 0; l < listCount; l++) {
+		for (int b = 0; b < lists[l]->count; b++) {
+			const binding_t *bind = &g_Binds[lists[l]->binds[b]];
 
-							Tcl_IncrRefCount(listv[a]);
-						}
+			if (user && !bind->anyuser && strcasecmp(bind->user, user) != 0)
+				continue;
 
-						objv[idx++] = Tcl_NewListObj(argc, listv);
-						Tcl_IncrRefCount(objv[idx - 1]);
+			candidates[count].bind = lists[l]->binds[b];
+			candidates[count].serial = bind->serial;
+			count++;
+		}
+	}
 
-						for (int a = 0; a < argc; a++) {
-							Tcl_DecrRefCount(listv[a]);
-						}
+	/* binds are called in the order of their slots; a bind might be
+	 * in the candidate list more than once if several arguments match */
+	if (listCount > 1)
+		qsort(candidates, count, sizeof(bindcandidate_t), CompareBindCandidates);
 
-						free(listv);
-					}
+	if (lists != stackLists)
+		free(lists);
 
-					lazyConversionDone = true;
-				}
+	for (int c = 0; c < count; c++) {
+		if (c > 0 && candidates[c].bind == candidates[c - 1].bind)
+			continue;
 
-				Tcl_ExternalToUtfDString(g_Encoding, g_Binds[i].proc, -1, &dsProc);
-				objv[0] = Tcl_NewStringObj(Tcl_DStringValue(&dsProc), Tcl_DStringLength(&dsProc));
-				Tcl_DStringFree(&dsProc);
+		/* earlier binds might have removed this one */
+		if (!g_Binds[candidates[c].bind].valid || g_Binds[candidates[c].bind].serial != candidates[c].serial)
+			continue;
 
-				Tcl_IncrRefCount(objv[0]);
+		if (!lazyConversionDone) {
+			Tcl_Encoding encoding = GetUserEncoding(user);
 
-				if (User == NULL) {
-					User = g_Bouncer->GetUser(user);
-				}
+			if (user) {
+				objv[idx++] = ExternalToObj(encoding, user);
 
-				if (User != NULL) {
-					setctx(user);
+				Tcl_IncrRefCount(objv[idx - 1]);
+			}
+
+			if (argc) {
+				listv = (Tcl_Obj**)malloc(sizeof(Tcl_Obj*) * argc);
+
+				for (int a = 0; a < argc; a++) {
+					listv[a] = ExternalToObj(encoding, argv[a]);
+
+					Tcl_IncrRefCount(listv[a]);
 				}
 
-				g_CurrentClient = client;
+				objv[idx++] = Tcl_NewListObj(argc, listv);
+				Tcl_IncrRefCount(objv[idx - 1]);
 
-				Tcl_EvalObjv(g_Interp, idx, objv, TCL_EVAL_GLOBAL);
+				for (int a = 0; a < argc; a++) {
+					Tcl_DecrRefCount(listv[a]);
+				}
 
-				Tcl_DecrRefCount(objv[0]);
+				free(listv);
 			}
+
+			lazyConversionDone = true;
 		}
+
+		/* the bind might be removed while the proc is running */
+		objv[0] = g_Binds[candidates[c].bind].procobj;
+		Tcl_IncrRefCount(objv[0]);
+
+		if (g_Binds[candidates[c].bind].async) {
+			Tcl_Obj* script = Tcl_NewListObj(idx, objv);
+
+			Tcl_IncrRefCount(script);
+
+			if (g_TclAsync != NULL)
+				g_TclAsync->Queue(Tcl_GetString(script));
+
+			Tcl_DecrRefCount(script);
+			Tcl_DecrRefCount(objv[0]);
+
+			continue;
+		}
+
+		if (User == NULL) {
+			User = g_Bouncer->GetUser(user);
+		}
+
+		if (User != NULL) {
+			setctx(user);
+		}
+
+		g_CurrentClient = client;
+
+		Tcl_EvalObjv(g_Interp, idx, objv, TCL_EVAL_GLOBAL);
+
+		Tcl_DecrRefCount(objv[0]);
 	}
 
+	if (candidates != stackCandidates)
+		free(candidates);
+
 	if (lazyConversionDone) {
 		for (int i = 1; i < idx; i++) {
 			if (objv[i])
@@ -502,6 +868,706 @@ void CallBinds(binding_type_e type, const char* user, CClientConnection *client,
 	}
 }
 
+/* stands for the handle of the line's source in the arguments of an eggdrop-style bind */
+static const char EggHand[] = "<hand>";
+
+/* the state for dispatching an IRC line to eggdrop-style binds */
+typedef struct eggdispatch_s {
+	const char* user;
+	const char* source;
+	const bindlist_t* lists[2]; /* the user's binds and the binds for all users */
+	int listCount;
+	Tcl_Obj* hand; /* the source's handle, once it's needed */
+	Tcl_Encoding encoding; /* the user's encoding */
+} eggdispatch_t;
+
+static Tcl_Obj* EggString(const eggdispatch_t* d, const char* string) {
+	Tcl_Obj* obj = ExternalToObj(d->encoding, string);
+
+	Tcl_IncrRefCount(obj);
+
+	return obj;
+}
+
+static bool InitEggDispatch(eggdispatch_t* d, const char* user, const char* source) {
+	const bindlist_t* list;
+
+	d->user = user;
+	d->source = source;
+	d->listCount = 0;
+	d->hand = NULL;
+	d->encoding = GetUserEncoding(user);
+
+	if (g_EggBindUsers == NULL)
+		return false;
+
+	list = g_EggBindUsers->Get(user);
+
+	if (list != NULL && list->count > 0)
+		d->lists[d->listCount++] = list;
+
+	list = g_EggBindUsers->Get(":any");
+
+	if (list != NULL && list->count > 0)
+		d->lists[d->listCount++] = list;
+
+	return d->listCount > 0;
+}
+
+static void FinishEggDispatch(eggdispatch_t* d) {
+	if (d->hand != NULL)
+		Tcl_DecrRefCount(d->hand);
+}
+
+/* the handle which is used for checking the flags and which is passed
+ * to the procs; EggHand means the handle of the line's source */
+static Tcl_Obj* GetEggHandle(eggdispatch_t* d, const char* handle) {
+	if (handle != EggHand)
+		return EggString(d, handle);
+
+	if (d->hand == NULL) {
+		Tcl_Obj* objv[2];
+
+		objv[0] = Tcl_NewStringObj("finduser", -1);
+		Tcl_IncrRefCount(objv[0]);
+		objv[1] = EggString(d, d->source);
+
+		setctx(d->user);
+
+		if (Tcl_EvalObjv(g_Interp, 2, objv, TCL_EVAL_GLOBAL) == TCL_OK)
+			d->hand = Tcl_GetObjResult(g_Interp);
+		else
+			d->hand = Tcl_NewStringObj("*", -1);
+
+		Tcl_IncrRefCount(d->hand);
+
+		Tcl_DecrRefCount(objv[0]);
+		Tcl_DecrRefCount(objv[1]);
+	}
+
+	Tcl_IncrRefCount(d->hand);
+
+	return d->hand;
+}
+
+static bool EggMatchAttr(eggdispatch_t* d, Tcl_Obj* handle, const eggbind_t* bind, const char* chan) {
+	Tcl_Obj* objv[4];
+	int result = 0;
+
+	objv[0] = Tcl_NewStringObj("matchattr", -1);
+	Tcl_IncrRefCount(objv[0]);
+	objv[1] = handle;
+	objv[2] = EggString(d, bind->flags);
+	objv[3] = EggString(d, chan);
+
+	setctx(d->user);
+
+	if (Tcl_EvalObjv(g_Interp, 4, objv, TCL_EVAL_GLOBAL) != TCL_OK ||
+			Tcl_GetBooleanFromObj(NULL, Tcl_GetObjResult(g_Interp), &result) != TCL_OK)
+		result = 0;
+
+	Tcl_DecrRefCount(objv[0]);
+	Tcl_DecrRefCount(objv[2]);
+	Tcl_DecrRefCount(objv[3]);
+
+	return result != 0;
+}
+
+static void EggBindError(eggdispatch_t* d, const eggbind_t* bind, Tcl_Obj* args) {
+	const char* types[] = { "invalid", "raw", "pub", "pubm", "msg", "msgm", "ctcp", "ctcr",
+		"notc", "join", "part", "sign", "nick", "mode", "kick" };
+	Tcl_Obj* error = Tcl_GetObjResult(g_Interp);
+	Tcl_Obj* message;
+	Tcl_Obj* objv[2];
+
+	Tcl_IncrRefCount(error);
+
+	message = Tcl_NewStringObj("Error in tcl bind ", -1);
+	Tcl_IncrRefCount(message);
+	Tcl_AppendStringsToObj(message, types[bind->type], " ", NULL);
+	Tcl_AppendObjToObj(message, objv[1] = EggString(d, bind->flags));
+	Tcl_DecrRefCount(objv[1]);
+	Tcl_AppendToObj(message, " ", -1);
+	Tcl_AppendObjToObj(message, objv[1] = EggString(d, bind->mask));
+	Tcl_DecrRefCount(objv[1]);
+	Tcl_AppendToObj(message, " called: ", -1);
+	Tcl_AppendObjToObj(message, bind->procobj);
+	Tcl_AppendToObj(message, " (", -1);
+	Tcl_AppendObjToObj(message, args);
+	Tcl_AppendToObj(message, ")", -1);
+
+	objv[0] = Tcl_NewStringObj("bncnotc", -1);
+	Tcl_IncrRefCount(objv[0]);
+
+	setctx(d->user);
+
+	objv[1] = message;
+	Tcl_EvalObjv(g_Interp, 2, objv, TCL_EVAL_GLOBAL);
+
+	const char* text = Tcl_GetString(error);
+
+	while (text != NULL) {
+		const char* end = strchr(text, '\n');
+
+		objv[1] = Tcl_NewStringObj(text, end ? end - text : -1);
+		Tcl_IncrRefCount(objv[1]);
+
+		setctx(d->user);
+		Tcl_EvalObjv(g_Interp, 2, objv, TCL_EVAL_GLOBAL);
+
+		Tcl_DecrRefCount(objv[1]);
+
+		text = end ? end + 1 : NULL;
+	}
+
+	Tcl_DecrRefCount(objv[0]);
+	Tcl_DecrRefCount(message);
+	Tcl_DecrRefCount(error);
+}
+
+/* calls the procs of all binds with the specified type whose mask matches
+ * (like the script's sbnc:callbinds); the argument objects are only
+ * created once a bind matches */
+static void DispatchEggBinds(eggdispatch_t* d, eggbind_type_e type, const char* handle, const char* chan,
+		const char* mask, int argc, const char** argv) {
+	bindcandidate_t stackCandidates[32];
+	bindcandidate_t* candidates = stackCandidates;
+	int total = 0, count = 0;
+	Tcl_Obj* handleObj = NULL;
+	Tcl_Obj* args = NULL;
+	Tcl_Obj* clastbind = NULL;
+
+	for (int l = 0; l < d->listCount; l++)
+		total += d->lists[l]->count;
+
+	if (total > (int)(sizeof(stackCandidates) / sizeof(stackCandidates[0]))) {
+		candidates = (bindcandidate_t*)malloc(sizeof(bindcandidate_t) * total);
+
+		if (candidates == NULL)
+			return;
+	}
+
+	/* the user's binds are called before the ":any" binds, and each
+	 * list is in the order in which its binds were created */
+	for (int l = 0; l < d->listCount; l++) {
+		for (int b = 0; b < d->lists[l]->count; b++) {
+			const eggbind_t* bind = &g_EggBinds[d->lists[l]->binds[b]];
+
+			if (bind->type != type || !Tcl_StringCaseMatch(mask, bind->mask, 1))
+				continue;
+
+			candidates[count].bind = d->lists[l]->binds[b];
+			candidates[count].serial = bind->serial;
+			count++;
+		}
+	}
+
+	for (int c = 0; c < count; c++) {
+		eggbind_t* bind = &g_EggBinds[candidates[c].bind];
+
+		/* earlier binds might have removed this one */
+		if (!bind->valid || bind->serial != candidates[c].serial)
+			continue;
+
+		if (handleObj == NULL)
+			handleObj = GetEggHandle(d, handle);
+
+		if (!bind->anyflags && !EggMatchAttr(d, handleObj, bind, chan))
+			continue;
+
+		/* the flags check might have removed the bind */
+		bind = &g_EggBinds[candidates[c].bind];
+
+		if (!bind->valid || bind->serial != candidates[c].serial)
+			continue;
+
+		if (args == NULL) {
+			args = Tcl_NewListObj(0, NULL);
+			Tcl_IncrRefCount(args);
+
+			for (int a = 0; a < argc; a++) {
+				if (argv[a] == EggHand) {
+					Tcl_ListObjAppendElement(NULL, args, handleObj);
+				} else {
+					Tcl_Obj* arg = EggString(d, argv[a]);
+
+					Tcl_ListObjAppendElement(NULL, args, arg);
+					Tcl_DecrRefCount(arg);
+				}
+			}
+		}
+
+		if (clastbind != NULL)
+			Tcl_DecrRefCount(clastbind);
+
+		clastbind = Tcl_NewStringObj("::sbnc:ns:", -1);
+		Tcl_IncrRefCount(clastbind);
+		{
+			Tcl_Obj* user = EggString(d, d->user);
+
+			Tcl_AppendObjToObj(clastbind, user);
+			Tcl_DecrRefCount(user);
+		}
+		Tcl_AppendToObj(clastbind, "::clastbind", -1);
+
+		{
+			Tcl_Obj* value = EggString(d, bind->mask);
+
+			Tcl_ObjSetVar2(g_Interp, clastbind, NULL, value, TCL_GLOBAL_ONLY);
+			Tcl_DecrRefCount(value);
+		}
+
+		/* like "eval $proc $args" */
+		Tcl_Obj* script = Tcl_DuplicateObj(bind->procobj);
+		int procc, result;
+		Tcl_Obj** procv;
+
+		Tcl_IncrRefCount(script);
+
+		if (Tcl_ListObjAppendList(NULL, script, args) == TCL_OK &&
+				Tcl_ListObjGetElements(NULL, script, &procc, &procv) == TCL_OK) {
+			setctx(d->user);
+			g_CurrentClient = NULL;
+
+			result = Tcl_EvalObjv(g_Interp, procc, procv, TCL_EVAL_GLOBAL);
+		} else {
+			result = Tcl_EvalObjEx(g_Interp, script, TCL_EVAL_GLOBAL);
+		}
+
+		if (result == TCL_ERROR)
+			EggBindError(d, &g_EggBinds[candidates[c].bind], args);
+
+		Tcl_DecrRefCount(script);
+	}
+
+	if (handleObj != NULL)
+		Tcl_DecrRefCount(handleObj);
+
+	if (args != NULL)
+		Tcl_DecrRefCount(args);
+
+	if (clastbind != NULL)
+		Tcl_DecrRefCount(clastbind);
+
+	if (candidates != stackCandidates)
+		free(candidates);
+}
+
+static char* EggJoin(const char* first, const char* second) {
+	char* result;
+
+	if (asprintf(&result, "%s %s", first, second) < 0)
+		return NULL;
+
+	return result;
+}
+
+static char* EggSpanDup(const ircspan_t* span) {
+	char* copy = (char*)malloc(span->Length + 1);
+
+	if (copy != NULL) {
+		memcpy(copy, span->Data, span->Length);
+		copy[span->Length] = '\0';
+	}
+
+	return copy;
+}
+
+/* like EggSplitSource, but uses the spans the core has already parsed */
+static void EggSplitPrefix(const ircmessage_t* message, char** nick, char** site) {
+	const char* bang = (const char*)memchr(message->Prefix.Data, '!', message->Prefix.Length);
+	ircspan_t span;
+
+	if (bang == NULL) {
+		*nick = EggSpanDup(&message->Prefix);
+		*site = strdup("");
+
+		return;
+	}
+
+	*nick = EggSpanDup(&message->Nick);
+
+	/* "user@host", the user might be empty */
+	span.Data = bang + 1;
+	span.Length = message->Prefix.Data + message->Prefix.Length - span.Data;
+
+	*site = EggSpanDup(&span);
+}
+
+/* splits a "nick!ident@host" source into its nick and its site */
+static void EggSplitSource(const char* source, char** nick, char** site) {
+	const char* bang = strchr(source, '!');
+	const char* end;
+
+	if (bang == NULL) {
+		*nick = strdup(source);
+		*site = strdup("");
+
+		return;
+	}
+
+	*nick = (char*)malloc(bang - source + 1);
+
+	if (*nick != NULL) {
+		memcpy(*nick, source, bang - source);
+		(*nick)[bang - source] = '\0';
+	}
+
+	end = strchr(bang + 1, '!');
+
+	if (end == NULL)
+		*site = strdup(bang + 1);
+	else {
+		*site = (char*)malloc(end - bang);
+
+		if (*site != NULL) {
+			memcpy(*site, bang + 1, end - bang - 1);
+			(*site)[end - bang - 1] = '\0';
+		}
+	}
+}
+
+/* extracts the verb and the text of a CTCP message, returns false if the
+ * message isn't a CTCP */
+static bool EggParseCTCP(const char* text, char** verb, char** arguments) {
+	const char* start = strchr(text, '\1');
+	const char* end;
+	const char* space;
+
+	if (start == NULL)
+		return false;
+
+	start++;
+	end = strchr(start, '\1');
+
+	if (end == NULL || end == start || *start == ' ')
+		return false;
+
+	space = (const char*)memchr(start, ' ', end - start);
+
+	if (space == NULL)
+		space = end;
+
+	*verb = (char*)malloc(space - start + 1);
+
+	if (*verb == NULL)
+		return false;
+
+	memcpy(*verb, start, space - start);
+	(*verb)[space - start] = '\0';
+
+	if (space < end)
+		space++;
+
+	*arguments = (char*)malloc(end - space + 1);
+
+	if (*arguments == NULL) {
+		free(*verb);
+
+		return false;
+	}
+
+	memcpy(*arguments, space, end - space);
+	(*arguments)[end - space] = '\0';
+
+	return true;
+}
+
+/* like the script's "validchan $channel || botonchan $channel" */
+static bool EggIsChannel(CIRCConnection* irc, const char* user, const char* channel) {
+	if (irc->GetChannel(channel) != NULL)
+		return true;
+
+	Tcl_Encoding encoding = GetUserEncoding(user);
+	Tcl_DString dsName, dsChannel, dsLower;
+	bool result;
+
+	Tcl_DStringInit(&dsName);
+	Tcl_DStringAppend(&dsName, "::sbnc:ns:", -1);
+	Tcl_DStringAppend(&dsName, ExternalToUtf(encoding, user, -1, &dsChannel), -1);
+	Tcl_DStringFree(&dsChannel);
+	Tcl_DStringAppend(&dsName, "::channels", -1);
+
+	Tcl_DStringInit(&dsChannel);
+	Tcl_DStringAppend(&dsChannel, ExternalToUtf(encoding, channel, -1, &dsLower), -1);
+	Tcl_DStringFree(&dsLower);
+	Tcl_UtfToLower(Tcl_DStringValue(&dsChannel));
+
+	result = Tcl_GetVar2(g_Interp, Tcl_DStringValue(&dsName), Tcl_DStringValue(&dsChannel), TCL_GLOBAL_ONLY) != NULL;
+
+	Tcl_DStringFree(&dsChannel);
+	Tcl_DStringFree(&dsName);
+
+	return result;
+}
+
+/* checks whether a quit message looks like "server.one server.two" */
+static bool EggIsNetsplit(const char* message) {
+	const char* space = strchr(message, ' ');
+
+	if (space == NULL || strchr(space + 1, ' ') != NULL)
+		return false;
+
+	for (int i = 0; i < 2; i++) {
+		const char* start = (i == 0) ? message : space + 1;
+		const char* end = (i == 0) ? space : start + strlen(start);
+		const char* dot = (const char*)memchr(start + 1, '.', end > start + 1 ? end - start - 1 : 0);
+
+		/* the dot must not be the first or the last character */
+		if (dot == NULL || dot + 1 >= end || strpbrk(start, "\t") != NULL)
+			return false;
+	}
+
+	return true;
+}
+
+/* returns the names of the channels the nick is on */
+static char** EggGetCommonChannels(CIRCConnection* irc, const char* nick, int* count) {
+	CHashtable<CChannel*, false>* channels = irc->GetChannels();
+	char** result;
+	int i = 0;
+	hash_t<CChannel*>* channel;
+
+	*count = 0;
+
+	if (channels == NULL || channels->GetLength() == 0)
+		return NULL;
+
+	result = (char**)malloc(sizeof(char*) * channels->GetLength());
+
+	if (result == NULL)
+		return NULL;
+
+	while ((channel = channels->Iterate(i++)) != NULL) {
+		if (channel->Value->GetNames()->Get(nick) == NULL)
+			continue;
+
+		result[*count] = strdup(channel->Name);
+
+		if (result[*count] != NULL)
+			(*count)++;
+	}
+
+	return result;
+}
+
+static void EggFreeChannels(char** channels, int count) {
+	for (int i = 0; i < count; i++)
+		free(channels[i]);
+
+	free(channels);
+}
+
+/* dispatches an IRC line to the user's eggdrop-style binds; this used to be
+ * done by the script's sbnc:rawserver */
+void CallEggBinds(CIRCConnection* irc, const ircmessage_t* message) {
+	const char* user = irc->GetOwner()->GetUsername();
+	int argc = message->ArgC;
+	const char** argv = message->ArgV;
+	irc_command_t command = message->CommandId;
+	eggdispatch_t d;
+
+	if (argc < 2 || !InitEggDispatch(&d, user, argv[0]))
+		return;
+
+	const char* source = argv[0];
+	const char* targ = argc > 2 ? argv[2] : "";
+	const char* opt = argc > 3 ? argv[3] : "";
+	const char* last = argv[argc - 1];
+	char* verb = strdup(argv[1]);
+	char* rest;
+	char* nick;
+	char* site;
+	size_t length = 2;
+
+	if (verb == NULL) {
+		FinishEggDispatch(&d);
+
+		return;
+	}
+
+	for (char* p = verb; *p; p++)
+		*p = tolower((unsigned char)*p);
+
+	/* raw: "<params 2..end-1> <last>", the last one with a colon if it contains spaces */
+	for (int a = 2; a < argc; a++)
+		length += strlen(argv[a]) + 1;
+
+	rest = (char*)malloc(length);
+
+	if (rest == NULL) {
+		free(verb);
+		FinishEggDispatch(&d);
+
+		return;
+	}
+
+	rest[0] = '\0';
+
+	for (int a = 2; a < argc - 1; a++) {
+		if (a > 2)
+			strcat(rest, " ");
+
+		strcat(rest, argv[a]);
+	}
+
+	strcat(rest, " ");
+
+	if (strchr(last, ' ') != NULL)
+		strcat(rest, ":");
+
+	strcat(rest, last);
+
+	const char* rawArgs[] = { source, verb, rest };
+	DispatchEggBinds(&d, Egg_Raw, "-", "", verb, 3, rawArgs);
+
+	free(rest);
+
+	EggSplitPrefix(message, &nick, &site);
+
+	if (nick == NULL || site == NULL) {
+		free(nick);
+		free(site);
+		free(verb);
+		FinishEggDispatch(&d);
+
+		return;
+	}
+
+	if (command == IRCCommand_Privmsg || command == IRCCommand_Notice) {
+		bool privmsg = (command == IRCCommand_Privmsg);
+		char *ctcpVerb, *ctcpText;
+
+		if (EggParseCTCP(opt, &ctcpVerb, &ctcpText)) {
+			const char* args[] = { nick, site, EggHand, targ, ctcpVerb, ctcpText };
+			DispatchEggBinds(&d, privmsg ? Egg_Ctcp : Egg_Ctcr, EggHand, targ, ctcpVerb, 6, args);
+
+			free(ctcpVerb);
+			free(ctcpText);
+		} else if (!privmsg) {
+			const char* args[] = { nick, site, EggHand, opt, targ };
+			DispatchEggBinds(&d, Egg_Notc, EggHand, targ, opt, 5, args);
+		} else {
+			const char* space = strchr(opt, ' ');
+			char* command = space ? (char*)malloc(space - opt + 1) : strdup(opt);
+			const char* text = space ? space + 1 : "";
+
+			if (command != NULL) {
+				if (space) {
+					memcpy(command, opt, space - opt);
+					command[space - opt] = '\0';
+				}
+
+				if (EggIsChannel(irc, user, targ)) {
+					char* mask = EggJoin(targ, opt);
+					const char* pubArgs[] = { nick, site, EggHand, targ, text };
+					const char* pubmArgs[] = { nick, site, EggHand, targ, opt };
+
+					DispatchEggBinds(&d, Egg_Pub, EggHand, targ, command, 5, pubArgs);
+
+					if (mask != NULL)
+						DispatchEggBinds(&d, Egg_Pubm, EggHand, targ, mask, 5, pubmArgs);
+
+					free(mask);
+				} else {
+					const char* msgArgs[] = { nick, site, EggHand, text };
+					const char* msgmArgs[] = { nick, site, EggHand, opt };
+
+					DispatchEggBinds(&d, Egg_Msg, EggHand, "", command, 4, msgArgs);
+					DispatchEggBinds(&d, Egg_Msgm, EggHand, "", opt, 4, msgmArgs);
+				}
+
+				free(command);
+			}
+		}
+	} else if (command == IRCCommand_Join || command == IRCCommand_Part) {
+		char* mask = EggJoin(targ, source);
+		const char* args[] = { nick, site, EggHand, targ, opt };
+
+		if (mask != NULL) {
+			if (command == IRCCommand_Join)
+				DispatchEggBinds(&d, Egg_Join, EggHand, targ, mask, 4, args);
+			else
+				DispatchEggBinds(&d, Egg_Part, EggHand, targ, mask, 5, args);
+		}
+
+		free(mask);
+	} else if (command == IRCCommand_Kick) {
+		char* mask = EggJoin(targ, opt);
+		const char* args[] = { nick, site, EggHand, targ, opt, argc > 4 ? argv[4] : "" };
+
+		if (mask != NULL)
+			DispatchEggBinds(&d, Egg_Kick, EggHand, targ, mask, 6, args);
+
+		free(mask);
+	} else if (command == IRCCommand_Quit || command == IRCCommand_Nick) {
+		bool quit = (command == IRCCommand_Quit);
+		char** channels;
+		int count;
+
+		/* netsplits are not reported as sign-offs */
+		if (quit && EggIsNetsplit(targ)) {
+			channels = NULL;
+			count = 0;
+		} else
+			channels = EggGetCommonChannels(irc, quit ? nick : targ, &count);
+
+		for (int c = 0; c < count; c++) {
+			char* mask = EggJoin(channels[c], quit ? source : targ);
+			const char* args[] = { nick, site, EggHand, channels[c], targ };
+
+			if (mask != NULL)
+				DispatchEggBinds(&d, quit ? Egg_Sign : Egg_Nick, EggHand, channels[c], mask, 5, args);
+
+			free(mask);
+		}
+
+		EggFreeChannels(channels, count);
+	}
+
+	free(nick);
+	free(site);
+	free(verb);
+
+	FinishEggDispatch(&d);
+}
+
+/* dispatches a single mode change to the eggdrop-style "mode" binds */
+void CallEggModeBinds(CIRCConnection* irc, const char* channel, const char* source, const char* mode, const char* parameter) {
+	eggdispatch_t d;
+	char* nick;
+	char* site;
+	CChannel* chan;
+
+	if (!InitEggDispatch(&d, irc->GetOwner()->GetUsername(), source))
+		return;
+
+	EggSplitSource(source, &nick, &site);
+
+	if (nick != NULL && site != NULL) {
+		char* mask = EggJoin(channel, mode);
+
+		chan = irc->GetChannel(channel);
+
+		if (mask == NULL) {
+			/* nothing to do */
+		} else if (chan != NULL && chan->GetNames()->Get(nick) != NULL) {
+			const char* args[] = { nick, site, EggHand, channel, mode, parameter ? parameter : "" };
+			DispatchEggBinds(&d, Egg_Mode, EggHand, channel, mask, 6, args);
+		} else {
+			const char* args[] = { "", source, "*", channel, mode, parameter ? parameter : "" };
+			DispatchEggBinds(&d, Egg_Mode, "*", channel, mask, 6, args);
+		}
+
+		free(mask);
+	}
+
+	free(nick);
+	free(site);
+
+	FinishEggDispatch(&d);
+}
+
 void SetLatchedReturnValue(bool Ret) {
 	g_Ret = Ret;
 }
@@ -99,6 +99,10 @@ SOURCE=.\itoa.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\TclAsync.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\TclClientSocket.cpp
 # End Source File
 # Begin Source File
@@ -149,6 +153,10 @@ SOURCE=.\StdAfx.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\TclAsync.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\TclClientSocket.h
 # End Source File
 # Begin Source File
@@ -19,6 +19,9 @@
 
 extern Tcl_Interp* g_Interp;
 
+/** The encoding which is used for users who haven't set user.tclencoding */
+#define DEFAULT_TCLENCODING "iso8859-1"
+
 enum binding_type_e {
 	Type_Invalid,
 	Type_Client,
@@ -40,7 +43,8 @@ enum binding_type_e {
 	Type_SetUserTag,
 	Type_PreRehash,
 	Type_PostRehash,
-	Type_ChannelSort
+	Type_ChannelSort,
+	Type_Max
 };
 
 typedef struct binding_s {
@@ -49,17 +53,76 @@ typedef struct binding_s {
 	char* proc;
 	char* pattern;
 	char* user;
+	bool anyuser; /* whether the bind applies to all users */
+	unsigned int serial; /* distinguishes binds which use the same slot */
+	Tcl_Obj* procobj; /* the proc's name as a Tcl object */
+	bool async; /* whether the proc is called by the asynchronous interpreter */
 } binding_t;
 
+/* indices into g_Binds, in ascending order */
+typedef struct bindlist_s {
+	int* binds;
+	int count;
+} bindlist_t;
+
+/* the binds of one type: binds with the pattern "*" and
+ * binds which match a specific argument (case-insensitive) */
+typedef struct bindindex_s {
+	bindlist_t wildcard;
+	CHashtable<bindlist_t*, false>* patterns;
+} bindindex_t;
+
 extern binding_t* g_Binds;
 extern int g_BindCount;
+extern bindindex_t g_BindIndex[Type_Max];
+
+/* eggdrop-style bind types which are matched by the module itself;
+ * all other types are handled by sbnc:callbinds in bind.tcl */
+enum eggbind_type_e {
+	Egg_Invalid,
+	Egg_Raw,
+	Egg_Pub,
+	Egg_Pubm,
+	Egg_Msg,
+	Egg_Msgm,
+	Egg_Ctcp,
+	Egg_Ctcr,
+	Egg_Notc,
+	Egg_Join,
+	Egg_Part,
+	Egg_Sign,
+	Egg_Nick,
+	Egg_Mode,
+	Egg_Kick
+};
+
+typedef struct eggbind_s {
+	bool valid;
+	eggbind_type_e type;
+	char* user; /* the context the bind was created in (":any" for all users) */
+	char* flags;
+	char* mask;
+	char* proc;
+	bool anyflags; /* whether the flags match all handles */
+	unsigned int serial; /* distinguishes binds which use the same slot */
+	Tcl_Obj* procobj; /* the proc as a Tcl object */
+} eggbind_t;
+
+extern eggbind_t* g_EggBinds;
+extern int g_EggBindCount;
+extern CHashtable<bindlist_t*, false>* g_EggBindUsers; /* the eggdrop-style binds for each context */
 
-class CTimer;
+/* the shortest interval (in milliseconds) for repeating Tcl timers */
+#define TCLTIMER_MININTERVAL 1
 
 typedef struct tcltimer_s {
-	CTimer* timer;
 	char* proc;
 	char* param;
+	char* key; /* the key in g_TimerIndex, see GetTimerKey() */
+	unsigned int interval; /* in milliseconds */
+	bool repeat;
+	uint64_t next; /* the GetMonotonicTime() of the next call */
+	int slot; /* the timer's position in the g_Timers heap */
 } tcltimer_t;
 
 typedef struct tcldnsquery_s {
@@ -79,9 +142,20 @@ extern int g_SocketIdx;
 
 extern CClientConnection *g_CurrentClient;
 extern int g_ChannelSortValue;
+extern Tcl_Encoding g_Encoding;
 
 void RestartInterpreter(void);
 void RehashInterpreter(void);
 void CallBinds(binding_type_e type, const char* user, CClientConnection* client, int argc, const char** argv);
+void CallEggBinds(CIRCConnection* irc, const ircmessage_t* message);
+void CallEggModeBinds(CIRCConnection* irc, const char* channel, const char* source, const char* mode, const char* parameter);
 void SetLatchedReturnValue(bool Ret);
+bool IsAscii(const char* string, size_t length);
+const char* ExternalToUtf(Tcl_Encoding encoding, const char* string, int length, Tcl_DString* ds);
+const char* UtfToExternal(Tcl_Encoding encoding, const char* string, int length, Tcl_DString* ds);
+Tcl_Obj* ExternalToObj(Tcl_Encoding encoding, const char* string, int length = -1);
+bool IsAsciiCompatible(Tcl_Encoding encoding);
+Tcl_Encoding GetUserEncoding(const char* user);
+void FlushUserEncoding(const char* user);
+void DestroyTclTimers(void);
 int TclChannelSortHandler(const void *p1, const void *p2);
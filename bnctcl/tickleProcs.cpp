@@ -21,6 +21,7 @@
 #include "StdAfx.h"
 
 #include "tickle.h"
+#include "TclAsync.h"
 #include "tickleProcs.h"
 #include "TclClientSocket.h"
 #include "TclSocket.h"
@@ -30,9 +31,18 @@ CClientConnection *g_CurrentClient = NULL;
 
 binding_t *g_Binds = NULL;
 int g_BindCount = 0;
+bindindex_t g_BindIndex[Type_Max];
+static unsigned int g_BindSerial = 0;
+
+eggbind_t *g_EggBinds = NULL;
+int g_EggBindCount = 0;
+CHashtable<bindlist_t *, false> *g_EggBindUsers = NULL;
 
 tcltimer_t **g_Timers = NULL;
 int g_TimerCount = 0;
+static int g_TimerAlloc = 0;
+static CHashtable<tcltimer_t *, true> *g_TimerIndex = NULL;
+static deadline_t *g_TimerDeadline = NULL; /* wakes up the main loop for the first timer in g_Timers */
 
 extern Tcl_Encoding g_Encoding;
 
@@ -43,8 +53,16 @@ extern bool g_NoticeUser;
 
 extern "C" int Bnc_Init(Tcl_Interp *);
 
+static void RegisterListCommands(Tcl_Interp *interp);
+
 int Tcl_ProcInit(Tcl_Interp *interp) {
-	return Bnc_Init(interp);
+	if (Bnc_Init(interp) == TCL_ERROR)
+		return TCL_ERROR;
+
+	RegisterListCommands(interp);
+	RegisterAsyncCommands(interp);
+
+	return TCL_OK;
 }
 
 void die(void) {
@@ -100,6 +118,9 @@ void setctx(const char *ctx) {
 
 		free(CtxDup);
 	}
+
+	/* strings are converted using the user's encoding */
+	g_Encoding = GetUserEncoding(g_Context);
 }
 
 const char *getctx(int ts) {
@@ -141,99 +162,120 @@ const char *getctx(int ts) {
 	return Context;
 }
 
-const char *bncuserlist(void) {
-	int i;
-	int Count = g_Bouncer->GetUsers()->GetLength();
+const char* getchanmode(const char* Channel) {
+	CUser* Context = g_Bouncer->GetUser(g_Context);
 
-	int argc = 0;
-	const char** argv = (const char**)malloc(Count * sizeof(const char*));
+	if (!Context)
+		throw "Invalid user.";
 
-	CHashtable<CUser *, false> *Users = g_Bouncer->GetUsers();
+	CIRCConnection* IRC = Context->GetIRCConnection();
 
-	i = 0;
-	while (hash_t<CUser *> *User = Users->Iterate(i++)) {
-		argv[argc++] = User->Name;
-	}
+	if (!IRC)
+		throw "User is not connected to an IRC server.";
 
-	static char* List = NULL;
+	CChannel* Chan = IRC->GetChannel(Channel);
 
-	if (List != NULL) {
-		Tcl_Free(List);
-	}
+	if (!Chan)
+		return NULL;
+	else
+		return Chan->GetChannelModes();
+}
 
-	List = Tcl_Merge(argc, const_cast<char **>(argv));
+void rehash(void) {
+	RehashInterpreter();
 
-	free(argv);
+	g_Bouncer->Log("Rehashing TCL module");
+}
 
-	return List;
+static void FreeBindList(bindlist_t *list) {
+	free(list->binds);
+	free(list);
 }
 
-const char* internalchannels(void) {
-	CUser* Context = g_Bouncer->GetUser(g_Context);
+static bindlist_t *GetBindList(binding_type_e type, const char *pattern, bool create) {
+	bindindex_t *index = &g_BindIndex[type];
+	bindlist_t *list;
 
-	if (!Context)
-		throw "Invalid user.";
+	if (strcmp(pattern, "*") == 0)
+		return &index->wildcard;
 
-	CIRCConnection* IRC = Context->GetIRCConnection();
+	if (index->patterns == NULL) {
+		if (!create)
+			return NULL;
 
-	if (!IRC)
-		throw "User is not connected to an IRC server.";
+		index->patterns = new CHashtable<bindlist_t *, false>();
 
-	CHashtable<CChannel*, false>* H = IRC->GetChannels();
+		if (index->patterns == NULL)
+			return NULL;
 
-	if (H == NULL)
-		return NULL;
+		index->patterns->RegisterValueDestructor(FreeBindList);
+	}
 
-	int Count = H->GetLength();
+	list = index->patterns->Get(pattern);
 
-	const char** argv = (const char**)malloc(Count * sizeof(const char*));
+	if (list == NULL && create) {
+		list = (bindlist_t *)malloc(sizeof(bindlist_t));
 
-	int a = 0;
+		if (list == NULL)
+			return NULL;
 
-	while (hash_t<CChannel*>* Chan = H->Iterate(a)) {
-		argv[a] = Chan->Name;
-		a++;
-	}
+		list->binds = NULL;
+		list->count = 0;
 
-	static char* List = NULL;
+		if (IsError(index->patterns->Add(pattern, list))) {
+			free(list);
 
-	if (List != NULL) {
-		Tcl_Free(List);
+			return NULL;
+		}
 	}
 
-	List = Tcl_Merge(Count, const_cast<char **>(argv));
+	return list;
+}
 
-	free(argv);
+static bool IndexBind(int bind) {
+	bindlist_t *list = GetBindList(g_Binds[bind].type, g_Binds[bind].pattern, true);
+	int *binds;
+	int i;
 
-	return List;
-}
+	if (list == NULL)
+		return false;
 
-const char* getchanmode(const char* Channel) {
-	CUser* Context = g_Bouncer->GetUser(g_Context);
+	binds = (int *)realloc(list->binds, sizeof(int) * (list->count + 1));
 
-	if (!Context)
-		throw "Invalid user.";
+	if (binds == NULL)
+		return false;
 
-	CIRCConnection* IRC = Context->GetIRCConnection();
+	list->binds = binds;
 
-	if (!IRC)
-		throw "User is not connected to an IRC server.";
+	for (i = list->count; i > 0 && binds[i - 1] > bind; i--)
+		binds[i] = binds[i - 1];
 
-	CChannel* Chan = IRC->GetChannel(Channel);
+	binds[i] = bind;
+	list->count++;
 
-	if (!Chan)
-		return NULL;
-	else
-		return Chan->GetChannelModes();
+	return true;
 }
 
-void rehash(void) {
-	RehashInterpreter();
+static void UnindexBind(int bind) {
+	bindlist_t *list = GetBindList(g_Binds[bind].type, g_Binds[bind].pattern, false);
 
-	g_Bouncer->Log("Rehashing TCL module");
+	if (list == NULL)
+		return;
+
+	for (int i = 0; i < list->count; i++) {
+		if (list->binds[i] == bind) {
+			memmove(&list->binds[i], &list->binds[i + 1], sizeof(int) * (list->count - i - 1));
+			list->count--;
+
+			break;
+		}
+	}
+
+	if (list->count == 0 && list != &g_BindIndex[g_Binds[bind].type].wildcard)
+		g_BindIndex[g_Binds[bind].type].patterns->Remove(g_Binds[bind].pattern);
 }
 
-int internalbind(const char* type, const char* proc, const char* pattern, const char* user) {
+static int AddBind(const char* type, const char* proc, const char* pattern, const char* user, bool async) {
 	if (pattern == NULL) {
 		pattern = "*";
 	}
@@ -245,7 +287,8 @@ int internalbind(const char* type, const char* proc, const char* pattern, const
 	for (int i = 0; i < g_BindCount; i++) {
 		if (g_Binds[i].valid && strcmp(g_Binds[i].proc, proc) == 0
 			&& ((!pattern && g_Binds[i].pattern == NULL) || (pattern && g_Binds[i].pattern && strcmp(pattern, g_Binds[i].pattern) == 0))
-			&& ((!user && g_Binds[i].user == NULL) || (user && g_Binds[i].user && strcasecmp(user, g_Binds[i].user) == 0)))
+			&& ((!user && g_Binds[i].user == NULL) || (user && g_Binds[i].user && strcasecmp(user, g_Binds[i].user) == 0))
+			&& g_Binds[i].async == async)
 
 			return 0;
 	}
@@ -314,15 +357,56 @@ int internalbind(const char* type, const char* proc, const char* pattern, const
 		throw "Invalid bind type.";
 	}
 
+	/* the results of these binds are used by the bouncer */
+	if (async && (Bind->type == Type_PreScript || Bind->type == Type_PostScript ||
+			Bind->type == Type_Command || Bind->type == Type_ChannelSort)) {
+		Bind->type = Type_Invalid;
+
+		throw "This bind type can't be asynchronous.";
+	}
+
+	if (async && GetTclAsync() == NULL) {
+		Bind->type = Type_Invalid;
+
+		throw "The asynchronous interpreter is not available.";
+	}
+
 	Bind->proc = strdup(proc);
 	Bind->valid = true;
+	Bind->async = async;
 
 	Bind->pattern = strdup(pattern);
 	Bind->user = strdup(user);
+	Bind->anyuser = (strcasecmp(user, "*") == 0);
+	Bind->serial = ++g_BindSerial;
+
+	Bind->procobj = ExternalToObj(g_Encoding, proc);
+
+	Tcl_IncrRefCount(Bind->procobj);
+
+	if (!IndexBind(Bind - g_Binds)) {
+		Tcl_DecrRefCount(Bind->procobj);
+		free(Bind->proc);
+		free(Bind->pattern);
+		free(Bind->user);
+		Bind->valid = false;
+
+		throw "Out of memory.";
+	}
+
+	g_Bouncer->RefreshModuleSubscriptions();
 
 	return 1;
 }
 
+int internalbind(const char* type, const char* proc, const char* pattern, const char* user) {
+	return AddBind(type, proc, pattern, user, false);
+}
+
+int internalasyncbind(const char* type, const char* proc, const char* pattern, const char* user) {
+	return AddBind(type, proc, pattern, user, true);
+}
+
 int internalunbind(const char* type, const char* proc, const char* pattern, const char* user) {
 	binding_type_e bindtype;
 
@@ -382,91 +466,238 @@ int internalunbind(const char* type, const char* proc, const char* pattern, cons
 			&& (strcmp(pattern, g_Binds[i].pattern) == 0)
 			&& (strcasecmp(user, g_Binds[i].user) == 0)) {
 
+			UnindexBind(i);
+
+			Tcl_DecrRefCount(g_Binds[i].procobj);
 			free(g_Binds[i].proc);
 			free(g_Binds[i].pattern);
 			free(g_Binds[i].user);
 			g_Binds[i].valid = false;
+
+			g_Bouncer->RefreshModuleSubscriptions();
 		}
 	}
 
 	return 1;
 }
 
-const char* internalbinds(void) {
-	char** List = (char**)malloc(g_BindCount * sizeof(char*));
-	int n = 0;
+static eggbind_type_e EggBindType(const char *type) {
+	static const struct {
+		const char *name;
+		eggbind_type_e type;
+	} types[] = {
+		{ "raw", Egg_Raw },
+		{ "pub", Egg_Pub },
+		{ "pubm", Egg_Pubm },
+		{ "msg", Egg_Msg },
+		{ "msgm", Egg_Msgm },
+		{ "ctcp", Egg_Ctcp },
+		{ "ctcr", Egg_Ctcr },
+		{ "notc", Egg_Notc },
+		{ "join", Egg_Join },
+		{ "part", Egg_Part },
+		{ "sign", Egg_Sign },
+		{ "nick", Egg_Nick },
+		{ "mode", Egg_Mode },
+		{ "kick", Egg_Kick }
+	};
 
-	for (int i = 0; i < g_BindCount; i++) {
-		if (g_Binds[i].valid) {
-			const char* Bind[4];
-
-			binding_type_e type = g_Binds[i].type;
-
-			if (type == Type_Client)
-				Bind[0] = "client";
-			else if (type == Type_Server)
-				Bind[0] = "server";
-			else if (type == Type_PreScript)
-				Bind[0] = "pre";
-			else if (type == Type_PostScript)
-				Bind[0] = "post";
-			else if (type == Type_Attach)
-				Bind[0] = "attach";
-			else if (type == Type_Detach)
-				Bind[0] = "detach";
-			else if (type == Type_SingleMode)
-				Bind[0] = "modec";
-			else if (type == Type_Unload)
-				Bind[0] = "unload";
-			else if (type == Type_SvrDisconnect)
-				Bind[0] = "svrdisconnect";
-			else if (type == Type_SvrConnect)
-				Bind[0] = "svrconnect";
-			else if (type == Type_SvrLogon)
-				Bind[0] = "svrlogon";
-			else if (type == Type_UsrLoad)
-				Bind[0] = "usrload";
-			else if (type == Type_UsrCreate)
-				Bind[0] = "usrcreate";
-			else if (type == Type_UsrDelete)
-				Bind[0] = "usrdelete";
-			else if (type == Type_Command)
-				Bind[0] = "command";
-			else if (type == Type_SetTag)
-				Bind[0] = "settag";
-			else if (type == Type_SetUserTag)
-				Bind[0] = "setusertag";
-			else if (type == Type_PreRehash)
-				Bind[0] = "prerehash";
-			else if (type == Type_PostRehash)
-				Bind[0] = "postrehash";
-			else if (type == Type_ChannelSort)
-				Bind[0] = "channelsort";
-			else
-				Bind[0] = "invalid";
-
-			Bind[1] = g_Binds[i].proc;
-			Bind[2] = g_Binds[i].pattern;
-			Bind[3] = g_Binds[i].user;
-
-			char* Item = Tcl_Merge(4, const_cast<char **>(Bind));
-
-			List[n++] = Item;
+	for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (strcasecmp(type, types[i].name) == 0)
+			return types[i].type;
+	}
+
+	return Egg_Invalid;
+}
+
+static bool EggBindEquals(const eggbind_t *bind, eggbind_type_e type, const char *flags, const char *mask, const char *proc) {
+	return bind->valid && bind->type == type && strcasecmp(bind->flags, flags) == 0
+		&& strcasecmp(bind->mask, mask) == 0 && strcasecmp(bind->proc, proc) == 0;
+}
+
+int internaleggbind(const char* type, const char* flags, const char* mask, const char* proc, const char* user) {
+	eggbind_type_e bindtype = EggBindType(type);
+	bindlist_t *list;
+	eggbind_t *Bind = NULL;
+	int *binds;
+
+	if (bindtype == Egg_Invalid)
+		return 0;
+
+	if (user == NULL)
+		user = g_Context;
+
+	if (user == NULL)
+		throw "Invalid user.";
+
+	if (g_EggBindUsers == NULL) {
+		g_EggBindUsers = new CHashtable<bindlist_t *, false>();
+
+		if (g_EggBindUsers == NULL)
+			throw "Out of memory.";
+
+		g_EggBindUsers->RegisterValueDestructor(FreeBindList);
+	}
+
+	list = g_EggBindUsers->Get(user);
+
+	if (list == NULL) {
+		list = (bindlist_t *)malloc(sizeof(bindlist_t));
+
+		if (list == NULL)
+			throw "Out of memory.";
+
+		list->binds = NULL;
+		list->count = 0;
+
+		if (IsError(g_EggBindUsers->Add(user, list))) {
+			free(list);
+
+			throw "Out of memory.";
 		}
 	}
 
-	static char* Out = NULL;
+	for (int i = 0; i < list->count; i++) {
+		if (EggBindEquals(&g_EggBinds[list->binds[i]], bindtype, flags, mask, proc))
+			return 1;
+	}
+
+	binds = (int *)realloc(list->binds, sizeof(int) * (list->count + 1));
+
+	if (binds == NULL)
+		throw "Out of memory.";
+
+	list->binds = binds;
+
+	for (int a = 0; a < g_EggBindCount; a++) {
+		if (!g_EggBinds[a].valid) {
+			Bind = &g_EggBinds[a];
+
+			break;
+		}
+	}
+
+	if (Bind == NULL) {
+		eggbind_t *NewBinds = (eggbind_t *)realloc(g_EggBinds, sizeof(eggbind_t) * (g_EggBindCount + 1));
+
+		if (NewBinds == NULL)
+			throw "Out of memory.";
+
+		g_EggBinds = NewBinds;
+		Bind = &g_EggBinds[g_EggBindCount++];
+		Bind->valid = false;
+	}
+
+	Bind->type = bindtype;
+	Bind->user = strdup(user);
+	Bind->flags = strdup(flags);
+	Bind->mask = strdup(mask);
+	Bind->proc = strdup(proc);
+	Bind->anyflags = (strcmp(flags, "-") == 0 || strcmp(flags, "-|-") == 0);
+	Bind->serial = ++g_BindSerial;
+
+	Bind->procobj = ExternalToObj(g_Encoding, proc);
+
+	Tcl_IncrRefCount(Bind->procobj);
+
+	Bind->valid = true;
+
+	/* the list is kept in the order in which the binds were created,
+	 * which is also the order in which they are called */
+	list->binds[list->count++] = Bind - g_EggBinds;
+
+	g_Bouncer->RefreshModuleSubscriptions();
+
+	return 1;
+}
+
+int internaleggunbind(const char* type, const char* flags, const char* mask, const char* proc, const char* user) {
+	eggbind_type_e bindtype = EggBindType(type);
+	bindlist_t *list;
+
+	if (bindtype == Egg_Invalid)
+		return 0;
+
+	if (user == NULL)
+		user = g_Context;
+
+	if (user == NULL || g_EggBindUsers == NULL)
+		return 0;
+
+	list = g_EggBindUsers->Get(user);
+
+	if (list == NULL)
+		return 0;
+
+	for (int i = 0; i < list->count; i++) {
+		eggbind_t *Bind = &g_EggBinds[list->binds[i]];
+
+		if (!EggBindEquals(Bind, bindtype, flags, mask, proc))
+			continue;
+
+		Tcl_DecrRefCount(Bind->procobj);
+		free(Bind->user);
+		free(Bind->flags);
+		free(Bind->mask);
+		free(Bind->proc);
+		Bind->valid = false;
 
-	if (Out != NULL) {
-		Tcl_Free(Out);
+		memmove(&list->binds[i], &list->binds[i + 1], sizeof(int) * (list->count - i - 1));
+		list->count--;
+		i--;
+
+		g_Bouncer->RefreshModuleSubscriptions();
 	}
 
-	Out = Tcl_Merge(n, const_cast<char **>(List));
+	if (list->count == 0)
+		g_EggBindUsers->Remove(user);
 
-	for (int a = 0; a < n; a++)
-		Tcl_Free(List[a]);
+	return 1;
+}
 
-	return Out;
+static const char* BindTypeName(binding_type_e type) {
+	if (type == Type_Client)
+		return "client";
+	else if (type == Type_Server)
+		return "server";
+	else if (type == Type_PreScript)
+		return "pre";
+	else if (type == Type_PostScript)
+		return "post";
+	else if (type == Type_Attach)
+		return "attach";
+	else if (type == Type_Detach)
+		return "detach";
+	else if (type == Type_SingleMode)
+		return "modec";
+	else if (type == Type_Unload)
+		return "unload";
+	else if (type == Type_SvrDisconnect)
+		return "svrdisconnect";
+	else if (type == Type_SvrConnect)
+		return "svrconnect";
+	else if (type == Type_SvrLogon)
+		return "svrlogon";
+	else if (type == Type_UsrLoad)
+		return "usrload";
+	else if (type == Type_UsrCreate)
+		return "usrcreate";
+	else if (type == Type_UsrDelete)
+		return "usrdelete";
+	else if (type == Type_Command)
+		return "command";
+	else if (type == Type_SetTag)
+		return "settag";
+	else if (type == Type_SetUserTag)
+		return "setusertag";
+	else if (type == Type_PreRehash)
+		return "prerehash";
+	else if (type == Type_PostRehash)
+		return "postrehash";
+	else if (type == Type_ChannelSort)
+		return "channelsort";
+	else
+		return "invalid";
 }
 
 int putserv(const char* text, const char *option) {
@@ -616,46 +847,6 @@ int topicstamp(const char* Channel) {
 	return (int)Chan->GetTopicStamp();
 }
 
-const char* internalchanlist(const char* Channel) {
-	CUser* Context = g_Bouncer->GetUser(g_Context);
-
-	if (!Context)
-		throw "Invalid user.";
-
-	CIRCConnection* IRC = Context->GetIRCConnection();
-
-	if (!IRC)
-		return NULL;
-
-	CChannel* Chan = IRC->GetChannel(Channel);
-
-	if (!Chan)
-		return NULL;
-
-	const CHashtable<CNick*, false>* Names = Chan->GetNames();
-
-	int Count = Names->GetLength();
-	const char** argv = (const char**)malloc(Count * sizeof(const char*));
-
-	int a = 0;
-
-	while (hash_t<CNick*>* NickHash = Names->Iterate(a++)) {
-		argv[a-1] = NickHash->Name;
-	}
-
-	static char* List = NULL;
-
-	if (List != NULL) {
-		Tcl_Free(List);
-	}
-
-	List = Tcl_Merge(Count, const_cast<char **>(argv));
-
-	free(argv);
-
-	return List;
-}
-
 bool isop(const char* Nick, const char* Channel) {
 	CUser* Context = g_Bouncer->GetUser(g_Context);
 
@@ -894,35 +1085,13 @@ const char* getbncuser(const char* User, const char* Type, const char* Parameter
 		}
 
 		return Buffer;
+	} else if (strcasecmp(Type, "tclencoding") == 0) {
+		return Tcl_GetEncodingName(GetUserEncoding(User));
 	} else if (strcasecmp(Type, "tag") == 0) {
 		if (!Parameter2)
 			return NULL;
 
 		return Context->GetTagString(Parameter2);
-	} else if (strcasecmp(Type, "tags") == 0) {
-		CConfig *Config = Context->GetConfig();
-		int Count = Config->GetLength();
-		const char *Item;
-
-		int argc = 0;
-		const char** argv = (const char**)malloc(Count * sizeof(const char*));
-
-		while ((Item = Context->GetTagName(argc)) != NULL) {
-			argv[argc] = Item;
-			argc++;
-		}
-
-		static char* List = NULL;
-
-		if (List != NULL) {
-			Tcl_Free(List);
-		}
-
-		List = Tcl_Merge(argc, const_cast<char **>(argv));
-
-		free(argv);
-
-		return List;
 	} else if (strcasecmp(Type, "seen") == 0) {
 		int rc = asprintf(&Buffer, "%d", (int)Context->GetLastSeen());
 
@@ -981,38 +1150,6 @@ const char* getbncuser(const char* User, const char* Type, const char* Parameter
 		return Buffer;
 	} else if (strcasecmp(Type, "channelsort") == 0) {
 		return Context->GetChannelSortMode();
-	} else if (strcasecmp(Type, "sessions") == 0) {
-		CVector<client_t> *Clients = Context->GetClientConnections();
-		int Count = Clients->GetLength();
-		char *Item;
-
-		char** argv = (char**)malloc(Count * sizeof(const char*));
-
-		for (int i = 0; i < Count; i++) {
-			int rc = asprintf(&Item, "%s<%d", Context->GetUsername(), (int)(*Clients)[i].Creation);
-
-			if (RcFailed(rc)) {
-				g_Bouncer->Fatal();
-			}
-
-			argv[i] = Item;
-		}
-
-		static char* List = NULL;
-
-		if (List != NULL) {
-			Tcl_Free(List);
-		}
-
-		List = Tcl_Merge(Count, const_cast<char **>(argv));
-
-		for (int i = 0; i < Count; i++) {
-			free(argv[i]);
-		}
-
-		free(argv);
-
-		return List;
 	} else if (strcasecmp(Type, "autobacklog") == 0) {
 		return Context->GetAutoBacklog();
 	} else if (strcasecmp(Type, "sysnotices") == 0) {
@@ -1067,6 +1204,27 @@ int setbncuser(const char* User, const char* Type, const char* Value, const char
 		Context->SetAdmin(Value ? (atoi(Value) ? true : false) : false);
 	else if (strcasecmp(Type, "tag") == 0 && Value)
 		Context->SetTagString(Value, Parameter2);
+	else if (strcasecmp(Type, "tclencoding") == 0) {
+		if (Value && *Value) {
+			Tcl_Encoding Encoding = Tcl_GetEncoding(NULL, Value);
+
+			if (Encoding == NULL)
+				throw "Unknown encoding.";
+
+			bool Compatible = IsAsciiCompatible(Encoding);
+
+			Tcl_FreeEncoding(Encoding);
+
+			if (!Compatible)
+				throw "The encoding must be ASCII-compatible.";
+		}
+
+		Context->GetConfig()->WriteString("user.tclencoding", (Value && *Value) ? Value : NULL);
+		FlushUserEncoding(User);
+
+		if (g_Context != NULL && strcasecmp(g_Context, User) == 0)
+			g_Encoding = GetUserEncoding(User);
+	}
 	else if (strcasecmp(Type, "quitasaway") == 0)
 		Context->SetUseQuitReason(Value ? (atoi(Value) ? true : false) : false);
 	else if (strcasecmp(Type, "automodes") == 0)
@@ -1627,26 +1785,68 @@ void putmainlog(const char *Text) {
 	g_Bouncer->Log("%s", Text);
 }
 
-
-int trafficstats(const char* User, const char* ConnectionType, const char* Type) {
-	CUser* Context = g_Bouncer->GetUser(User);
+const char *bncsearchlog(const char *Words, const char *Nick, int Since, int Until, int Offset, int Count) {
+	CUser *Context = g_Bouncer->GetUser(g_Context);
+	CVector<char *> Results;
+	RESULT<bool> Result;
+	logquery_t Query;
 
 	if (!Context)
 		throw "Invalid user.";
 
-	unsigned int Bytes = 0;
+	memset(&Query, 0, sizeof(Query));
+	Query.Terms = Words;
+	Query.Nick = Nick;
+	Query.Since = Since;
+	Query.Until = Until;
 
-	if (!ConnectionType || strcasecmp(ConnectionType, "client") == 0) {
-		if (!Type || strcasecmp(Type, "in") == 0) {
-			Bytes += Context->GetClientStats()->GetInbound();
-		}
+	if (Offset < 0)
+		Offset = 0;
 
-		if (!Type || strcasecmp(Type, "out") == 0) {
-			Bytes += Context->GetClientStats()->GetOutbound();
-		}
-	}
+	if (Count <= 0)
+		Count = LOGINDEX_PAGESIZE;
 
-	if (!ConnectionType || strcasecmp(ConnectionType, "server") == 0) {
+	Result = Context->GetLog()->Search(&Query, Offset, Count, &Results);
+
+	if (IsError(Result)) {
+		throw GETDESCRIPTION(Result);
+	}
+
+	static char *List = NULL;
+
+	if (List != NULL) {
+		Tcl_Free(List);
+	}
+
+	List = Tcl_Merge(Results.GetLength(), Results.GetList());
+
+	for (int i = 0; i < Results.GetLength(); i++) {
+		free(Results[i]);
+	}
+
+	return List;
+}
+
+
+int trafficstats(const char* User, const char* ConnectionType, const char* Type) {
+	CUser* Context = g_Bouncer->GetUser(User);
+
+	if (!Context)
+		throw "Invalid user.";
+
+	unsigned int Bytes = 0;
+
+	if (!ConnectionType || strcasecmp(ConnectionType, "client") == 0) {
+		if (!Type || strcasecmp(Type, "in") == 0) {
+			Bytes += Context->GetClientStats()->GetInbound();
+		}
+
+		if (!Type || strcasecmp(Type, "out") == 0) {
+			Bytes += Context->GetClientStats()->GetOutbound();
+		}
+	}
+
+	if (!ConnectionType || strcasecmp(ConnectionType, "server") == 0) {
 		if (!Type || strcasecmp(Type, "in") == 0) {
 			Bytes += Context->GetIRCStats()->GetInbound();
 		}
@@ -1873,221 +2073,307 @@ void bncreply(const char* Text) {
 		g_CurrentClient->Privmsg(Text);
 }
 
-char* chanbans(const char* Channel) {
-	CUser* Context = g_Bouncer->GetUser(g_Context);
-
-	if (!Context)
-		throw "Invalid user.";
+/* returns the key which is used for a timer in g_TimerIndex; the length
+ * prefix keeps "a b" + "c" apart from "a" + "b c" */
+static char* GetTimerKey(const char* Proc, const char* Parameter) {
+	char* Key;
+	int rc;
 
-	CIRCConnection* IRC = Context->GetIRCConnection();
+	if (Parameter)
+		rc = asprintf(&Key, "%u:%s:%s", (unsigned int)strlen(Proc), Proc, Parameter);
+	else
+		rc = asprintf(&Key, "%u:%s", (unsigned int)strlen(Proc), Proc);
 
-	if (!IRC)
+	if (rc < 0)
 		return NULL;
 
-	CChannel* Chan = IRC->GetChannel(Channel);
+	return Key;
+}
 
-	if (!Chan)
-		return NULL;
+static void SetTimerSlot(int Slot, tcltimer_t* Timer) {
+	g_Timers[Slot] = Timer;
+	Timer->slot = Slot;
+}
 
-	CBanlist* Banlist = Chan->GetBanlist();
+/* g_Timers is a binary min-heap ordered by the timers' next call */
+static void SiftTimerUp(int Slot) {
+	tcltimer_t* Timer = g_Timers[Slot];
 
-	char** Blist = NULL;
-	int Bcount = 0;
+	while (Slot > 0) {
+		int Parent = (Slot - 1) / 2;
 
-	int i = 0;
-	while (const hash_t<ban_t *> *BanHash = Banlist->Iterate(i)) {
-		char *Timestamp;
-		const ban_t *Ban = BanHash->Value;
+		if (g_Timers[Parent]->next <= Timer->next)
+			break;
 
-		int rc = asprintf(&Timestamp, "%d", (int)Ban->Timestamp);
+		SetTimerSlot(Slot, g_Timers[Parent]);
+		Slot = Parent;
+	}
 
-		if (RcFailed(rc)) {
-			g_Bouncer->Fatal();
-		}
+	SetTimerSlot(Slot, Timer);
+}
 
-		char* ThisBan[3] = { Ban->Mask, Ban->Nick, Timestamp };
+static void SiftTimerDown(int Slot) {
+	tcltimer_t* Timer = g_Timers[Slot];
 
-		char* List = Tcl_Merge(3, const_cast<char **>(ThisBan));
+	while (true) {
+		int Child = Slot * 2 + 1;
 
-		gfree(Timestamp);
+		if (Child >= g_TimerCount)
+			break;
 
-		Blist = (char**)realloc(Blist, ++Bcount * sizeof(char*));
+		if (Child + 1 < g_TimerCount && g_Timers[Child + 1]->next < g_Timers[Child]->next)
+			Child++;
 
-		Blist[Bcount - 1] = List;
+		if (Timer->next <= g_Timers[Child]->next)
+			break;
 
-		i++;
+		SetTimerSlot(Slot, g_Timers[Child]);
+		Slot = Child;
 	}
 
-	static char* AllBans = NULL;
+	SetTimerSlot(Slot, Timer);
+}
+
+/* removes a timer from the heap and the index without freeing it */
+static void UnlinkTimer(tcltimer_t* Timer) {
+	int Slot = Timer->slot;
+
+	g_TimerIndex->Remove(Timer->key);
 
-	if (AllBans)
-		Tcl_Free(AllBans);
+	g_TimerCount--;
 
-	AllBans = Tcl_Merge(Bcount, const_cast<char **>(Blist));
+	if (Slot != g_TimerCount) {
+		SetTimerSlot(Slot, g_Timers[g_TimerCount]);
 
-	for (int a = 0; a < Bcount; a++)
-		Tcl_Free(Blist[a]);
+		if (Slot > 0 && g_Timers[Slot]->next < g_Timers[(Slot - 1) / 2]->next)
+			SiftTimerUp(Slot);
+		else
+			SiftTimerDown(Slot);
+	}
 
-	free(Blist);
+	g_Timers[g_TimerCount] = NULL;
+	Timer->slot = -1;
+}
 
-	return AllBans;
+static void FreeTimer(tcltimer_t* Timer) {
+	free(Timer->proc);
+	free(Timer->param);
+	free(Timer->key);
+	delete Timer;
 }
 
-bool TclTimerProc(time_t Now, void* RawCookie) {
-	tcltimer_t* Cookie = (tcltimer_t*)RawCookie;
+static tcltimer_t* GetTimer(const char* Proc, const char* Parameter) {
+	tcltimer_t* Timer;
+	char* Key;
 
-	if (Cookie == NULL)
-		return false;
+	if (g_TimerIndex == NULL)
+		return NULL;
 
-	Tcl_Obj* objv[2];
-	int objc;
+	Key = GetTimerKey(Proc, Parameter);
 
-	if (Cookie->param)
-		objc = 2;
-	else
-		objc = 1;
+	if (Key == NULL)
+		return NULL;
 
-	objv[0] = Tcl_NewStringObj(Cookie->proc, -1);
+	Timer = g_TimerIndex->Get(Key);
 
-	Tcl_IncrRefCount(objv[0]);
+	free(Key);
 
-	if (Cookie->param) {
-		objv[1] = Tcl_NewStringObj(Cookie->param, -1);
+	return Timer;
+}
+
+static tcltimer_t* FindTimer(const char* Proc, const char* Parameter) {
+	tcltimer_t* Timer = GetTimer(Proc, Parameter);
+
+	/* timers without a parameter match any parameter */
+	if (Timer == NULL && Parameter)
+		return GetTimer(Proc, NULL);
 
-		Tcl_IncrRefCount(objv[1]);
+	/* ... and vice versa, which needs a full scan; this isn't used by
+	 * any of the scripts which create lots of timers */
+	if (Timer == NULL && !Parameter) {
+		for (int i = 0; i < g_TimerCount; i++) {
+			if (strcmp(g_Timers[i]->proc, Proc) == 0)
+				return g_Timers[i];
+		}
 	}
 
-	Tcl_EvalObjv(g_Interp, objc, objv, TCL_EVAL_GLOBAL);
+	return Timer;
+}
 
-	if (Cookie->param) {
-		Tcl_DecrRefCount(objv[1]);
+static void CallTclTimers(void* Cookie);
+
+/* makes sure that the main loop wakes up in time for the next timer */
+static void ScheduleTclTimers(void) {
+	if (g_TimerDeadline == NULL) {
+		if (g_TimerCount == 0)
+			return;
+
+		g_TimerDeadline = g_Bouncer->CreateDeadline(CallTclTimers, NULL);
+
+		if (g_TimerDeadline == NULL)
+			return;
 	}
 
-	Tcl_DecrRefCount(objv[0]);
+	g_Bouncer->SetDeadline(g_TimerDeadline, g_TimerCount > 0 ? g_Timers[0]->next : 0);
+}
 
-	if (!Cookie->timer->GetRepeat()) {
-		for (int i = 0; i < g_TimerCount; i++) {
-			if (g_Timers[i] == Cookie) {
-				g_Timers[i] = NULL;
+/* calls all Tcl timers which are due */
+static void CallTclTimers(void* Cookie) {
+	uint64_t Now = GetMonotonicTime();
 
-				break;
-			}
+	while (g_TimerCount > 0 && g_Timers[0]->next <= Now) {
+		tcltimer_t* Timer = g_Timers[0];
+		Tcl_Obj* objv[2];
+		int objc = 1;
+
+		objv[0] = Tcl_NewStringObj(Timer->proc, -1);
+		Tcl_IncrRefCount(objv[0]);
+
+		if (Timer->param) {
+			objv[1] = Tcl_NewStringObj(Timer->param, -1);
+			Tcl_IncrRefCount(objv[1]);
+
+			objc = 2;
+		}
+
+		/* the proc may create or kill timers (including this one), so the
+		 * timer has to be rescheduled or unlinked before it's called */
+		if (Timer->repeat) {
+			Timer->next = Now + Timer->interval;
+			SiftTimerDown(0);
+		} else {
+			UnlinkTimer(Timer);
+			FreeTimer(Timer);
 		}
 
-		free(Cookie->proc);
-		free(Cookie->param);
-		delete Cookie;
+		Tcl_EvalObjv(g_Interp, objc, objv, TCL_EVAL_GLOBAL);
+
+		for (int i = 0; i < objc; i++) {
+			Tcl_DecrRefCount(objv[i]);
+		}
 	}
 
-	return true;
+	ScheduleTclTimers();
+}
+
+void DestroyTclTimers(void) {
+	for (int i = 0; i < g_TimerCount; i++) {
+		FreeTimer(g_Timers[i]);
+	}
+
+	free(g_Timers);
+	g_Timers = NULL;
+	g_TimerCount = 0;
+	g_TimerAlloc = 0;
+
+	delete g_TimerIndex;
+	g_TimerIndex = NULL;
+
+	g_Bouncer->DestroyDeadline(g_TimerDeadline);
+	g_TimerDeadline = NULL;
 }
 
-int internaltimer(int Interval, bool Repeat, const char* Proc, const char* Parameter) {
+int internaltimer(double Interval, bool Repeat, const char* Proc, const char* Parameter) {
+	tcltimer_t* Timer;
+	double Milliseconds = Interval * 1000;
+
+	if (Milliseconds < 0 || Milliseconds > UINT_MAX)
+		throw "Invalid interval.";
+
 	internalkilltimer(Proc, Parameter);
 
-	tcltimer_t** n = NULL;
+	if (g_TimerIndex == NULL)
+		g_TimerIndex = new CHashtable<tcltimer_t*, true>();
 
-	for (int i = 0; i < g_TimerCount; i++) {
-		if (g_Timers[i] == NULL) {
-			n = &g_Timers[i];
+	if (g_TimerCount == g_TimerAlloc) {
+		int Alloc = g_TimerAlloc ? g_TimerAlloc * 2 : 64;
+		tcltimer_t** Timers = (tcltimer_t**)realloc(g_Timers, Alloc * sizeof(tcltimer_t*));
 
-			break;
-		}
+		if (Timers == NULL)
+			throw "realloc() failed.";
+
+		g_Timers = Timers;
+		g_TimerAlloc = Alloc;
 	}
 
-	if (n == NULL) {
-		g_Timers = (tcltimer_t**)realloc(g_Timers, ++g_TimerCount * sizeof(tcltimer_t*));
+	Timer = new tcltimer_t;
+
+	Timer->proc = strdup(Proc);
+	Timer->param = Parameter ? strdup(Parameter) : NULL;
+	Timer->key = GetTimerKey(Proc, Parameter);
+	Timer->interval = (unsigned int)(Milliseconds + 0.5);
+	Timer->repeat = Repeat;
+
+	if (Timer->proc == NULL || (Parameter && Timer->param == NULL) || Timer->key == NULL ||
+			IsError(g_TimerIndex->Add(Timer->key, Timer))) {
+		FreeTimer(Timer);
 
-		n = &g_Timers[g_TimerCount - 1];
+		throw "Could not create the timer.";
 	}
-	
-	*n = new tcltimer_t;;
 
-	tcltimer_t* p = *n;
+	if (Repeat && Timer->interval < TCLTIMER_MININTERVAL)
+		Timer->interval = TCLTIMER_MININTERVAL;
 
-	p->timer = g_Bouncer->CreateTimer(Interval, Repeat, TclTimerProc, p);
+	Timer->next = GetMonotonicTime() + Timer->interval;
 
-	p->proc = strdup(Proc);
+	g_Timers[g_TimerCount] = Timer;
+	SiftTimerUp(g_TimerCount++);
 
-	if (Parameter) {
-		p->param = strdup(Parameter);
-	} else
-		p->param = NULL;
+	ScheduleTclTimers();
 
 	return 1;
 }
 
 int internalkilltimer(const char* Proc, const char* Parameter) {
-	if (!g_Timers)
-		return 0;
+	tcltimer_t* Timer = FindTimer(Proc, Parameter);
 
-	for (int i = 0; i < g_TimerCount; i++) {
-		if (g_Timers[i] && strcmp(g_Timers[i]->proc, Proc) == 0 &&
-				(!Parameter || !g_Timers[i]->param || strcmp(Parameter, g_Timers[i]->param) == 0)) {
-			g_Timers[i]->timer->Destroy();
-			free(g_Timers[i]->proc);
-			free(g_Timers[i]->param);
-			delete g_Timers[i];
+	if (Timer == NULL)
+		return 0;
 
-			g_Timers[i] = NULL;
+	UnlinkTimer(Timer);
+	FreeTimer(Timer);
 
-			return 1;
-		}
-	}
+	ScheduleTclTimers();
 
-	return 0;
+	return 1;
 }
 
-char *internaltimers(void) {
-	char **List = (char **)malloc(g_TimerCount * sizeof(char *));
-	const char *Timer[4];
-	char *Temp1, *Temp2;
-	int Count = 0;
+int internalkilltimers(const char* Proc, const char* Prefix) {
+	size_t PrefixLength = Prefix ? strlen(Prefix) : 0;
+	int Count = 0, Kept = 0;
 
 	for (int i = 0; i < g_TimerCount; i++) {
-		int rc;
+		tcltimer_t* Timer = g_Timers[i];
 
-		if (g_Timers[i] == NULL) {
-			continue;
-		}
+		if (strcmp(Timer->proc, Proc) != 0 ||
+				(Prefix && (!Timer->param || strncmp(Timer->param, Prefix, PrefixLength) != 0))) {
+			g_Timers[Kept++] = Timer;
 
-		Timer[0] = g_Timers[i]->proc;
-		rc = asprintf(&Temp1, "%d", g_Timers[i]->timer->GetInterval());
-
-		if (RcFailed(rc)) {
-			g_Bouncer->Fatal();
+			continue;
 		}
 
-		Timer[1] = Temp1;
-		rc = asprintf(&Temp2, "%d", g_Timers[i]->timer->GetRepeat());
-
-		if (RcFailed(rc)) {
-			g_Bouncer->Fatal();
-		}
+		g_TimerIndex->Remove(Timer->key);
+		FreeTimer(Timer);
 
-		Timer[2] = Temp2;
+		Count++;
+	}
 
-		Timer[3] = g_Timers[i]->param ? g_Timers[i]->param : "";
+	if (Count == 0)
+		return 0;
 
-		List[Count++] = Tcl_Merge(4, const_cast<char **>(Timer));
+	g_TimerCount = Kept;
 
-		gfree(Temp1);
-		gfree(Temp2);
+	for (int i = 0; i < g_TimerCount; i++) {
+		g_Timers[i]->slot = i;
 	}
 
-	static char *Out = NULL;
-
-	if (Out != NULL) {
-		Tcl_Free(Out);
+	for (int i = g_TimerCount / 2 - 1; i >= 0; i--) {
+		SiftTimerDown(i);
 	}
 
-	Out = Tcl_Merge(Count, const_cast<char **>(List));
+	ScheduleTclTimers();
 
-	for (int a = 0; a < Count; a++) {
-		Tcl_Free(List[a]);
-	}
-
-	return Out;
+	return Count;
 }
 
 const char* getcurrentnick(void) {
@@ -2488,3 +2774,400 @@ const char *bncshareddir(void) {
 const char *bncexedir(void) {
     return g_Bouncer->BuildPathExe("");
 }
+
+/*
+ * The following procs return lists which can get quite large (e.g. the
+ * nicks of a channel). They are implemented as native Tcl commands which
+ * build the lists as Tcl objects instead of merging everything into a
+ * string which Tcl would have to parse again. Each of them accepts an
+ * optional pattern and the index and the number of the items which
+ * should be returned.
+ */
+
+typedef struct listfilter_s {
+	const char *pattern; /* in the external encoding, NULL matches everything */
+	Tcl_DString dsPattern;
+	int first;
+	int count; /* -1 for no limit */
+	int matched;
+} listfilter_t;
+
+static int InitListFilter(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[], int fixed, const char *usage, listfilter_t *filter) {
+	filter->pattern = NULL;
+	filter->first = 0;
+	filter->count = -1;
+	filter->matched = 0;
+
+	Tcl_DStringInit(&filter->dsPattern);
+
+	if (objc < fixed + 1 || objc > fixed + 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, usage);
+
+		return TCL_ERROR;
+	}
+
+	if (objc > fixed + 2 && Tcl_GetIntFromObj(interp, objv[fixed + 2], &filter->first) != TCL_OK)
+		return TCL_ERROR;
+
+	if (objc > fixed + 3 && Tcl_GetIntFromObj(interp, objv[fixed + 3], &filter->count) != TCL_OK)
+		return TCL_ERROR;
+
+	if (objc > fixed + 1) {
+		const char *pattern = Tcl_GetString(objv[fixed + 1]);
+
+		if (pattern[0] != '\0' && strcmp(pattern, "*") != 0)
+			filter->pattern = UtfToExternal(g_Encoding, pattern, -1, &filter->dsPattern);
+	}
+
+	return TCL_OK;
+}
+
+static void FreeListFilter(listfilter_t *filter) {
+	Tcl_DStringFree(&filter->dsPattern);
+}
+
+/* returns 1 if the item should be added to the list, 0 if it should be
+ * skipped and -1 if the list is complete */
+static int FilterListItem(listfilter_t *filter, const char *name) {
+	if (filter->pattern != NULL && !Tcl_StringCaseMatch(name, filter->pattern, 1))
+		return 0;
+
+	if (filter->matched++ < filter->first)
+		return 0;
+
+	if (filter->count >= 0 && filter->matched - filter->first > filter->count)
+		return -1;
+
+	return 1;
+}
+
+static void AppendListString(Tcl_Obj *list, const char *string) {
+	Tcl_ListObjAppendElement(NULL, list, ExternalToObj(g_Encoding, string));
+}
+
+static CChannel *GetContextChannel(Tcl_Obj *channel) {
+	CUser *Context = g_Bouncer->GetUser(g_Context);
+
+	if (Context == NULL)
+		throw "Invalid user.";
+
+	CIRCConnection *IRC = Context->GetIRCConnection();
+
+	if (IRC == NULL)
+		return NULL;
+
+	Tcl_DString dsChannel;
+	CChannel *Chan = IRC->GetChannel(UtfToExternal(g_Encoding, Tcl_GetString(channel), -1, &dsChannel));
+
+	Tcl_DStringFree(&dsChannel);
+
+	return Chan;
+}
+
+static int ListCommandError(Tcl_Interp *interp, const char *Description) {
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(Description, -1));
+
+	return TCL_ERROR;
+}
+
+static int BncUserListCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	listfilter_t filter;
+
+	if (InitListFilter(interp, objc, objv, 0, "?pattern? ?first? ?count?", &filter) != TCL_OK) {
+		FreeListFilter(&filter);
+
+		return TCL_ERROR;
+	}
+
+	Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+	CHashtable<CUser *, false> *Users = g_Bouncer->GetUsers();
+	int i = 0, rc;
+
+	while (hash_t<CUser *> *User = Users->Iterate(i++)) {
+		if ((rc = FilterListItem(&filter, User->Name)) < 0)
+			break;
+
+		if (rc > 0)
+			AppendListString(list, User->Name);
+	}
+
+	FreeListFilter(&filter);
+
+	Tcl_SetObjResult(interp, list);
+
+	return TCL_OK;
+}
+
+static int InternalChannelsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	listfilter_t filter;
+
+	if (InitListFilter(interp, objc, objv, 0, "?pattern? ?first? ?count?", &filter) != TCL_OK) {
+		FreeListFilter(&filter);
+
+		return TCL_ERROR;
+	}
+
+	CUser *Context = g_Bouncer->GetUser(g_Context);
+	CIRCConnection *IRC = Context ? Context->GetIRCConnection() : NULL;
+
+	if (IRC == NULL) {
+		FreeListFilter(&filter);
+
+		return ListCommandError(interp, Context ? "User is not connected to an IRC server." : "Invalid user.");
+	}
+
+	Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+	CHashtable<CChannel *, false> *Channels = IRC->GetChannels();
+	int i = 0, rc;
+
+	while (hash_t<CChannel *> *Chan = Channels ? Channels->Iterate(i++) : NULL) {
+		if ((rc = FilterListItem(&filter, Chan->Name)) < 0)
+			break;
+
+		if (rc > 0)
+			AppendListString(list, Chan->Name);
+	}
+
+	FreeListFilter(&filter);
+
+	Tcl_SetObjResult(interp, list);
+
+	return TCL_OK;
+}
+
+static int InternalChanListCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	listfilter_t filter;
+	CChannel *Chan;
+
+	if (InitListFilter(interp, objc, objv, 1, "channel ?pattern? ?first? ?count?", &filter) != TCL_OK) {
+		FreeListFilter(&filter);
+
+		return TCL_ERROR;
+	}
+
+	try {
+		Chan = GetContextChannel(objv[1]);
+	} catch (const char *Description) {
+		FreeListFilter(&filter);
+
+		return ListCommandError(interp, Description);
+	}
+
+	Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+	int i = 0, rc;
+
+	while (hash_t<CNick *> *Nick = Chan ? Chan->GetNames()->Iterate(i++) : NULL) {
+		if ((rc = FilterListItem(&filter, Nick->Name)) < 0)
+			break;
+
+		if (rc > 0)
+			AppendListString(list, Nick->Name);
+	}
+
+	FreeListFilter(&filter);
+
+	Tcl_SetObjResult(interp, list);
+
+	return TCL_OK;
+}
+
+static int ChanBansCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	listfilter_t filter;
+	CChannel *Chan;
+
+	if (InitListFilter(interp, objc, objv, 1, "channel ?pattern? ?first? ?count?", &filter) != TCL_OK) {
+		FreeListFilter(&filter);
+
+		return TCL_ERROR;
+	}
+
+	try {
+		Chan = GetContextChannel(objv[1]);
+	} catch (const char *Description) {
+		FreeListFilter(&filter);
+
+		return ListCommandError(interp, Description);
+	}
+
+	Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+	int i = 0, rc;
+
+	while (const hash_t<ban_t *> *BanHash = Chan ? Chan->GetBanlist()->Iterate(i++) : NULL) {
+		const ban_t *Ban = BanHash->Value;
+
+		if ((rc = FilterListItem(&filter, Ban->Mask)) < 0)
+			break;
+
+		if (rc == 0)
+			continue;
+
+		Tcl_Obj *item = Tcl_NewListObj(0, NULL);
+
+		AppendListString(item, Ban->Mask);
+		AppendListString(item, Ban->Nick);
+		Tcl_ListObjAppendElement(NULL, item, Tcl_NewIntObj((int)Ban->Timestamp));
+
+		Tcl_ListObjAppendElement(NULL, list, item);
+	}
+
+	FreeListFilter(&filter);
+
+	Tcl_SetObjResult(interp, list);
+
+	return TCL_OK;
+}
+
+static int InternalBindsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	listfilter_t filter;
+
+	if (InitListFilter(interp, objc, objv, 0, "?pattern? ?first? ?count?", &filter) != TCL_OK) {
+		FreeListFilter(&filter);
+
+		return TCL_ERROR;
+	}
+
+	Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+	int rc;
+
+	for (int i = 0; i < g_BindCount; i++) {
+		if (!g_Binds[i].valid)
+			continue;
+
+		if ((rc = FilterListItem(&filter, g_Binds[i].proc)) < 0)
+			break;
+
+		if (rc == 0)
+			continue;
+
+		Tcl_Obj *item = Tcl_NewListObj(0, NULL);
+
+		AppendListString(item, BindTypeName(g_Binds[i].type));
+		AppendListString(item, g_Binds[i].proc);
+		AppendListString(item, g_Binds[i].pattern);
+		AppendListString(item, g_Binds[i].user);
+
+		Tcl_ListObjAppendElement(NULL, list, item);
+	}
+
+	FreeListFilter(&filter);
+
+	Tcl_SetObjResult(interp, list);
+
+	return TCL_OK;
+}
+
+/* whole seconds are returned as integers so that existing scripts keep working */
+static Tcl_Obj *NewIntervalObj(unsigned int interval) {
+	if (interval % 1000 == 0)
+		return Tcl_NewIntObj(interval / 1000);
+	else
+		return Tcl_NewDoubleObj(interval / 1000.0);
+}
+
+static int InternalTimersCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	listfilter_t filter;
+
+	if (InitListFilter(interp, objc, objv, 0, "?pattern? ?first? ?count?", &filter) != TCL_OK) {
+		FreeListFilter(&filter);
+
+		return TCL_ERROR;
+	}
+
+	Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+	int rc;
+
+	for (int i = 0; i < g_TimerCount; i++) {
+		if ((rc = FilterListItem(&filter, g_Timers[i]->proc)) < 0)
+			break;
+
+		if (rc == 0)
+			continue;
+
+		Tcl_Obj *item = Tcl_NewListObj(0, NULL);
+
+		AppendListString(item, g_Timers[i]->proc);
+		Tcl_ListObjAppendElement(NULL, item, NewIntervalObj(g_Timers[i]->interval));
+		Tcl_ListObjAppendElement(NULL, item, Tcl_NewIntObj(g_Timers[i]->repeat));
+		AppendListString(item, g_Timers[i]->param);
+
+		Tcl_ListObjAppendElement(NULL, list, item);
+	}
+
+	FreeListFilter(&filter);
+
+	Tcl_SetObjResult(interp, list);
+
+	return TCL_OK;
+}
+
+/* "tags" and "sessions" return lists, everything else is handled by getbncuser() */
+static int GetBncUserCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+	Tcl_DString dsUser, dsType, dsParameter;
+	const char *User, *Type, *Parameter2 = NULL;
+	int Result = TCL_OK;
+
+	if (objc < 3 || objc > 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "user type ?parameter?");
+
+		return TCL_ERROR;
+	}
+
+	User = UtfToExternal(g_Encoding, Tcl_GetString(objv[1]), -1, &dsUser);
+	Type = UtfToExternal(g_Encoding, Tcl_GetString(objv[2]), -1, &dsType);
+	Tcl_DStringInit(&dsParameter);
+
+	if (objc > 3)
+		Parameter2 = UtfToExternal(g_Encoding, Tcl_GetString(objv[3]), -1, &dsParameter);
+
+	CUser *Context = g_Bouncer->GetUser(User);
+
+	if (Context != NULL && strcasecmp(Type, "tags") == 0) {
+		Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+		const char *Item;
+		int i = 0;
+
+		/* the optional parameter is a pattern for the tags' names */
+		while ((Item = Context->GetTagName(i++)) != NULL) {
+			if (Parameter2 == NULL || Tcl_StringCaseMatch(Item, Parameter2, 1))
+				AppendListString(list, Item);
+		}
+
+		Tcl_SetObjResult(interp, list);
+	} else if (Context != NULL && strcasecmp(Type, "sessions") == 0) {
+		Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+		CVector<client_t> *Clients = Context->GetClientConnections();
+
+		for (int i = 0; i < Clients->GetLength(); i++) {
+			char Suffix[32];
+			Tcl_Obj *item = ExternalToObj(g_Encoding, Context->GetUsername());
+
+			snprintf(Suffix, sizeof(Suffix), "<%d", (int)(*Clients)[i].Creation);
+			Tcl_AppendToObj(item, Suffix, -1);
+			Tcl_ListObjAppendElement(NULL, list, item);
+		}
+
+		Tcl_SetObjResult(interp, list);
+	} else {
+		try {
+			Tcl_SetObjResult(interp, ExternalToObj(g_Encoding, getbncuser(User, Type, Parameter2)));
+		} catch (const char *Description) {
+			Result = ListCommandError(interp, Description);
+		}
+	}
+
+	Tcl_DStringFree(&dsParameter);
+	Tcl_DStringFree(&dsType);
+	Tcl_DStringFree(&dsUser);
+
+	return Result;
+}
+
+static void RegisterListCommands(Tcl_Interp *interp) {
+	Tcl_CreateObjCommand(interp, "bncuserlist", BncUserListCmd, NULL, NULL);
+	Tcl_CreateObjCommand(interp, "internalchannels", InternalChannelsCmd, NULL, NULL);
+	Tcl_CreateObjCommand(interp, "internalchanlist", InternalChanListCmd, NULL, NULL);
+	Tcl_CreateObjCommand(interp, "chanbans", ChanBansCmd, NULL, NULL);
+	Tcl_CreateObjCommand(interp, "internalbinds", InternalBindsCmd, NULL, NULL);
+	Tcl_CreateObjCommand(interp, "internaltimers", InternalTimersCmd, NULL, NULL);
+	Tcl_CreateObjCommand(interp, "getbncuser", GetBncUserCmd, NULL, NULL);
+}
@@ -25,6 +25,9 @@
 
 %rename(rand) ticklerand;
 
+/* getbncuser is a native command which wraps getbncuser() (see RegisterListCommands) */
+%ignore getbncuser;
+
 %include "exception.i"
 %exception {
 	try {
@@ -36,7 +39,7 @@
 
 %typemap(in) char * (Tcl_DString ds_, bool ds_use_ = false) {
 	ds_use_ = true;
-	$1 = Tcl_UtfToExternalDString(g_Encoding, Tcl_GetString($input), -1, &ds_);
+	$1 = (char *)UtfToExternal(g_Encoding, Tcl_GetString($input), -1, &ds_);
 }
 
 %typemap(freearg) char * {
@@ -47,16 +50,15 @@
 %typemap(in) const char * = char *;
 
 %typemap(ret) char * {
-	Tcl_DString ds_ret;
-	Tcl_SetObjResult(interp, Tcl_NewStringObj(Tcl_ExternalToUtfDString(g_Encoding, $1, -1, &ds_ret),-1));
-
-	Tcl_DStringFree(&ds_ret);
+	Tcl_SetObjResult(interp, ExternalToObj(g_Encoding, $1, -1));
 }
 
 %typemap(freearg) const char * = char *;
 
 %header %{
 extern Tcl_Encoding g_Encoding;
+const char* UtfToExternal(Tcl_Encoding encoding, const char* string, int length, Tcl_DString* ds);
+Tcl_Obj* ExternalToObj(Tcl_Encoding encoding, const char* string, int length);
 %}
 
 struct CTclSocket;
@@ -76,19 +78,19 @@ const char *simul(const char* User, const char* Command);
 
 int internalbind(const char* type, const char* proc, const char* pattern = 0, const char* user = 0);
 int internalunbind(const char* type, const char* proc, const char* pattern = 0, const char* user = 0);
+int internalasyncbind(const char* type, const char* proc, const char* pattern = 0, const char* user = 0);
+int internaleggbind(const char* type, const char* flags, const char* mask, const char* proc, const char* user = 0);
+int internaleggunbind(const char* type, const char* flags, const char* mask, const char* proc, const char* user = 0);
 
 void setctx(const char* ctx);
 const char* getctx(int ts = 0);
 
-const char* bncuserlist(void);
 const char* getbncuser(const char* User, const char* Type, const char* Parameter2 = 0);
 int setbncuser(const char* User, const char* Type, const char* Value = 0, const char* Parameter2 = 0);
 void addbncuser(const char* User, const char* Password);
 void delbncuser(const char* User);
 bool bnccheckpassword(const char* User, const char* Password);
 
-const char* internalchanlist(const char* Channel);
-
 const char* bncversion(void);
 const char* bncnumversion(void);
 int bncuptime(void);
@@ -101,7 +103,6 @@ int requiresparam(char Mode);
 bool isprefixmode(char Mode);
 const char* getchanprefix(const char* Channel, const char* Nick);
 
-const char* internalchannels(void);
 const char* bncmodules(void);
 
 int bncsettag(const char* channel, const char* nick, const char* tag, const char* value);
@@ -129,17 +130,15 @@ int internalconnect(const char* Host, unsigned short Port, bool SSL = false);
 const char *internalgetipforsocket(int Socket);
 void internalclosesocket(int Socket);
 
-int internaltimer(int Interval, bool Repeat, const char* Proc, const char* Parameter = 0);
+int internaltimer(double Interval, bool Repeat, const char* Proc, const char* Parameter = 0);
 int internalkilltimer(const char* Proc, const char* Parameter = 0);
-char *internaltimers(void);
+int internalkilltimers(const char* Proc, const char* Prefix = 0);
 
 void bncdisconnect(const char* Reason);
 void bnckill(const char* Reason);
 
 const char* getcurrentnick(void);
 
-const char* internalbinds(void);
-
 const char* bncgetmotd(void);
 void bncsetmotd(const char* Motd);
 const char* bncgetgvhost(void);
@@ -171,6 +170,7 @@ const char *getusermodes(void);
 int hijacksocket(void);
 
 void putmainlog(const char *Text);
+const char *bncsearchlog(const char *Words, const char *Nick = 0, int Since = 0, int Until = 0, int Offset = 0, int Count = 0);
 
 int bncgetreslimit(const char *Resource, const char *User = 0);
 void bncsetreslimit(const char *Resource, int NewLimit, const char *User = 0);
@@ -200,7 +200,6 @@ int queuesize(const char* Queue);
 int puthelp(const char* text, const char *option = 0);
 int putquick(const char* text, const char *option = 0);
 void putlog(const char* Text);
-char* chanbans(const char* Channel);
 
 void control(int Socket, const char* Proc);
 
@@ -0,0 +1,298 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "StdAfx.h"
+
+/** The payload sizes of the size classes */
+static const size_t g_ArenaClassSizes[ARENA_CLASSES] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+
+/** The offset of the first block in a chunk */
+#define ARENA_CHUNKHEADER ((sizeof(arenachunk_t) + 15) & ~(size_t)15)
+
+/**
+ * CArena
+ *
+ * Constructs an empty arena. Memory isn't allocated until the first
+ * block is needed.
+ */
+CArena::CArena(void) {
+	m_Chunks = NULL;
+	m_Large = NULL;
+	m_NextChunk = ARENA_MINCHUNK;
+
+	memset(m_Free, 0, sizeof(m_Free));
+}
+
+/**
+ * ~CArena
+ *
+ * Releases all blocks which have been allocated by the arena.
+ */
+CArena::~CArena(void) {
+	Release();
+}
+
+/**
+ * AllocSmall
+ *
+ * Allocates a block for the specified class, either from the class's
+ * free list or from the current chunk.
+ *
+ * @param Class the size class
+ */
+arenablock_t *CArena::AllocSmall(size_t Class) {
+	arenablock_t *Block;
+	arenachunk_t *Chunk;
+	size_t Size = sizeof(arenablock_t) + g_ArenaClassSizes[Class];
+
+	if (m_Free[Class] != NULL) {
+		Block = m_Free[Class];
+		m_Free[Class] = Block->Next;
+	} else {
+		Chunk = m_Chunks;
+
+		// the rest of the current chunk is wasted, which is at most
+		// the size of the largest class
+		if (Chunk == NULL || Chunk->Size - Chunk->Used < Size) {
+			Chunk = (arenachunk_t *)malloc(ARENA_CHUNKHEADER + m_NextChunk);
+
+			if (Chunk == NULL) {
+				return NULL;
+			}
+
+			Chunk->Next = m_Chunks;
+			Chunk->Size = m_NextChunk;
+			Chunk->Used = 0;
+
+			m_Chunks = Chunk;
+
+			if (m_NextChunk < ARENA_MAXCHUNK) {
+				m_NextChunk *= 2;
+			}
+		}
+
+		Block = (arenablock_t *)((char *)Chunk + ARENA_CHUNKHEADER + Chunk->Used);
+		Chunk->Used += Size;
+	}
+
+	Block->Arena = this;
+	Block->Class = Class;
+
+	return Block;
+}
+
+/**
+ * AllocLarge
+ *
+ * Allocates a block which doesn't fit into any of the size classes.
+ *
+ * @param Size the size of the block
+ */
+arenablock_t *CArena::AllocLarge(size_t Size) {
+	arenalarge_t *Large;
+
+	Large = (arenalarge_t *)malloc(sizeof(arenalarge_t) + Size);
+
+	if (Large == NULL) {
+		return NULL;
+	}
+
+	Large->Previous = NULL;
+	Large->Next = m_Large;
+	Large->Size = Size;
+
+	if (m_Large != NULL) {
+		m_Large->Previous = Large;
+	}
+
+	m_Large = Large;
+
+	Large->Block.Arena = this;
+	Large->Block.Class = ARENA_CLASSES;
+
+	return &Large->Block;
+}
+
+/**
+ * GetBlockSize
+ *
+ * Returns the number of bytes which can be used in a block.
+ *
+ * @param Block the block's header
+ */
+size_t CArena::GetBlockSize(const arenablock_t *Block) {
+	if (Block->Class == ARENA_CLASSES) {
+		return ((const arenalarge_t *)((const char *)Block - offsetof(arenalarge_t, Block)))->Size;
+	} else {
+		return g_ArenaClassSizes[Block->Class];
+	}
+}
+
+/**
+ * Alloc
+ *
+ * Allocates a block. Returns NULL if there isn't enough memory.
+ *
+ * @param Size the size of the block
+ */
+void *CArena::Alloc(size_t Size) {
+	arenablock_t *Block = NULL;
+
+	if (Size > g_ArenaClassSizes[ARENA_CLASSES - 1]) {
+		Block = AllocLarge(Size);
+	} else {
+		for (size_t i = 0; i < ARENA_CLASSES; i++) {
+			if (Size <= g_ArenaClassSizes[i]) {
+				Block = AllocSmall(i);
+
+				break;
+			}
+		}
+	}
+
+	if (Block == NULL) {
+		return NULL;
+	}
+
+	return Block + 1;
+}
+
+/**
+ * Realloc
+ *
+ * Resizes a block. The block may be moved to another location; if this
+ * fails NULL is returned and the original block is left untouched.
+ *
+ * @param Block the block, or NULL
+ * @param Size the new size of the block
+ */
+void *CArena::Realloc(void *Block, size_t Size) {
+	size_t OldSize;
+	void *NewBlock;
+
+	if (Block == NULL) {
+		return Alloc(Size);
+	}
+
+	OldSize = GetBlockSize((arenablock_t *)Block - 1);
+
+	if (Size <= OldSize) {
+		return Block;
+	}
+
+	NewBlock = Alloc(Size);
+
+	if (NewBlock == NULL) {
+		return NULL;
+	}
+
+	memcpy(NewBlock, Block, OldSize);
+
+	Free(Block);
+
+	return NewBlock;
+}
+
+/**
+ * StrDup
+ *
+ * Duplicates a string.
+ *
+ * @param String the string
+ */
+char *CArena::StrDup(const char *String) {
+	size_t Length = strlen(String) + 1;
+	char *Copy;
+
+	Copy = (char *)Alloc(Length);
+
+	if (Copy != NULL) {
+		memcpy(Copy, String, Length);
+	}
+
+	return Copy;
+}
+
+/**
+ * Free
+ *
+ * Returns a block to the arena which has allocated it. Small blocks are
+ * kept for later allocations.
+ *
+ * @param Block the block, or NULL
+ */
+void CArena::Free(void *Block) {
+	arenablock_t *Header;
+	arenalarge_t *Large;
+	CArena *Arena;
+
+	if (Block == NULL) {
+		return;
+	}
+
+	Header = (arenablock_t *)Block - 1;
+	Arena = Header->Arena;
+
+	if (Header->Class == ARENA_CLASSES) {
+		Large = (arenalarge_t *)((char *)Header - offsetof(arenalarge_t, Block));
+
+		if (Large->Previous != NULL) {
+			Large->Previous->Next = Large->Next;
+		} else {
+			Arena->m_Large = Large->Next;
+		}
+
+		if (Large->Next != NULL) {
+			Large->Next->Previous = Large->Previous;
+		}
+
+		free(Large);
+	} else {
+		size_t Class = Header->Class;
+
+		Header->Next = Arena->m_Free[Class];
+		Arena->m_Free[Class] = Header;
+	}
+}
+
+/**
+ * Release
+ *
+ * Releases all blocks at once. Blocks which have been allocated by the
+ * arena must not be used afterwards.
+ */
+void CArena::Release(void) {
+	while (m_Chunks != NULL) {
+		arenachunk_t *Chunk = m_Chunks;
+
+		m_Chunks = Chunk->Next;
+		free(Chunk);
+	}
+
+	while (m_Large != NULL) {
+		arenalarge_t *Large = m_Large;
+
+		m_Large = Large->Next;
+		free(Large);
+	}
+
+	memset(m_Free, 0, sizeof(m_Free));
+
+	m_NextChunk = ARENA_MINCHUNK;
+}
@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/** The number of size classes */
+#define ARENA_CLASSES 10
+
+/** The size of the first chunk, chunks grow up to ARENA_MAXCHUNK */
+#define ARENA_MINCHUNK 1024
+
+/** The maximum size of a chunk */
+#define ARENA_MAXCHUNK 32768
+
+class CArena;
+
+/**
+ * arenablock_t
+ *
+ * The header of a block which has been allocated by an arena.
+ */
+typedef struct arenablock_s {
+	CArena *Arena; /**< the arena which owns the block */
+
+	union {
+		size_t Class; /**< the block's size class, or ARENA_CLASSES for large blocks */
+		struct arenablock_s *Next; /**< the next free block of the same class */
+	};
+} arenablock_t;
+
+/**
+ * arenachunk_t
+ *
+ * A chunk of memory which small blocks are carved from.
+ */
+typedef struct arenachunk_s {
+	struct arenachunk_s *Next; /**< the previously allocated chunk */
+	size_t Size; /**< the number of bytes which can be used for blocks */
+	size_t Used; /**< the number of bytes which have been carved out */
+} arenachunk_t;
+
+/**
+ * arenalarge_t
+ *
+ * A block which is too large for any of the size classes. Large blocks
+ * are allocated with malloc() and kept in a list.
+ */
+typedef struct arenalarge_s {
+	struct arenalarge_s *Previous; /**< the previous large block */
+	struct arenalarge_s *Next; /**< the next large block */
+	size_t Size; /**< the size of the block */
+	arenablock_t Block; /**< the block's header */
+} arenalarge_t;
+
+/**
+ * CArena
+ *
+ * An allocator for lots of small objects which share a lifetime (e.g.
+ * the nicks, bans and modes of a channel). Small blocks are carved from
+ * chunks and recycled through per-class free lists, so blocks which are
+ * freed one by one don't fragment the heap. Everything is released at
+ * once when the arena is destroyed, without freeing the individual blocks.
+ */
+class SBNCAPI CArena {
+	arenachunk_t *m_Chunks; /**< the chunks, the current chunk first */
+	arenablock_t *m_Free[ARENA_CLASSES]; /**< the free blocks for each class */
+	arenalarge_t *m_Large; /**< the large blocks */
+	size_t m_NextChunk; /**< the size of the next chunk */
+
+	arenablock_t *AllocSmall(size_t Class);
+	arenablock_t *AllocLarge(size_t Size);
+	static size_t GetBlockSize(const arenablock_t *Block);
+public:
+#ifndef SWIG
+	CArena(void);
+	~CArena(void);
+#endif /* SWIG */
+
+	void *Alloc(size_t Size);
+	void *Realloc(void *Block, size_t Size);
+	char *StrDup(const char *String);
+	static void Free(void *Block);
+
+	void Release(void);
+};
+
+#endif /* ARENA_H */
@@ -27,19 +27,21 @@
  * @param Ban the ban which is going to be destroyed
  */
 void DestroyBan(ban_t *Ban) {
-	free(Ban->Mask);
-	free(Ban->Nick);
-	delete Ban;
+	CArena::Free(Ban->Mask);
+	CArena::Free(Ban->Nick);
+	CArena::Free(Ban);
 }
 
 /**
  * CBanlist
  *
- * Constructs an empty banlist.
+ * Constructs an empty banlist. The bans are allocated from the
+ * channel's arena.
  */
 CBanlist::CBanlist(CChannel *Owner) {
 	SetOwner(Owner);
 
+	m_Bans.SetArena(Owner->GetArena());
 	m_Bans.RegisterValueDestructor(DestroyBan);
 }
 
@@ -54,21 +56,28 @@ CBanlist::CBanlist(CChannel *Owner) {
  */
 RESULT<bool> CBanlist::SetBan(const char *Mask, const char *Nick, time_t Timestamp) {
 	ban_t *Ban;
+	CArena *Arena = GetOwner()->GetArena();
 
 	if (!GetUser()->IsAdmin() && m_Bans.GetLength() >= g_Bouncer->GetResourceLimit("bans", GetUser())) {
 		THROW(bool, Generic_QuotaExceeded, "Too many bans.");
 	}
 
-	Ban = new ban_t;
+	Ban = (ban_t *)Arena->Alloc(sizeof(ban_t));
 
 	if (AllocFailed(Ban)) {
-		THROW(bool, Generic_OutOfMemory, "new operator failed.");
+		THROW(bool, Generic_OutOfMemory, "CArena::Alloc() failed.");
 	}
 
-	Ban->Mask = strdup(Mask);
-	Ban->Nick = strdup(Nick);
+	Ban->Mask = Arena->StrDup(Mask);
+	Ban->Nick = Arena->StrDup(Nick);
 	Ban->Timestamp = Timestamp;
 
+	if (AllocFailed(Ban->Mask) || AllocFailed(Ban->Nick)) {
+		DestroyBan(Ban);
+
+		THROW(bool, Generic_OutOfMemory, "CArena::StrDup() failed.");
+	}
+
 	return m_Bans.Add(Mask, Ban);
 }
 
@@ -19,89 +19,167 @@
 
 #include "StdAfx.h"
 
-int CacheGetIntegerReal(CConfig *Config, int *CacheValue, const char *Option, const char *Prefix) {
-	char *OptionName;
+/**
+ * CCache
+ *
+ * Constructs a new cache. Use CacheInitialize() to attach the cache
+ * to a configuration object.
+ *
+ * @param Prefix the common prefix of the settings
+ * @param Options the names of the settings, without the prefix
+ * @param Count the number of settings
+ * @param Slots the slots for the settings
+ */
+CCache::CCache(const char *Prefix, const char *const *Options, unsigned int Count, cacheslot_t *Slots) {
+	m_Config = NULL;
+	m_Prefix = Prefix;
+	m_PrefixLength = strlen(Prefix);
+	m_Options = Options;
+	m_Count = Count;
+	m_Slots = Slots;
+
+	InvalidateAll();
+}
 
-	if (Prefix != NULL) {
-		int rc = asprintf(&OptionName, "%s%s", Prefix, Option);
+/**
+ * ~CCache
+ *
+ * Destructs the cache.
+ */
+CCache::~CCache(void) {
+	if (m_Config != NULL && m_Config->m_Cache == this) {
+		m_Config->m_Cache = NULL;
+	}
+}
 
-		if (RcFailed(rc)) {
-			return 0;
-		}
-	} else {
-		OptionName = const_cast<char *>(Option);
+/**
+ * Initialize
+ *
+ * Attaches the cache to a configuration object.
+ *
+ * @param Config the configuration object
+ */
+void CCache::Initialize(CConfig *Config) {
+	if (m_Config != NULL && m_Config->m_Cache == this) {
+		m_Config->m_Cache = NULL;
 	}
 
-	*CacheValue = Config->ReadInteger(OptionName);
+	m_Config = Config;
 
-	if (Prefix != NULL) {
-		free(OptionName);
+	if (m_Config != NULL) {
+		m_Config->m_Cache = this;
 	}
 
-	return *CacheValue;
+	InvalidateAll();
 }
 
-const char *CacheGetStringReal(CConfig *Config, const char **CacheValue, const char *Option, const char *Prefix) {
-	char *OptionName;
+/**
+ * Invalidate
+ *
+ * Invalidates the slot for a setting (if the setting is cached).
+ *
+ * @param Setting the name of the setting (including the prefix)
+ */
+void CCache::Invalidate(const char *Setting) {
+	if (strncasecmp(Setting, m_Prefix, m_PrefixLength) != 0) {
+		return;
+	}
+
+	Setting += m_PrefixLength;
 
-	if (Prefix != NULL) {
-		int rc = asprintf(&OptionName, "%s%s", Prefix, Option);
+	for (unsigned int i = 0; i < m_Count; i++) {
+		if (strcasecmp(m_Options[i], Setting) == 0) {
+			m_Slots[i].Valid = false;
 
-		if (RcFailed(rc)) {
-			return NULL;
+			return;
 		}
-	} else {
-		OptionName = const_cast<char *>(Option);
 	}
+}
 
-	*CacheValue = Config->ReadString(OptionName);
-
-	if (Prefix != NULL) {
-		free(OptionName);
+/**
+ * InvalidateAll
+ *
+ * Invalidates all slots.
+ */
+void CCache::InvalidateAll(void) {
+	for (unsigned int i = 0; i < m_Count; i++) {
+		m_Slots[i].Valid = false;
 	}
-
-	return *CacheValue;
 }
 
-void CacheSetIntegerReal(CConfig *Config, int *CacheValue, const char *Option, int Value, const char *Prefix) {
-	char *OptionName;
-
-	if (Prefix != NULL) {
-		int rc = asprintf(&OptionName, "%s%s", Prefix, Option);
+/**
+ * GetOptionName
+ *
+ * Builds the full name of a setting.
+ *
+ * @param Slot the setting's slot
+ * @param Buffer the buffer for the name
+ * @param Size the size of the buffer
+ */
+bool CCache::GetOptionName(unsigned int Slot, char *Buffer, size_t Size) const {
+	int rc = snprintf(Buffer, Size, "%s%s", m_Prefix, m_Options[Slot]);
+
+	return (rc >= 0 && (size_t)rc < Size);
+}
 
-		if (RcFailed(rc)) {
-			return;
-		}
-	} else {
-		OptionName = const_cast<char *>(Option);
+/**
+ * Fetch
+ *
+ * Reads a setting from the configuration object and stores it in its slot.
+ *
+ * @param Slot the setting's slot
+ */
+void CCache::Fetch(unsigned int Slot) const {
+	cacheslot_t *CacheSlot = &m_Slots[Slot];
+	char OptionName[128];
+
+	CacheSlot->Integer = 0;
+	CacheSlot->String = NULL;
+
+	if (m_Config == NULL || !GetOptionName(Slot, OptionName, sizeof(OptionName))) {
+		return;
 	}
 
-	*CacheValue = Value;
+	CacheSlot->String = m_Config->ReadString(OptionName);
 
-	Config->WriteInteger(OptionName, Value);
-
-	if (Prefix != NULL) {
-		free(OptionName);
+	if (CacheSlot->String != NULL) {
+		CacheSlot->Integer = atoi(CacheSlot->String);
 	}
-}
-
-void CacheSetStringReal(CConfig *Config, const char **CacheValue, const char *Option, const char *Value, const char *Prefix) {
-	char *OptionName;
 
-	if (Prefix != NULL) {
-		int rc = asprintf(&OptionName, "%s%s", Prefix, Option);
+	CacheSlot->Valid = true;
+}
 
-		if (RcFailed(rc)) {
-			return;
-		}
-	} else {
-		OptionName = const_cast<char *>(Option);
+/**
+ * SetInteger
+ *
+ * Sets a setting's value.
+ *
+ * @param Slot the setting's slot
+ * @param Value the new value
+ */
+void CCache::SetInteger(unsigned int Slot, int Value) {
+	char OptionName[128];
+
+	if (m_Config != NULL && GetOptionName(Slot, OptionName, sizeof(OptionName))) {
+		/* the config object invalidates the slot */
+		m_Config->WriteInteger(OptionName, Value);
 	}
+}
 
-	Config->WriteString(OptionName, Value);
-	*CacheValue = Config->ReadString(OptionName);
-
-	if (Prefix != NULL) {
-		free(OptionName);
+/**
+ * SetString
+ *
+ * Sets a setting's value.
+ *
+ * @param Slot the setting's slot
+ * @param Value the new value, can be NULL to indicate that the setting
+ *              is to be removed
+ */
+void CCache::SetString(unsigned int Slot, const char *Value) {
+	char OptionName[128];
+
+	if (m_Config != NULL && GetOptionName(Slot, OptionName, sizeof(OptionName))) {
+		/* the config object invalidates the slot */
+		m_Config->WriteString(OptionName, Value);
 	}
 }
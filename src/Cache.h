@@ -20,34 +20,127 @@
 #ifndef CACHE_H
 #define CACHE_H
 
-#define CACHE(Name) struct configcache##Name
+/**
+ * cacheslot_t
+ *
+ * A cached setting.
+ */
+typedef struct cacheslot_s {
+	bool Valid; /**< whether the slot contains the setting's current value */
+	int Integer; /**< the setting's value as an integer, 0 if it doesn't exist */
+	const char *String; /**< the setting's value, NULL if it doesn't exist */
+} cacheslot_t;
 
-#define DEFINE_CACHE(Name) CACHE(Name) { \
-	CConfig *BgConfig; \
-	const char *BgPrefix;
-#define END_DEFINE_CACHE };
+/**
+ * CCache
+ *
+ * Caches a fixed set of settings which share a common prefix (e.g. "user.")
+ * in an array of slots. The configuration object invalidates a slot when the
+ * setting is changed, so reading a cached setting is a simple array access.
+ *
+ * Caches are declared using DEFINE_CACHE() and a list of options:
+ *
+ * #define FOO_OPTIONS(INT, STRING) \
+ *	INT(port) \
+ *	STRING(server)
+ *
+ * DEFINE_CACHE(Foo, "foo.", FOO_OPTIONS);
+ *
+ * This defines the class CCacheFoo whose settings can be accessed using
+ * CacheGetInteger(Cache, port), CacheSetString(Cache, server, Value), etc.
+ */
+class SBNCAPI CCache {
+	CConfig *m_Config; /**< the configuration object */
+	const char *m_Prefix; /**< the common prefix of the settings */
+	size_t m_PrefixLength; /**< the length of the prefix */
+	const char *const *m_Options; /**< the names of the settings (without the prefix) */
+	unsigned int m_Count; /**< the number of settings */
+	cacheslot_t *m_Slots; /**< the slots */
 
-#define DEFINE_OPTION_INT(Name) int Name
-#define DEFINE_OPTION_STRING(Name) const char *Name
+	friend class CConfig;
 
-#define CacheInitialize(Cache, Config, Prefix) { \
-	memset(&(Cache), 0xFF, sizeof((Cache))); \
-	(Cache).BgConfig = Config; \
-	(Cache).BgPrefix = Prefix; \
-	}
+	bool GetOptionName(unsigned int Slot, char *Buffer, size_t Size) const;
+	void Fetch(unsigned int Slot) const;
 
+public:
 #ifndef SWIG
-int CacheGetIntegerReal(CConfig *Config, int *CacheValue, const char *Option, const char *Prefix);
-const char *CacheGetStringReal(CConfig *Config, const char **CacheValue, const char *Option, const char *Prefix);
+	CCache(const char *Prefix, const char *const *Options, unsigned int Count, cacheslot_t *Slots);
+	virtual ~CCache(void);
+#endif /* SWIG */
+
+	void Initialize(CConfig *Config);
+
+	void Invalidate(const char *Setting);
+	void InvalidateAll(void);
+
+	/**
+	 * GetInteger
+	 *
+	 * Returns the value of a setting as an integer.
+	 *
+	 * @param Slot the setting's slot
+	 */
+	int GetInteger(unsigned int Slot) const {
+		if (!m_Slots[Slot].Valid) {
+			Fetch(Slot);
+		}
+
+		return m_Slots[Slot].Integer;
+	}
 
-void CacheSetIntegerReal(CConfig *Config, int *CacheValue, const char *Option, int Value, const char *Prefix);
-void CacheSetStringReal(CConfig *Config, const char **CacheValue, const char *Option, const char *Value, const char *Prefix);
+	/**
+	 * GetString
+	 *
+	 * Returns the value of a setting, or NULL if the setting doesn't exist.
+	 *
+	 * @param Slot the setting's slot
+	 */
+	const char *GetString(unsigned int Slot) const {
+		if (!m_Slots[Slot].Valid) {
+			Fetch(Slot);
+		}
+
+		return m_Slots[Slot].String;
+	}
+
+	void SetInteger(unsigned int Slot, int Value);
+	void SetString(unsigned int Slot, const char *Value);
+};
+
+#define CACHE_OPTION(Name) Option_##Name,
+#define CACHE_OPTION_NAME(Name) #Name,
+#define CACHE_INT_OPTION(Name) IntOption_##Name = Option_##Name,
+#define CACHE_STRING_OPTION(Name) StringOption_##Name = Option_##Name,
+#define CACHE_NO_OPTION(Name)
+
+#define DEFINE_CACHE(Name, Prefix, Options) \
+class SBNCAPI CCache##Name : public CCache { \
+public: \
+	enum { Options(CACHE_OPTION, CACHE_OPTION) Option_Count }; \
+	enum { Options(CACHE_INT_OPTION, CACHE_NO_OPTION) IntOption_Count = Option_Count }; \
+	enum { Options(CACHE_NO_OPTION, CACHE_STRING_OPTION) StringOption_Count = Option_Count }; \
+	\
+private: \
+	cacheslot_t m_Storage[Option_Count]; \
+	\
+	static const char *const *GetOptionNames(void) { \
+		static const char *const OptionNames[] = { Options(CACHE_OPTION_NAME, CACHE_OPTION_NAME) NULL }; \
+		\
+		return OptionNames; \
+	} \
+	\
+public: \
+	CCache##Name(void) : CCache(Prefix, GetOptionNames(), Option_Count, m_Storage) { } \
+}
+
+#ifndef SWIG
+#define CacheInitialize(Cache, Config) (Cache).Initialize(Config)
 
-#define CacheGetInteger(Cache, Option) (((Cache).Option == -1 || !(Cache).BgConfig->CanUseCache()) ? CacheGetIntegerReal((Cache).BgConfig, &((Cache).Option), #Option, (Cache).BgPrefix) : (Cache).Option)
-#define CacheGetString(Cache, Option) (((Cache).Option == (char *)-1 || !(Cache).BgConfig->CanUseCache())? CacheGetStringReal((Cache).BgConfig, &((Cache).Option), #Option, (Cache).BgPrefix) : (Cache).Option)
+#define CacheGetInteger(Cache, Option) (Cache).GetInteger((Cache).IntOption_##Option)
+#define CacheGetString(Cache, Option) (Cache).GetString((Cache).StringOption_##Option)
 
-#define CacheSetInteger(Cache, Option, Value) CacheSetIntegerReal((Cache).BgConfig, &((Cache).Option), #Option, Value, (Cache).BgPrefix)
-#define CacheSetString(Cache, Option, Value) CacheSetStringReal((Cache).BgConfig, &((Cache).Option), #Option, Value, (Cache).BgPrefix)
+#define CacheSetInteger(Cache, Option, Value) (Cache).SetInteger((Cache).IntOption_##Option, Value)
+#define CacheSetString(Cache, Option, Value) (Cache).SetString((Cache).StringOption_##Option, Value)
 #endif /* SWIG */
 
 #endif /* CACHE_H */
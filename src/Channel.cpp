@@ -30,7 +30,7 @@
 CChannel::CChannel(const char *Name, CIRCConnection *Owner) {
 	SetOwner(Owner);
 
-	m_Name = strdup(Name);
+	m_Name = m_Arena.StrDup(Name);
 	if (AllocFailed(m_Name)) {}
 
 	m_Timestamp = g_CurrentTime;
@@ -40,6 +40,7 @@ CChannel::CChannel(const char *Name, CIRCConnection *Owner) {
 	m_TopicStamp = 0;
 	m_HasTopic = 0;
 
+	m_Nicks.SetArena(&m_Arena);
 	m_Nicks.RegisterValueDestructor(DestroyObject<CNick>);
 
 	m_HasNames = false;
@@ -60,16 +61,10 @@ CChannel::CChannel(const char *Name, CIRCConnection *Owner) {
  * Destructs a channel object.
  */
 CChannel::~CChannel() {
-	free(m_Name);
-
-	free(m_Topic);
-	free(m_TopicNick);
+	/* the name, topic, nicks, bans and mode parameters are released together
+	 * with m_Arena rather than one by one */
 	free(m_TempModes);
 
-	for (int i = 0; i < m_Modes.GetLength(); i++) {
-		free(m_Modes[i].Parameter);
-	}
-
 	delete m_Banlist;
 
 	for (CListCursor<backlog_t> BacklogCursor(&m_Backlog); BacklogCursor.IsValid(); BacklogCursor.Proceed()) {
@@ -87,6 +82,15 @@ const char *CChannel::GetName(void) const {
 	return m_Name;
 }
 
+/**
+ * GetArena
+ *
+ * Returns the arena which is used for the channel's nicks, bans and modes.
+ */
+CArena *CChannel::GetArena(void) {
+	return &m_Arena;
+}
+
 /**
  * GetChannelModes
  *
@@ -170,7 +174,7 @@ void CChannel::ParseModeChange(const char *Source, const char *Modes, int pargc,
 		m_TempModes = NULL;
 	}
 
-	const CVector<CModule *> *Modules = g_Bouncer->GetModules();
+	const CVector<CModule *> *Modules = g_Bouncer->GetModuleSubscribers(ModuleEvent_ModeChange, NULL);
 
 	for (size_t i = 0; i < strlen(Modes); i++) {
 		char Current = Modes[i];
@@ -245,7 +249,7 @@ void CChannel::ParseModeChange(const char *Source, const char *Modes, int pargc,
 
 		if (Flip) {
 			if (Slot != NULL) {
-				free(Slot->Parameter);
+				CArena::Free(Slot->Parameter);
 			} else {
 				Slot = m_Modes.GetNew();
 			}
@@ -261,14 +265,14 @@ void CChannel::ParseModeChange(const char *Source, const char *Modes, int pargc,
 			Slot->Mode = Current;
 
 			if (ModeType != 0 && p < pargc) {
-				Slot->Parameter = strdup(pargv[p++]);
+				Slot->Parameter = m_Arena.StrDup(pargv[p++]);
 			} else {
 				Slot->Parameter = NULL;
 			}
 		} else {
 			if (Slot != NULL) {
 				Slot->Mode = '\0';
-				free(Slot->Parameter);
+				CArena::Free(Slot->Parameter);
 
 				Slot->Parameter = NULL;
 			}
@@ -334,13 +338,13 @@ const char *CChannel::GetTopic(void) const {
 void CChannel::SetTopic(const char *Topic) {
 	char *NewTopic;
 
-	NewTopic = strdup(Topic);
+	NewTopic = m_Arena.StrDup(Topic);
 
 	if (AllocFailed(NewTopic)) {
 		return;
 	}
 
-	free(m_Topic);
+	CArena::Free(m_Topic);
 	m_Topic = NewTopic;
 	m_HasTopic = 1;
 }
@@ -364,13 +368,13 @@ const char *CChannel::GetTopicNick(void) const {
 void CChannel::SetTopicNick(const char *Nick) {
 	char *NewTopicNick;
 
-	NewTopicNick = strdup(Nick);
+	NewTopicNick = m_Arena.StrDup(Nick);
 
 	if (AllocFailed(NewTopicNick)) {
 		return;
 	}
 
-	free(m_TopicNick);
+	CArena::Free(m_TopicNick);
 	m_TopicNick = NewTopicNick;
 	m_HasTopic = 1;
 }
@@ -440,7 +444,7 @@ void CChannel::AddUser(const char *Nick, const char *ModeChars) {
 
 	m_Nicks.Remove(Nick);
 
-	NickObj = new CNick(Nick, this);
+	NickObj = new (&m_Arena) CNick(Nick, this);
 
 	if (AllocFailed(NickObj)) {
 		m_Nicks.Clear();
@@ -528,7 +532,7 @@ const CHashtable<CNick *, false> *CChannel::GetNames(void) const {
  */
 void CChannel::ClearModes(void) {
 	for (int i = 0; i < m_Modes.GetLength(); i++) {
-		free(m_Modes[i].Parameter);
+		CArena::Free(m_Modes[i].Parameter);
 	}
 
 	m_Modes.Clear();
@@ -790,3 +794,62 @@ void CChannel::EraseBacklog(void) {
 
 	m_BacklogCount = 0;
 }
+
+/**
+ * SearchBacklog
+ *
+ * Searches the backlog. Matching lines are returned newest first.
+ *
+ * @param Query the query
+ * @param Skip the number of matching lines which should be skipped
+ * @param Count the maximum number of lines to return
+ * @param Results will receive the lines (must be freed by the caller)
+ * @return whether there are more matching lines
+ */
+RESULT<bool> CChannel::SearchBacklog(const logquery_t *Query, unsigned int Skip, unsigned int Count, CVector<char *> *Results) const {
+	char strMessageTime[100];
+	unsigned int Matched = 0;
+	tm MessageTm;
+
+	/* the backlog is small enough so we don't need an index for it */
+	for (link_t<backlog_t> *Line = m_Backlog.GetTail(); Line != NULL; Line = Line->Previous) {
+		const char *NickEnd = strchr(Line->Value.Source, '!');
+		size_t NickLength = (NickEnd != NULL) ? NickEnd - Line->Value.Source : strlen(Line->Value.Source);
+		char *Out;
+		int rc;
+
+		if (!CLogIndex::MatchLine(Query, Line->Value.Source, NickLength, Line->Value.Message, Line->Value.Time)) {
+			continue;
+		}
+
+		Matched++;
+
+		if (Matched <= Skip) {
+			continue;
+		}
+
+		if ((unsigned int)Results->GetLength() >= Count) {
+			RETURN(bool, true);
+		}
+
+		MessageTm = *localtime(&(Line->Value.Time));
+
+#ifdef _WIN32
+		strftime(strMessageTime, sizeof(strMessageTime), "%#c" , &MessageTm);
+#else
+		strftime(strMessageTime, sizeof(strMessageTime), "%a %B %d %Y %H:%M:%S" , &MessageTm);
+#endif
+
+		rc = asprintf(&Out, "[%s]: <%.*s> %s", strMessageTime, (int)NickLength, Line->Value.Source, Line->Value.Message);
+
+		if (RcFailed(rc)) {
+			continue;
+		}
+
+		if (!Results->Insert(Out)) {
+			free(Out);
+		}
+	}
+
+	RETURN(bool, false);
+}
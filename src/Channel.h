@@ -53,6 +53,9 @@ int ChannelNameCompare(const void *p1, const void *p2);
  */
 class SBNCAPI CChannel : public CObject<CChannel, CIRCConnection> {
 private:
+	CArena m_Arena; /**< the channel's nicks, bans and modes; this needs to be
+						 the first member so it's destroyed last */
+
 	char *m_Name; /**< the name of the channel */
 	time_t m_Creation; /**< the time when the channel was created */
 	time_t m_Timestamp; /**< when the user joined the channel */
@@ -88,6 +91,10 @@ public:
 
 	const char *GetName(void) const;
 
+#ifndef SWIG
+	CArena *GetArena(void);
+#endif /* SWIG */
+
 	RESULT<const char *> GetChannelModes(void);
 	void ParseModeChange(const char *source, const char *modes, int pargc, const char **pargv);
 
@@ -129,6 +136,7 @@ public:
 	void AddBacklogLine(const char *Source, const char *Message);
 	void PlayBacklog(CClientConnection *Client);
 	void EraseBacklog(void);
+	RESULT<bool> SearchBacklog(const logquery_t *Query, unsigned int Skip, unsigned int Count, CVector<char *> *Results) const;
 };
 
 #endif /* CHANNEL_H */
@@ -28,8 +28,10 @@ IMPL_DNSEVENTPROXY(CClientConnection, AsyncDnsFinishedClient)
  *
  * @param Client the client socket
  * @param SSL whether to use SSL
+ * @param PeerName the client's hostname if the client has been handed off
+ *                 by another shard, or NULL
  */
-CClientConnection::CClientConnection(SOCKET Client, bool SSL) : CConnection(Client, SSL, Role_Server) {
+CClientConnection::CClientConnection(SOCKET Client, bool SSL, const char *PeerName) : CConnection(Client, SSL, Role_Server) {
 	m_Nick = NULL;
 	m_Password = NULL;
 	m_Username = NULL;
@@ -44,8 +46,14 @@ CClientConnection::CClientConnection(SOCKET Client, bool SSL) : CConnection(Clie
 	m_DestroyClientTimer = NULL;
 	m_CapabilitiesEnd = false;
 	m_Capabilities = new CHashtable<const char *, false>();
-
-	if (Client != INVALID_SOCKET) {
+	m_Playback = NULL;
+	m_HandOffShard = -1;
+	m_HandOffData = NULL;
+
+	if (Client != INVALID_SOCKET && PeerName != NULL) {
+		/* the other shard has already greeted the client and looked up its hostname */
+		m_PeerName = strdup(PeerName);
+	} else if (Client != INVALID_SOCKET) {
 		WriteLine(":shroudbnc.info NOTICE AUTH :*** shroudBNC %s - "
 			"Copyright (C) 2005-2014 Gunnar Beutner", g_Bouncer->GetBouncerVersion());
 
@@ -90,6 +98,38 @@ CClientConnection::~CClientConnection() {
 	delete m_PingTimer;
 	delete m_DestroyClientTimer;
 	delete m_Capabilities;
+	delete m_Playback;
+	delete m_HandOffData;
+}
+
+/**
+ * ParseSearchTime
+ *
+ * Parses a time specification for the "search" command. This is either
+ * a UNIX timestamp or a relative time (e.g. "12h" for 12 hours ago).
+ *
+ * @param Value the time specification
+ */
+static time_t ParseSearchTime(const char *Value) {
+	char *End;
+	long Number;
+
+	Number = strtol(Value, &End, 10);
+
+	switch (tolower(*End)) {
+		case 's':
+			return g_CurrentTime - Number;
+		case 'm':
+			return g_CurrentTime - Number * 60;
+		case 'h':
+			return g_CurrentTime - Number * 60 * 60;
+		case 'd':
+			return g_CurrentTime - Number * 60 * 60 * 24;
+		case 'w':
+			return g_CurrentTime - Number * 60 * 60 * 24 * 7;
+		default:
+			return Number;
+	}
 }
 
 /**
@@ -152,7 +192,7 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 			AddCommand(&m_CommandList, "resetpass", "Admin", "sets a user's password",
 				"Syntax: resetpass <user> <password>\nResets another user's password.");
 			AddCommand(&m_CommandList, "who", "Admin", "shows users",
-				"Syntax: who\nShows a list of all users.\nFlags (which are displayed in front of the username):\n"
+				"Syntax: who\nShows a list of all users (with multiple shards only the ones served by the same process).\nFlags (which are displayed in front of the username):\n"
 				"@ user is an admin\n* user is currently logged in\n! user is suspended");
 			AddCommand(&m_CommandList, "admin", "Admin", "gives someone admin privileges",
 				"Syntax: admin <username>\nGives admin privileges to a user.");
@@ -171,14 +211,14 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 			AddCommand(&m_CommandList, "simul", "Admin", "simulates a command on another user's connection",
 				"Syntax: simul <username> <command>\nExecutes a command in another user's context.");
 			AddCommand(&m_CommandList, "broadcast", "Admin", "sends a global notice to all bouncer users",
-				"Syntax: broadcast <text>\nSends a notice to all currently connected users.");
+				"Syntax: broadcast <text>\nSends a notice to all currently connected users (with multiple shards only the ones served by the same process).");
 			AddCommand(&m_CommandList, "kill", "Admin", "disconnects a user from the bouncer",
 				"Syntax: kill <username>\nDisconnects a user from the bouncer.");
 			AddCommand(&m_CommandList, "disconnect", "Admin", "disconnects a user from the irc server",
 				"Syntax: disconnect [username]\nDisconnects a user from the IRC server which he is currently connected to."
 				" If you don't specify a username, your own IRC connection will be closed.");
 			AddCommand(&m_CommandList, "playmainlog", "Admin", "plays the bouncer's log",
-				"Syntax: playmainlog\nDisplays the bouncer's log.");
+				"Syntax: playmainlog [first line] [count]\nDisplays the bouncer's log.");
 			AddCommand(&m_CommandList, "erasemainlog", "Admin", "erases the bouncer's log",
 				"Syntax: erasemainlog\nErases the bouncer's log.");
 			AddCommand(&m_CommandList, "globalset", "Admin", "sets global options",
@@ -187,6 +227,10 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 				"Syntax: globalunset <option>\nRestores the default value of a global option.");
 			AddCommand(&m_CommandList, "die", "Admin", "terminates the bouncer",
 				"Syntax: die\nTerminates the bouncer.");
+			AddCommand(&m_CommandList, "userdb", "Admin", "manages the user database",
+				"Syntax: userdb [save|export]\nShows information about the user database (see system.userdb). "
+				"\"save\" merges the journal into the database, \"export\" writes the users' settings to their "
+				"configuration files (users/<name>.conf).");
 			AddCommand(&m_CommandList, "addlistener", "Admin", "creates an additional listener",
 #ifdef USESSL
 				"Syntax: addlistener <port> [address] [ssl]\nCreates an additional listener which can be used by clients.");
@@ -201,9 +245,13 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 		}
 
 		AddCommand(&m_CommandList, "read", "User", "plays your message log",
-			"Syntax: read\nDisplays your private log.");
+			"Syntax: read [first line] [count]\nDisplays your private log.");
 		AddCommand(&m_CommandList, "erase", "User", "erases your message log",
 			"Syntax: erase\nErases your private log.");
+		AddCommand(&m_CommandList, "search", "User", "searches your message log",
+			"Syntax: search [-nick <nick>] [-since <time>] [-until <time>] [-channel <#channel>] [-page <page>] [words]\n"
+			"Searches your private log (or the backlog of a channel) for entries which contain all of the specified words."
+			" Times can either be UNIX timestamps or relative times like 30m, 12h or 7d.");
 		AddCommand(&m_CommandList, "set", "User", "sets configurable options for your user",
 			"Syntax: set [option] [value]\nDisplays or changes configurable options for your user.");
 		AddCommand(&m_CommandList, "unset", "User", "restores the default value of an option",
@@ -240,8 +288,10 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 			"Syntax: help [command]\nDisplays a list of commands or information about individual commands.");
 	}
 
-	for (int i = 0; i < Modules->GetLength(); i++) {
-		if ((*Modules)[i]->InterceptClientCommand(this, Subcommand, argc, argv, NoticeUser)) {
+	const CVector<CModule *> *Subscribers = g_Bouncer->GetModuleSubscribers(ModuleEvent_ClientCommand, Subcommand);
+
+	for (int i = 0; i < Subscribers->GetLength(); i++) {
+		if ((*Subscribers)[i]->InterceptClientCommand(this, Subcommand, argc, argv, NoticeUser)) {
 			latchedRetVal = false;
 		}
 	}
@@ -371,6 +421,11 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 			return false;
 		}
 
+		if (g_Bouncer->GetShardCount() > 1) {
+			SENDUSER("Modules cannot be loaded while shroudBNC is running with multiple shards.");
+			return false;
+		}
+
 		RESULT<CModule *> ModuleResult = g_Bouncer->LoadModule(argv[1]);
 
 		if (!IsError(ModuleResult)) {
@@ -398,7 +453,9 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 
 		int Index = atoi(argv[1]);
 
-		if (Index == 0 || Index > Modules->GetLength()) {
+		if (g_Bouncer->GetShardCount() > 1) {
+			SENDUSER("Modules cannot be unloaded while shroudBNC is running with multiple shards.");
+		} else if (Index == 0 || Index > Modules->GetLength()) {
 			SENDUSER("There is no such module.");
 		} else {
 			CModule *Module = (*Modules)[Index - 1];
@@ -444,6 +501,8 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 				SENDUSER(Out);
 				free(Out);
 			}
+		} else if (g_Bouncer->GetShardCount() > 1) {
+			SENDUSER("Global settings cannot be changed while shroudBNC is running with multiple shards.");
 		} else {
 			if (strcasecmp(argv[1], "defaultvhost") == 0) {
 				g_Bouncer->SetDefaultVHost(argv[2]);
@@ -585,6 +644,35 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 				SENDUSER(Out);
 				free(Out);
 			}
+
+			if (GetOwner()->GetIRCConnection() != NULL && GetOwner()->GetFloodCalibration()) {
+				rc = asprintf(&Out, "floodrate - %u bytes/s (currently %u bytes/s)", GetOwner()->GetFloodRate(),
+					GetOwner()->GetIRCConnection()->GetFloodControl()->GetRate());
+			} else {
+				rc = asprintf(&Out, "floodrate - %u bytes/s", GetOwner()->GetFloodRate());
+			}
+			if (!RcFailed(rc)) {
+				SENDUSER(Out);
+				free(Out);
+			}
+
+			rc = asprintf(&Out, "floodburst - %u bytes", GetOwner()->GetFloodBurst());
+			if (!RcFailed(rc)) {
+				SENDUSER(Out);
+				free(Out);
+			}
+
+			rc = asprintf(&Out, "floodpenalty - %u ms", GetOwner()->GetFloodPenalty());
+			if (!RcFailed(rc)) {
+				SENDUSER(Out);
+				free(Out);
+			}
+
+			rc = asprintf(&Out, "floodcalibrate - %s", GetOwner()->GetFloodCalibration() ? "On" : "Off");
+			if (!RcFailed(rc)) {
+				SENDUSER(Out);
+				free(Out);
+			}
 		} else {
 			if (strcasecmp(argv[1], "server") == 0) {
 				if (argc > 3) {
@@ -697,6 +785,36 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 				} else {
 					SENDUSER("Value must be either 'on' or 'off'.");
 
+					return false;
+				}
+			} else if (strcasecmp(argv[1], "floodrate") == 0 || strcasecmp(argv[1], "floodburst") == 0) {
+				if (atoi(argv[2]) < 0) {
+					SENDUSER("Value must not be negative.");
+
+					return false;
+				}
+
+				if (strcasecmp(argv[1], "floodrate") == 0) {
+					GetOwner()->SetFloodRate(atoi(argv[2]));
+				} else {
+					GetOwner()->SetFloodBurst(atoi(argv[2]));
+				}
+			} else if (strcasecmp(argv[1], "floodpenalty") == 0) {
+				if (atoi(argv[2]) < 0) {
+					SENDUSER("Value must not be negative.");
+
+					return false;
+				}
+
+				GetOwner()->SetFloodPenalty((argv[2][0] != '\0') ? argv[2] : NULL);
+			} else if (strcasecmp(argv[1], "floodcalibrate") == 0) {
+				if (strcasecmp(argv[2], "on") == 0) {
+					GetOwner()->SetFloodCalibration(true);
+				} else if (strcasecmp(argv[2], "off") == 0) {
+					GetOwner()->SetFloodCalibration(false);
+				} else {
+					SENDUSER("Value must be either 'on' or 'off'.");
+
 					return false;
 				}
 			} else {
@@ -802,6 +920,49 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 		g_Bouncer->Log("Shutdown requested by %s", GetOwner()->GetUsername());
 		g_Bouncer->Shutdown();
 
+		return false;
+	} else if (strcasecmp(Subcommand, "userdb") == 0 && GetOwner()->IsAdmin()) {
+		CConfigDatabase *Database = g_Bouncer->GetUserDatabase();
+
+		if (Database == NULL) {
+			SENDUSER("The user database is not enabled. Set system.userdb=1 in sbnc.conf and restart shroudBNC to enable it.");
+
+			return false;
+		}
+
+		if (argc > 1 && strcasecmp(argv[1], "save") == 0) {
+			RESULT<bool> Result = Database->Save();
+
+			if (IsError(Result)) {
+				SENDUSER(GETDESCRIPTION(Result));
+			} else {
+				SENDUSER("Done.");
+			}
+		} else if (argc > 1 && strcasecmp(argv[1], "export") == 0) {
+			RESULT<unsigned int> Result = Database->Export();
+
+			if (IsError(Result)) {
+				SENDUSER(GETDESCRIPTION(Result));
+			} else {
+				rc = asprintf(&Out, "Exported %u user(s).", (unsigned int)Result);
+
+				if (!RcFailed(rc)) {
+					SENDUSER(Out);
+					free(Out);
+				}
+			}
+		} else if (argc > 1) {
+			SENDUSER("Syntax: userdb [save|export]");
+		} else {
+			rc = asprintf(&Out, "Database: %s (%u user(s), %lu bytes, journal: %lu bytes)", Database->GetFilename(),
+				Database->GetUserCount(), (unsigned long)Database->GetSize(), (unsigned long)Database->GetJournalSize());
+
+			if (!RcFailed(rc)) {
+				SENDUSER(Out);
+				free(Out);
+			}
+		}
+
 		return false;
 	} else if (strcasecmp(Subcommand, "adduser") == 0 && GetOwner()->IsAdmin()) {
 		const char *Password;
@@ -1046,6 +1207,60 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 			free(Out);
 		}
 
+		if (GetOwner()->IsAdmin()) {
+			rc = asprintf(&Out, "DNS cache: %u entries, %u hits, %u misses, %u coalesced", CDnsQuery::GetCacheSize(),
+				CDnsQuery::GetCacheHits(), CDnsQuery::GetCacheMisses(), CDnsQuery::GetCacheCoalesced());
+			if (!RcFailed(rc)) {
+				SENDUSER(Out);
+				free(Out);
+			}
+
+#ifdef HAVE_LIBSSL
+			SSL_CTX *SSLContext = g_Bouncer->GetSSLContext();
+			SSL_CTX *SSLClientContext = g_Bouncer->GetSSLClientContext();
+
+			if (SSLContext != NULL) {
+				rc = asprintf(&Out, "SSL sessions (clients): %ld cached, %ld of %ld handshakes resumed",
+					SSL_CTX_sess_number(SSLContext), SSL_CTX_sess_hits(SSLContext), SSL_CTX_sess_accept_good(SSLContext));
+				if (!RcFailed(rc)) {
+					SENDUSER(Out);
+					free(Out);
+				}
+			}
+
+			if (SSLClientContext != NULL) {
+				rc = asprintf(&Out, "SSL sessions (IRC servers): %ld of %ld handshakes resumed",
+					SSL_CTX_sess_hits(SSLClientContext), SSL_CTX_sess_connect_good(SSLClientContext));
+				if (!RcFailed(rc)) {
+					SENDUSER(Out);
+					free(Out);
+				}
+			}
+#endif
+
+			CWorkerPool *WorkerPool = g_Bouncer->GetWorkerPool();
+
+			if (WorkerPool != NULL) {
+				rc = asprintf(&Out, "Worker threads: %d, %u jobs pending, %u completed", WorkerPool->GetThreadCount(),
+					WorkerPool->GetPendingCount(), WorkerPool->GetProcessedCount());
+				if (!RcFailed(rc)) {
+					SENDUSER(Out);
+					free(Out);
+				}
+			}
+
+			CShardChannel *ShardChannel = g_Bouncer->GetShardChannel();
+
+			if (ShardChannel != NULL) {
+				rc = asprintf(&Out, "Shard: %d of %d, %u clients handed off to this shard", g_Bouncer->GetShardIndex() + 1,
+					g_Bouncer->GetShardCount(), ShardChannel->GetReceivedCount());
+				if (!RcFailed(rc)) {
+					SENDUSER(Out);
+					free(Out);
+				}
+			}
+		}
+
 		return false;
 	} else if (strcasecmp(Subcommand, "impulse") == 0 && GetOwner()->IsAdmin()) {
 		if (argc < 2) {
@@ -1255,18 +1470,34 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 
 		return false;
 	} else if (strcasecmp(Subcommand, "read") == 0) {
-		GetOwner()->GetLog()->PlayToUser(this, NoticeUser ? Log_Notice : Log_Message);
+		logrange_t Range;
 
-		if (!GetOwner()->GetLog()->IsEmpty()) {
-			if (NoticeUser) {
-				RealNotice("End of LOG. Use '/sbnc erase' to remove this log.");
-			} else {
-				Privmsg("End of LOG. Use '/msg -sBNC erase' to remove this log.");
-			}
-		} else {
+		if (GetOwner()->GetLog()->IsEmpty()) {
 			SENDUSER("Your personal log is empty.");
+
+			return false;
+		}
+
+		if ((argc > 1 && atoi(argv[1]) < 0) || (argc > 2 && atoi(argv[2]) < 0)) {
+			SENDUSER("Value must not be negative.");
+
+			return false;
+		}
+
+		memset(&Range, 0, sizeof(Range));
+
+		if (argc > 1) {
+			Range.FirstLine = atoi(argv[1]);
+		}
+
+		if (argc > 2) {
+			Range.LineCount = atoi(argv[2]);
 		}
 
+		GetOwner()->GetLog()->PlayToUser(this, NoticeUser ? Log_Notice : Log_Message, &Range,
+			NoticeUser ? "End of LOG. Use '/sbnc erase' to remove this log." :
+			"End of LOG. Use '/msg -sBNC erase' to remove this log.");
+
 		return false;
 	} else if (strcasecmp(Subcommand, "erase") == 0) {
 		if (GetOwner()->GetLog()->IsEmpty()) {
@@ -1277,19 +1508,126 @@ bool CClientConnection::ProcessBncCommand(const char *Subcommand, int argc, cons
 		}
 
 		return false;
-	} else if (strcasecmp(Subcommand, "playmainlog") == 0 && GetOwner()->IsAdmin()) {
-		g_Bouncer->GetLog()->PlayToUser(this, NoticeUser ? Log_Notice : Log_Message);
-
-		if (!g_Bouncer->GetLog()->IsEmpty()) {
-			if (NoticeUser) {
-				RealNotice("End of LOG. Use /sbnc erasemainlog to remove this log.");
+	} else if (strcasecmp(Subcommand, "search") == 0) {
+		logquery_t Query;
+		CVector<char *> Results;
+		RESULT<bool> Result;
+		const char *ChannelName = NULL;
+		int Page = 1, i;
+
+		memset(&Query, 0, sizeof(Query));
+
+		for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+			if (strcasecmp(argv[i], "-nick") == 0) {
+				Query.Nick = argv[i + 1];
+			} else if (strcasecmp(argv[i], "-since") == 0) {
+				Query.Since = ParseSearchTime(argv[i + 1]);
+			} else if (strcasecmp(argv[i], "-until") == 0) {
+				Query.Until = ParseSearchTime(argv[i + 1]);
+			} else if (strcasecmp(argv[i], "-channel") == 0) {
+				ChannelName = argv[i + 1];
+			} else if (strcasecmp(argv[i], "-page") == 0) {
+				Page = atoi(argv[i + 1]);
 			} else {
-				Privmsg("End of LOG. Use /msg -sBNC erasemainlog to remove this log.");
+				break;
+			}
+		}
+
+		if (i < argc) {
+			ArgRejoinArray(argv, i);
+			Query.Terms = argv[i];
+		}
+
+		if (Page < 1) {
+			Page = 1;
+		}
+
+		if (ChannelName != NULL) {
+			CChannel *Channel = NULL;
+
+			if (GetOwner()->GetIRCConnection() != NULL) {
+				Channel = GetOwner()->GetIRCConnection()->GetChannel(ChannelName);
+			}
+
+			if (Channel == NULL) {
+				SENDUSER("You are not on that channel.");
+
+				return false;
+			}
+
+			Result = Channel->SearchBacklog(&Query, (Page - 1) * LOGINDEX_PAGESIZE, LOGINDEX_PAGESIZE, &Results);
+		} else {
+			Result = GetOwner()->GetLog()->Search(&Query, (Page - 1) * LOGINDEX_PAGESIZE, LOGINDEX_PAGESIZE, &Results);
+		}
+
+		if (IsError(Result)) {
+			SENDUSER(GETDESCRIPTION(Result));
+
+			return false;
+		}
+
+		for (i = 0; i < Results.GetLength(); i++) {
+			SENDUSER(Results[i]);
+			free(Results[i]);
+		}
+
+		if (ChannelName == NULL) {
+			CLogIndex *Index = GetOwner()->GetLog()->GetIndex();
+
+			if (Index != NULL && Index->GetIndexedSize() < Index->GetLogSize()) {
+				rc = asprintf(&Out, "Your log is still being indexed (%d%% done), some entries might be missing.",
+					(int)(Index->GetIndexedSize() * 100 / Index->GetLogSize()));
+
+				if (!RcFailed(rc)) {
+					SENDUSER(Out);
+					free(Out);
+				}
 			}
+		}
+
+		if (Result.GetResult()) {
+			rc = asprintf(&Out, "End of SEARCH (page %d). Use the option -page %d to see more results.", Page, Page + 1);
+		} else if (Results.GetLength() == 0 && Page == 1) {
+			rc = asprintf(&Out, "No matching entries were found.");
 		} else {
+			rc = asprintf(&Out, "End of SEARCH (page %d).", Page);
+		}
+
+		if (!RcFailed(rc)) {
+			SENDUSER(Out);
+			free(Out);
+		}
+
+		return false;
+	} else if (strcasecmp(Subcommand, "playmainlog") == 0 && GetOwner()->IsAdmin()) {
+		logrange_t Range;
+
+		if (g_Bouncer->GetLog()->IsEmpty()) {
 			SENDUSER("The main log is empty.");
+
+			return false;
+		}
+
+		if ((argc > 1 && atoi(argv[1]) < 0) || (argc > 2 && atoi(argv[2]) < 0)) {
+			SENDUSER("Value must not be negative.");
+
+			return false;
+		}
+
+		memset(&Range, 0, sizeof(Range));
+
+		if (argc > 1) {
+			Range.FirstLine = atoi(argv[1]);
+		}
+
+		if (argc > 2) {
+			Range.LineCount = atoi(argv[2]);
 		}
 
+		g_Bouncer->GetLog()->PlayToUser(this, NoticeUser ? Log_Notice : Log_Message, &Range,
+			NoticeUser ? "End of LOG. Use /sbnc erasemainlog to remove this log." :
+			"End of LOG. Use /msg -sBNC erasemainlog to remove this log.");
+
 		return false;
 	} else if (strcasecmp(Subcommand, "erasemainlog") == 0 && GetOwner()->IsAdmin()) {
 		g_Bouncer->GetLog()->Clear();
@@ -1511,7 +1849,7 @@ bool CClientConnection::ParseLineArgV(int argc, const char **argv) {
 
 	m_LastResponse = g_CurrentTime;
 
-	const CVector<CModule *> *Modules = g_Bouncer->GetModules();
+	const CVector<CModule *> *Modules = g_Bouncer->GetModuleSubscribers(ModuleEvent_ClientMessage, argv[0]);
 
 	for (int i = 0; i < Modules->GetLength(); i++) {
 		if (!(*Modules)[i]->InterceptClientMessage(this, argc, argv)) {
@@ -1536,7 +1874,7 @@ bool CClientConnection::ParseLineArgV(int argc, const char **argv) {
 
 			ValidateUser();
 			
-			if (m_Username != NULL) {
+			if (m_Username != NULL && m_HandOffShard == -1) {
 				WriteUnformattedLine(":shroudbnc.info NOTICE AUTH :*** This server requires a "
 					"password. Use /QUOTE PASS thepassword to supply a password now.");
 			}
@@ -1571,7 +1909,7 @@ bool CClientConnection::ParseLineArgV(int argc, const char **argv) {
 			if (m_Nick != NULL && m_Username != NULL) {
 				ValidSSLCert = ValidateUser();
 
-				if (!ValidSSLCert) {
+				if (!ValidSSLCert && m_HandOffShard == -1) {
 					WriteUnformattedLine(":shroudbnc.info NOTICE AUTH :*** This server requires "
 						"a password. Use /QUOTE PASS thepassword to supply a password now.");
 				}
@@ -2122,6 +2460,14 @@ void CClientConnection::ParseLine(const char *Line) {
 		return; // protocol violation
 	}
 
+	if (m_HandOffShard != -1) {
+		/* the client has sent more lines before we could hand it off */
+		m_HandOffData->Write(Line, strlen(Line));
+		m_HandOffData->Write("\r\n", 2);
+
+		return;
+	}
+
 	bool ReturnValue;
 	tokendata_t Args;
 	const char **argv, **real_argv;
@@ -2195,6 +2541,24 @@ bool CClientConnection::ValidateUser(void) {
 		free(password);
 	}
 
+	if (g_Bouncer->GetShardCount() > 1 && g_Bouncer->GetUserShard(m_Username) != g_Bouncer->GetShardIndex()) {
+		/* the user is served by another shard, HandOff() passes the connection on once
+		 * we're done with the lines the client has sent so far */
+		if (m_HandOffData == NULL) {
+			m_HandOffData = new CFIFOBuffer();
+
+			if (AllocFailed(m_HandOffData)) {
+				Kill("*** Internal error.");
+
+				return false;
+			}
+		}
+
+		m_HandOffShard = g_Bouncer->GetUserShard(m_Username);
+
+		return false;
+	}
+
 #ifdef HAVE_LIBSSL
 	int Count = 0;
 	bool MatchUsername = false;
@@ -2316,6 +2680,10 @@ void CClientConnection::SetPeerName(const char *PeerName, bool LookupFailure) {
 	m_PeerName = strdup(PeerName);
 
 	ProcessBuffer();
+
+	if (m_HandOffShard != -1) {
+		HandOff();
+	}
 }
 
 /**
@@ -2435,6 +2803,12 @@ int CClientConnection::Read(bool DontProcess) {
 		return CConnection::Read(true);
 	}
 
+	if (ReturnValue == 0 && m_HandOffShard != -1) {
+		HandOff();
+
+		return 0;
+	}
+
 	if (ReturnValue == 0 && GetRecvqSize() > 5120) {
 		Kill("RecvQ exceeded.");
 	}
@@ -2442,6 +2816,41 @@ int CClientConnection::Read(bool DontProcess) {
 	return ReturnValue;
 }
 
+/**
+ * Write
+ *
+ * Called when data can be written for this connection. Refills the sendq
+ * from the current log playback (if any) once it has drained.
+ */
+int CClientConnection::Write(void) {
+	int ReturnValue;
+
+	ReturnValue = CConnection::Write();
+
+	if (m_Playback != NULL && !m_Shutdown && GetSendqSize() < PLAYBACK_LOWWATER) {
+		if (!m_Playback->Pump()) {
+			delete m_Playback;
+			m_Playback = NULL;
+		}
+	}
+
+	return ReturnValue;
+}
+
+/**
+ * HasQueuedData
+ *
+ * Checks whether the connection has data which can be written to the
+ * socket (including data from a pending log playback).
+ */
+bool CClientConnection::HasQueuedData(void) const {
+	if (m_Playback != NULL && !m_Shutdown) {
+		return true;
+	}
+
+	return CConnection::HasQueuedData();
+}
+
 /**
  * WriteUnformattedLine
  *
@@ -2545,11 +2954,178 @@ clientdata_t CClientConnection::Hijack(void) {
 		ClientData.SSLObject = NULL;
 	}
 
+	delete m_Playback;
+	m_Playback = NULL;
+
 	m_DestroyClientTimer = new CTimer(1, false, DestroyClientTimer, this);
 
 	return ClientData;
 }
 
+/**
+ * HandOff
+ *
+ * Passes the connection on to the shard which serves the user.
+ */
+void CClientConnection::HandOff(void) {
+	clientdata_t ClientData;
+	const char *Fields[5];
+	char *Capabilities, *Message;
+	size_t Length = 0, Offset = 0;
+	int i;
+	bool Sent;
+
+	Capabilities = (char *)malloc(512);
+
+	if (AllocFailed(Capabilities)) {
+		Kill("*** Internal error.");
+
+		return;
+	}
+
+	Capabilities[0] = '\0';
+
+	i = 0;
+	while (hash_t<const char *> *CapHash = m_Capabilities->Iterate(i++)) {
+		if (Capabilities[0] != '\0') {
+			strmcat(Capabilities, " ", 512);
+		}
+
+		strmcat(Capabilities, CapHash->Value, 512);
+	}
+
+	Fields[0] = m_PeerName;
+	Fields[1] = m_Nick ? m_Nick : "";
+	Fields[2] = m_Username;
+	Fields[3] = m_Password;
+	Fields[4] = Capabilities;
+
+	for (i = 0; i < 5; i++) {
+		Length += strlen(Fields[i]) + 1;
+	}
+
+	/* the lines we haven't processed and whatever is left in the recvq */
+	Length += m_HandOffData->GetSize() + m_RecvQ->GetSize();
+
+	if (Length > SHARD_MAXHANDOFF) {
+		free(Capabilities);
+
+		Kill("*** RecvQ exceeded.");
+
+		return;
+	}
+
+	Message = (char *)malloc(Length);
+
+	if (AllocFailed(Message)) {
+		free(Capabilities);
+
+		Kill("*** Internal error.");
+
+		return;
+	}
+
+	for (i = 0; i < 5; i++) {
+		memcpy(Message + Offset, Fields[i], strlen(Fields[i]) + 1);
+		Offset += strlen(Fields[i]) + 1;
+	}
+
+	memcpy(Message + Offset, m_HandOffData->Peek(), m_HandOffData->GetSize());
+	Offset += m_HandOffData->GetSize();
+
+	memcpy(Message + Offset, m_RecvQ->Peek(), m_RecvQ->GetSize());
+
+	free(Capabilities);
+
+	/* the other shard sends its replies directly, so make sure ours come first */
+	if (m_SendQ->GetSize() > 0) {
+		send(GetSocket(), m_SendQ->Peek(), m_SendQ->GetSize(), 0);
+	}
+
+	Sent = g_Bouncer->HandOffClient(m_HandOffShard, GetSocket(), Message, Length);
+
+	free(Message);
+
+	if (!Sent) {
+		g_Bouncer->Log("Could not hand off the connection for user %s to shard %d.", m_Username, m_HandOffShard);
+
+		m_HandOffShard = -1;
+
+		Kill("*** The bouncer is busy. Please reconnect.");
+
+		return;
+	}
+
+	ClientData = Hijack();
+
+	closesocket(ClientData.Socket);
+
+	delete ClientData.RecvQ;
+	delete ClientData.SendQ;
+}
+
+/**
+ * Resume
+ *
+ * Continues the login of a client which has been handed off by another shard.
+ *
+ * @param Nick the client's nick
+ * @param Username the username
+ * @param Password the password
+ * @param Capabilities the client's capabilities (space-separated)
+ * @param Data lines which the client has sent after the login
+ * @param Length the length of the data
+ */
+void CClientConnection::Resume(const char *Nick, const char *Username, const char *Password,
+		const char *Capabilities, const char *Data, size_t Length) {
+	const char *Args;
+
+	if (Nick[0] != '\0') {
+		SetNick(Nick);
+	}
+
+	free(m_Username);
+	m_Username = strdup(Username);
+
+	free(m_Password);
+
+	/* ValidateUser() splits this again, the password itself might contain colons */
+	if (asprintf(&m_Password, "%s:%s", Username, Password) < 0) {
+		m_Password = NULL;
+	}
+
+	if (AllocFailed(m_Username) || AllocFailed(m_Password)) {
+		Kill("*** Internal error.");
+
+		return;
+	}
+
+	Args = ArgTokenize(Capabilities);
+
+	if (Args != NULL) {
+		for (int a = 0; a < ArgCount(Args); a++) {
+			for (int i = 0; i < g_Bouncer->GetCapabilities()->GetLength(); i++) {
+				const char *cap = g_Bouncer->GetCapabilities()->Get(i);
+
+				if (strcasecmp(cap, ArgGet(Args, a + 1)) == 0) {
+					m_Capabilities->Add(cap, cap);
+					break;
+				}
+			}
+		}
+
+		ArgFree(Args);
+	}
+
+	if (Length > 0) {
+		m_RecvQ->Write(Data, Length);
+	}
+
+	if (ValidateUser()) {
+		ProcessBuffer();
+	}
+}
+
 /**
  * ClientAuthTimer
  *
@@ -2704,3 +3280,22 @@ bool CClientConnection::HasCapability(const char *cap) const {
 	return m_Capabilities->Get(cap) != NULL;
 }
 
+
+/**
+ * SetPlayback
+ *
+ * Sets the log which is streamed to the client. Any previous playback
+ * is cancelled.
+ *
+ * @param Playback the playback object, or NULL
+ */
+void CClientConnection::SetPlayback(CLogPlayback *Playback) {
+	delete m_Playback;
+
+	m_Playback = Playback;
+
+	if (m_Playback != NULL && GetSendqSize() < PLAYBACK_LOWWATER && !m_Playback->Pump()) {
+		delete m_Playback;
+		m_Playback = NULL;
+	}
+}
@@ -24,6 +24,8 @@
 %template(COwnedObjectCUser) COwnedObject<class CUser>;
 #endif /* SWIGINTERFACE */
 
+class CLogPlayback;
+
 #ifndef SWIG
 bool ClientAuthTimer(time_t Now, void *Client);
 bool ClientPingTimer(time_t Now, void *ClientConnection);
@@ -62,6 +64,9 @@ private:
 	CTimer* m_DestroyClientTimer; /**< used by Hijack() to destroy the client connection */
 	bool m_CapabilitiesEnd; /**< whether the client has issues the CAP LS command */
 	CHashtable<const char *, false> *m_Capabilities; /**< IRCv3 capabilities */
+	CLogPlayback *m_Playback; /**< the log which is currently being sent to the client */
+	int m_HandOffShard; /**< the shard which this client is being handed off to, or -1 */
+	CFIFOBuffer *m_HandOffData; /**< lines which have to be processed by the other shard */
 
 #ifndef SWIG
 	friend bool ClientAuthTimer(time_t Now, void *Client);
@@ -78,15 +83,18 @@ private:
 #endif /*SWIG */
 
 	bool ValidateUser(void);
+	void HandOff(void);
 	void SetPeerName(const char *PeerName, bool LookupFailure);
 	virtual int Read(bool DontProcess = false);
+	virtual int Write(void);
+	virtual bool HasQueuedData(void) const;
 	virtual const char *GetClassName(void) const;
 	bool ParseLineArgV(int argc, const char **argv);
 	bool ProcessBncCommand(const char *Subcommand, int argc, const char **argv, bool NoticeUser);
 
 public:
 #ifndef SWIG
-	CClientConnection(SOCKET Socket, bool SSL = false);
+	CClientConnection(SOCKET Socket, bool SSL = false, const char *PeerName = NULL);
 	virtual ~CClientConnection(void);
 #endif /* SWIG */
 
@@ -102,6 +110,8 @@ public:
 	virtual commandlist_t *GetCommandList(void);
 
 	virtual clientdata_t Hijack(void);
+	void Resume(const char *Nick, const char *Username, const char *Password, const char *Capabilities,
+		const char *Data, size_t Length);
 
 	virtual void ChangeNick(const char *NewNick);
 	virtual void SetNick(const char *NewNick);
@@ -116,6 +126,8 @@ public:
 
 	virtual CHashtable<const char *, false> *GetCapabilities(void);
 	virtual bool HasCapability(const char *cap) const;
+
+	virtual void SetPlayback(CLogPlayback *Playback);
 };
 
 #ifdef SBNC
@@ -19,6 +19,11 @@
 
 #include "StdAfx.h"
 
+static CList<CConfig *> *g_DirtyConfigs = NULL; /**< configs with changes which haven't been journaled yet */
+static CTimer *g_ConfigFlushTimer = NULL; /**< writes pending changes to the journals */
+
+bool ConfigFlushTimer(time_t Now, void *Cookie);
+
 /**
  * CConfig
  *
@@ -33,6 +38,16 @@ CConfig::CConfig(const char *Filename, CUser *Owner) {
 	SetOwner(Owner);
 
 	m_WriteLock = false;
+	m_JournalFilename = NULL;
+	m_DirtyLink = NULL;
+	m_JournalSize = 0;
+	m_LastCompaction = g_CurrentTime;
+	m_Modified = false;
+	m_Database = NULL;
+	m_DatabaseKey = NULL;
+	m_Loaded = true;
+	m_ReadOnly = false;
+	m_Cache = NULL;
 
 	m_Settings.RegisterValueDestructor(FreeString);
 
@@ -42,6 +57,12 @@ CConfig::CConfig(const char *Filename, CUser *Owner) {
 		if (AllocFailed(m_Filename)) {
 			g_Bouncer->Fatal();
 		}
+
+		int rc = asprintf(&m_JournalFilename, "%s.journal", m_Filename);
+
+		if (RcFailed(rc)) {
+			g_Bouncer->Fatal();
+		}
 	} else {
 		m_Filename = NULL;
 	}
@@ -49,6 +70,67 @@ CConfig::CConfig(const char *Filename, CUser *Owner) {
 	Reload();
 }
 
+/**
+ * CConfig
+ *
+ * Constructs a new configuration object which uses a database. The settings
+ * are loaded when they're first accessed.
+ *
+ * @param Database the database
+ * @param Name the name of the settings in the database
+ */
+CConfig::CConfig(CConfigDatabase *Database, const char *Name, CUser *Owner) {
+	SetOwner(Owner);
+
+	m_Filename = NULL;
+	m_WriteLock = false;
+	m_JournalFilename = NULL;
+	m_DirtyLink = NULL;
+	m_JournalSize = 0;
+	m_LastCompaction = g_CurrentTime;
+	m_Modified = false;
+	m_Database = Database;
+	m_Loaded = false;
+	m_ReadOnly = false;
+	m_Cache = NULL;
+
+	m_Settings.RegisterValueDestructor(FreeString);
+
+	m_DatabaseKey = strdup(Name);
+
+	if (AllocFailed(m_DatabaseKey)) {
+		g_Bouncer->Fatal();
+	}
+
+	m_Database->Attach(m_DatabaseKey, this);
+}
+
+/**
+ * Load
+ *
+ * Loads the settings from the database unless that has already happened.
+ */
+void CConfig::Load(void) {
+	if (m_Loaded) {
+		return;
+	}
+
+	m_Loaded = true;
+
+	m_WriteLock = true;
+
+	if (m_Database->Load(m_DatabaseKey, &m_Settings)) {
+		/* imported settings need to be saved */
+		m_Modified = true;
+	}
+
+	m_WriteLock = false;
+
+	if (m_Cache != NULL) {
+		m_Cache->InvalidateAll();
+	}
+}
+
 /**
  * ParseConfig
  *
@@ -133,12 +215,111 @@ bool CConfig::ParseConfig(void) {
 	return true;
 }
 
+/**
+ * ReplayJournal
+ *
+ * Applies the changes from the journal. Each line of the journal
+ * has one of these formats:
+ *
+ * +setting=value
+ * -setting
+ *
+ * An incomplete last line (e.g. because we crashed while writing it) is
+ * ignored.
+ */
+bool CConfig::ReplayJournal(void) {
+	const size_t LineLength = 131072;
+	char *Line, *Eq, *dupValue;
+	FILE *JournalFile;
+	size_t Length;
+	bool Incomplete = false;
+
+	m_JournalSize = 0;
+
+	if (m_JournalFilename == NULL || (JournalFile = fopen(m_JournalFilename, "r")) == NULL) {
+		return false;
+	}
+
+	Line = (char *)malloc(LineLength);
+
+	if (AllocFailed(Line)) {
+		fclose(JournalFile);
+
+		return false;
+	}
+
+	m_WriteLock = true;
+
+	while (fgets(Line, LineLength, JournalFile) != NULL) {
+		Length = strlen(Line);
+
+		if (Length == 0 || Line[Length - 1] != '\n') {
+			Incomplete = true;
+
+			break;
+		}
+
+		m_JournalSize += Length;
+
+		Line[Length - 1] = '\0';
+
+		if (Line[0] == '+' && (Eq = strchr(Line, '=')) != NULL) {
+			*Eq = '\0';
+
+			dupValue = strdup(Eq + 1);
+
+			if (AllocFailed(dupValue)) {
+				g_Bouncer->Fatal();
+			}
+
+			if (m_Settings.Add(Line + 1, dupValue) == false) {
+				g_Bouncer->Fatal();
+			}
+		} else if (Line[0] == '-') {
+			m_Settings.Remove(Line + 1);
+		}
+	}
+
+	fclose(JournalFile);
+
+	m_WriteLock = false;
+
+	free(Line);
+
+	if (Incomplete) {
+		/* get rid of the damaged entry, new entries would be appended to it otherwise */
+		Compact();
+	}
+
+	return true;
+}
+
 /**
  * ~CConfig
  *
- * Destructs the configuration object.
+ * Destructs the configuration object. Changes which have not been written
+ * to the configuration file yet are saved.
  */
 CConfig::~CConfig() {
+	if (m_Cache != NULL) {
+		m_Cache->m_Config = NULL;
+	}
+
+	if (m_Database != NULL) {
+		if (m_DirtyLink != NULL) {
+			WriteJournal();
+		}
+
+		m_Database->Detach(m_DatabaseKey, this);
+
+		free(m_DatabaseKey);
+	} else if (m_Modified) {
+		/* objects which have only been used for reading the config must
+		 * not overwrite changes made by someone else */
+		Compact();
+	}
+
+	free(m_JournalFilename);
 	free(m_Filename);
 }
 
@@ -151,6 +332,8 @@ CConfig::~CConfig() {
  * @param Setting the configuration setting
  */
 RESULT<const char *> CConfig::ReadString(const char *Setting) const {
+	const_cast<CConfig *>(this)->Load();
+
 	const char *Value = m_Settings.Get(Setting);
 
 	if (Value != NULL && Value[0] != '\0') {
@@ -160,6 +343,29 @@ RESULT<const char *> CConfig::ReadString(const char *Setting) const {
 	}
 }
 
+/**
+ * PeekInteger
+ *
+ * Reads a configuration setting as an integer without loading the
+ * settings from the database (if possible). Returns 0 if the setting
+ * does not exist.
+ *
+ * @param Setting the configuration setting
+ */
+int CConfig::PeekInteger(const char *Setting) const {
+	const char *Value;
+
+	if (!m_Loaded && m_Database->Peek(m_DatabaseKey, Setting, &Value)) {
+		return (Value != NULL) ? atoi(Value) : 0;
+	}
+
+	const_cast<CConfig *>(this)->Load();
+
+	Value = m_Settings.Get(Setting);
+
+	return (Value != NULL) ? atoi(Value) : 0;
+}
+
 /**
  * ReadInteger
  *
@@ -169,6 +375,8 @@ RESULT<const char *> CConfig::ReadString(const char *Setting) const {
  * @param Setting the configuration setting
  */
 RESULT<int> CConfig::ReadInteger(const char *Setting) const {
+	const_cast<CConfig *>(this)->Load();
+
 	const char *Value = m_Settings.Get(Setting);
 
 	if (Value != NULL) {
@@ -197,6 +405,10 @@ RESULT<bool> CConfig::WriteString(const char *Setting, const char *Value) {
 		RETURN(bool, true);
 	}
 
+	if (m_ReadOnly) {
+		THROW(bool, Generic_Unknown, "The configuration is read-only.");
+	}
+
 	if (Value != NULL) {
 		ReturnValue = m_Settings.Add(Setting, strdup(Value));
 	} else {
@@ -205,7 +417,43 @@ RESULT<bool> CConfig::WriteString(const char *Setting, const char *Value) {
 
 	THROWIFERROR(bool, ReturnValue);
 
-	if (!m_WriteLock && IsError(Persist())) {
+	if (m_Cache != NULL) {
+		m_Cache->Invalidate(Setting);
+	}
+
+	if (m_WriteLock) {
+		RETURN(bool, true);
+	}
+
+	m_Modified = true;
+
+	/* changes are collected for a few seconds and then written to the journal */
+	if ((m_JournalFilename != NULL || m_Database != NULL) && !IsError(m_Dirty.Add(Setting, true))) {
+		if (m_DirtyLink == NULL) {
+			if (g_DirtyConfigs == NULL) {
+				g_DirtyConfigs = new CList<CConfig *>();
+
+				if (AllocFailed(g_DirtyConfigs)) {
+					g_Bouncer->Fatal();
+				}
+			}
+
+			m_DirtyLink = g_DirtyConfigs->Insert(this);
+		}
+
+		if (m_DirtyLink != NULL) {
+			if (g_ConfigFlushTimer == NULL) {
+				g_ConfigFlushTimer = new CTimer((g_Bouncer != NULL) ? g_Bouncer->GetConfigDelay() : DEFAULT_CONFIGDELAY,
+					false, ConfigFlushTimer, NULL);
+			}
+
+			if (g_ConfigFlushTimer != NULL) {
+				RETURN(bool, true);
+			}
+		}
+	}
+
+	if (IsError(Compact())) {
 		g_Bouncer->Fatal();
 	}
 
@@ -308,6 +556,145 @@ RESULT<bool> CConfig::Persist(void) const {
 	RETURN(bool, true);
 }
 
+/**
+ * WriteJournal
+ *
+ * Appends pending changes to the journal. The journal is compacted if it
+ * has become too large.
+ */
+RESULT<bool> CConfig::WriteJournal(void) {
+	RESULT<bool> Result;
+	FILE *JournalFile;
+	const char *Value;
+	int rc;
+
+	if (m_DirtyLink != NULL) {
+		g_DirtyConfigs->Remove(m_DirtyLink);
+		m_DirtyLink = NULL;
+	}
+
+	if (m_Dirty.GetLength() == 0) {
+		RETURN(bool, true);
+	}
+
+	if (m_Database != NULL) {
+		Result = m_Database->WriteJournal(m_DatabaseKey, &m_Dirty, &m_Settings);
+
+		m_Dirty.Clear();
+
+		return Result;
+	}
+
+	JournalFile = fopen(m_JournalFilename, "a");
+
+	if (JournalFile == NULL) {
+		return Compact();
+	}
+
+	SetPermissions(m_JournalFilename, S_IRUSR | S_IWUSR);
+
+	int i = 0;
+	while (hash_t<bool> *DirtyHash = m_Dirty.Iterate(i++)) {
+		Value = m_Settings.Get(DirtyHash->Name);
+
+		if (Value != NULL) {
+			rc = fprintf(JournalFile, "+%s=%s\n", DirtyHash->Name, Value);
+		} else {
+			rc = fprintf(JournalFile, "-%s\n", DirtyHash->Name);
+		}
+
+		if (rc > 0) {
+			m_JournalSize += rc;
+		}
+	}
+
+	m_Dirty.Clear();
+
+	if (fclose(JournalFile) != 0 || m_JournalSize > CONFIG_JOURNALSIZE ||
+			g_CurrentTime - m_LastCompaction >= CONFIG_COMPACTINTERVAL) {
+		return Compact();
+	}
+
+	RETURN(bool, true);
+}
+
+/**
+ * Compact
+ *
+ * Writes all settings to the configuration file and removes the journal.
+ */
+RESULT<bool> CConfig::Compact(void) {
+	RESULT<bool> Result;
+
+	if (m_DirtyLink != NULL) {
+		g_DirtyConfigs->Remove(m_DirtyLink);
+		m_DirtyLink = NULL;
+	}
+
+	m_Dirty.Clear();
+
+	if (m_Database != NULL) {
+		return m_Database->Save();
+	}
+
+	Result = Persist();
+
+	THROWIFERROR(bool, Result);
+
+	/* if we crash before the journal is gone replaying it is harmless */
+	if (m_JournalFilename != NULL && m_JournalSize > 0) {
+		unlink(m_JournalFilename);
+	}
+
+	m_JournalSize = 0;
+	m_LastCompaction = g_CurrentTime;
+	m_Modified = false;
+
+	RETURN(bool, true);
+}
+
+/**
+ * FlushAll
+ *
+ * Writes pending changes of all configuration objects to their journals.
+ */
+void CConfig::FlushAll(void) {
+	link_t<CConfig *> *Head;
+
+	if (g_ConfigFlushTimer != NULL) {
+		g_ConfigFlushTimer->Destroy();
+		g_ConfigFlushTimer = NULL;
+	}
+
+	if (g_DirtyConfigs == NULL) {
+		return;
+	}
+
+	while ((Head = g_DirtyConfigs->GetHead()) != NULL) {
+		if (IsError(Head->Value->WriteJournal()) && g_Bouncer != NULL) {
+			g_Bouncer->Log("Could not save configuration file: %s", (Head->Value->m_Database != NULL) ?
+				Head->Value->m_Database->GetFilename() : Head->Value->GetFilename());
+		}
+	}
+}
+
+/**
+ * ConfigFlushTimer
+ *
+ * Writes pending changes to the journals.
+ *
+ * @param Now the current time
+ * @param Cookie not used
+ */
+bool ConfigFlushTimer(time_t Now, void *Cookie) {
+	/* the timer is destroyed when we return */
+	g_ConfigFlushTimer = NULL;
+
+	CConfig::FlushAll();
+
+	return false;
+}
+
 /**
  * GetFilename
  *
@@ -326,6 +713,8 @@ const char *CConfig::GetFilename(void) const {
  * @param Index specifies the index of the setting which is to be returned
  */
 hash_t<char *> *CConfig::Iterate(int Index) const {
+	const_cast<CConfig *>(this)->Load();
+
 	return m_Settings.Iterate(Index);
 }
 
@@ -335,10 +724,25 @@ hash_t<char *> *CConfig::Iterate(int Index) const {
  * Reloads all settings from disk.
  */
 void CConfig::Reload(void) {
+	/* pending changes would be lost otherwise */
+	if (m_DirtyLink != NULL) {
+		WriteJournal();
+	}
+
+	/* the database doesn't change behind our back */
+	if (m_Database != NULL) {
+		return;
+	}
+
 	m_Settings.Clear();
 
 	if (m_Filename != NULL) {
 		ParseConfig();
+		ReplayJournal();
+	}
+
+	if (m_Cache != NULL) {
+		m_Cache->InvalidateAll();
 	}
 }
 
@@ -348,6 +752,8 @@ void CConfig::Reload(void) {
  * Returns the number of items in the config.
  */
 unsigned int CConfig::GetLength(void) const {
+	const_cast<CConfig *>(this)->Load();
+
 	return m_Settings.GetLength();
 }
 
@@ -358,18 +764,32 @@ unsigned int CConfig::GetLength(void) const {
  * Returns the hashtable which is used for caching the settings.
  */
 CHashtable<char *, false> *CConfig::GetInnerHashtable(void) {
+	Load();
+
 	return &m_Settings;
 }
 
 /**
  * CanUseCache
  *
- * Checks whether a cached version of this Setting can be used.
+ * Checks whether a cached version of this Setting can be used. This is
+ * always the case because caches are invalidated when settings are changed.
  */
 bool CConfig::CanUseCache(void) {
 	return true;
 }
 
+/**
+ * SetReadOnly
+ *
+ * Specifies whether changes to the settings are rejected.
+ *
+ * @param ReadOnly whether the settings are read-only
+ */
+void CConfig::SetReadOnly(bool ReadOnly) {
+	m_ReadOnly = ReadOnly;
+}
+
 /**
  * Destroy
  *
@@ -20,10 +20,27 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+/** The default number of seconds changes are buffered before they're written to the journal */
+#define DEFAULT_CONFIGDELAY 5
+
+/** A config's journal is compacted when it grows beyond this many bytes */
+#define CONFIG_JOURNALSIZE (16 * 1024)
+
+/** A config's journal is compacted at least this often (in seconds) while changes are made */
+#define CONFIG_COMPACTINTERVAL (60 * 60)
+
+class CConfigDatabase;
+class CCache;
+
 /**
  * CConfig
  *
- * Represents a shroudBNC configuration file
+ * Represents a shroudBNC configuration file. Changes are buffered for a
+ * short time (see CCore::GetConfigDelay()) and then appended to a journal
+ * (<filename>.journal), which is merged into the configuration file when it
+ * gets too large and when the object is destroyed. Configuration objects
+ * can also be backed by a CConfigDatabase, in which case the settings are
+ * loaded when they're first accessed.
  */
 class SBNCAPI CConfig : public CObject<CConfig, CUser> {
 private:
@@ -33,12 +50,36 @@ private:
 	bool m_WriteLock; /**< marks whether the configuration file should be
 						   updated when settings are added/removed */
 
+	char *m_JournalFilename; /**< the filename of the journal */
+	CHashtable<bool, false> m_Dirty; /**< settings which haven't been journaled yet */
+	link_t<CConfig *> *m_DirtyLink; /**< link in the list of configs with pending changes */
+	size_t m_JournalSize; /**< the size of the journal */
+	time_t m_LastCompaction; /**< when the journal was last compacted */
+	bool m_Modified; /**< whether settings have been changed using this object */
+
+	CConfigDatabase *m_Database; /**< the database which contains the settings, or NULL */
+	char *m_DatabaseKey; /**< the name of the settings in the database */
+	bool m_Loaded; /**< whether the settings have been loaded */
+	bool m_ReadOnly; /**< whether changes are rejected */
+
+	CCache *m_Cache; /**< the cache for this object's settings, or NULL */
+
+	void Load(void);
+
 	bool ParseConfig(void);
+	bool ReplayJournal(void);
 	RESULT<bool> Persist(void) const;
+	RESULT<bool> WriteJournal(void);
+	RESULT<bool> Compact(void);
+
+	friend bool ConfigFlushTimer(time_t Now, void *Cookie);
+	friend class CConfigDatabase;
+	friend class CCache;
 
 public:
 #ifndef SWIG
 	CConfig(const char *Filename, CUser *Owner);
+	CConfig(CConfigDatabase *Database, const char *Name, CUser *Owner);
 	virtual ~CConfig(void);
 #endif /* SWIG */
 
@@ -47,6 +88,8 @@ public:
 	virtual RESULT<int> ReadInteger(const char *Setting) const;
 	virtual RESULT<const char *> ReadString(const char *Setting) const;
 
+	int PeekInteger(const char *Setting) const;
+
 	virtual RESULT<bool> WriteInteger(const char *Setting, const int Value);
 	virtual RESULT<bool> WriteString(const char *Setting, const char *Value);
 
@@ -59,6 +102,10 @@ public:
 	virtual unsigned int GetLength(void) const;
 
 	virtual bool CanUseCache(void);
+
+	void SetReadOnly(bool ReadOnly);
+
+	static void FlushAll(void);
 };
 
 #endif /* CONFIG_H */
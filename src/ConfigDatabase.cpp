@@ -0,0 +1,1175 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "StdAfx.h"
+
+/**
+ * Checksum
+ *
+ * Updates a FNV-1a checksum.
+ *
+ * @param Checksum the previous checksum
+ * @param Data the data
+ * @param Length the length of the data
+ */
+static uint32_t Checksum(uint32_t Checksum, const void *Data, size_t Length) {
+	const unsigned char *Bytes = (const unsigned char *)Data;
+
+	for (size_t i = 0; i < Length; i++) {
+		Checksum ^= Bytes[i];
+		Checksum *= 16777619;
+	}
+
+	return Checksum;
+}
+
+/**
+ * EntryCompare
+ *
+ * Compares two database entries (by the users' names).
+ */
+static int EntryCompare(const void *p1, const void *p2) {
+	const configdbentry_t *Entry1 = (const configdbentry_t *)p1, *Entry2 = (const configdbentry_t *)p2;
+
+	return strcasecmp(Entry1->Name, Entry2->Name);
+}
+
+/**
+ * DestroySettings
+ *
+ * Destroys a hashtable of settings.
+ *
+ * @param Settings the settings
+ */
+static void DestroySettings(CHashtable<char *, false> *Settings) {
+	delete Settings;
+}
+
+/**
+ * CConfigDatabase
+ *
+ * Opens a user database. Changes which were journaled but not saved yet
+ * (e.g. because shroudBNC crashed) are merged into the database.
+ *
+ * @param Filename the filename of the database, relative to the config directory
+ */
+CConfigDatabase::CConfigDatabase(const char *Filename) {
+	m_Data = NULL;
+	m_Size = 0;
+	m_Header = NULL;
+	m_Users = NULL;
+	m_Journal = NULL;
+	m_JournalSize = 0;
+	m_LastSave = g_CurrentTime;
+	m_Modified = false;
+	m_Imported = 0;
+
+	m_Records.RegisterValueDestructor(FreeRecord);
+
+	m_Filename = strdup(g_Bouncer->BuildPathConfig(Filename));
+
+	if (AllocFailed(m_Filename)) {
+		g_Bouncer->Fatal();
+	}
+
+	int rc = asprintf(&m_JournalFilename, "%s.journal", m_Filename);
+
+	if (RcFailed(rc)) {
+		g_Bouncer->Fatal();
+	}
+
+	if (!Map()) {
+		g_Bouncer->Log("The user database (%s) is damaged. Restore it from a backup or remove "
+			"it to import the users' configuration files again.", m_Filename);
+
+		g_Bouncer->Fatal();
+	}
+
+	if (ReplayJournal()) {
+		RESULT<bool> Result = Save();
+
+		if (IsError(Result)) {
+			g_Bouncer->Log("Could not save the user database: %s", GETDESCRIPTION(Result));
+		}
+	}
+}
+
+/**
+ * ~CConfigDatabase
+ *
+ * Saves changes and closes the database.
+ */
+CConfigDatabase::~CConfigDatabase(void) {
+	if (m_Modified) {
+		RESULT<bool> Result = Save();
+
+		if (IsError(Result)) {
+			g_Bouncer->Log("Could not save the user database: %s", GETDESCRIPTION(Result));
+		}
+	}
+
+	if (m_Journal != NULL) {
+		fclose(m_Journal);
+	}
+
+	Unmap();
+
+	free(m_JournalFilename);
+	free(m_Filename);
+}
+
+/**
+ * Map
+ *
+ * Maps the database file into memory and verifies it. A missing database
+ * is treated like an empty one.
+ */
+bool CConfigDatabase::Map(void) {
+	struct stat StatBuf;
+
+	if (stat(m_Filename, &StatBuf) < 0 || StatBuf.st_size == 0) {
+		return true;
+	}
+
+	if ((uint64_t)StatBuf.st_size < sizeof(configdbheader_t) || (uint64_t)StatBuf.st_size > 0xFFFFFFFFu) {
+		return false;
+	}
+
+	m_Size = StatBuf.st_size;
+
+#ifndef _WIN32
+	int fd = open(m_Filename, O_RDONLY);
+
+	if (fd < 0) {
+		m_Size = 0;
+
+		return false;
+	}
+
+	void *Data = mmap(NULL, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (Data == MAP_FAILED) {
+		m_Size = 0;
+
+		return false;
+	}
+
+	m_Data = (char *)Data;
+#else /* _WIN32 */
+	FILE *DatabaseFile = fopen(m_Filename, "rb");
+
+	if (DatabaseFile == NULL) {
+		m_Size = 0;
+
+		return false;
+	}
+
+	m_Data = (char *)malloc(m_Size);
+
+	if (AllocFailed(m_Data) || fread(m_Data, 1, m_Size, DatabaseFile) != m_Size) {
+		fclose(DatabaseFile);
+
+		Unmap();
+
+		return false;
+	}
+
+	fclose(DatabaseFile);
+#endif /* _WIN32 */
+
+	m_Header = (const configdbheader_t *)m_Data;
+	m_Users = (const configdbuser_t *)(m_Data + sizeof(configdbheader_t));
+
+	if (m_Header->Magic != CONFIGDB_MAGIC || m_Header->Version != CONFIGDB_VERSION ||
+			m_Header->Size != m_Size || (uint64_t)m_Header->UserCount * sizeof(configdbuser_t) >
+			m_Size - sizeof(configdbheader_t)) {
+		Unmap();
+
+		return false;
+	}
+
+	if (Checksum(2166136261u, m_Data + sizeof(configdbheader_t), m_Size - sizeof(configdbheader_t)) != m_Header->Checksum) {
+		Unmap();
+
+		return false;
+	}
+
+	for (unsigned int i = 0; i < m_Header->UserCount; i++) {
+		const configdbuser_t *User = &m_Users[i];
+
+		if (User->NameOffset >= m_Size || memchr(m_Data + User->NameOffset, '\0', m_Size - User->NameOffset) == NULL ||
+				(uint64_t)User->RecordOffset + User->RecordLength > m_Size ||
+				(User->RecordLength > 0 && m_Data[User->RecordOffset + User->RecordLength - 1] != '\0') ||
+				(i > 0 && strcasecmp(m_Data + m_Users[i - 1].NameOffset, m_Data + User->NameOffset) >= 0)) {
+			Unmap();
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Unmap
+ *
+ * Unmaps the database file.
+ */
+void CConfigDatabase::Unmap(void) {
+	if (m_Data != NULL) {
+#ifndef _WIN32
+		munmap(m_Data, m_Size);
+#else /* _WIN32 */
+		free(m_Data);
+#endif /* _WIN32 */
+	}
+
+	m_Data = NULL;
+	m_Size = 0;
+	m_Header = NULL;
+	m_Users = NULL;
+}
+
+/**
+ * FindUser
+ *
+ * Returns the index of a user in the user table, or -1 if the user is not
+ * in the database file.
+ *
+ * @param Name the name of the user
+ */
+int CConfigDatabase::FindUser(const char *Name) const {
+	int Low = 0, High, Middle, Result;
+
+	if (m_Header == NULL) {
+		return -1;
+	}
+
+	High = (int)m_Header->UserCount - 1;
+
+	while (Low <= High) {
+		Middle = Low + (High - Low) / 2;
+		Result = strcasecmp(Name, m_Data + m_Users[Middle].NameOffset);
+
+		if (Result == 0) {
+			return Middle;
+		} else if (Result < 0) {
+			High = Middle - 1;
+		} else {
+			Low = Middle + 1;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * ReplayJournal
+ *
+ * Reads the journal. Each line of the journal has one of these formats:
+ *
+ * +user setting=value
+ * -user setting
+ * *user
+ *
+ * The last format is used for users who have been removed. An incomplete
+ * last line is ignored. Returns true if there were any changes.
+ */
+bool CConfigDatabase::ReplayJournal(void) {
+	const size_t LineLength = 131072;
+	CHashtable<CHashtable<char *, false> *, false> Users;
+	CHashtable<char *, false> *Settings;
+	char *Line, *Setting, *Eq, *dupValue;
+	FILE *JournalFile;
+	size_t Length;
+	int Index;
+
+	if ((JournalFile = fopen(m_JournalFilename, "r")) == NULL) {
+		return false;
+	}
+
+	Line = (char *)malloc(LineLength);
+
+	if (AllocFailed(Line)) {
+		g_Bouncer->Fatal();
+	}
+
+	Users.RegisterValueDestructor(DestroySettings);
+
+	while (fgets(Line, LineLength, JournalFile) != NULL) {
+		Length = strlen(Line);
+
+		if (Length == 0 || Line[Length - 1] != '\n') {
+			break;
+		}
+
+		Line[Length - 1] = '\0';
+
+		Setting = strchr(Line + 1, ' ');
+
+		if (Setting != NULL) {
+			*Setting = '\0';
+			Setting++;
+		}
+
+		if (Line[0] == '*') {
+			Users.Remove(Line + 1);
+			m_Records.Remove(Line + 1);
+			m_Removed.Add(Line + 1, true);
+
+			continue;
+		}
+
+		if (Setting == NULL) {
+			continue;
+		}
+
+		Settings = Users.Get(Line + 1);
+
+		if (Settings == NULL) {
+			Settings = new CHashtable<char *, false>();
+
+			if (AllocFailed(Settings)) {
+				g_Bouncer->Fatal();
+			}
+
+			Settings->RegisterValueDestructor(FreeString);
+
+			if (!m_Removed.Get(Line + 1) && (Index = FindUser(Line + 1)) != -1) {
+				Deserialize(m_Data + m_Users[Index].RecordOffset, m_Users[Index].RecordLength, Settings);
+			}
+
+			if (IsError(Users.Add(Line + 1, Settings))) {
+				g_Bouncer->Fatal();
+			}
+		}
+
+		if (Line[0] == '+' && (Eq = strchr(Setting, '=')) != NULL) {
+			*Eq = '\0';
+
+			dupValue = strdup(Eq + 1);
+
+			if (AllocFailed(dupValue) || IsError(Settings->Add(Setting, dupValue))) {
+				g_Bouncer->Fatal();
+			}
+		} else if (Line[0] == '-') {
+			Settings->Remove(Setting);
+		}
+
+		m_Modified = true;
+	}
+
+	fclose(JournalFile);
+	free(Line);
+
+	int i = 0;
+	while (hash_t<CHashtable<char *, false> *> *UserHash = Users.Iterate(i++)) {
+		configdbrecord_t *Record = Serialize(UserHash->Value);
+
+		if (Record == NULL || IsError(m_Records.Add(UserHash->Name, Record))) {
+			g_Bouncer->Fatal();
+		}
+
+		m_Removed.Remove(UserHash->Name);
+	}
+
+	if (m_Removed.GetLength() > 0) {
+		m_Modified = true;
+	}
+
+	return m_Modified;
+}
+
+/**
+ * Serialize
+ *
+ * Creates a record for the specified settings.
+ *
+ * @param Settings the settings
+ */
+configdbrecord_t *CConfigDatabase::Serialize(const CHashtable<char *, false> *Settings) {
+	configdbrecord_t *Record;
+	size_t NameLength, ValueLength;
+	int i;
+
+	Record = (configdbrecord_t *)malloc(sizeof(configdbrecord_t));
+
+	if (AllocFailed(Record)) {
+		return NULL;
+	}
+
+	Record->Length = 0;
+	Record->Count = 0;
+
+	i = 0;
+	while (hash_t<char *> *SettingHash = Settings->Iterate(i++)) {
+		if (SettingHash->Value != NULL) {
+			Record->Length += strlen(SettingHash->Name) + strlen(SettingHash->Value) + 2;
+		}
+	}
+
+	Record->Data = (char *)malloc(Record->Length > 0 ? Record->Length : 1);
+
+	if (AllocFailed(Record->Data)) {
+		free(Record);
+
+		return NULL;
+	}
+
+	char *Cursor = Record->Data;
+
+	i = 0;
+	while (hash_t<char *> *SettingHash = Settings->Iterate(i++)) {
+		if (SettingHash->Value == NULL) {
+			continue;
+		}
+
+		NameLength = strlen(SettingHash->Name) + 1;
+		ValueLength = strlen(SettingHash->Value) + 1;
+
+		memcpy(Cursor, SettingHash->Name, NameLength);
+		memcpy(Cursor + NameLength, SettingHash->Value, ValueLength);
+
+		Cursor += NameLength + ValueLength;
+		Record->Count++;
+	}
+
+	return Record;
+}
+
+/**
+ * Deserialize
+ *
+ * Adds the settings from a record to a hashtable.
+ *
+ * @param Data the record
+ * @param Length the length of the record
+ * @param Settings the hashtable
+ */
+bool CConfigDatabase::Deserialize(const char *Data, size_t Length, CHashtable<char *, false> *Settings) {
+	const char *End = Data + Length;
+	const char *Value;
+	char *dupValue;
+
+	/* records always end with a '\0' (which is checked when the database is mapped) */
+	while (Data < End) {
+		Value = Data + strlen(Data) + 1;
+
+		if (Value >= End) {
+			return false;
+		}
+
+		dupValue = strdup(Value);
+
+		if (AllocFailed(dupValue)) {
+			return false;
+		}
+
+		if (IsError(Settings->Add(Data, dupValue))) {
+			return false;
+		}
+
+		Data = Value + strlen(Value) + 1;
+	}
+
+	return true;
+}
+
+/**
+ * FindSetting
+ *
+ * Looks up a single setting in a record. Returns NULL if the record
+ * doesn't contain the setting.
+ *
+ * @param Data the record
+ * @param Length the length of the record
+ * @param Setting the name of the setting
+ */
+const char *CConfigDatabase::FindSetting(const char *Data, size_t Length, const char *Setting) {
+	const char *End = Data + Length;
+	const char *Value;
+
+	while (Data < End) {
+		Value = Data + strlen(Data) + 1;
+
+		if (Value >= End) {
+			return NULL;
+		}
+
+		if (strcasecmp(Data, Setting) == 0) {
+			return Value;
+		}
+
+		Data = Value + strlen(Value) + 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * FreeRecord
+ *
+ * Frees a record.
+ *
+ * @param Record the record
+ */
+void CConfigDatabase::FreeRecord(configdbrecord_t *Record) {
+	if (Record != NULL) {
+		free(Record->Data);
+		free(Record);
+	}
+}
+
+/**
+ * Attach
+ *
+ * Registers a configuration object which uses the database.
+ *
+ * @param Name the name of the user
+ * @param Config the configuration object
+ */
+void CConfigDatabase::Attach(const char *Name, CConfig *Config) {
+	m_Configs.Add(Name, Config);
+}
+
+/**
+ * Detach
+ *
+ * Unregisters a configuration object. Changes which have been made using
+ * the object are kept until the database is saved.
+ *
+ * @param Name the name of the user
+ * @param Config the configuration object
+ */
+void CConfigDatabase::Detach(const char *Name, CConfig *Config) {
+	configdbrecord_t *Record;
+
+	if (m_Configs.Get(Name) != Config) {
+		return;
+	}
+
+	m_Configs.Remove(Name);
+
+	if (Config->m_Loaded && Config->m_Modified) {
+		Record = Serialize(&Config->m_Settings);
+
+		if (Record == NULL || IsError(m_Records.Add(Name, Record))) {
+			g_Bouncer->Log("Could not save the settings for user %s.", Name);
+
+			FreeRecord(Record);
+
+			return;
+		}
+
+		m_Modified = true;
+	}
+}
+
+/**
+ * Load
+ *
+ * Loads a user's settings. Users who are not in the database yet are
+ * imported from their configuration file (users/<name>.conf).
+ *
+ * @param Name the name of the user
+ * @param Settings the hashtable which will contain the user's settings
+ * @return true if the settings were imported
+ */
+bool CConfigDatabase::Load(const char *Name, CHashtable<char *, false> *Settings) {
+	configdbrecord_t *Record;
+	CConfig *TextConfig;
+	char *Filename, *dupValue;
+	int Index;
+
+	if ((Record = m_Records.Get(Name)) != NULL) {
+		Deserialize(Record->Data, Record->Length, Settings);
+
+		return false;
+	}
+
+	if (m_Removed.Get(Name)) {
+		return false;
+	}
+
+	if ((Index = FindUser(Name)) != -1) {
+		Deserialize(m_Data + m_Users[Index].RecordOffset, m_Users[Index].RecordLength, Settings);
+
+		return false;
+	}
+
+	int rc = asprintf(&Filename, "users/%s.conf", Name);
+
+	if (RcFailed(rc)) {
+		g_Bouncer->Fatal();
+	}
+
+	TextConfig = new CConfig(Filename, NULL);
+
+	free(Filename);
+
+	if (AllocFailed(TextConfig)) {
+		g_Bouncer->Fatal();
+	}
+
+	if (TextConfig->GetLength() == 0) {
+		TextConfig->Destroy();
+
+		return false;
+	}
+
+	int i = 0;
+	while (hash_t<char *> *SettingHash = TextConfig->Iterate(i++)) {
+		dupValue = strdup(SettingHash->Value);
+
+		if (AllocFailed(dupValue) || IsError(Settings->Add(SettingHash->Name, dupValue))) {
+			g_Bouncer->Fatal();
+		}
+	}
+
+	TextConfig->Destroy();
+
+	m_Imported++;
+	m_Modified = true;
+
+	return true;
+}
+
+/**
+ * Peek
+ *
+ * Reads a single setting without loading the user's settings. Returns
+ * false if the user still needs to be imported, in which case only
+ * Load() can tell.
+ *
+ * @param Name the name of the user
+ * @param Setting the name of the setting
+ * @param Value will contain the value, or NULL if the setting doesn't exist
+ */
+bool CConfigDatabase::Peek(const char *Name, const char *Setting, const char **Value) const {
+	configdbrecord_t *Record;
+	int Index;
+
+	*Value = NULL;
+
+	if ((Record = m_Records.Get(Name)) != NULL) {
+		*Value = FindSetting(Record->Data, Record->Length, Setting);
+
+		return true;
+	}
+
+	if (m_Removed.Get(Name)) {
+		return true;
+	}
+
+	if ((Index = FindUser(Name)) != -1) {
+		*Value = FindSetting(m_Data + m_Users[Index].RecordOffset, m_Users[Index].RecordLength, Setting);
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * WriteJournal
+ *
+ * Appends a user's changes to the journal. The database is saved if the
+ * journal has become too large.
+ *
+ * @param Name the name of the user
+ * @param Dirty the names of the settings which have been changed
+ * @param Settings the user's settings
+ */
+RESULT<bool> CConfigDatabase::WriteJournal(const char *Name, const CHashtable<bool, false> *Dirty,
+		const CHashtable<char *, false> *Settings) {
+	const char *Value;
+	int rc;
+
+	m_Modified = true;
+
+	if (m_Journal == NULL) {
+		m_Journal = fopen(m_JournalFilename, "a");
+
+		if (m_Journal == NULL) {
+			return Save();
+		}
+
+		SetPermissions(m_JournalFilename, S_IRUSR | S_IWUSR);
+	}
+
+	int i = 0;
+	while (hash_t<bool> *DirtyHash = Dirty->Iterate(i++)) {
+		Value = Settings->Get(DirtyHash->Name);
+
+		if (Value != NULL) {
+			rc = fprintf(m_Journal, "+%s %s=%s\n", Name, DirtyHash->Name, Value);
+		} else {
+			rc = fprintf(m_Journal, "-%s %s\n", Name, DirtyHash->Name);
+		}
+
+		if (rc > 0) {
+			m_JournalSize += rc;
+		}
+	}
+
+	if (fflush(m_Journal) != 0 || ferror(m_Journal) || m_JournalSize > CONFIGDB_JOURNALSIZE ||
+			g_CurrentTime - m_LastSave >= CONFIG_COMPACTINTERVAL) {
+		return Save();
+	}
+
+	RETURN(bool, true);
+}
+
+/**
+ * RemoveUser
+ *
+ * Removes a user's settings from the database.
+ *
+ * @param Name the name of the user
+ */
+void CConfigDatabase::RemoveUser(const char *Name) {
+	m_Records.Remove(Name);
+	m_Removed.Add(Name, true);
+	m_Modified = true;
+
+	if (m_Journal == NULL) {
+		m_Journal = fopen(m_JournalFilename, "a");
+	}
+
+	if (m_Journal != NULL) {
+		int rc = fprintf(m_Journal, "*%s\n", Name);
+
+		if (rc > 0) {
+			m_JournalSize += rc;
+		}
+
+		fflush(m_Journal);
+	}
+}
+
+/**
+ * GetEntries
+ *
+ * Collects the current records of all users, sorted by their names.
+ *
+ * @param Entries the vector which will contain the entries
+ */
+bool CConfigDatabase::GetEntries(CVector<configdbentry_t> *Entries) const {
+	configdbentry_t Entry;
+	configdbrecord_t *Record;
+	CConfig *Config;
+	unsigned int i;
+
+	for (i = 0; m_Header != NULL && i < m_Header->UserCount; i++) {
+		Entry.Name = m_Data + m_Users[i].NameOffset;
+
+		if (m_Removed.Get(Entry.Name) || m_Records.Get(Entry.Name) != NULL) {
+			continue;
+		}
+
+		Config = m_Configs.Get(Entry.Name);
+
+		if (Config != NULL && Config->m_Loaded && Config->m_Modified) {
+			continue;
+		}
+
+		Entry.Data = m_Data + m_Users[i].RecordOffset;
+		Entry.Length = m_Users[i].RecordLength;
+		Entry.Count = m_Users[i].SettingCount;
+		Entry.Free = false;
+
+		if (IsError(Entries->Insert(Entry))) {
+			return false;
+		}
+	}
+
+	i = 0;
+	while (hash_t<configdbrecord_t *> *RecordHash = m_Records.Iterate(i++)) {
+		Config = m_Configs.Get(RecordHash->Name);
+
+		if (Config != NULL && Config->m_Loaded && Config->m_Modified) {
+			continue;
+		}
+
+		Entry.Name = RecordHash->Name;
+		Entry.Data = RecordHash->Value->Data;
+		Entry.Length = RecordHash->Value->Length;
+		Entry.Count = RecordHash->Value->Count;
+		Entry.Free = false;
+
+		if (IsError(Entries->Insert(Entry))) {
+			return false;
+		}
+	}
+
+	i = 0;
+	while (hash_t<CConfig *> *ConfigHash = m_Configs.Iterate(i++)) {
+		Config = ConfigHash->Value;
+
+		if (!Config->m_Loaded || !Config->m_Modified) {
+			continue;
+		}
+
+		Record = Serialize(&Config->m_Settings);
+
+		if (Record == NULL) {
+			return false;
+		}
+
+		Entry.Name = ConfigHash->Name;
+		Entry.Data = Record->Data;
+		Entry.Length = Record->Length;
+		Entry.Count = Record->Count;
+		Entry.Free = true;
+
+		free(Record);
+
+		if (IsError(Entries->Insert(Entry))) {
+			free(const_cast<char *>(Entry.Data));
+
+			return false;
+		}
+	}
+
+	qsort(Entries->GetList(), Entries->GetLength(), sizeof(configdbentry_t), EntryCompare);
+
+	return true;
+}
+
+/**
+ * FreeEntries
+ *
+ * Frees the entries which were returned by GetEntries().
+ *
+ * @param Entries the entries
+ */
+void CConfigDatabase::FreeEntries(CVector<configdbentry_t> *Entries) {
+	for (int i = 0; i < Entries->GetLength(); i++) {
+		if ((*Entries)[i].Free) {
+			free(const_cast<char *>((*Entries)[i].Data));
+		}
+	}
+
+	Entries->Clear();
+}
+
+/**
+ * Save
+ *
+ * Writes all users' settings to the database file and removes the journal.
+ */
+RESULT<bool> CConfigDatabase::Save(void) {
+	CVector<configdbentry_t> Entries;
+	configdbheader_t Header;
+	configdbuser_t *Users;
+	char *Filename;
+	FILE *DatabaseFile;
+	uint64_t Offset;
+	int i, Count;
+	bool Failed = false;
+
+	if (!GetEntries(&Entries)) {
+		FreeEntries(&Entries);
+
+		THROW(bool, Generic_OutOfMemory, "Could not collect the users' settings.");
+	}
+
+	Count = Entries.GetLength();
+
+	Users = (configdbuser_t *)malloc(Count * sizeof(configdbuser_t) + 1);
+
+	if (AllocFailed(Users)) {
+		FreeEntries(&Entries);
+
+		THROW(bool, Generic_OutOfMemory, "malloc() failed.");
+	}
+
+	Offset = sizeof(configdbheader_t) + Count * sizeof(configdbuser_t);
+
+	for (i = 0; i < Count; i++) {
+		Users[i].NameOffset = (uint32_t)Offset;
+		Offset += strlen(Entries[i].Name) + 1;
+	}
+
+	for (i = 0; i < Count; i++) {
+		Users[i].RecordOffset = (uint32_t)Offset;
+		Users[i].RecordLength = (uint32_t)Entries[i].Length;
+		Users[i].SettingCount = Entries[i].Count;
+		Offset += Entries[i].Length;
+	}
+
+	if (Offset > 0xFFFFFFFFu) {
+		free(Users);
+		FreeEntries(&Entries);
+
+		THROW(bool, Generic_Unknown, "The user database is too large.");
+	}
+
+	int rc = asprintf(&Filename, "%s.tmp", m_Filename);
+
+	if (RcFailed(rc)) {
+		free(Users);
+		FreeEntries(&Entries);
+
+		THROW(bool, Generic_OutOfMemory, "asprintf() failed.");
+	}
+
+	DatabaseFile = fopen(Filename, "wb");
+
+	if (DatabaseFile == NULL) {
+		free(Filename);
+		free(Users);
+		FreeEntries(&Entries);
+
+		THROW(bool, Generic_Unknown, "Could not open the user database.");
+	}
+
+	SetPermissions(Filename, S_IRUSR | S_IWUSR);
+
+	memset(&Header, 0, sizeof(Header));
+	Header.Magic = CONFIGDB_MAGIC;
+	Header.Version = CONFIGDB_VERSION;
+	Header.UserCount = Count;
+	Header.Size = Offset;
+	Header.Checksum = Checksum(2166136261u, Users, Count * sizeof(configdbuser_t));
+
+	for (i = 0; i < Count; i++) {
+		Header.Checksum = Checksum(Header.Checksum, Entries[i].Name, strlen(Entries[i].Name) + 1);
+	}
+
+	for (i = 0; i < Count; i++) {
+		Header.Checksum = Checksum(Header.Checksum, Entries[i].Data, Entries[i].Length);
+	}
+
+	if (fwrite(&Header, sizeof(Header), 1, DatabaseFile) != 1 ||
+			(Count > 0 && fwrite(Users, sizeof(configdbuser_t), Count, DatabaseFile) != (size_t)Count)) {
+		Failed = true;
+	}
+
+	for (i = 0; i < Count && !Failed; i++) {
+		if (fwrite(Entries[i].Name, strlen(Entries[i].Name) + 1, 1, DatabaseFile) != 1) {
+			Failed = true;
+		}
+	}
+
+	for (i = 0; i < Count && !Failed; i++) {
+		if (Entries[i].Length > 0 && fwrite(Entries[i].Data, Entries[i].Length, 1, DatabaseFile) != 1) {
+			Failed = true;
+		}
+	}
+
+	free(Users);
+	FreeEntries(&Entries);
+
+	if (fclose(DatabaseFile) != 0 || Failed) {
+		unlink(Filename);
+		free(Filename);
+
+		THROW(bool, Generic_Unknown, "Could not write the user database.");
+	}
+
+	Unmap();
+
+#ifdef _WIN32
+	unlink(m_Filename);
+#endif
+
+	rc = rename(Filename, m_Filename);
+
+	free(Filename);
+
+	if (RcFailed(rc) || !Map()) {
+		g_Bouncer->Log("Could not replace the user database (%s).", m_Filename);
+
+		g_Bouncer->Fatal();
+	}
+
+	m_Records.Clear();
+	m_Removed.Clear();
+
+	i = 0;
+	while (hash_t<CConfig *> *ConfigHash = m_Configs.Iterate(i++)) {
+		ConfigHash->Value->m_Modified = false;
+	}
+
+	/* if we crash before the journal is gone replaying it is harmless */
+	if (m_Journal != NULL) {
+		fclose(m_Journal);
+		m_Journal = NULL;
+	}
+
+	unlink(m_JournalFilename);
+
+	m_JournalSize = 0;
+	m_LastSave = g_CurrentTime;
+	m_Modified = false;
+
+	RETURN(bool, true);
+}
+
+/**
+ * Export
+ *
+ * Writes all users' settings to their configuration files (users/<name>.conf).
+ * Returns the number of users which have been exported.
+ */
+RESULT<unsigned int> CConfigDatabase::Export(void) {
+	CVector<configdbentry_t> Entries;
+	char *Filename, *TempFilename;
+	const char *Setting, *Value, *End;
+	FILE *ConfigFile;
+	unsigned int Exported = 0;
+	bool Failed;
+	int rc;
+
+	if (!GetEntries(&Entries)) {
+		FreeEntries(&Entries);
+
+		THROW(unsigned int, Generic_OutOfMemory, "Could not collect the users' settings.");
+	}
+
+	for (int i = 0; i < Entries.GetLength(); i++) {
+		rc = asprintf(&TempFilename, "users/%s.conf", Entries[i].Name);
+
+		if (RcFailed(rc)) {
+			continue;
+		}
+
+		Filename = strdup(g_Bouncer->BuildPathConfig(TempFilename));
+
+		free(TempFilename);
+
+		if (AllocFailed(Filename)) {
+			continue;
+		}
+
+		rc = asprintf(&TempFilename, "%s.tmp", Filename);
+
+		if (RcFailed(rc)) {
+			free(Filename);
+
+			continue;
+		}
+
+		ConfigFile = fopen(TempFilename, "w");
+
+		if (ConfigFile == NULL) {
+			free(TempFilename);
+			free(Filename);
+
+			continue;
+		}
+
+		SetPermissions(TempFilename, S_IRUSR | S_IWUSR);
+
+		Failed = false;
+		Setting = Entries[i].Data;
+		End = Entries[i].Data + Entries[i].Length;
+
+		while (Setting < End) {
+			Value = Setting + strlen(Setting) + 1;
+
+			if (Value >= End) {
+				break;
+			}
+
+			if (fprintf(ConfigFile, "%s=%s\n", Setting, Value) < 0) {
+				Failed = true;
+			}
+
+			Setting = Value + strlen(Value) + 1;
+		}
+
+		if (fclose(ConfigFile) != 0 || Failed) {
+			unlink(TempFilename);
+		} else {
+#ifdef _WIN32
+			unlink(Filename);
+#endif
+
+			if (rename(TempFilename, Filename) == 0) {
+				Exported++;
+
+				free(TempFilename);
+
+				/* the old journal doesn't apply to the new file */
+				if (asprintf(&TempFilename, "%s.journal", Filename) >= 0) {
+					unlink(TempFilename);
+				} else {
+					TempFilename = NULL;
+				}
+			}
+		}
+
+		free(TempFilename);
+		free(Filename);
+	}
+
+	FreeEntries(&Entries);
+
+	RETURN(unsigned int, Exported);
+}
+
+/**
+ * GetFilename
+ *
+ * Returns the filename of the database.
+ */
+const char *CConfigDatabase::GetFilename(void) const {
+	return m_Filename;
+}
+
+/**
+ * GetUserCount
+ *
+ * Returns the number of users in the database file.
+ */
+unsigned int CConfigDatabase::GetUserCount(void) const {
+	return (m_Header != NULL) ? m_Header->UserCount : 0;
+}
+
+/**
+ * GetSize
+ *
+ * Returns the size of the database file.
+ */
+size_t CConfigDatabase::GetSize(void) const {
+	return m_Size;
+}
+
+/**
+ * GetJournalSize
+ *
+ * Returns the size of the journal.
+ */
+size_t CConfigDatabase::GetJournalSize(void) const {
+	return m_JournalSize;
+}
+
+/**
+ * GetImportCount
+ *
+ * Returns the number of users who have been imported from their
+ * configuration files.
+ */
+unsigned int CConfigDatabase::GetImportCount(void) const {
+	return m_Imported;
+}
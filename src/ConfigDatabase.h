@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#ifndef CONFIGDATABASE_H
+#define CONFIGDATABASE_H
+
+/** The magic number at the beginning of the database ("SBDB") */
+#define CONFIGDB_MAGIC 0x42444253
+
+/** The version of the database format */
+#define CONFIGDB_VERSION 1
+
+/** The database is rewritten when its journal grows beyond this many bytes */
+#define CONFIGDB_JOURNALSIZE (1024 * 1024)
+
+/**
+ * configdbheader_t
+ *
+ * The header of the database file. It is followed by UserCount
+ * configdbuser_t structures (sorted by the users' names), the names
+ * and the users' records.
+ */
+typedef struct configdbheader_s {
+	uint32_t Magic; /**< CONFIGDB_MAGIC */
+	uint32_t Version; /**< CONFIGDB_VERSION */
+	uint32_t UserCount; /**< the number of users */
+	uint32_t Checksum; /**< a checksum of everything after the header */
+	uint64_t Size; /**< the size of the file */
+} configdbheader_t;
+
+/**
+ * configdbuser_t
+ *
+ * An entry in the database's user table. A record consists of SettingCount
+ * pairs of zero-terminated strings (the setting's name and its value).
+ */
+typedef struct configdbuser_s {
+	uint32_t NameOffset; /**< the file offset of the zero-terminated name */
+	uint32_t RecordOffset; /**< the file offset of the record */
+	uint32_t RecordLength; /**< the length of the record */
+	uint32_t SettingCount; /**< the number of settings in the record */
+} configdbuser_t;
+
+/**
+ * configdbrecord_t
+ *
+ * A record which has not been written to the database file yet.
+ */
+typedef struct configdbrecord_s {
+	char *Data; /**< the settings */
+	size_t Length; /**< the length of the data */
+	unsigned int Count; /**< the number of settings */
+} configdbrecord_t;
+
+/**
+ * configdbentry_t
+ *
+ * A user's record which is about to be saved or exported.
+ */
+typedef struct configdbentry_s {
+	const char *Name; /**< the name of the user */
+	const char *Data; /**< the settings */
+	size_t Length; /**< the length of the data */
+	unsigned int Count; /**< the number of settings */
+	bool Free; /**< whether Data has to be freed */
+} configdbentry_t;
+
+/**
+ * CConfigDatabase
+ *
+ * Stores the configuration of all users in a single memory-mapped file.
+ * Configuration objects which are backed by the database load their
+ * settings when they're first accessed. Changes are appended to a shared
+ * journal (<filename>.journal) which is merged into the database when it
+ * gets too large and when the object is destroyed. Users who are not in the
+ * database yet are imported from their text configuration files.
+ */
+class SBNCAPI CConfigDatabase {
+	char *m_Filename; /**< the filename of the database */
+	char *m_JournalFilename; /**< the filename of the journal */
+
+	char *m_Data; /**< the contents of the database file */
+	size_t m_Size; /**< the size of the database file */
+	const configdbheader_t *m_Header; /**< the header */
+	const configdbuser_t *m_Users; /**< the user table */
+
+	CHashtable<CConfig *, false> m_Configs; /**< configuration objects which use the database */
+	CHashtable<configdbrecord_t *, false> m_Records; /**< records which replace the ones in the file */
+	CHashtable<bool, false> m_Removed; /**< users whose records have been removed */
+
+	FILE *m_Journal; /**< the journal */
+	size_t m_JournalSize; /**< the size of the journal */
+	time_t m_LastSave; /**< when the database was last written */
+	bool m_Modified; /**< whether the database needs to be saved */
+	unsigned int m_Imported; /**< the number of imported users */
+
+	bool Map(void);
+	void Unmap(void);
+	int FindUser(const char *Name) const;
+	bool ReplayJournal(void);
+	bool GetEntries(CVector<configdbentry_t> *Entries) const;
+	static void FreeEntries(CVector<configdbentry_t> *Entries);
+
+	static configdbrecord_t *Serialize(const CHashtable<char *, false> *Settings);
+	static bool Deserialize(const char *Data, size_t Length, CHashtable<char *, false> *Settings);
+	static const char *FindSetting(const char *Data, size_t Length, const char *Setting);
+	static void FreeRecord(configdbrecord_t *Record);
+public:
+#ifndef SWIG
+	CConfigDatabase(const char *Filename);
+	virtual ~CConfigDatabase(void);
+#endif /* SWIG */
+
+	void Attach(const char *Name, CConfig *Config);
+	void Detach(const char *Name, CConfig *Config);
+
+	bool Load(const char *Name, CHashtable<char *, false> *Settings);
+	bool Peek(const char *Name, const char *Setting, const char **Value) const;
+	RESULT<bool> WriteJournal(const char *Name, const CHashtable<bool, false> *Dirty,
+		const CHashtable<char *, false> *Settings);
+	void RemoveUser(const char *Name);
+
+	RESULT<bool> Save(void);
+	RESULT<unsigned int> Export(void);
+
+	const char *GetFilename(void) const;
+	unsigned int GetUserCount(void) const;
+	size_t GetSize(void) const;
+	size_t GetJournalSize(void) const;
+	unsigned int GetImportCount(void) const;
+};
+
+#endif /* CONFIGDATABASE_H */
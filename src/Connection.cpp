@@ -22,7 +22,9 @@
 #define BLOCKSIZE 4096
 
 IMPL_DNSEVENTPROXY(CConnection, AsyncDnsFinished);
-IMPL_DNSEVENTPROXY(CConnection, AsyncBindIpDnsFinished);
+IMPL_DNSEVENTPROXY(CConnection, AsyncBindIpLookupFinished);
+
+void ConnectionAttemptDeadline(void *Cookie);
 
 /**
  * CConnection
@@ -69,15 +71,92 @@ CConnection::CConnection(const char *Host, unsigned int Port, const char *BindIp
 
 	m_Socket = INVALID_SOCKET;
 	m_PortCache = Port;
-	m_BindIpCache = BindIp ? strdup(BindIp) : NULL;
-	m_BindDnsQuery = NULL;
 
-	if (Host != NULL) {
-		m_DnsQuery = new CDnsQuery(this, USE_DNSEVENTPROXY(CConnection, AsyncDnsFinished));
+	if (Host == NULL) {
+		return;
+	}
+
+	// the bind address decides which of the remote host's addresses can be used (see StartAttempt())
+	if (BindIp != NULL) {
+		addrinfo Hints = {}, *Result;
+
+		Hints.ai_flags = AI_NUMERICHOST;
+		Hints.ai_family = AF_UNSPEC;
+
+		if (getaddrinfo(BindIp, NULL, &Hints, &Result) == 0) {
+			if (Result->ai_family == AF_INET) {
+				SetBindAddress(AF_INET, &(((sockaddr_in *)Result->ai_addr)->sin_addr));
+#ifdef HAVE_IPV6
+			} else if (Result->ai_family == AF_INET6) {
+				SetBindAddress(AF_INET6, &(((sockaddr_in6 *)Result->ai_addr)->sin6_addr));
+#endif /* HAVE_IPV6 */
+			}
+
+			freeaddrinfo(Result);
+
+			if (m_BindAddr == NULL) {
+				m_BindFailed = true;
+			}
+		} else {
+			// AsyncConnect() waits until this has been looked up
+			m_BindIpCache = strdup(BindIp);
+
+			if (AllocFailed(m_BindIpCache)) {
+				m_BindFailed = true;
+			}
+		}
+	}
+
+	m_DnsQuery = new CDnsQuery(this, USE_DNSEVENTPROXY(CConnection, AsyncDnsFinished));
+
+#ifdef HAVE_IPV6
+	if (Family == AF_UNSPEC) {
+		addrinfo Hints = {}, *Result;
+
+		Hints.ai_flags = AI_NUMERICHOST;
+		Hints.ai_family = AF_UNSPEC;
+
+		// there's nothing to race for IP addresses
+		if (getaddrinfo(Host, NULL, &Hints, &Result) == 0) {
+			Family = Result->ai_family;
+
+			freeaddrinfo(Result);
+		}
+	}
+
+	// look up both address families in parallel and race the connects
+	if (Family == AF_UNSPEC) {
+		m_AltDnsQuery = new CDnsQuery(this, USE_DNSEVENTPROXY(CConnection, AsyncDnsFinished));
+
+		m_PendingLookups = 2;
+		m_DnsQuery->GetHostByName(Host, AF_INET6);
+		m_AltDnsQuery->GetHostByName(Host, AF_INET);
+	} else {
+#endif /* HAVE_IPV6 */
+		if (Family == AF_UNSPEC) {
+			Family = AF_INET;
+		}
+
+		m_PendingLookups = 1;
 		m_DnsQuery->GetHostByName(Host, Family);
+#ifdef HAVE_IPV6
+	}
+#endif /* HAVE_IPV6 */
+
+	// the bind address is looked up on its own so that its family doesn't
+	// depend on which of the remote host's addresses arrive first
+	if (m_BindIpCache != NULL) {
+		m_BindDnsQuery = new CDnsQuery(this, USE_DNSEVENTPROXY(CConnection, AsyncBindIpLookupFinished));
+
+#ifdef HAVE_IPV6
+		m_BindLookupFamily = Family;
 
-		// try to connect.. maybe we already have both addresses
-		AsyncConnect();
+		m_BindDnsQuery->GetHostByName(m_BindIpCache, (Family == AF_INET) ? AF_INET : AF_INET6);
+#else
+		m_BindLookupFamily = AF_INET;
+
+		m_BindDnsQuery->GetHostByName(m_BindIpCache, AF_INET);
+#endif /* HAVE_IPV6 */
 	}
 }
 
@@ -98,10 +177,24 @@ void CConnection::InitConnection(SOCKET Client, bool SSL) {
 	m_Traffic = NULL;
 
 	m_DnsQuery = NULL;
+	m_AltDnsQuery = NULL;
 	m_BindDnsQuery = NULL;
+	m_PendingLookups = 0;
 
-	m_HostAddr = NULL;
 	m_BindAddr = NULL;
+	m_BindFamily = AF_UNSPEC;
+	m_BindLookupFamily = AF_UNSPEC;
+	m_BindFailed = false;
+	m_BindMismatch = false;
+
+	m_NextAddress[0] = 0;
+	m_NextAddress[1] = 0;
+	m_LastAddressList = 1;
+	m_NextAttempt = 0;
+	m_AttemptDeadline = NULL;
+	m_LastError = 0;
+
+	m_Handshake = NULL;
 
 	m_BindIpCache = NULL;
 	m_PortCache = 0;
@@ -140,7 +233,21 @@ void CConnection::InitConnection(SOCKET Client, bool SSL) {
 CConnection::~CConnection(void) {
 	g_Bouncer->UnregisterSocket(m_Socket);
 
+	/* the worker thread is still using the socket and the SSL object,
+	 * SSLHandshakeDone() takes care of them */
+	if (m_Handshake != NULL) {
+		m_Handshake->Owner = NULL;
+
+		m_Socket = INVALID_SOCKET;
+		m_SSL = NULL;
+	}
+
+	CancelAttempts();
+
+	g_Bouncer->DestroyDeadline(m_AttemptDeadline);
+
 	delete m_DnsQuery;
+	delete m_AltDnsQuery;
 	delete m_BindDnsQuery;
 
 	free(m_BindIpCache);
@@ -149,8 +256,7 @@ CConnection::~CConnection(void) {
 		shutdown(m_Socket, SD_BOTH);
 		closesocket(m_Socket);
 	}
-	
-	free(m_HostAddr);
+
 	free(m_BindAddr);
 
 	delete m_SendQ;
@@ -197,6 +303,12 @@ void CConnection::InitSocket(void) {
 			//SSL_set_fd(m_SSL, m_Socket);
 
 			if (GetRole() == Role_Client) {
+				SSL_SESSION *Session = GetSSLSession();
+
+				if (Session != NULL) {
+					SSL_set_session(m_SSL, Session);
+				}
+
 				SSL_set_connect_state(m_SSL);
 			} else {
 				SSL_set_accept_state(m_SSL);
@@ -262,6 +374,10 @@ int CConnection::Read(bool DontProcess) {
 		return -1;
 	}
 
+	if (StartHandshake()) {
+		return 0;
+	}
+
 #ifdef HAVE_LIBSSL
 	if (IsSSL()) {
 		ReadResult = SSL_read(m_SSL, Buffer, BufferSize);
@@ -344,6 +460,10 @@ int CConnection::Write(void) {
 	size_t Size;
 	int ReturnValue = 0;
 
+	if (StartHandshake()) {
+		return 0;
+	}
+
 	Size = m_SendQ->GetSize();
 
 	if (Size > 0) {
@@ -723,6 +843,131 @@ const X509 *CConnection::GetPeerCertificate(void) const {
 	return NULL;
 }
 
+/**
+ * SSLHandshakeWork
+ *
+ * Performs a step of an SSL handshake on a worker thread. The socket is
+ * non-blocking, so this only takes as long as the cryptographic
+ * operations for the data which is available.
+ *
+ * @param Cookie the sslhandshake_t structure
+ */
+static void SSLHandshakeWork(void *Cookie) {
+#ifdef HAVE_LIBSSL
+	sslhandshake_t *Handshake = (sslhandshake_t *)Cookie;
+
+	ERR_clear_error();
+
+	Handshake->Result = SSL_do_handshake(Handshake->SSLObject);
+	Handshake->Error = SSL_get_error(Handshake->SSLObject, Handshake->Result);
+
+	ERR_clear_error();
+#endif /* HAVE_LIBSSL */
+}
+
+/**
+ * SSLHandshakeDone
+ *
+ * Hands a connection back to the main loop once a worker thread
+ * has performed a step of its SSL handshake.
+ *
+ * @param Cookie the sslhandshake_t structure
+ */
+void SSLHandshakeDone(void *Cookie) {
+	sslhandshake_t *Handshake = (sslhandshake_t *)Cookie;
+	CConnection *Owner = Handshake->Owner;
+	int Code;
+
+	if (Owner == NULL) {
+#ifdef HAVE_LIBSSL
+		SSL_free(Handshake->SSLObject);
+#endif /* HAVE_LIBSSL */
+
+		shutdown(Handshake->Socket, SD_BOTH);
+		closesocket(Handshake->Socket);
+
+		free(Handshake);
+
+		return;
+	}
+
+	Owner->m_Handshake = NULL;
+
+	g_Bouncer->RegisterSocket(Owner->m_Socket, (CSocketEvents *)Owner);
+
+#ifdef HAVE_LIBSSL
+	if (Handshake->Result == 1) {
+		/* the client might have sent data along with its last handshake message */
+		Code = Owner->Read();
+	} else if (Handshake->Error == SSL_ERROR_WANT_READ || Handshake->Error == SSL_ERROR_WANT_WRITE) {
+		Code = 0;
+	} else {
+		Code = -1;
+	}
+#else /* HAVE_LIBSSL */
+	Code = -1;
+#endif /* HAVE_LIBSSL */
+
+	free(Handshake);
+
+	if (Code != 0) {
+		Owner->Error(Code);
+		Owner->Destroy();
+	}
+}
+
+/**
+ * StartHandshake
+ *
+ * Passes the next step of an incoming connection's SSL handshake on to a
+ * worker thread (if they're enabled) so that the main loop doesn't have to
+ * wait for the cryptographic operations. The socket is unregistered until
+ * the step has been performed. Returns false if the caller has to deal
+ * with the socket itself.
+ */
+bool CConnection::StartHandshake(void) {
+#if defined(HAVE_LIBSSL) && OPENSSL_VERSION_NUMBER >= 0x10100000L
+	CWorkerPool *WorkerPool = g_Bouncer->GetWorkerPool();
+
+	/* a worker thread is already performing a step of the handshake */
+	if (m_Handshake != NULL) {
+		return true;
+	}
+
+	/* certificate checks for outgoing connections need the main thread */
+	if (!IsSSL() || m_SSL == NULL || GetRole() != Role_Server || m_Shutdown ||
+			WorkerPool == NULL || SSL_is_init_finished(m_SSL)) {
+		return false;
+	}
+
+	m_Handshake = (sslhandshake_t *)malloc(sizeof(sslhandshake_t));
+
+	if (AllocFailed(m_Handshake)) {
+		return false;
+	}
+
+	m_Handshake->Owner = this;
+	m_Handshake->SSLObject = m_SSL;
+	m_Handshake->Socket = m_Socket;
+	m_Handshake->Result = 0;
+	m_Handshake->Error = 0;
+
+	if (IsError(WorkerPool->Submit((unsigned int)m_Socket, SSLHandshakeWork, SSLHandshakeDone, m_Handshake))) {
+		free(m_Handshake);
+		m_Handshake = NULL;
+
+		return false;
+	}
+
+	g_Bouncer->UnregisterSocket(m_Socket);
+
+	return true;
+#else /* defined(HAVE_LIBSSL) && OPENSSL_VERSION_NUMBER >= 0x10100000L */
+	/* older OpenSSL versions need locking callbacks for being used by multiple threads */
+	return false;
+#endif /* defined(HAVE_LIBSSL) && OPENSSL_VERSION_NUMBER >= 0x10100000L */
+}
+
 /**
  * SSLVerify
  *
@@ -732,139 +977,417 @@ int CConnection::SSLVerify(int PreVerifyOk, X509_STORE_CTX *Context) const {
 	return 1;
 }
 
+/**
+ * GetSSLSession
+ *
+ * Returns an SSL session which should be resumed for an outgoing
+ * connection, or NULL.
+ */
+SSL_SESSION *CConnection::GetSSLSession(void) const {
+	return NULL;
+}
+
+/**
+ * SSLNewSession
+ *
+ * Called when the server has created a new SSL session for an outgoing
+ * connection. Returns true if the connection has taken ownership of the
+ * session.
+ *
+ * @param Session the session
+ */
+bool CConnection::SSLNewSession(SSL_SESSION *Session) {
+	return false;
+}
+
 /**
  * AsyncConnect
  *
- * Tries to establish a connection.
+ * Tries to establish a connection. Once the remote host's addresses are
+ * known a connection attempt is started. If it hasn't succeeded after
+ * CONNECT_ATTEMPTDELAY milliseconds the next address is tried in parallel
+ * (alternating between IPv6 and IPv4 addresses) and so on, until one of
+ * the attempts succeeds or all of them have failed.
  */
 void CConnection::AsyncConnect(void) {
-	if (m_HostAddr != NULL && (m_BindAddr != NULL || m_BindIpCache == NULL)) {
-		sockaddr *Remote = NULL, *Bind = NULL;
-		sockaddr_in RemoteV4, BindV4;
-		sockaddr_in6 RemoteV6, BindV6;
-
-		if (m_Family == AF_INET) {
-			memset(&RemoteV4, 0, sizeof(RemoteV4));
-			RemoteV4.sin_family = m_Family;
-			RemoteV4.sin_port = htons(m_PortCache);
-			RemoteV4.sin_addr.s_addr = ((in_addr *)m_HostAddr)->s_addr;
-
-			Remote = (sockaddr *)&RemoteV4;
-
-			if (m_BindAddr != NULL) {
-				memset(&BindV4, 0, sizeof(BindV4));
-				BindV4.sin_family = m_Family;
-				BindV4.sin_port = 0;
-				BindV4.sin_addr.s_addr = ((in_addr *)m_BindAddr)->s_addr;
-
-				Bind = (sockaddr *)&BindV4;
-			}
-#ifdef HAVE_IPV6
-		} else if (m_Family == AF_INET6) {
-			memset(&RemoteV6, 0, sizeof(RemoteV6));
-			RemoteV6.sin6_family = m_Family;
-			RemoteV6.sin6_port = htons(m_PortCache);
-			memcpy(&(RemoteV6.sin6_addr), m_HostAddr, sizeof(in6_addr));
+	uint64_t Now;
+	int Attempts;
 
-			Remote = (sockaddr *)&RemoteV6;
+	if (m_Socket != INVALID_SOCKET || m_LatchedDestruction) {
+		return;
+	}
+
+	// wait for the bind address
+	if (m_BindIpCache != NULL) {
+		return;
+	}
 
-			if (m_BindAddr != NULL) {
-				memset(&BindV6, 0, sizeof(BindV6));
-				BindV6.sin6_family = m_Family;
-				BindV6.sin6_port = 0;
-				memcpy(&(BindV6.sin6_addr), m_BindAddr, sizeof(in6_addr));
+	Now = GetMonotonicTime();
+	Attempts = m_Attempts.GetLength();
 
-				Bind = (sockaddr *)&BindV6;
-			}
+	if (Attempts > 0 && Now < m_NextAttempt) {
+		ScheduleAttempt(m_NextAttempt);
+
+		return;
+	}
+
+	while (StartAttempt()) {
+		if (m_Attempts.GetLength() > Attempts) {
+			m_NextAttempt = Now + CONNECT_ATTEMPTDELAY;
+			ScheduleAttempt(m_NextAttempt);
+
+			return;
+		}
+	}
+
+	if (m_BindFailed || (m_Attempts.GetLength() == 0 && m_PendingLookups == 0)) {
+		int ErrorCode = m_LastError;
+
+		// the vhost couldn't be resolved or it doesn't match any of the remote addresses
+		if (m_BindFailed || (ErrorCode == 0 && m_BindMismatch)) {
+#ifndef _WIN32
+			ErrorCode = EADDRNOTAVAIL;
+#else
+			ErrorCode = WSAEADDRNOTAVAIL;
+#endif
+		}
+
+#ifndef _WIN32
+		if (ErrorCode == 0) {
+			ErrorCode = -1;
+		}
+#endif
+
+		Error(ErrorCode);
+
+		m_LatchedDestruction = true;
+	}
+}
+
+/**
+ * AddAddresses
+ *
+ * Adds the addresses from a dns response to the list of addresses
+ * which are tried when connecting.
+ *
+ * @param Response the response
+ */
+void CConnection::AddAddresses(const hostent *Response) {
+	for (int i = 0; Response->h_addr_list[i] != NULL; i++) {
+		sockaddr_storage Address;
+		int List;
+
+		memset(&Address, 0, sizeof(Address));
+
+		if (Response->h_addrtype == AF_INET) {
+			sockaddr_in *AddressV4 = (sockaddr_in *)&Address;
+
+			AddressV4->sin_family = AF_INET;
+			AddressV4->sin_port = htons(m_PortCache);
+			memcpy(&(AddressV4->sin_addr), Response->h_addr_list[i], sizeof(in_addr));
+
+			List = 1;
+#ifdef HAVE_IPV6
+		} else if (Response->h_addrtype == AF_INET6) {
+			sockaddr_in6 *AddressV6 = (sockaddr_in6 *)&Address;
+
+			AddressV6->sin6_family = AF_INET6;
+			AddressV6->sin6_port = htons(m_PortCache);
+			memcpy(&(AddressV6->sin6_addr), Response->h_addr_list[i], sizeof(in6_addr));
+
+			List = 0;
 #endif /* HAVE_IPV6 */
 		} else {
-			Error(0);
+			return;
+		}
 
+		if (m_Addresses[List].GetLength() >= CONNECT_MAXADDRESSES) {
 			return;
 		}
 
-		int ErrorCode;
-		m_Socket = SocketAndConnectResolved(Remote, Bind, &ErrorCode);
+		// the IPv6 query falls back to IPv4 addresses, which might give us duplicates
+		bool Duplicate = false;
 
-		free(m_HostAddr);
-		m_HostAddr = NULL;
+		for (int j = 0; j < m_Addresses[List].GetLength(); j++) {
+			if (memcmp(m_Addresses[List].GetAddressOf(j), &Address, sizeof(Address)) == 0) {
+				Duplicate = true;
 
-		if (m_Socket == INVALID_SOCKET) {
-#ifndef _WIN32
-			if (ErrorCode == 0) {
-				ErrorCode = -1;
+				break;
 			}
-#endif
+		}
+
+		if (!Duplicate) {
+			m_Addresses[List].Insert(Address);
+		}
+	}
+}
+
+/**
+ * StartAttempt
+ *
+ * Starts a connection attempt for the next address. Returns false if
+ * there are no more addresses which could be tried.
+ */
+bool CConnection::StartAttempt(void) {
+	sockaddr *Remote = NULL, *Bind = NULL;
+	sockaddr_storage BindAddress;
 
-			Error(ErrorCode);
+	// alternate between the address families, starting with IPv6
+	for (int i = 1; i <= 2 && Remote == NULL; i++) {
+		int List = (m_LastAddressList + i) % 2;
+
+		while (m_NextAddress[List] < m_Addresses[List].GetLength()) {
+			sockaddr *Address = (sockaddr *)m_Addresses[List].GetAddressOf(m_NextAddress[List]++);
+
+			if (m_BindAddr != NULL && Address->sa_family != m_BindFamily) {
+				m_BindMismatch = true;
+
+				continue;
+			}
+
+			Remote = Address;
+			m_LastAddressList = List;
+
+			break;
+		}
+	}
+
+	if (Remote == NULL) {
+		return false;
+	}
 
-			m_LatchedDestruction = true;
+	if (m_BindAddr != NULL) {
+		memset(&BindAddress, 0, sizeof(BindAddress));
+
+		if (m_BindFamily == AF_INET) {
+			((sockaddr_in *)&BindAddress)->sin_family = AF_INET;
+			memcpy(&(((sockaddr_in *)&BindAddress)->sin_addr), m_BindAddr, sizeof(in_addr));
+#ifdef HAVE_IPV6
 		} else {
-			InitSocket();
+			((sockaddr_in6 *)&BindAddress)->sin6_family = AF_INET6;
+			memcpy(&(((sockaddr_in6 *)&BindAddress)->sin6_addr), m_BindAddr, sizeof(in6_addr));
+#endif /* HAVE_IPV6 */
 		}
+
+		Bind = (sockaddr *)&BindAddress;
 	}
+
+	int ErrorCode;
+	SOCKET Socket = SocketAndConnectResolved(Remote, Bind, &ErrorCode);
+
+	if (Socket == INVALID_SOCKET) {
+		m_LastError = ErrorCode;
+
+		return true;
+	}
+
+	// ctor takes care of registering the socket
+	CConnectionAttempt *Attempt = new CConnectionAttempt(this, Socket, Remote->sa_family);
+
+	if (AllocFailed(Attempt)) {
+		closesocket(Socket);
+
+		return true;
+	}
+
+	if (IsError(m_Attempts.Insert(Attempt))) {
+		delete Attempt;
+	}
+
+	return true;
 }
 
 /**
- * AsyncDnsFinished
+ * ScheduleAttempt
  *
- * Called when the DNS query for the remote host is finished.
+ * Makes sure that AsyncConnect() is called once the specified time has
+ * been reached. This is used instead of calling AsyncConnect() directly
+ * from socket callbacks, which run while the core is iterating over the
+ * sockets.
  *
- * @param Response the response
+ * @param Due the GetMonotonicTime() at which AsyncConnect() should be called
  */
-void CConnection::AsyncDnsFinished(hostent *Response) {
-	if (Response == NULL || Response->h_addr_list[0] == NULL) {
-		// we cannot destroy the object here as there might still be the other
-		// dns query (bind ip) in the queue which would get destroyed in the
-		// destructor; this causes a crash in the StartMainLoop() function
-		m_LatchedDestruction = true;
+void CConnection::ScheduleAttempt(uint64_t Due) {
+	if (m_AttemptDeadline == NULL) {
+		m_AttemptDeadline = g_Bouncer->CreateDeadline(ConnectionAttemptDeadline, this);
 
-		return;
-	 }
+		if (m_AttemptDeadline == NULL) {
+			return;
+		}
+	}
 
-	int Size = INADDR_LEN(Response->h_addrtype);
+	g_Bouncer->SetDeadline(m_AttemptDeadline, Due);
+}
 
-	m_HostAddr = malloc(Size);
+/**
+ * ConnectionAttemptDeadline
+ *
+ * Starts the next connection attempt.
+ *
+ * @param Cookie the connection
+ */
+void ConnectionAttemptDeadline(void *Cookie) {
+	((CConnection *)Cookie)->AsyncConnect();
+}
 
-	if (AllocFailed(m_HostAddr)) {
-		m_LatchedDestruction = true;
+/**
+ * AttemptConnected
+ *
+ * Called when one of the connection attempts has succeeded. The other
+ * attempts are cancelled.
+ *
+ * @param Attempt the attempt
+ */
+void CConnection::AttemptConnected(CConnectionAttempt *Attempt) {
+	m_Attempts.Remove(Attempt);
+
+	m_Family = Attempt->GetFamily();
+	m_Socket = Attempt->Detach();
+
+	delete Attempt;
+
+	CancelAttempts();
+
+	if (m_AttemptDeadline != NULL) {
+		g_Bouncer->SetDeadline(m_AttemptDeadline, 0);
+	}
+
+	InitSocket();
+}
+
+/**
+ * AttemptFailed
+ *
+ * Called when one of the connection attempts has failed. The next
+ * address is tried right after the current main loop iteration.
+ *
+ * @param Attempt the attempt
+ */
+void CConnection::AttemptFailed(CConnectionAttempt *Attempt) {
+	m_Attempts.Remove(Attempt);
+
+	m_LastError = Attempt->GetErrorCode();
+
+	delete Attempt;
+
+	// don't start new attempts while the core is destroying all sockets
+	if (g_Bouncer->GetStatus() != Status_Running) {
 		return;
 	}
 
-	m_Family = Response->h_addrtype;
-	memcpy(m_HostAddr, Response->h_addr_list[0], Size);
+	m_NextAttempt = 0;
+
+	ScheduleAttempt(GetMonotonicTime());
+}
 
-	 if (m_BindIpCache != NULL) {
-		m_BindDnsQuery = new CDnsQuery(this, USE_DNSEVENTPROXY(CConnection, AsyncBindIpDnsFinished));
-		m_BindDnsQuery->GetHostByName(m_BindIpCache, Response->h_addrtype);
+/**
+ * CancelAttempts
+ *
+ * Cancels all pending connection attempts.
+ */
+void CConnection::CancelAttempts(void) {
+	for (int i = 0; i < m_Attempts.GetLength(); i++) {
+		delete m_Attempts[i];
 	}
 
-	AsyncConnect();
+	m_Attempts.Clear();
 }
 
 /**
- * AsyncBindIpDnsFinished
+ * AsyncDnsFinished
  *
- * Called when the DNS query for the local bind address is finished.
+ * Called when a DNS query for the remote host is finished.
  *
  * @param Response the response
  */
+void CConnection::AsyncDnsFinished(hostent *Response) {
+	m_PendingLookups--;
 
-void CConnection::AsyncBindIpDnsFinished(hostent *Response) {
 	if (Response != NULL && Response->h_addr_list[0] != NULL) {
-		int Size = INADDR_LEN(Response->h_addrtype);
+		AddAddresses(Response);
+	}
 
-		m_BindAddr = malloc(Size);
+	// we cannot destroy the object here as there might still be the other
+	// dns queries in the queue which would get destroyed in the
+	// destructor; this causes a crash in the StartMainLoop() function.
+	// responses for IP addresses arrive while the constructor is still
+	// running, so errors can't be reported from here either.
+	ScheduleAttempt(GetMonotonicTime());
+}
 
-		if (!AllocFailed(m_BindAddr)) {
-			memcpy(m_BindAddr, Response->h_addr_list[0], Size);
-		}
+/**
+ * AsyncBindIpDnsFinished
+ *
+ * Called when the DNS query for the local bind address is finished.
+ *
+ * @param Response the response
+ */
+void CConnection::AsyncBindIpDnsFinished(hostent *Response) {
+	if (Response == NULL || Response->h_addr_list[0] == NULL ||
+			!SetBindAddress(Response->h_addrtype, Response->h_addr_list[0])) {
+		m_BindFailed = true;
 	}
 
 	free(m_BindIpCache);
 	m_BindIpCache = NULL;
 
-	AsyncConnect();
+	ScheduleAttempt(GetMonotonicTime());
+}
+
+/**
+ * AsyncBindIpLookupFinished
+ *
+ * Called when one of the DNS queries for the local bind address is finished.
+ * If the caller didn't ask for a specific address family IPv4 addresses are
+ * looked up when the host doesn't have any IPv6 addresses.
+ *
+ * @param Response the response
+ */
+void CConnection::AsyncBindIpLookupFinished(hostent *Response) {
+#ifdef HAVE_IPV6
+	if ((Response == NULL || Response->h_addr_list[0] == NULL) && m_BindLookupFamily == AF_UNSPEC) {
+		m_BindLookupFamily = AF_INET;
+		m_BindDnsQuery->GetHostByName(m_BindIpCache, AF_INET);
+
+		return;
+	}
+#endif /* HAVE_IPV6 */
+
+	AsyncBindIpDnsFinished(Response);
+}
+
+/**
+ * SetBindAddress
+ *
+ * Sets the local address for the connection attempts.
+ *
+ * @param Family the address family
+ * @param Address the address (an in_addr or in6_addr)
+ */
+bool CConnection::SetBindAddress(int Family, const void *Address) {
+	int Size;
+
+	if (Family != AF_INET
+#ifdef HAVE_IPV6
+			&& Family != AF_INET6
+#endif /* HAVE_IPV6 */
+			) {
+		return false;
+	}
+
+	Size = INADDR_LEN(Family);
+
+	free(m_BindAddr);
+	m_BindAddr = malloc(Size);
+
+	if (AllocFailed(m_BindAddr)) {
+		return false;
+	}
+
+	memcpy(m_BindAddr, Address, Size);
+	m_BindFamily = Family;
+
+	return true;
 }
 
 /**
@@ -990,3 +1513,150 @@ void CConnection::SetSSLObject(void *SSLObject) {
 	m_SSL = (SSL *)SSLObject;
 #endif
 }
+
+/**
+ * CConnectionAttempt
+ *
+ * Constructs a new connection attempt and registers its socket.
+ *
+ * @param Owner the connection which is notified about the outcome
+ * @param Socket a socket for which a non-blocking connect() is in progress
+ * @param Family the socket's address family
+ */
+CConnectionAttempt::CConnectionAttempt(CConnection *Owner, SOCKET Socket, int Family) {
+	m_Owner = Owner;
+	m_Socket = Socket;
+	m_Family = Family;
+	m_ErrorCode = 0;
+	m_Failed = false;
+
+	g_Bouncer->RegisterSocket(m_Socket, this);
+}
+
+/**
+ * ~CConnectionAttempt
+ *
+ * Unregisters and closes the socket unless it has been detached.
+ */
+CConnectionAttempt::~CConnectionAttempt(void) {
+	if (m_Socket != INVALID_SOCKET) {
+		g_Bouncer->UnregisterSocket(m_Socket);
+
+		closesocket(m_Socket);
+	}
+}
+
+/**
+ * Detach
+ *
+ * Unregisters the socket and hands it over to the caller.
+ */
+SOCKET CConnectionAttempt::Detach(void) {
+	SOCKET Socket = m_Socket;
+
+	g_Bouncer->UnregisterSocket(m_Socket);
+
+	m_Socket = INVALID_SOCKET;
+
+	return Socket;
+}
+
+/**
+ * GetFamily
+ *
+ * Returns the socket's address family.
+ */
+int CConnectionAttempt::GetFamily(void) const {
+	return m_Family;
+}
+
+/**
+ * GetErrorCode
+ *
+ * Returns the error code for a failed attempt.
+ */
+int CConnectionAttempt::GetErrorCode(void) const {
+	return m_ErrorCode;
+}
+
+/**
+ * Destroy
+ *
+ * Called when the attempt has failed.
+ */
+void CConnectionAttempt::Destroy(void) {
+	m_Owner->AttemptFailed(this);
+}
+
+/**
+ * Read
+ *
+ * Incoming data is left alone for the connection which adopts the socket.
+ */
+int CConnectionAttempt::Read(bool DontProcess) {
+	return 0;
+}
+
+/**
+ * Write
+ *
+ * Called when connect() has finished.
+ */
+int CConnectionAttempt::Write(void) {
+	int ErrorCode = 0;
+	socklen_t ErrorCodeLength = sizeof(ErrorCode);
+
+	if (m_Failed) {
+		return 0;
+	}
+
+	if (getsockopt(m_Socket, SOL_SOCKET, SO_ERROR, (char *)&ErrorCode, &ErrorCodeLength) != 0 || ErrorCode != 0) {
+		Error(ErrorCode);
+
+		return 0;
+	}
+
+	// this destroys the attempt
+	m_Owner->AttemptConnected(this);
+
+	return 0;
+}
+
+/**
+ * Error
+ *
+ * Called when connect() has failed.
+ *
+ * @param ErrorCode the error code
+ */
+void CConnectionAttempt::Error(int ErrorCode) {
+	m_ErrorCode = ErrorCode;
+	m_Failed = true;
+}
+
+/**
+ * HasQueuedData
+ *
+ * Attempts always wait for their socket to become writable.
+ */
+bool CConnectionAttempt::HasQueuedData(void) const {
+	return true;
+}
+
+/**
+ * ShouldDestroy
+ *
+ * Failed attempts are destroyed.
+ */
+bool CConnectionAttempt::ShouldDestroy(void) const {
+	return m_Failed;
+}
+
+/**
+ * GetClassName
+ *
+ * Returns the class' name.
+ */
+const char *CConnectionAttempt::GetClassName(void) const {
+	return "CConnectionAttempt";
+}
@@ -23,6 +23,26 @@
 class CUser;
 class CTrafficStats;
 class CFIFOBuffer;
+class CConnection;
+
+/** The delay (in milliseconds) before another address is tried while the previous attempts are still pending */
+#define CONNECT_ATTEMPTDELAY 250
+
+/** The maximum number of addresses which are tried for each address family */
+#define CONNECT_MAXADDRESSES 16
+
+/**
+ * sslhandshake_t
+ *
+ * A step of an SSL handshake which is being performed by a worker thread.
+ */
+typedef struct sslhandshake_s {
+	CConnection *Owner; /**< the connection, or NULL if it has been destroyed in the meantime */
+	SSL *SSLObject; /**< the connection's SSL object */
+	SOCKET Socket; /**< the connection's socket */
+	int Result; /**< the return value of SSL_do_handshake() */
+	int Error; /**< the SSL error code for the result */
+} sslhandshake_t;
 
 /**
  * connection_role_e
@@ -35,6 +55,39 @@ enum connection_role_e {
 	Role_Client
 };
 
+/**
+ * CConnectionAttempt
+ *
+ * A non-blocking connect() to one of the remote host's addresses. A
+ * CConnection races several of these and adopts the socket of the first
+ * one which succeeds.
+ */
+class CConnectionAttempt : public CSocketEvents {
+	CConnection *m_Owner; /**< the connection which started the attempt */
+	SOCKET m_Socket; /**< the socket */
+	int m_Family; /**< the address family */
+	int m_ErrorCode; /**< the error which caused the attempt to fail */
+	bool m_Failed; /**< whether the attempt has failed */
+
+public:
+#ifndef SWIG
+	CConnectionAttempt(CConnection *Owner, SOCKET Socket, int Family);
+	virtual ~CConnectionAttempt(void);
+#endif /* SWIG */
+
+	SOCKET Detach(void);
+	int GetFamily(void) const;
+	int GetErrorCode(void) const;
+
+	virtual void Destroy(void);
+	virtual int Read(bool DontProcess = false);
+	virtual int Write(void);
+	virtual void Error(int ErrorCode);
+	virtual bool HasQueuedData(void) const;
+	virtual bool ShouldDestroy(void) const;
+	virtual const char *GetClassName(void) const;
+};
+
 /**
  * CConnection
  *
@@ -44,6 +97,7 @@ class SBNCAPI CConnection : public CSocketEvents {
 #ifndef SWIG
 	friend class CCore;
 	friend class CUser;
+	friend class CConnectionAttempt;
 #endif /* SWIG */
 protected:
 	virtual void ParseLine(const char *Line);
@@ -72,17 +126,33 @@ protected:
 public:
 	virtual void AsyncDnsFinished(hostent *Response);
 	virtual void AsyncBindIpDnsFinished(hostent *Response);
+	void AsyncBindIpLookupFinished(hostent *Response);
 
 private:
 	CDnsQuery *m_DnsQuery; /**< the dns query for looking up the hostname */
+	CDnsQuery *m_AltDnsQuery; /**< the dns query for the hostname's IPv4 addresses */
+	unsigned int m_PendingLookups; /**< the number of pending dns queries for the hostname */
 	CDnsQuery *m_BindDnsQuery; /**< the dns query for looking up the bind address */
 	unsigned int m_PortCache; /**< the port or -1 if the cache is invalided */
-	char *m_BindIpCache; /**< the bind address */
+	char *m_BindIpCache; /**< the bind address while it is being looked up */
+	int m_BindLookupFamily; /**< the family which is used for looking up the bind address, AF_UNSPEC tries both */
+	bool m_BindFailed; /**< whether the bind address could not be resolved */
+	bool m_BindMismatch; /**< whether remote addresses were skipped because of the bind address' family */
 
 	CTrafficStats *m_Traffic; /**< the traffic statistics for this connection */
 
 	void *m_BindAddr; /**< the bind address (an in_addr or in_addr6) */
-	void *m_HostAddr; /** the remote address (an in_addr or in_addr6) */
+	int m_BindFamily; /**< the bind address' family */
+
+	CVector<sockaddr_storage> m_Addresses[2]; /**< the remote addresses (IPv6 and IPv4) */
+	int m_NextAddress[2]; /**< the next address which is tried for each family */
+	int m_LastAddressList; /**< the list which was used for the last attempt */
+	CVector<CConnectionAttempt *> m_Attempts; /**< pending connection attempts */
+	uint64_t m_NextAttempt; /**< when the next attempt may be started */
+	struct deadline_s *m_AttemptDeadline; /**< calls AsyncConnect() when the next attempt is due */
+	int m_LastError; /**< the error code of the last failed attempt */
+
+	sslhandshake_t *m_Handshake; /**< the handshake step which is being performed by a worker thread, or NULL */
 
 	connection_role_e m_Role; /**< the role of this connection */
 
@@ -96,6 +166,21 @@ private:
 
 	void InitConnection(SOCKET Client, bool SSL);
 
+	bool SetBindAddress(int Family, const void *Address);
+	void AddAddresses(const hostent *Response);
+	bool StartAttempt(void);
+	void ScheduleAttempt(uint64_t Due);
+	void AttemptConnected(CConnectionAttempt *Attempt);
+	void AttemptFailed(CConnectionAttempt *Attempt);
+	void CancelAttempts(void);
+
+	bool StartHandshake(void);
+
+#ifndef SWIG
+	friend void SSLHandshakeDone(void *Cookie);
+	friend void ConnectionAttemptDeadline(void *Cookie);
+#endif /* SWIG */
+
 	virtual const char *GetClassName(void) const;
 public:
 #ifndef SWIG
@@ -128,6 +213,8 @@ public:
 	bool IsSSL(void) const;
 	const X509 *GetPeerCertificate(void) const;
 	virtual int SSLVerify(int PreVerifyOk, X509_STORE_CTX *Context) const;
+	virtual SSL_SESSION *GetSSLSession(void) const;
+	virtual bool SSLNewSession(SSL_SESSION *Session);
 
 	sockaddr *GetRemoteAddress(void) const;
 	sockaddr *GetLocalAddress(void) const;
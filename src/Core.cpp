@@ -26,6 +26,26 @@ time_t g_CurrentTime; /**< current time (updated in main loop) */
 #ifdef HAVE_LIBSSL
 int SSLVerifyCertificate(int preverify_ok, X509_STORE_CTX *x509ctx);
 int g_SSLCustomIndex; /**< custom SSL index */
+
+/**
+ * sslticketkey_t
+ *
+ * A key for encrypting and authenticating SSL session tickets.
+ */
+typedef struct sslticketkey_s {
+	unsigned char Name[16]; /**< identifies the key */
+	unsigned char AesKey[32]; /**< the key for encrypting tickets */
+	unsigned char HmacKey[32]; /**< the key for authenticating tickets */
+} sslticketkey_t;
+
+static sslticketkey_t g_SSLTicketKeys[2]; /**< the current and the previous ticket key */
+
+/* the keys are used by worker threads during SSL handshakes */
+#ifdef _WIN32
+static CRITICAL_SECTION g_SSLTicketKeyLock; /**< protects g_SSLTicketKeys */
+#else
+static pthread_mutex_t g_SSLTicketKeyLock = PTHREAD_MUTEX_INITIALIZER; /**< protects g_SSLTicketKeys */
+#endif
 #endif
 
 time_t g_LastReconnect = 0; /**< time of the last reconnect */
@@ -33,13 +53,15 @@ time_t g_LastReconnect = 0; /**< time of the last reconnect */
 static struct reslimit_s {
 	const char *Resource;
 	unsigned int DefaultLimit;
+	unsigned int SystemOption; /**< the slot of system.max<resource> */
+	unsigned int UserOption; /**< the slot of user.max<resource> */
 } g_ResourceLimits[] = {
-		{ "channels", 50 },
-		{ "nicks", 5000 },
-		{ "bans", 100 },
-		{ "keys", 50 },
-		{ "clients", 5 },
-		{ NULL, 0 }
+		{ "channels", 50, CCacheSystem::IntOption_maxchannels, CCacheUser::StringOption_maxchannels },
+		{ "nicks", 5000, CCacheSystem::IntOption_maxnicks, CCacheUser::StringOption_maxnicks },
+		{ "bans", 100, CCacheSystem::IntOption_maxbans, CCacheUser::StringOption_maxbans },
+		{ "keys", 50, CCacheSystem::IntOption_maxkeys, CCacheUser::StringOption_maxkeys },
+		{ "clients", 5, CCacheSystem::IntOption_maxclients, CCacheUser::StringOption_maxclients },
+		{ NULL, 0, 0, 0 }
 	};
 
 /**
@@ -52,8 +74,6 @@ static struct reslimit_s {
  * @param argv program arguments
  */
 CCore::CCore(CConfig *Config, int argc, char **argv) {
-	int i;
-
 	m_Log = NULL;
 
 	m_PidFile = NULL;
@@ -67,7 +87,7 @@ CCore::CCore(CConfig *Config, int argc, char **argv) {
 
 	m_Status = Status_Running; 
 
-	CacheInitialize(m_ConfigCache, Config, "system.");
+	CacheInitialize(m_ConfigCache, Config);
 
 	char *SourcePath = strdup(BuildPathLog("sbnc.log"));
 	rename(SourcePath, BuildPathLog("sbnc.log.old"));
@@ -95,46 +115,40 @@ CCore::CCore(CConfig *Config, int argc, char **argv) {
 	m_Ident = new CIdentSupport();
 
 	m_Config = new CConfig("sbnc.conf", NULL);
-	CacheInitialize(m_ConfigCache, m_Config, "system.");
-
-	const char *Users;
-	CUser *User;
+	CacheInitialize(m_ConfigCache, m_Config);
 
-	if ((Users = m_Config->ReadString("system.users")) == NULL) {
-		if (!MakeConfig()) {
-			Log("Configuration file could not be created.");
+	if (m_Config->ReadInteger("system.userdb")) {
+		m_UserDatabase = new CConfigDatabase("users.db");
 
+		if (AllocFailed(m_UserDatabase)) {
 			Fatal();
 		}
-
-		printf("Configuration has been successfully saved. Please restart shroudBNC now.\n");
-		exit(EXIT_SUCCESS);
-	}
-
-	const char *Args;
-	int Count;
-
-	Args = ArgTokenize(Users);
-
-	if (AllocFailed(Args)) {
-		Fatal();
+	} else {
+		m_UserDatabase = NULL;
 	}
 
-	Count = ArgCount(Args);
+	m_WorkerPool = NULL;
 
-	for (i = 0; i < Count; i++) {
-		const char *Name = ArgGet(Args, i + 1);
+	m_ShardCount = 1;
+	m_ShardIndex = 0;
+	m_ShardSockets = NULL;
+	m_ShardChannel = NULL;
 
-		User = new CUser(Name);
+	if (m_Config->ReadString("system.users") == NULL) {
+		if (!MakeConfig()) {
+			Log("Configuration file could not be created.");
 
-		if (AllocFailed(User)) {
 			Fatal();
 		}
 
-		m_Users.Add(Name, User);
+		printf("Configuration has been successfully saved. Please restart shroudBNC now.\n");
+		exit(EXIT_SUCCESS);
 	}
 
-	ArgFree(Args);
+	/* with multiple shards each shard process loads its own users */
+	if (m_Config->ReadInteger("system.shards") <= 1) {
+		LoadUsers();
+	}
 
 	m_Listener = NULL;
 	m_ListenerV6 = NULL;
@@ -146,6 +160,16 @@ CCore::CCore(CConfig *Config, int argc, char **argv) {
 	m_LoadingModules = false;
 	m_LoadingListeners = false;
 
+	for (int i = 0; i < ModuleEvent_Max; i++) {
+		m_ModuleSubscribers[i].Commands = new CHashtable<CVector<CModule *> *, false>();
+		m_ModuleSubscribers[i].Commands->RegisterValueDestructor(DestroyObject<CVector<CModule *> >);
+	}
+
+	m_ModuleSubscriptionsDirty = false;
+
+	m_WakeupTimeout = -1;
+	m_DeadlinePass = 0;
+
 	InitializeSocket();
 
 	m_Capabilities = new CVector<const char *>();
@@ -160,6 +184,7 @@ CCore::CCore(CConfig *Config, int argc, char **argv) {
  */
 CCore::~CCore(void) {
 	int a, i;
+	CWorkerPool *WorkerPool;
 
 	for (a = m_Modules.GetLength() - 1; a >= 0; a--) {
 		delete m_Modules[a];
@@ -167,8 +192,30 @@ CCore::~CCore(void) {
 
 	m_Modules.Clear();
 
+	for (i = 0; i < ModuleEvent_Max; i++) {
+		delete m_ModuleSubscribers[i].Commands;
+	}
+
 	UninitializeAdditionalListeners();
 
+	/* waits for pending jobs, which might still need the users; jobs which
+	 * are submitted while the pool is destroyed are done synchronously */
+	WorkerPool = m_WorkerPool;
+	m_WorkerPool = NULL;
+	delete WorkerPool;
+
+	delete m_ShardChannel;
+
+	if (m_ShardSockets != NULL) {
+		for (i = 0; i < 2 * m_ShardCount; i++) {
+			if (m_ShardSockets[i] != INVALID_SOCKET) {
+				closesocket(m_ShardSockets[i]);
+			}
+		}
+
+		free(m_ShardSockets);
+	}
+
 	for (CListCursor<socket_t> SocketCursor(&m_OtherSockets); SocketCursor.IsValid(); SocketCursor.Proceed()) {
 		if (SocketCursor->PollFd->fd != INVALID_SOCKET) {
 			SocketCursor->Events->Destroy();
@@ -180,8 +227,22 @@ CCore::~CCore(void) {
 		delete User->Value;
 	}
 
+	/* connections destroy their own deadlines, so this has to wait until they're gone */
+	for (i = 0; i < m_Deadlines.GetLength(); i++) {
+		free(m_Deadlines[i]);
+	}
+
+	m_Deadlines.Clear();
+
+	CConfig::FlushAll();
+
+	delete m_UserDatabase;
+
 	CTimer::DestroyAllTimers();
 
+	/* merges the journal into sbnc.conf */
+	m_Config->Destroy();
+
 	delete m_Log;
 	delete m_Ident;
 
@@ -301,6 +362,8 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 	} else {
 		SSL_CTX_set_verify(m_SSLClientContext, SSL_VERIFY_PEER, SSLVerifyCertificate);
 	}
+
+	InitializeSSLSessions();
 #endif
 
 	if (Port != 0 && m_Listener != NULL && m_Listener->IsValid()) {
@@ -339,6 +402,33 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 #endif
 	}
 
+	/* this only returns in the shard processes */
+	if (m_Config->ReadInteger("system.shards") > 1) {
+		StartShards(m_Config->ReadInteger("system.shards"));
+
+		LoadUsers();
+	}
+
+	/* threads don't survive fork(), so we can only start them now */
+	int Workers = m_Config->ReadInteger("system.workers");
+
+	if (Workers > 0) {
+		m_WorkerPool = new CWorkerPool(Workers);
+
+		if (AllocFailed(m_WorkerPool)) {
+			Fatal();
+		}
+
+		if (m_WorkerPool->GetThreadCount() == 0) {
+			Log("Could not start worker threads.");
+
+			delete m_WorkerPool;
+			m_WorkerPool = NULL;
+		} else {
+			Log("Started %d worker thread(s).", m_WorkerPool->GetThreadCount());
+		}
+	}
+
 	/* Note: We need to load the modules after using fork() as otherwise tcl cannot be cleanly unloaded */
 	m_LoadingModules = true;
 
@@ -380,6 +470,7 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 	int m_ShutdownLoop = 5;
 
 	time_t Last = 0;
+	bool ModulesWereBusy = false;
 
 	while (GetStatus() == Status_Running || --m_ShutdownLoop) {
 		time_t Now, Best = 0, SleepInterval = 0;
@@ -436,7 +527,9 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 
 		SleepInterval = Best - g_CurrentTime;
 
-		DnsSocketCookie *DnsCookie = CDnsQuery::RegisterSockets();
+		m_WakeupTimeout = -1;
+
+		CDnsQuery::ScheduleTimeout();
 
 		for (CListCursor<socket_t> SocketCursor(&m_OtherSockets); SocketCursor.IsValid(); SocketCursor.Proceed()) {
 			if (SocketCursor->PollFd->fd == INVALID_SOCKET) {
@@ -454,15 +547,19 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 			}
 		}
 
+		// modules which don't subscribe to this can use sockets, deadlines
+		// and wakeup events instead, so the main loop doesn't have to poll them
 		bool ModulesBusy = false;
 
-	        for (int j = 0; j < m_Modules.GetLength(); j++) {
-        	        if (m_Modules[j]->MainLoop()) {
-                	        ModulesBusy = true;
-	                }
-	        }
+		const CVector<CModule *> *Subscribers = GetModuleSubscribers(ModuleEvent_MainLoop, NULL);
+
+		for (int j = 0; j < Subscribers->GetLength(); j++) {
+			if ((*Subscribers)[j]->MainLoop()) {
+				ModulesBusy = true;
+			}
+		}
 
-		if (SleepInterval <= 0 || GetStatus() != Status_Running || ModulesBusy) {
+		if (SleepInterval <= 0 || GetStatus() != Status_Running) {
 			SleepInterval = 1;
 		}
 
@@ -470,19 +567,40 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 			SleepInterval = 3;
 		}
 
-		timeval interval = { (long)SleepInterval, 0 };
+		int Timeout = SleepInterval * 1000;
+
+		if (m_WakeupTimeout != -1 && m_WakeupTimeout < Timeout) {
+			Timeout = m_WakeupTimeout;
+		}
+
+		int DeadlineTimeout = GetDeadlineTimeout();
+
+		if (DeadlineTimeout != -1 && DeadlineTimeout < Timeout) {
+			Timeout = DeadlineTimeout;
+		}
+
+		// modules which still have work to do get another chance right away;
+		// modules which are always busy (e.g. Tcl's "after idle" loops) must
+		// not make us spin, so after that they're only polled now and then
+		if (ModulesBusy && !ModulesWereBusy) {
+			Timeout = 0;
+		} else if (ModulesBusy && Timeout > MAINLOOP_BUSYTIMEOUT) {
+			Timeout = MAINLOOP_BUSYTIMEOUT;
+		}
+
+		ModulesWereBusy = ModulesBusy;
 
 		time(&Last);
 
 #ifdef _DEBUG
-		//printf("poll: %d seconds\n", SleepInterval);
+		//printf("poll: %d msecs\n", Timeout);
 #endif
 
 #if defined(_WIN32) && defined(_DEBUG)
 		DWORD TimeDiff = GetTickCount();
 #endif
 
-		int ready = poll(m_PollFds.GetList(), m_PollFds.GetLength(), interval.tv_sec * 1000);
+		int ready = poll(m_PollFds.GetList(), m_PollFds.GetLength(), Timeout);
 
 #if defined(_WIN32) && defined(_DEBUG)
 		TickCount += GetTickCount() - TimeDiff;
@@ -562,7 +680,8 @@ void CCore::StartMainLoop(bool ShouldDaemonize) {
 		}
 
 		CDnsQuery::ProcessTimeouts();
-		CDnsQuery::UnregisterSockets(DnsCookie);
+
+		CallDeadlines();
 
 #if defined(_WIN32) && defined(_DEBUG)
 		DWORD Ticks = GetTickCount() - TickCount;
@@ -599,7 +718,8 @@ CUser *CCore::GetUser(const char *Name) {
  * GlobalNotice
  *
  * Sends a message to all bouncer users who are currently
- * logged in.
+ * logged in. With multiple shards only the users which are served by
+ * this process receive the message.
  *
  * @param Text the text of the message
  */
@@ -627,7 +747,8 @@ void CCore::GlobalNotice(const char *Text) {
 /**
  * GetUsers
  *
- * Returns a hashtable which contains all bouncer users.
+ * Returns a hashtable which contains all bouncer users. With multiple
+ * shards this only contains the users which are served by this process.
  */
 CHashtable<CUser *, false> *CCore::GetUsers(void) {
 	return &m_Users;
@@ -679,6 +800,11 @@ const CVector<CModule *> *CCore::GetModules(void) const {
 RESULT<CModule *> CCore::LoadModule(const char *Filename) {
 	RESULT<bool> Result;
 
+	/* the other shards wouldn't load the module */
+	if (!m_LoadingModules && m_ShardCount > 1) {
+		THROW(CModule *, Generic_Unknown, "Modules cannot be loaded while shroudBNC is running with multiple shards.");
+	}
+
 	CModule *Module = new CModule(Filename);
 
 	if (AllocFailed(Module)) {
@@ -702,6 +828,8 @@ RESULT<CModule *> CCore::LoadModule(const char *Filename) {
 
 		Module->Init(this);
 
+		RefreshModuleSubscriptions();
+
 		if (!m_LoadingModules) {
 			UpdateModuleConfig();
 		}
@@ -738,11 +866,18 @@ RESULT<CModule *> CCore::LoadModule(const char *Filename) {
  * @param Module the module
  */
 bool CCore::UnloadModule(CModule *Module) {
+	if (m_ShardCount > 1) {
+		return false;
+	}
+
 	if (m_Modules.Remove(Module)) {
 		Log("Unloaded module: %s", Module->GetFilename());
 
 		delete Module;
 
+		/* rebuild the lists right away so they don't refer to the module anymore */
+		UpdateModuleSubscribers();
+
 		UpdateModuleConfig();
 
 		return true;
@@ -751,6 +886,150 @@ bool CCore::UnloadModule(CModule *Module) {
 	}
 }
 
+/**
+ * GetModuleSubscribers
+ *
+ * Returns the modules which should be notified about an event, in the
+ * order in which they were loaded.
+ *
+ * @param Event the event
+ * @param Command the command (e.g. the IRC command or numeric), or NULL
+ */
+const CVector<CModule *> *CCore::GetModuleSubscribers(module_event_t Event, const char *Command) {
+	CVector<CModule *> *Subscribers;
+
+	if (m_ModuleSubscriptionsDirty) {
+		UpdateModuleSubscribers();
+	}
+
+	if (Command != NULL) {
+		Subscribers = m_ModuleSubscribers[Event].Commands->Get(Command);
+
+		if (Subscribers != NULL) {
+			return Subscribers;
+		}
+	}
+
+	return &m_ModuleSubscribers[Event].All;
+}
+
+/**
+ * RefreshModuleSubscriptions
+ *
+ * Makes sure that the modules' subscriptions are queried again before the
+ * next event is dispatched. Modules need to call this whenever the result
+ * of their GetSubscriptions() function changes.
+ */
+void CCore::RefreshModuleSubscriptions(void) {
+	m_ModuleSubscriptionsDirty = true;
+}
+
+/**
+ * UpdateModuleSubscribers
+ *
+ * Rebuilds the subscriber lists. The lists are cleared rather than freed
+ * so that loops over them which are still running remain valid.
+ */
+void CCore::UpdateModuleSubscribers(void) {
+	const modulesubscription_t *Subscriptions;
+	const modulesubscription_t *Subscription;
+	hash_t<CVector<CModule *> *> *CommandHash;
+	CVector<CModule *> *Subscribers;
+	int i, a;
+
+	m_ModuleSubscriptionsDirty = false;
+
+	for (i = 0; i < ModuleEvent_Max; i++) {
+		m_ModuleSubscribers[i].All.Clear();
+
+		a = 0;
+		while ((CommandHash = m_ModuleSubscribers[i].Commands->Iterate(a++)) != NULL) {
+			CommandHash->Value->Clear();
+		}
+	}
+
+	/* first pass: create lists for all the commands */
+	for (i = 0; i < m_Modules.GetLength(); i++) {
+		Subscriptions = m_Modules[i]->GetSubscriptions();
+
+		for (Subscription = Subscriptions; Subscription != NULL && Subscription->Event != ModuleEvent_None; Subscription++) {
+			if (Subscription->Event >= ModuleEvent_Max || Subscription->Command == NULL) {
+				continue;
+			}
+
+			if (m_ModuleSubscribers[Subscription->Event].Commands->Get(Subscription->Command) != NULL) {
+				continue;
+			}
+
+			Subscribers = new CVector<CModule *>();
+
+			if (AllocFailed(Subscribers)) {
+				continue;
+			}
+
+			if (IsError(m_ModuleSubscribers[Subscription->Event].Commands->Add(Subscription->Command, Subscribers))) {
+				delete Subscribers;
+			}
+		}
+	}
+
+	/* second pass: add the modules to the lists; modules which are
+	 * interested in all commands are added to every list */
+	for (i = 0; i < m_Modules.GetLength(); i++) {
+		Subscriptions = m_Modules[i]->GetSubscriptions();
+
+		if (Subscriptions == NULL) {
+			for (int Event = ModuleEvent_None + 1; Event < ModuleEvent_Max; Event++) {
+				m_ModuleSubscribers[Event].All.Insert(m_Modules[i]);
+
+				a = 0;
+				while ((CommandHash = m_ModuleSubscribers[Event].Commands->Iterate(a++)) != NULL) {
+					CommandHash->Value->Insert(m_Modules[i]);
+				}
+			}
+
+			continue;
+		}
+
+		for (Subscription = Subscriptions; Subscription->Event != ModuleEvent_None; Subscription++) {
+			modulesubscribers_t *EventSubscribers;
+
+			if (Subscription->Event >= ModuleEvent_Max) {
+				continue;
+			}
+
+			EventSubscribers = &m_ModuleSubscribers[Subscription->Event];
+
+			if (Subscription->Command != NULL) {
+				Subscribers = EventSubscribers->Commands->Get(Subscription->Command);
+
+				if (Subscribers != NULL && (Subscribers->GetLength() == 0 ||
+						(*Subscribers)[Subscribers->GetLength() - 1] != m_Modules[i])) {
+					Subscribers->Insert(m_Modules[i]);
+				}
+
+				continue;
+			}
+
+			if (EventSubscribers->All.GetLength() > 0 &&
+					EventSubscribers->All[EventSubscribers->All.GetLength() - 1] == m_Modules[i]) {
+				continue;
+			}
+
+			EventSubscribers->All.Insert(m_Modules[i]);
+
+			a = 0;
+			while ((CommandHash = EventSubscribers->Commands->Iterate(a++)) != NULL) {
+				Subscribers = CommandHash->Value;
+
+				if (Subscribers->GetLength() == 0 || (*Subscribers)[Subscribers->GetLength() - 1] != m_Modules[i]) {
+					Subscribers->Insert(m_Modules[i]);
+				}
+			}
+		}
+	}
+}
+
 /**
  * UpdateModuleConfig
  *
@@ -1024,6 +1303,26 @@ CConfig *CCore::GetConfig(void) {
 	return m_Config;
 }
 
+/**
+ * GetUserDatabase
+ *
+ * Returns the database which contains the users' settings, or NULL
+ * if the users' settings are stored in separate configuration files.
+ */
+CConfigDatabase *CCore::GetUserDatabase(void) {
+	return m_UserDatabase;
+}
+
+/**
+ * GetWorkerPool
+ *
+ * Returns the pool of worker threads, or NULL if worker threads
+ * are disabled.
+ */
+CWorkerPool *CCore::GetWorkerPool(void) {
+	return m_WorkerPool;
+}
+
 /**
  * GetLog
  *
@@ -1071,6 +1370,11 @@ RESULT<CUser *> CCore::CreateUser(const char *Username, const char *Password) {
 		THROW(CUser *, Generic_Unknown, "The username you specified is not valid.");
 	}
 
+	/* the other shards wouldn't know about the new user */
+	if (m_ShardCount > 1) {
+		THROW(CUser *, Generic_Unknown, "Users cannot be created while shroudBNC is running with multiple shards.");
+	}
+
 	User = new CUser(Username);
 
 	Result = m_Users.Add(Username, User);
@@ -1118,6 +1422,10 @@ RESULT<bool> CCore::RemoveUser(const char *Username, bool RemoveConfig) {
 		THROW(bool, Generic_Unknown, "There is no such user.");
 	}
 
+	if (m_ShardCount > 1) {
+		THROW(bool, Generic_Unknown, "Users cannot be removed while shroudBNC is running with multiple shards.");
+	}
+
 	for (int i = 0; i < m_Modules.GetLength(); i++) {
 		m_Modules[i]->UserDelete(Username);
 	}
@@ -1125,7 +1433,10 @@ RESULT<bool> CCore::RemoveUser(const char *Username, bool RemoveConfig) {
 	UsernameCopy = strdup(User->GetUsername());
 
 	if (RemoveConfig) {
-		ConfigCopy = strdup(User->GetConfig()->GetFilename());
+		if (User->GetConfig()->GetFilename() != NULL) {
+			ConfigCopy = strdup(User->GetConfig()->GetFilename());
+		}
+
 		LogCopy = strdup(User->GetLog()->GetFilename());
 	}
 
@@ -1143,12 +1454,32 @@ RESULT<bool> CCore::RemoveUser(const char *Username, bool RemoveConfig) {
 
 	if (UsernameCopy != NULL) {
 		Log("User removed: %s", UsernameCopy);
+
+		if (RemoveConfig && ConfigCopy == NULL && m_UserDatabase != NULL) {
+			m_UserDatabase->RemoveUser(UsernameCopy);
+		}
+
 		free(UsernameCopy);
 	}
 
 	if (RemoveConfig) {
-		unlink(ConfigCopy);
+		char *IndexCopy, *JournalCopy;
+
+		if (ConfigCopy != NULL) {
+			unlink(ConfigCopy);
+		}
+
 		unlink(LogCopy);
+
+		if (LogCopy != NULL && asprintf(&IndexCopy, "%s.idx", LogCopy) >= 0) {
+			unlink(IndexCopy);
+			free(IndexCopy);
+		}
+
+		if (ConfigCopy != NULL && asprintf(&JournalCopy, "%s.journal", ConfigCopy) >= 0) {
+			unlink(JournalCopy);
+			free(JournalCopy);
+		}
 	}
 
 	free(ConfigCopy);
@@ -1501,55 +1832,316 @@ int CCore::GetSSLCustomIndex(void) const {
 
 #ifdef HAVE_LIBSSL
 /**
- * SSLVerifyCertificate
+ * LockSSLTicketKeys
  *
- * Checks whether an SSL certificate is valid.
+ * Acquires the lock for the SSL session ticket keys.
+ */
+static void LockSSLTicketKeys(void) {
+#ifdef _WIN32
+	EnterCriticalSection(&g_SSLTicketKeyLock);
+#else
+	pthread_mutex_lock(&g_SSLTicketKeyLock);
+#endif
+}
+
+/**
+ * UnlockSSLTicketKeys
  *
- * @param preverify_ok was the preverification of the certificate successful
- * @param x509ctx X509 context
+ * Releases the lock for the SSL session ticket keys.
  */
-int SSLVerifyCertificate(int preverify_ok, X509_STORE_CTX *x509ctx) {
-	SSL *ssl = (SSL *)X509_STORE_CTX_get_ex_data(x509ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
-	CConnection *Ptr = (CConnection *)SSL_get_ex_data(ssl, g_SSLCustomIndex);
+static void UnlockSSLTicketKeys(void) {
+#ifdef _WIN32
+	LeaveCriticalSection(&g_SSLTicketKeyLock);
+#else
+	pthread_mutex_unlock(&g_SSLTicketKeyLock);
+#endif
+}
 
-	if (Ptr != NULL) {
-		return Ptr->SSLVerify(preverify_ok, x509ctx);
-	} else {
-		return 0;
-	}
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX sslticketmac_t; /**< the MAC context for session tickets */
+
+/**
+ * InitSSLTicketMac
+ *
+ * Initializes the MAC context for a session ticket.
+ *
+ * @param MacContext the MAC context
+ * @param Key the ticket key
+ */
+static int InitSSLTicketMac(EVP_MAC_CTX *MacContext, sslticketkey_t *Key) {
+	OSSL_PARAM Params[3];
+
+	Params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, Key->HmacKey, sizeof(Key->HmacKey));
+	Params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0);
+	Params[2] = OSSL_PARAM_construct_end();
+
+	return EVP_MAC_CTX_set_params(MacContext, Params);
+}
+#else
+typedef HMAC_CTX sslticketmac_t; /**< the MAC context for session tickets */
+
+/**
+ * InitSSLTicketMac
+ *
+ * Initializes the HMAC context for a session ticket.
+ *
+ * @param MacContext the HMAC context
+ * @param Key the ticket key
+ */
+static int InitSSLTicketMac(HMAC_CTX *MacContext, sslticketkey_t *Key) {
+	return HMAC_Init_ex(MacContext, Key->HmacKey, sizeof(Key->HmacKey), EVP_sha256(), NULL);
 }
 #endif
 
 /**
- * DebugImpulse
+ * SSLTicketKeyCallback
  *
- * Executes a debug command.
+ * Sets up the encryption of a new SSL session ticket, or the decryption of
+ * a ticket which was presented by a client.
  *
- * @param impulse the command
+ * @param ssl the SSL connection
+ * @param Name the name of the key
+ * @param IV the initialization vector
+ * @param CipherContext the cipher context
+ * @param MacContext the MAC context
+ * @param Encrypt whether a new ticket is being created
  */
-const char *CCore::DebugImpulse(int impulse) {
-	if (impulse == 6) {
-		int a = 23, b = 0, c;
-		
-		c = a / b;
+static int SSLTicketKeyCallback(SSL *ssl, unsigned char *Name, unsigned char *IV,
+		EVP_CIPHER_CTX *CipherContext, sslticketmac_t *MacContext, int Encrypt) {
+	sslticketkey_t Key;
+	int Index = -1;
+
+	LockSSLTicketKeys();
+
+	if (Encrypt) {
+		Index = 0;
+	} else {
+		for (int i = 0; i < 2; i++) {
+			if (memcmp(Name, g_SSLTicketKeys[i].Name, sizeof(Key.Name)) == 0) {
+				Index = i;
+
+				break;
+			}
+		}
 	}
 
-	if (impulse == 7) {
-		_exit(0);
+	if (Index != -1) {
+		Key = g_SSLTicketKeys[Index];
 	}
 
-	if (impulse == 12) {
-		int i = 0;
-		hash_t<CUser *> *User;
-		static char *Out = NULL;
-		unsigned int diff;
+	UnlockSSLTicketKeys();
 
-		while ((User = g_Bouncer->GetUsers()->Iterate(i++)) != NULL) {
-			if (User->Value->GetClientConnectionMultiplexer() == NULL && User->Value->GetIRCConnection() != NULL) {
-				CIRCConnection *IRC = User->Value->GetIRCConnection();
+	if (Index == -1) {
+		return 0;
+	}
 
-#ifndef _WIN32
-				timeval start, end;
+	if (Encrypt) {
+		if (RAND_bytes(IV, EVP_MAX_IV_LENGTH) <= 0) {
+			return -1;
+		}
+
+		memcpy(Name, Key.Name, sizeof(Key.Name));
+
+		if (EVP_EncryptInit_ex(CipherContext, EVP_aes_256_cbc(), NULL, Key.AesKey, IV) <= 0 ||
+				InitSSLTicketMac(MacContext, &Key) <= 0) {
+			return -1;
+		}
+
+		return 1;
+	}
+
+	if (InitSSLTicketMac(MacContext, &Key) <= 0 ||
+			EVP_DecryptInit_ex(CipherContext, EVP_aes_256_cbc(), NULL, Key.AesKey, IV) <= 0) {
+		return -1;
+	}
+
+	/* tickets which use the previous key are replaced */
+	return (Index == 0) ? 1 : 2;
+}
+
+/**
+ * SSLTicketKeyTimer
+ *
+ * Periodically replaces the key for SSL session tickets and removes
+ * expired sessions from the session cache.
+ *
+ * @param Now the current time
+ * @param Cookie not used
+ */
+static bool SSLTicketKeyTimer(time_t Now, void *Cookie) {
+	g_Bouncer->RotateSSLTicketKeys();
+
+	SSL_CTX_flush_sessions(g_Bouncer->GetSSLContext(), Now);
+
+	return true;
+}
+
+/**
+ * SSLNewSession
+ *
+ * Passes a new session for an outgoing SSL connection to the connection
+ * object so that it can be resumed later on.
+ *
+ * @param ssl the SSL connection
+ * @param Session the session
+ */
+static int SSLNewSession(SSL *ssl, SSL_SESSION *Session) {
+	CConnection *Ptr = (CConnection *)SSL_get_ex_data(ssl, g_SSLCustomIndex);
+
+	if (Ptr != NULL && Ptr->SSLNewSession(Session)) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * SSLVerifyCertificate
+ *
+ * Checks whether an SSL certificate is valid.
+ *
+ * @param preverify_ok was the preverification of the certificate successful
+ * @param x509ctx X509 context
+ */
+int SSLVerifyCertificate(int preverify_ok, X509_STORE_CTX *x509ctx) {
+	SSL *ssl = (SSL *)X509_STORE_CTX_get_ex_data(x509ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+	CConnection *Ptr = (CConnection *)SSL_get_ex_data(ssl, g_SSLCustomIndex);
+
+	if (Ptr != NULL) {
+		return Ptr->SSLVerify(preverify_ok, x509ctx);
+	} else {
+		return 0;
+	}
+}
+#endif
+
+/**
+ * InitializeSSLSessions
+ *
+ * Configures session resumption for the SSL contexts: the server context
+ * uses a session cache and session tickets (whose keys are rotated
+ * periodically), the client context passes new sessions to the IRC
+ * connections so that users can resume them when they reconnect.
+ */
+void CCore::InitializeSSLSessions(void) {
+#ifdef HAVE_LIBSSL
+	const char *Value;
+	int CacheSize, Timeout, Interval;
+
+	Value = m_Config->ReadString("system.sslsessioncache");
+	CacheSize = (Value != NULL) ? atoi(Value) : DEFAULT_SSLSESSIONCACHE;
+
+	Timeout = m_Config->ReadInteger("system.sslsessiontimeout");
+
+	if (Timeout <= 0) {
+		Timeout = DEFAULT_SSLSESSIONTIMEOUT;
+	}
+
+	Value = m_Config->ReadString("system.sslticketinterval");
+	Interval = (Value != NULL) ? atoi(Value) : DEFAULT_SSLTICKETINTERVAL;
+
+	SSL_CTX_set_timeout(m_SSLClientContext, Timeout);
+	SSL_CTX_set_session_cache_mode(m_SSLClientContext, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(m_SSLClientContext, SSLNewSession);
+
+	if (m_SSLContext == NULL) {
+		return;
+	}
+
+	if (CacheSize <= 0) {
+		SSL_CTX_set_session_cache_mode(m_SSLContext, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(m_SSLContext, SSL_OP_NO_TICKET);
+
+		return;
+	}
+
+	/* sessions can't be resumed without this when client certificates are requested */
+	SSL_CTX_set_session_id_context(m_SSLContext, (const unsigned char *)"sbnc", 4);
+
+	SSL_CTX_set_session_cache_mode(m_SSLContext, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(m_SSLContext, CacheSize);
+	SSL_CTX_set_timeout(m_SSLContext, Timeout);
+
+#ifdef _WIN32
+	InitializeCriticalSection(&g_SSLTicketKeyLock);
+#endif
+
+	/* both the current and the previous key need to be valid */
+	if (Interval <= 0 || !RotateSSLTicketKeys() || !RotateSSLTicketKeys()) {
+		SSL_CTX_set_options(m_SSLContext, SSL_OP_NO_TICKET);
+
+		return;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(m_SSLContext, SSLTicketKeyCallback);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(m_SSLContext, SSLTicketKeyCallback);
+#endif
+
+	new CTimer(Interval, true, SSLTicketKeyTimer, NULL);
+#endif
+}
+
+/**
+ * RotateSSLTicketKeys
+ *
+ * Generates a new key for SSL session tickets. Tickets which were issued
+ * using the previous key can still be used until the key is rotated again.
+ */
+bool CCore::RotateSSLTicketKeys(void) {
+#ifdef HAVE_LIBSSL
+	sslticketkey_t Key;
+
+	if (RAND_bytes((unsigned char *)&Key, sizeof(Key)) <= 0) {
+		Log("Could not generate a key for SSL session tickets.");
+
+		return false;
+	}
+
+	LockSSLTicketKeys();
+
+	g_SSLTicketKeys[1] = g_SSLTicketKeys[0];
+	g_SSLTicketKeys[0] = Key;
+
+	UnlockSSLTicketKeys();
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * DebugImpulse
+ *
+ * Executes a debug command.
+ *
+ * @param impulse the command
+ */
+const char *CCore::DebugImpulse(int impulse) {
+	if (impulse == 6) {
+		int a = 23, b = 0, c;
+		
+		c = a / b;
+	}
+
+	if (impulse == 7) {
+		_exit(0);
+	}
+
+	if (impulse == 12) {
+		int i = 0;
+		hash_t<CUser *> *User;
+		static char *Out = NULL;
+		unsigned int diff;
+
+		while ((User = g_Bouncer->GetUsers()->Iterate(i++)) != NULL) {
+			if (User->Value->GetClientConnectionMultiplexer() == NULL && User->Value->GetIRCConnection() != NULL) {
+				CIRCConnection *IRC = User->Value->GetIRCConnection();
+
+#ifndef _WIN32
+				timeval start, end;
 
 				gettimeofday(&start, NULL);
 #else
@@ -1965,7 +2557,8 @@ void CCore::DeleteFakeClient(CFakeClient *FakeClient) const {
 /**
  * GetAdminUsers
  *
- * Returns a list of users who are admins.
+ * Returns a list of users who are admins. With multiple shards this
+ * only contains the users which are served by this process.
  */
 CVector<CUser *> *CCore::GetAdminUsers(void) {
 	return &m_AdminUsers;
@@ -1984,6 +2577,11 @@ RESULT<bool> CCore::AddAdditionalListener(unsigned int Port, const char *BindAdd
 	additionallistener_t AdditionalListener;
 	CClientListener *Listener, *ListenerV6;
 
+	/* the listeners are shared by all shards */
+	if (m_ShardCount > 1) {
+		THROW(bool, Generic_Unknown, "Listeners cannot be changed while shroudBNC is running with multiple shards.");
+	}
+
 	for (int i = 0; i < m_AdditionalListeners.GetLength(); i++) {
 		if (m_AdditionalListeners[i].Port == Port) {
 			THROW(bool, Generic_Unknown, "This port is already in use.");
@@ -2048,6 +2646,10 @@ RESULT<bool> CCore::AddAdditionalListener(unsigned int Port, const char *BindAdd
  * @param Port the port of the listener
  */
 RESULT<bool> CCore::RemoveAdditionalListener(unsigned int Port) {
+	if (m_ShardCount > 1) {
+		THROW(bool, Generic_Unknown, "Listeners cannot be changed while shroudBNC is running with multiple shards.");
+	}
+
 	for (int i = 0; i < m_AdditionalListeners.GetLength(); i++) {
 		if (m_AdditionalListeners[i].Port == Port) {
 			if (m_AdditionalListeners[i].Listener != NULL) {
@@ -2245,7 +2847,7 @@ CClientListener *CCore::GetMainSSLListenerV6(void) const {
 }
 
 int CCore::GetResourceLimit(const char *Resource, CUser *User) {
-	int i = 0, rc;
+	int i = 0;
 
 	if (Resource == NULL || (User != NULL && User->IsAdmin())) {
 		if (Resource != NULL && strcasecmp(Resource, "clients") == 0) {
@@ -2257,31 +2859,15 @@ int CCore::GetResourceLimit(const char *Resource, CUser *User) {
 
 	while (g_ResourceLimits[i].Resource != NULL) {
 		if (strcasecmp(g_ResourceLimits[i].Resource, Resource) == 0) {
-			char *Name;
-
 			if (User != NULL) {
-				rc = asprintf(&Name, "user.max%s", Resource);
+				const char *UserLimit = User->GetConfigCache()->GetString(g_ResourceLimits[i].UserOption);
 
-				if (!RcFailed(rc)) {
-					CResult<int> UserLimit = User->GetConfig()->ReadInteger(Name);
-
-					if (!IsError(UserLimit)) {
-						return UserLimit;
-					}
-
-					free(Name);
+				if (UserLimit != NULL) {
+					return atoi(UserLimit);
 				}
 			}
 
-			rc = asprintf(&Name, "system.max%s", Resource);
-
-			if (RcFailed(rc)) {
-				return g_ResourceLimits[i].DefaultLimit;
-			}
-
-			int Value = m_Config->ReadInteger(Name);
-
-			free(Name);
+			int Value = m_ConfigCache.GetInteger(g_ResourceLimits[i].SystemOption);
 
 			if (Value == 0) {
 				return g_ResourceLimits[i].DefaultLimit;
@@ -2316,6 +2902,8 @@ void CCore::SetResourceLimit(const char *Resource, int Limit, CUser *User) {
 	}
 
 	Config->WriteInteger(Name, Limit);
+
+	free(Name);
 }
 
 int CCore::GetInterval(void) const {
@@ -2327,6 +2915,22 @@ void CCore::SetInterval(int Interval) {
 	CacheSetInteger(m_ConfigCache, interval, Interval);
 }
 
+/**
+ * GetConfigDelay
+ *
+ * Returns the number of seconds changes to configuration objects are
+ * buffered before they're written to disk.
+ */
+int CCore::GetConfigDelay(void) const {
+	int Delay = CacheGetInteger(m_ConfigCache, configdelay);
+
+	if (Delay <= 0) {
+		return DEFAULT_CONFIGDELAY;
+	} else {
+		return Delay;
+	}
+}
+
 bool CCore::GetMD5(void) const {
 	if (CacheGetInteger(m_ConfigCache, md5) != 0) {
 		return true;
@@ -2359,10 +2963,521 @@ void CCore::SetDontMatchUser(bool Value) {
 	CacheSetInteger(m_ConfigCache, dontmatchuser, Value ? 1 : 0);
 }
 
-CACHE(System) *CCore::GetConfigCache(void) {
+CCacheSystem *CCore::GetConfigCache(void) {
 	return &m_ConfigCache;
 }
 
+/**
+ * ScheduleWakeup
+ *
+ * Makes sure that the main loop wakes up after the specified number of
+ * milliseconds even if none of the sockets has any events. This is meant
+ * to be called from HasQueuedData() by sockets which need to delay their
+ * output.
+ *
+ * @param Milliseconds the number of milliseconds
+ */
+void CCore::ScheduleWakeup(int Milliseconds) {
+	if (m_WakeupTimeout == -1 || Milliseconds < m_WakeupTimeout) {
+		m_WakeupTimeout = Milliseconds;
+	}
+}
+
+/**
+ * CreateDeadline
+ *
+ * Creates a deadline. The deadline isn't armed until SetDeadline() is
+ * called for it. Modules which need lots of timers should multiplex them
+ * onto a single deadline (e.g. using a heap). Deadlines have to be destroyed
+ * before the module which created them is unloaded.
+ *
+ * @param Proc the function which is called when the deadline has passed
+ * @param Cookie the function's argument
+ */
+deadline_t *CCore::CreateDeadline(DeadlineProc Proc, void *Cookie) {
+	deadline_t *Deadline;
+
+	Deadline = (deadline_t *)malloc(sizeof(deadline_t));
+
+	if (AllocFailed(Deadline)) {
+		return NULL;
+	}
+
+	Deadline->Due = 0;
+	Deadline->Pass = m_DeadlinePass;
+	Deadline->Proc = Proc;
+	Deadline->Cookie = Cookie;
+
+	if (!m_Deadlines.Insert(Deadline)) {
+		free(Deadline);
+
+		return NULL;
+	}
+
+	return Deadline;
+}
+
+/**
+ * SetDeadline
+ *
+ * Arms (or disarms) a deadline. The deadline's function is called once
+ * after GetMonotonicTime() has reached the specified value; it has to set
+ * the deadline again if it wants to be called repeatedly.
+ *
+ * @param Deadline the deadline
+ * @param Due the GetMonotonicTime() at which the function should be called,
+ *            or 0 to disarm the deadline
+ */
+void CCore::SetDeadline(deadline_t *Deadline, uint64_t Due) {
+	Deadline->Due = Due;
+	Deadline->Pass = m_DeadlinePass;
+}
+
+/**
+ * DestroyDeadline
+ *
+ * Destroys a deadline. This may be called from the deadline's own function.
+ *
+ * @param Deadline the deadline
+ */
+void CCore::DestroyDeadline(deadline_t *Deadline) {
+	if (Deadline == NULL) {
+		return;
+	}
+
+	m_Deadlines.Remove(Deadline);
+
+	free(Deadline);
+}
+
+/**
+ * GetDeadlineTimeout
+ *
+ * Returns the number of milliseconds until the next deadline passes,
+ * or -1 if there are no armed deadlines.
+ */
+int CCore::GetDeadlineTimeout(void) const {
+	uint64_t Now, Next = 0;
+
+	for (int i = 0; i < m_Deadlines.GetLength(); i++) {
+		uint64_t Due = m_Deadlines[i]->Due;
+
+		if (Due != 0 && (Next == 0 || Due < Next)) {
+			Next = Due;
+		}
+	}
+
+	if (Next == 0) {
+		return -1;
+	}
+
+	Now = GetMonotonicTime();
+
+	if (Next <= Now) {
+		return 0;
+	} else if (Next - Now > INT_MAX) {
+		return INT_MAX;
+	} else {
+		return (int)(Next - Now);
+	}
+}
+
+/**
+ * CallDeadlines
+ *
+ * Calls the functions for all deadlines which have passed. Deadlines which
+ * are set by these functions aren't called until the next iteration of
+ * the main loop.
+ */
+void CCore::CallDeadlines(void) {
+	uint64_t Now;
+	deadline_t *Deadline;
+	int i;
+
+	if (m_Deadlines.GetLength() == 0) {
+		return;
+	}
+
+	m_DeadlinePass++;
+
+	Now = GetMonotonicTime();
+
+	/* the functions may create or destroy deadlines, so the search starts
+	 * over after each call */
+	do {
+		Deadline = NULL;
+
+		for (i = 0; i < m_Deadlines.GetLength(); i++) {
+			deadline_t *Candidate = m_Deadlines[i];
+
+			if (Candidate->Due != 0 && Candidate->Due <= Now && Candidate->Pass != m_DeadlinePass) {
+				Deadline = Candidate;
+
+				break;
+			}
+		}
+
+		if (Deadline != NULL) {
+			Deadline->Due = 0;
+			Deadline->Proc(Deadline->Cookie);
+		}
+	} while (Deadline != NULL);
+}
+
+/**
+ * LoadUsers
+ *
+ * Creates the user objects for all users in the user list which are
+ * served by this process.
+ */
+void CCore::LoadUsers(void) {
+	const char *Args;
+	int Count;
+	CUser *User;
+
+	Args = ArgTokenize(CacheGetString(m_ConfigCache, users));
+
+	if (AllocFailed(Args)) {
+		Fatal();
+	}
+
+	Count = ArgCount(Args);
+
+	for (int i = 0; i < Count; i++) {
+		const char *Name = ArgGet(Args, i + 1);
+
+		if (GetUserShard(Name) != m_ShardIndex) {
+			continue;
+		}
+
+		User = new CUser(Name);
+
+		if (AllocFailed(User)) {
+			Fatal();
+		}
+
+		m_Users.Add(Name, User);
+	}
+
+	ArgFree(Args);
+
+	if (m_UserDatabase != NULL && m_UserDatabase->GetImportCount() > 0) {
+		Log("Imported %u user(s) into the user database.", m_UserDatabase->GetImportCount());
+
+		RESULT<bool> Result = m_UserDatabase->Save();
+
+		if (IsError(Result)) {
+			Log("Could not save the user database: %s", GETDESCRIPTION(Result));
+		}
+	}
+
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t g_ShardSignal = 0; /**< a signal which the shard supervisor has to pass on to the shards */
+
+/**
+ * ShardSignalHandler
+ *
+ * Remembers signals which the shard supervisor has to pass on to the shards.
+ *
+ * @param Signal the signal
+ */
+static void ShardSignalHandler(int Signal) {
+	g_ShardSignal = Signal;
+}
+#endif /* _WIN32 */
+
+/**
+ * StartShards
+ *
+ * Forks the shard processes; each of them serves a disjoint subset of the
+ * users. The original process becomes the shard supervisor: it restarts
+ * shards which have crashed and exits once the shards have exited. This
+ * function therefore only returns in the shard processes (or if sharding
+ * could not be enabled).
+ *
+ * @param Count the number of shards
+ */
+bool CCore::StartShards(int Count) {
+#ifndef _WIN32
+	pid_t Pids[SHARD_MAXSHARDS];
+	time_t Started[SHARD_MAXSHARDS];
+	struct sigaction Action;
+	bool Shutdown = false;
+	int i;
+
+	if (Count > SHARD_MAXSHARDS) {
+		Count = SHARD_MAXSHARDS;
+	}
+
+	/* neither the database nor SSL sessions can be shared between processes */
+	if (m_UserDatabase != NULL) {
+		Log("Shards cannot be used together with the user database (system.userdb).");
+
+		return false;
+	}
+
+	bool SSL = (m_SSLListener != NULL || m_SSLListenerV6 != NULL);
+
+	for (i = 0; i < m_AdditionalListeners.GetLength(); i++) {
+		if (m_AdditionalListeners[i].SSL) {
+			SSL = true;
+		}
+	}
+
+	if (SSL) {
+		Log("Shards cannot be used together with SSL listeners.");
+
+		return false;
+	}
+
+	m_ShardSockets = (SOCKET *)malloc(sizeof(SOCKET) * 2 * Count);
+
+	if (AllocFailed(m_ShardSockets)) {
+		return false;
+	}
+
+	for (i = 0; i < Count; i++) {
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, &m_ShardSockets[2 * i]) < 0) {
+			Log("Could not create socket pair for the shards: %s", strerror(errno));
+
+			for (int a = 0; a < 2 * i; a++) {
+				closesocket(m_ShardSockets[a]);
+			}
+
+			free(m_ShardSockets);
+			m_ShardSockets = NULL;
+
+			return false;
+		}
+	}
+
+	m_ShardCount = Count;
+
+	memset(&Action, 0, sizeof(Action));
+	Action.sa_handler = ShardSignalHandler;
+	sigemptyset(&Action.sa_mask);
+
+	sigaction(SIGTERM, &Action, NULL);
+	sigaction(SIGINT, &Action, NULL);
+	sigaction(SIGHUP, &Action, NULL);
+
+	for (i = 0; i < Count; i++) {
+		Started[i] = time(NULL);
+		Pids[i] = ForkShard(i);
+
+		if (Pids[i] == 0) {
+			return true;
+		}
+	}
+
+	Log("Started %d shard(s).", Count);
+
+	while (true) {
+		int Status;
+		pid_t Pid = waitpid(-1, &Status, 0);
+
+		time(&g_CurrentTime);
+
+		if (g_ShardSignal != 0) {
+			Shutdown = true;
+
+			for (i = 0; i < Count; i++) {
+				if (Pids[i] > 0) {
+					kill(Pids[i], g_ShardSignal);
+				}
+			}
+
+			g_ShardSignal = 0;
+		}
+
+		if (Pid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			/* there are no shards left */
+			break;
+		}
+
+		for (i = 0; i < Count; i++) {
+			if (Pids[i] == Pid) {
+				break;
+			}
+		}
+
+		if (i == Count) {
+			continue;
+		}
+
+		Pids[i] = -1;
+
+		if (Shutdown) {
+			continue;
+		}
+
+		if (WIFEXITED(Status) && WEXITSTATUS(Status) == EXIT_SUCCESS) {
+			/* e.g. the "die" command, which is meant for the whole bouncer */
+			Log("Shard %d has exited. Shutting down the other shards.", i);
+
+			Shutdown = true;
+
+			for (int a = 0; a < Count; a++) {
+				if (Pids[a] > 0) {
+					kill(Pids[a], SIGTERM);
+				}
+			}
+
+			continue;
+		}
+
+		Log("Shard %d (pid %d) has crashed. Restarting it.", i, (int)Pid);
+
+		/* don't restart a shard which crashes right away too often */
+		if (time(NULL) - Started[i] < 10) {
+			sleep(10);
+
+			time(&g_CurrentTime);
+
+			if (g_ShardSignal != 0) {
+				continue;
+			}
+		}
+
+		Started[i] = time(NULL);
+		Pids[i] = ForkShard(i);
+
+		if (Pids[i] == 0) {
+			return true;
+		}
+	}
+
+	Log("All shards have exited.");
+
+	/* the shards have saved everything, our copy of the configuration is out of date */
+	UnlockPidFile();
+
+	exit(EXIT_SUCCESS);
+#else /* _WIN32 */
+	Log("Shards are not supported on this platform.");
+
+	return false;
+#endif /* _WIN32 */
+}
+
+/**
+ * ForkShard
+ *
+ * Starts a shard process. Returns the shard's pid in the supervisor,
+ * 0 in the shard process and -1 if the process could not be started.
+ *
+ * @param Index the index of the shard
+ */
+int CCore::ForkShard(int Index) {
+#ifndef _WIN32
+	pid_t Pid = fork();
+
+	if (Pid < 0) {
+		Log("Could not start shard %d: %s", Index, strerror(errno));
+
+		return -1;
+	} else if (Pid > 0) {
+		return Pid;
+	}
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+
+	m_ShardIndex = Index;
+
+	/* all shards share sbnc.conf and its journal, so none of them may change it */
+	m_Config->SetReadOnly(true);
+
+	/* we only need the sending ends of the other shards' socket pairs */
+	for (int i = 0; i < m_ShardCount; i++) {
+		if (i == Index) {
+			closesocket(m_ShardSockets[2 * i]);
+			m_ShardSockets[2 * i] = INVALID_SOCKET;
+		} else {
+			closesocket(m_ShardSockets[2 * i + 1]);
+			m_ShardSockets[2 * i + 1] = INVALID_SOCKET;
+		}
+	}
+
+	m_ShardChannel = new CShardChannel(m_ShardSockets[2 * Index + 1]);
+
+	if (AllocFailed(m_ShardChannel)) {
+		Fatal();
+	}
+
+	Log("Shard %d started (pid %d).", Index, (int)getpid());
+#endif /* _WIN32 */
+
+	return 0;
+}
+
+/**
+ * GetShardCount
+ *
+ * Returns the number of shard processes, or 1 if sharding is disabled.
+ */
+int CCore::GetShardCount(void) const {
+	return m_ShardCount;
+}
+
+/**
+ * GetShardIndex
+ *
+ * Returns the index of this shard process.
+ */
+int CCore::GetShardIndex(void) const {
+	return m_ShardIndex;
+}
+
+/**
+ * GetUserShard
+ *
+ * Returns the index of the shard which serves the specified user.
+ *
+ * @param Name the user's name
+ */
+int CCore::GetUserShard(const char *Name) const {
+	if (m_ShardCount <= 1 || Name == NULL) {
+		return 0;
+	}
+
+	return (int)(Hash(Name, false) % m_ShardCount);
+}
+
+/**
+ * GetShardChannel
+ *
+ * Returns the channel which receives clients from other shards, or NULL.
+ */
+CShardChannel *CCore::GetShardChannel(void) {
+	return m_ShardChannel;
+}
+
+/**
+ * HandOffClient
+ *
+ * Passes a client connection on to another shard.
+ *
+ * @param Shard the index of the shard
+ * @param Client the client's socket
+ * @param Data the handoff message (see CShardChannel)
+ * @param Length the length of the message
+ */
+bool CCore::HandOffClient(int Shard, SOCKET Client, const char *Data, size_t Length) {
+	if (Shard < 0 || Shard >= m_ShardCount || Shard == m_ShardIndex) {
+		return false;
+	}
+
+	return CShardChannel::Send(m_ShardSockets[2 * Shard], Client, Data, Length);
+}
+
 bool CCore::Daemonize(void) {
 #ifndef _WIN32
 	pid_t pid;
@@ -22,6 +22,18 @@
 
 #define DEFAULT_SENDQ (10 * 1024)
 
+/** The default number of SSL sessions which are cached for clients */
+#define DEFAULT_SSLSESSIONCACHE 1024
+
+/** The default number of seconds after which SSL sessions expire */
+#define DEFAULT_SSLSESSIONTIMEOUT 7200
+
+/** The default number of seconds after which a new key for SSL session tickets is generated */
+#define DEFAULT_SSLTICKETINTERVAL 3600
+
+/** The poll timeout (in milliseconds) while modules stay busy for more than one iteration of the main loop */
+#define MAINLOOP_BUSYTIMEOUT 50
+
 class CConfig;
 class CUser;
 class CLog;
@@ -33,6 +45,7 @@ class CModule;
 class CConnection;
 class CTimer;
 class CFakeClient;
+class CShardChannel;
 struct CSocketEvents;
 struct sockaddr_in;
 
@@ -41,19 +54,31 @@ struct sockaddr_in;
  *
  * Commonly used settings are cached.
  */
-DEFINE_CACHE(System)
-	DEFINE_OPTION_INT(dontmatchuser);
-	DEFINE_OPTION_INT(port);
-	DEFINE_OPTION_INT(sslport);
-	DEFINE_OPTION_INT(sendq);
-	DEFINE_OPTION_INT(md5);
-	DEFINE_OPTION_INT(interval);
-
-	DEFINE_OPTION_STRING(vhost);
-	DEFINE_OPTION_STRING(users);
-	DEFINE_OPTION_STRING(ip);
-	DEFINE_OPTION_STRING(motd);
-END_DEFINE_CACHE
+/**
+ * SYSTEM_OPTIONS
+ *
+ * The cached settings from sbnc.conf (without the "system." prefix).
+ */
+#define SYSTEM_OPTIONS(INT, STRING) \
+	INT(dontmatchuser) \
+	INT(port) \
+	INT(sslport) \
+	INT(sendq) \
+	INT(md5) \
+	INT(interval) \
+	INT(configdelay) \
+	INT(maxchannels) \
+	INT(maxnicks) \
+	INT(maxbans) \
+	INT(maxkeys) \
+	INT(maxclients) \
+	\
+	STRING(vhost) \
+	STRING(users) \
+	STRING(ip) \
+	STRING(motd)
+
+DEFINE_CACHE(System, "system.", SYSTEM_OPTIONS);
 
 /**
  * socket_t
@@ -88,6 +113,60 @@ typedef struct additionallistener_s {
 	CSocketEvents *ListenerV6; /**< IPv6 listener object */
 } additionallistener_t;
 
+/**
+ * module_event_t
+ *
+ * Events which modules can subscribe to (see CModuleFar::GetSubscriptions).
+ */
+typedef enum module_event_e {
+	ModuleEvent_None, /**< marks the end of a subscription list */
+	ModuleEvent_IRCMessage, /**< InterceptIRCMessage, the command is the IRC command or numeric */
+	ModuleEvent_ClientMessage, /**< InterceptClientMessage, the command is the client's command */
+	ModuleEvent_ClientCommand, /**< InterceptClientCommand, the command is the /sbnc command */
+	ModuleEvent_ModeChange, /**< SingleModeChange, the command is ignored */
+	ModuleEvent_MainLoop, /**< MainLoop, the command is ignored */
+	ModuleEvent_Max
+} module_event_t;
+
+/**
+ * modulesubscription_t
+ *
+ * An event a module is interested in.
+ */
+typedef struct modulesubscription_s {
+	module_event_t Event; /**< the event */
+	const char *Command; /**< the command (case-insensitive), or NULL for all commands */
+} modulesubscription_t;
+
+/**
+ * modulesubscribers_t
+ *
+ * The modules which have subscribed to an event, in the order in which they were loaded.
+ */
+typedef struct modulesubscribers_s {
+	CVector<CModule *> All; /**< modules which are interested in all commands */
+	CHashtable<CVector<CModule *> *, false> *Commands; /**< the modules for each command which any module has subscribed to */
+} modulesubscribers_t;
+
+/**
+ * DeadlineProc
+ *
+ * A function which is called on the main thread when a deadline has passed.
+ */
+typedef void (*DeadlineProc)(void *Cookie);
+
+/**
+ * deadline_t
+ *
+ * A millisecond timer which is managed by the main loop (see CCore::CreateDeadline).
+ */
+typedef struct deadline_s {
+	uint64_t Due; /**< the GetMonotonicTime() at which the function is called, or 0 */
+	unsigned int Pass; /**< the main loop iteration in which the deadline was set */
+	DeadlineProc Proc; /**< the function */
+	void *Cookie; /**< the function's argument */
+} deadline_t;
+
 /**
  * CCore
  *
@@ -102,12 +181,21 @@ class SBNCAPI CCore {
 
 	FILE *m_PidFile; /**< sbnc.pid file */
 	CConfig *m_Config; /**< sbnc.conf object */
+	CConfigDatabase *m_UserDatabase; /**< the users' settings, or NULL if they're stored in text files */
+	CWorkerPool *m_WorkerPool; /**< worker threads, or NULL if they're disabled */
+
+	int m_ShardCount; /**< the number of shard processes, or 1 if sharding is disabled */
+	int m_ShardIndex; /**< the index of this shard process */
+	SOCKET *m_ShardSockets; /**< the socket pairs for handing off clients (sending and receiving end for each shard) */
+	CShardChannel *m_ShardChannel; /**< receives clients from other shards, or NULL */
 
 	CClientListener *m_Listener, *m_ListenerV6; /**< the main unencrypted listeners */
 	CClientListener *m_SSLListener, *m_SSLListenerV6; /**< the main ssl listeners */
 
 	CHashtable<CUser *, false> m_Users; /**< the bouncer users */
 	CVector<CModule *> m_Modules; /**< currently loaded modules */
+	modulesubscribers_t m_ModuleSubscribers[ModuleEvent_Max]; /**< the modules for each event */
+	bool m_ModuleSubscriptionsDirty; /**< whether m_ModuleSubscribers needs to be rebuilt */
 	mutable CList<socket_t> m_OtherSockets; /**< a list of active sockets */
 	CList<CTimer *> m_Timers; /**< a list of active timers */
 
@@ -120,9 +208,14 @@ class SBNCAPI CCore {
 	bool m_LoadingModules; /**< are we currently loading modules? */
 	bool m_LoadingListeners; /**< are we currently loading listeners */
 
+	int m_WakeupTimeout; /**< the number of milliseconds until the main loop needs to wake up, or -1 */
+
+	CVector<deadline_t *> m_Deadlines; /**< deadlines which have been created by modules */
+	unsigned int m_DeadlinePass; /**< the number of times CallDeadlines() has been called */
+
 	CVector<char *> m_Args; /**< program arguments */
 
-	mutable CACHE(System) m_ConfigCache;
+	CCacheSystem m_ConfigCache;
 
 	SSL_CTX *m_SSLContext; /**< SSL context for client listeners */
 	SSL_CTX *m_SSLClientContext; /**< SSL context for IRC connections */
@@ -138,6 +231,9 @@ class SBNCAPI CCore {
 	CVector<const char *> *m_Capabilities;
 
 	void UpdateModuleConfig(void);
+	void UpdateModuleSubscribers(void);
+	int GetDeadlineTimeout(void) const;
+	void CallDeadlines(void);
 	void UpdateUserConfig(void);
 	void UnlockPidFile(void);
 	void WritePidFile(void);
@@ -146,10 +242,16 @@ class SBNCAPI CCore {
 	void InitializeSocket(void);
 	void UninitializeSocket(void);
 
+	void InitializeSSLSessions(void);
+
 	void InitializeAdditionalListeners(void);
 	void UninitializeAdditionalListeners(void);
 	void UpdateAdditionalListeners(void);
 
+	void LoadUsers(void);
+	bool StartShards(int Count);
+	int ForkShard(int Index);
+
 	bool Daemonize(void);
 public:
 #ifndef SWIG
@@ -168,11 +270,21 @@ public:
 	RESULT<CModule *> LoadModule(const char *Filename);
 	bool UnloadModule(CModule *Module);
 	const CVector<CModule *> *GetModules(void) const;
+	const CVector<CModule *> *GetModuleSubscribers(module_event_t Event, const char *Command);
+	void RefreshModuleSubscriptions(void);
 
 	void SetIdent(const char *Ident);
 	const char *GetIdent(void) const;
 
 	CConfig *GetConfig(void);
+	CConfigDatabase *GetUserDatabase(void);
+	CWorkerPool *GetWorkerPool(void);
+
+	int GetShardCount(void) const;
+	int GetShardIndex(void) const;
+	int GetUserShard(const char *Name) const;
+	CShardChannel *GetShardChannel(void);
+	bool HandOffClient(int Shard, SOCKET Client, const char *Data, size_t Length);
 
 	void RegisterSocket(SOCKET Socket, CSocketEvents *EventInterface);
 	void UnregisterSocket(SOCKET Socket);
@@ -218,6 +330,7 @@ public:
 	SSL_CTX *GetSSLContext(void) ;
 	SSL_CTX *GetSSLClientContext(void);
 	int GetSSLCustomIndex(void) const;
+	bool RotateSSLTicketKeys(void);
 
 	const char *DebugImpulse(int impulse);
 
@@ -259,6 +372,8 @@ public:
 	int GetInterval(void) const;
 	void SetInterval(int Interval);
 
+	int GetConfigDelay(void) const;
+
 	bool GetMD5(void) const;
 	void SetMD5(bool MD5Flag);
 
@@ -268,9 +383,17 @@ public:
 	bool GetDontMatchUser(void) const;
 	void SetDontMatchUser(bool Value);
 
-	CACHE(System) *GetConfigCache(void);
+	CCacheSystem *GetConfigCache(void);
 
 	CVector<const char *> *GetCapabilities(void);
+
+	void ScheduleWakeup(int Milliseconds);
+
+#ifndef SWIG
+	deadline_t *CreateDeadline(DeadlineProc Proc, void *Cookie);
+	void SetDeadline(deadline_t *Deadline, uint64_t Due);
+	void DestroyDeadline(deadline_t *Deadline);
+#endif /* SWIG */
 };
 
 #ifndef SWIG
@@ -20,6 +20,102 @@
 #include "StdAfx.h"
 
 ares_channel CDnsQuery::m_DnsChannel; /**< ares channel object */
+CVector<CDnsSocket *> CDnsQuery::m_Sockets;
+CVector<CDnsSocket *> CDnsQuery::m_ClosedSockets;
+CHashtable<dnscacheentry_t *, false> *CDnsQuery::m_Cache;
+unsigned int CDnsQuery::m_CacheHits;
+unsigned int CDnsQuery::m_CacheMisses;
+unsigned int CDnsQuery::m_CacheCoalesced;
+
+void DnsSocketStateCallback(void *Cookie, ares_socket_t Socket, int Readable, int Writable);
+
+/**
+ * CopyHostEnt
+ *
+ * Creates a copy of a hostent structure, which can be freed using
+ * FreeHostEnt().
+ *
+ * @param HostEnt the hostent structure
+ */
+static hostent *CopyHostEnt(const hostent *HostEnt) {
+	hostent *Copy;
+	int Count;
+
+	Copy = (hostent *)malloc(sizeof(hostent));
+
+	if (AllocFailed(Copy)) {
+		return NULL;
+	}
+
+	memset(Copy, 0, sizeof(hostent));
+
+	Copy->h_addrtype = HostEnt->h_addrtype;
+	Copy->h_length = HostEnt->h_length;
+
+	if (HostEnt->h_name != NULL) {
+		Copy->h_name = strdup(HostEnt->h_name);
+	}
+
+	for (Count = 0; HostEnt->h_aliases != NULL && HostEnt->h_aliases[Count] != NULL; Count++)
+		; // empty
+
+	Copy->h_aliases = (char **)malloc((Count + 1) * sizeof(char *));
+
+	if (Copy->h_aliases != NULL) {
+		for (int i = 0; i < Count; i++) {
+			Copy->h_aliases[i] = strdup(HostEnt->h_aliases[i]);
+		}
+
+		Copy->h_aliases[Count] = NULL;
+	}
+
+	for (Count = 0; HostEnt->h_addr_list != NULL && HostEnt->h_addr_list[Count] != NULL; Count++)
+		; // empty
+
+	Copy->h_addr_list = (char **)malloc((Count + 1) * sizeof(char *));
+
+	if (Copy->h_addr_list != NULL) {
+		for (int i = 0; i < Count; i++) {
+			Copy->h_addr_list[i] = (char *)malloc(HostEnt->h_length);
+
+			if (Copy->h_addr_list[i] != NULL) {
+				memcpy(Copy->h_addr_list[i], HostEnt->h_addr_list[i], HostEnt->h_length);
+			}
+		}
+
+		Copy->h_addr_list[Count] = NULL;
+	}
+
+	return Copy;
+}
+
+/**
+ * FreeHostEnt
+ *
+ * Frees a hostent structure which was created by CopyHostEnt().
+ *
+ * @param HostEnt the hostent structure
+ */
+static void FreeHostEnt(hostent *HostEnt) {
+	if (HostEnt == NULL) {
+		return;
+	}
+
+	free(HostEnt->h_name);
+
+	for (int i = 0; HostEnt->h_aliases != NULL && HostEnt->h_aliases[i] != NULL; i++) {
+		free(HostEnt->h_aliases[i]);
+	}
+
+	free(HostEnt->h_aliases);
+
+	for (int i = 0; HostEnt->h_addr_list != NULL && HostEnt->h_addr_list[i] != NULL; i++) {
+		free(HostEnt->h_addr_list[i]);
+	}
+
+	free(HostEnt->h_addr_list);
+	free(HostEnt);
+}
 
 /**
  * GenericDnsQueryCallback
@@ -35,13 +131,11 @@ ares_channel CDnsQuery::m_DnsChannel; /**< ares channel object */
 void GenericDnsQueryCallback(void *CookieRaw, int Status, int Timeouts, hostent *HostEntity) {
 	DnsEventCookie *Cookie = (DnsEventCookie *)CookieRaw;
 
-	if (Cookie->Query == NULL) {
-		return;
+	if (Cookie->Query != NULL) {
+		Cookie->Query->m_PendingQueries--;
+		Cookie->Query->AsyncDnsEvent(Status, HostEntity);
 	}
 
-	Cookie->Query->AsyncDnsEvent(Status, HostEntity);
-	Cookie->Query->m_PendingQueries--;
-
 	Cookie->RefCount--;
 
 	if (Cookie->RefCount <= 0) {
@@ -49,6 +143,77 @@ void GenericDnsQueryCallback(void *CookieRaw, int Status, int Timeouts, hostent
 	}
 }
 
+/**
+ * DnsCacheSearchCallback
+ *
+ * Called by c-ares when a forward lookup for a cache entry has completed.
+ *
+ * @param Cookie the cache entry
+ * @param Status the status of the dns query
+ * @param Timeouts the number of timeouts that occured while querying the dns servers
+ * @param Buffer the dns response
+ * @param Length the length of the response
+ */
+void DnsCacheSearchCallback(void *Cookie, int Status, int Timeouts, unsigned char *Buffer, int Length) {
+	dnscacheentry_t *Entry = (dnscacheentry_t *)Cookie;
+	hostent *Response = NULL;
+	int Count = DNSCACHE_MAXADDRESSES, TTL = DNSCACHE_MAXTTL;
+
+	if (Status == ARES_SUCCESS) {
+#ifdef HAVE_IPV6
+		if (Entry->Family == AF_INET6) {
+			ares_addr6ttl TTLs[DNSCACHE_MAXADDRESSES];
+
+			Status = ares_parse_aaaa_reply(Buffer, Length, &Response, TTLs, &Count);
+
+			for (int i = 0; Status == ARES_SUCCESS && i < Count; i++) {
+				TTL = min(TTL, TTLs[i].ttl);
+			}
+		} else {
+#endif /* HAVE_IPV6 */
+			ares_addrttl TTLs[DNSCACHE_MAXADDRESSES];
+
+			Status = ares_parse_a_reply(Buffer, Length, &Response, TTLs, &Count);
+
+			for (int i = 0; Status == ARES_SUCCESS && i < Count; i++) {
+				TTL = min(TTL, TTLs[i].ttl);
+			}
+#ifdef HAVE_IPV6
+		}
+#endif /* HAVE_IPV6 */
+	}
+
+	// like ares_gethostbyname() we fall back to IPv4 if there are no IPv6 addresses
+	if ((Status == ARES_ENODATA || Status == ARES_EBADRESP) && Entry->Family == AF_INET6 && CDnsQuery::m_DnsChannel != NULL) {
+		const char *Name = strchr(Entry->Key, '/') + 1;
+
+		Entry->Family = AF_INET;
+		ares_search(CDnsQuery::m_DnsChannel, Name, ns_c_in, ns_t_a, DnsCacheSearchCallback, Entry);
+
+		return;
+	}
+
+	CDnsQuery::CompleteCacheEntry(Entry, Status, Response, TTL);
+
+	if (Response != NULL) {
+		ares_free_hostent(Response);
+	}
+}
+
+/**
+ * DnsCacheAddrCallback
+ *
+ * Called by c-ares when a reverse lookup for a cache entry has completed.
+ *
+ * @param Cookie the cache entry
+ * @param Status the status of the dns query
+ * @param Timeouts the number of timeouts that occured while querying the dns servers
+ * @param HostEntity the response for the dns query (can be NULL)
+ */
+void DnsCacheAddrCallback(void *Cookie, int Status, int Timeouts, hostent *HostEntity) {
+	CDnsQuery::CompleteCacheEntry((dnscacheentry_t *)Cookie, Status, HostEntity, DNSCACHE_PTRTTL);
+}
+
 /**
  * CDnsQuery
  *
@@ -78,7 +243,9 @@ CDnsQuery::CDnsQuery(void *EventInterface, DnsEventFunction EventFunction, int T
 		ares_options Options;
 
 		Options.timeout = m_Timeout;
-		ares_init_options(&m_DnsChannel, &Options, ARES_OPT_TIMEOUT);
+		Options.sock_state_cb = DnsSocketStateCallback;
+		Options.sock_state_cb_data = NULL;
+		ares_init_options(&m_DnsChannel, &Options, ARES_OPT_TIMEOUT | ARES_OPT_SOCK_STATE_CB);
 	}
 }
 
@@ -108,25 +275,31 @@ CDnsQuery::~CDnsQuery(void) {
 void CDnsQuery::GetHostByName(const char *Host, int Family) {
 	struct addrinfo hints = {}, *result;
 
+	/* literals are parsed regardless of the family so that they never end up in the DNS */
 	hints.ai_flags = AI_NUMERICHOST;
-	hints.ai_family = Family;
+	hints.ai_family = AF_UNSPEC;
 
 	if (getaddrinfo(Host, NULL, &hints, &result) == 0) {
 		struct hostent hent = {};
 		char *Address;
 		char *AddressList[2];
 
+		if (result->ai_family != Family || (Family != AF_INET && Family != AF_INET6)) {
+			freeaddrinfo(result);
+
+			m_EventCookie->RefCount++;
+			GenericDnsQueryCallback(m_EventCookie, ARES_ENODATA, 0, NULL);
+
+			return;
+		}
+
 		hent.h_addrtype = result->ai_family;
 		hent.h_length = INADDR_LEN(result->ai_family);
 
 		if (result->ai_family == AF_INET) {
 			Address = (char *)&(((sockaddr_in *)result->ai_addr)->sin_addr);
-		} else if (result->ai_family == AF_INET6) {
-			Address = (char *)&(((sockaddr_in6 *)result->ai_addr)->sin6_addr);
 		} else {
-			m_EventCookie->RefCount++;
-			GenericDnsQueryCallback(m_EventCookie, ARES_EBADNAME, 0, NULL);
-			return;
+			Address = (char *)&(((sockaddr_in6 *)result->ai_addr)->sin6_addr);
 		}
 
 		AddressList[0] = Address;
@@ -142,9 +315,31 @@ void CDnsQuery::GetHostByName(const char *Host, int Family) {
 		return;
 	}
 
-	m_PendingQueries++;
-	m_EventCookie->RefCount++;
-	ares_gethostbyname(m_DnsChannel, Host, Family, GenericDnsQueryCallback, m_EventCookie);
+	hostent *HostEnt;
+
+	if (ares_gethostbyname_file(m_DnsChannel, Host, Family, &HostEnt) == ARES_SUCCESS) {
+		m_EventCookie->RefCount++;
+		GenericDnsQueryCallback(m_EventCookie, ARES_SUCCESS, 0, HostEnt);
+
+		ares_free_hostent(HostEnt);
+
+		return;
+	}
+
+	char *Key;
+	dnscacheentry_t *Entry;
+
+	int rc = asprintf(&Key, "%d/%s", Family, Host);
+
+	if (RcFailed(rc)) {
+		return;
+	}
+
+	if (!LookupCache(Key, Family, &Entry)) {
+		ares_search(m_DnsChannel, Host, ns_c_in, (Family == AF_INET6) ? ns_t_aaaa : ns_t_a, DnsCacheSearchCallback, Entry);
+	}
+
+	free(Key);
 }
 
 /**
@@ -168,10 +363,202 @@ void CDnsQuery::GetHostByAddr(sockaddr *Address) {
 	}
 #endif /* HAVE_IPV6 */
 
+	char *Key;
+	dnscacheentry_t *Entry;
+
+	int rc = asprintf(&Key, "ptr/%s", IpToString(Address));
+
+	if (RcFailed(rc)) {
+		return;
+	}
+
+	if (!LookupCache(Key, 0, &Entry)) {
+		ares_gethostbyaddr(m_DnsChannel, IpAddr, INADDR_LEN(Address->sa_family),
+			Address->sa_family, DnsCacheAddrCallback, Entry);
+	}
+
+	free(Key);
+}
+
+/**
+ * LookupCache
+ *
+ * Answers a lookup from the cache or attaches it to a pending query.
+ * Returns false if a new query has to be started for the returned entry,
+ * true otherwise.
+ *
+ * @param Key the key for the lookup
+ * @param Family the address family, or 0 for reverse lookups
+ * @param Entry receives the new cache entry
+ */
+bool CDnsQuery::LookupCache(const char *Key, int Family, dnscacheentry_t **Entry) {
+	dnscacheentry_t *CacheEntry;
+
+	if (m_Cache == NULL) {
+		m_Cache = new CHashtable<dnscacheentry_t *, false>();
+
+		if (AllocFailed(m_Cache)) {
+			g_Bouncer->Fatal();
+		}
+	}
+
+	CacheEntry = m_Cache->Get(Key);
+
+	if (CacheEntry != NULL && !CacheEntry->Pending && CacheEntry->Expires <= g_CurrentTime) {
+		RemoveCacheEntry(CacheEntry);
+
+		CacheEntry = NULL;
+	}
+
 	m_PendingQueries++;
 	m_EventCookie->RefCount++;
-	ares_gethostbyaddr(m_DnsChannel, IpAddr, INADDR_LEN(Address->sa_family),
-		Address->sa_family, GenericDnsQueryCallback, m_EventCookie);
+
+	if (CacheEntry != NULL && CacheEntry->Pending) {
+		m_CacheCoalesced++;
+
+		if (IsError(CacheEntry->Waiters.Insert(m_EventCookie))) {
+			GenericDnsQueryCallback(m_EventCookie, ARES_ENOMEM, 0, NULL);
+		}
+
+		return true;
+	} else if (CacheEntry != NULL) {
+		m_CacheHits++;
+
+		GenericDnsQueryCallback(m_EventCookie, CacheEntry->Status, 0, CacheEntry->Response);
+
+		return true;
+	}
+
+	m_CacheMisses++;
+
+	if (m_Cache->GetLength() >= DNSCACHE_MAXENTRIES) {
+		PurgeCache();
+	}
+
+	CacheEntry = new dnscacheentry_t;
+
+	if (AllocFailed(CacheEntry)) {
+		g_Bouncer->Fatal();
+	}
+
+	CacheEntry->Key = strdup(Key);
+
+	if (AllocFailed(CacheEntry->Key)) {
+		g_Bouncer->Fatal();
+	}
+
+	CacheEntry->Family = Family;
+	CacheEntry->Pending = true;
+	CacheEntry->Status = ARES_SUCCESS;
+	CacheEntry->Response = NULL;
+	CacheEntry->Expires = 0;
+
+	if (IsError(CacheEntry->Waiters.Insert(m_EventCookie)) || IsError(m_Cache->Add(Key, CacheEntry))) {
+		g_Bouncer->Fatal();
+	}
+
+	*Entry = CacheEntry;
+
+	return false;
+}
+
+/**
+ * CompleteCacheEntry
+ *
+ * Stores the result of a query in the cache and notifies the lookups
+ * which are waiting for it.
+ *
+ * @param Entry the cache entry
+ * @param Status the c-ares status code
+ * @param Response the response (can be NULL)
+ * @param TTL the number of seconds the response may be cached
+ */
+void CDnsQuery::CompleteCacheEntry(dnscacheentry_t *Entry, int Status, hostent *Response, int TTL) {
+	DnsEventCookie **Waiters;
+	int WaiterCount;
+	hostent *Copy = NULL;
+	bool Cache;
+
+	if (Status == ARES_SUCCESS && Response != NULL) {
+		Copy = CopyHostEnt(Response);
+		Cache = (Copy != NULL);
+		TTL = max(TTL, DNSCACHE_MINTTL);
+	} else {
+		// only cache definitive answers, not timeouts and other errors
+		Cache = (Status == ARES_ENOTFOUND || Status == ARES_ENODATA);
+		TTL = DNSCACHE_NEGATIVETTL;
+	}
+
+	WaiterCount = Entry->Waiters.GetLength();
+	Waiters = (DnsEventCookie **)malloc(WaiterCount * sizeof(DnsEventCookie *));
+
+	if (AllocFailed(Waiters)) {
+		g_Bouncer->Fatal();
+	}
+
+	memcpy(Waiters, Entry->Waiters.GetList(), WaiterCount * sizeof(DnsEventCookie *));
+
+	Entry->Waiters.Clear();
+	Entry->Pending = false;
+
+	// new lookups which are started by the callbacks use the cached result
+	if (Cache) {
+		Entry->Status = Status;
+		Entry->Response = Copy;
+		Entry->Expires = g_CurrentTime + TTL;
+	} else {
+		RemoveCacheEntry(Entry);
+	}
+
+	for (int i = 0; i < WaiterCount; i++) {
+		GenericDnsQueryCallback(Waiters[i], Status, 0, Response);
+	}
+
+	free(Waiters);
+}
+
+/**
+ * RemoveCacheEntry
+ *
+ * Removes an entry from the cache and destroys it.
+ *
+ * @param Entry the cache entry
+ */
+void CDnsQuery::RemoveCacheEntry(dnscacheentry_t *Entry) {
+	m_Cache->Remove(Entry->Key);
+
+	FreeHostEnt(Entry->Response);
+	free(Entry->Key);
+
+	delete Entry;
+}
+
+/**
+ * PurgeCache
+ *
+ * Removes expired entries from the cache. If that doesn't free up enough
+ * room all entries which aren't pending are removed.
+ */
+void CDnsQuery::PurgeCache(void) {
+	CVector<dnscacheentry_t *> Expired;
+	bool All = false;
+	int i;
+
+	for (int Pass = 0; Pass < 2 && m_Cache->GetLength() >= DNSCACHE_MAXENTRIES; Pass++) {
+		i = 0;
+		while (hash_t<dnscacheentry_t *> *CacheEntry = m_Cache->Iterate(i++)) {
+			if (!CacheEntry->Value->Pending && (All || CacheEntry->Value->Expires <= g_CurrentTime)) {
+				Expired.Insert(CacheEntry->Value);
+			}
+		}
+
+		for (i = 0; i < Expired.GetLength(); i++) {
+			RemoveCacheEntry(Expired[i]);
+		}
+
+		Expired.Clear();
+		All = true;
+	}
 }
 
 /**
@@ -190,89 +577,134 @@ void CDnsQuery::AsyncDnsEvent(int Status, hostent *Response) {
 }
 
 /**
- * RegisterSockets
+ * DnsSocketStateCallback
  *
- * Registers all DNS sockets and returns a cookie that can be used to
- * unregister the sockets later on - or NULL if no sockets were registered.
+ * Called by c-ares when it opens or closes one of its sockets or when it
+ * changes its interest in writing to a socket. The sockets stay registered
+ * with the main loop until c-ares closes them.
  *
- * @return DnsSocketCookie a cookie
+ * @param Cookie not used
+ * @param Socket the socket
+ * @param Readable whether c-ares wants to read from the socket
+ * @param Writable whether c-ares wants to write to the socket
  */
-DnsSocketCookie *CDnsQuery::RegisterSockets() {
-	SOCKET Sockets[ARES_GETSOCK_MAXNUM];
-	int Bitmask, Count = 0;
-	DnsSocketCookie *Cookie;
+void DnsSocketStateCallback(void *Cookie, ares_socket_t Socket, int Readable, int Writable) {
+	CDnsSocket *DnsSocket = NULL;
+	int Index;
 
-	if (m_DnsChannel == NULL) {
-		return NULL;
+	for (Index = 0; Index < CDnsQuery::m_Sockets.GetLength(); Index++) {
+		if (CDnsQuery::m_Sockets[Index]->GetSocket() == Socket) {
+			DnsSocket = CDnsQuery::m_Sockets[Index];
+
+			break;
+		}
 	}
 
-	Bitmask = ares_getsock(m_DnsChannel, Sockets, sizeof(Sockets) / sizeof(*Sockets));
+	if (DnsSocket != NULL) {
+		if (Readable || Writable) {
+			DnsSocket->SetOutbound(Writable != 0);
+
+			return;
+		}
 
-	Cookie = new DnsSocketCookie;
+		DnsSocket->Close();
 
-	if (AllocFailed(Cookie)) {
-		g_Bouncer->Fatal();
-	}
+		CDnsQuery::m_Sockets.Remove(Index);
 
-	for (int i = 0; i < (int)(sizeof(Sockets) / sizeof(*Sockets)); i++) {
-		if (!ARES_GETSOCK_READABLE(Bitmask, i) && !ARES_GETSOCK_WRITABLE(Bitmask, i)) {
-			continue;
+		if (!CDnsQuery::m_ClosedSockets.Insert(DnsSocket)) {
+			delete DnsSocket;
 		}
 
-		Count++;
-		// ctor takes care of registering the socket
-#ifdef _MSC_VER
-#	pragma warning( push )
-#	pragma warning( disable : 4800 )
-#endif /* _MSC_VER */
-		Cookie->Sockets[Count - 1] = new CDnsSocket(Sockets[i], ARES_GETSOCK_WRITABLE(Bitmask, i));
-#ifdef _MSC_VER
-#	pragma warning( pop ) 
-#endif /* _MSC_VER */
+		return;
 	}
 
-	if (Count == 0) {
-		delete Cookie;
-
-		return NULL;
+	if (!Readable && !Writable) {
+		return;
 	}
 
-	Cookie->Count = Count;
+	// ctor takes care of registering the socket
+	DnsSocket = new CDnsSocket(Socket, Writable != 0);
+
+	if (AllocFailed(DnsSocket)) {
+		g_Bouncer->Fatal();
+	}
 
-	return Cookie;
+	if (!CDnsQuery::m_Sockets.Insert(DnsSocket)) {
+		g_Bouncer->Fatal();
+	}
 }
 
 /**
- * UnregisterSockets
+ * ProcessTimeouts
  *
- * Unregisters a set of DNS sockets.
+ * Processes timeouts for the DNS sockets and destroys sockets which
+ * have been closed by c-ares.
+ */
+void CDnsQuery::ProcessTimeouts(void) {
+	if (m_DnsChannel != NULL && m_Sockets.GetLength() > 0) {
+		ares_process_fd(m_DnsChannel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+	}
+
+	for (int i = 0; i < m_ClosedSockets.GetLength(); i++) {
+		delete m_ClosedSockets[i];
+	}
+
+	m_ClosedSockets.Clear();
+}
+
+/**
+ * ScheduleTimeout
  *
- * @param Cookie a cookie returned by RegisterSockets
+ * Makes sure that the main loop wakes up in time for the next c-ares
+ * timeout.
  */
-void CDnsQuery::UnregisterSockets(DnsSocketCookie *Cookie) {
-	if (Cookie == NULL) {
+void CDnsQuery::ScheduleTimeout(void) {
+	timeval Timeout;
+
+	if (m_DnsChannel == NULL || m_Sockets.GetLength() == 0) {
 		return;
 	}
 
-	for (int i = 0; i < Cookie->Count; i++) {
-		// dtor takes care of un-registering the socket
-		Cookie->Sockets[i]->Destroy();
-
-		delete Cookie->Sockets[i];
+	if (ares_timeout(m_DnsChannel, NULL, &Timeout) != NULL) {
+		g_Bouncer->ScheduleWakeup(Timeout.tv_sec * 1000 + (Timeout.tv_usec + 999) / 1000);
 	}
+}
+
+/**
+ * GetCacheSize
+ *
+ * Returns the number of entries in the DNS cache (including pending queries).
+ */
+unsigned int CDnsQuery::GetCacheSize(void) {
+	return (m_Cache != NULL) ? m_Cache->GetLength() : 0;
+}
 
-	delete Cookie;
+/**
+ * GetCacheHits
+ *
+ * Returns the number of lookups which were answered from the cache.
+ */
+unsigned int CDnsQuery::GetCacheHits(void) {
+	return m_CacheHits;
 }
 
 /**
- * ProcessTimeouts
+ * GetCacheMisses
  *
- * Processes timeouts for the DNS sockets.
+ * Returns the number of lookups which required a new DNS query.
  */
-void CDnsQuery::ProcessTimeouts(void) {
-	if (m_DnsChannel != NULL) {
-		ares_process_fd(m_DnsChannel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
-	}
+unsigned int CDnsQuery::GetCacheMisses(void) {
+	return m_CacheMisses;
+}
+
+/**
+ * GetCacheCoalesced
+ *
+ * Returns the number of lookups which were attached to a pending query
+ * for the same name.
+ */
+unsigned int CDnsQuery::GetCacheCoalesced(void) {
+	return m_CacheCoalesced;
 }
 
 /**
@@ -36,6 +36,40 @@ typedef struct {
 	CDnsQuery *Query;
 } DnsEventCookie;
 
+/** The maximum number of entries in the DNS cache */
+#define DNSCACHE_MAXENTRIES 4096
+
+/** The minimum number of seconds a successful lookup is cached */
+#define DNSCACHE_MINTTL 30
+
+/** The maximum number of seconds a successful lookup is cached */
+#define DNSCACHE_MAXTTL 3600
+
+/** The number of seconds a failed lookup is cached */
+#define DNSCACHE_NEGATIVETTL 60
+
+/** The number of seconds a reverse lookup is cached (c-ares doesn't tell us the TTL for those) */
+#define DNSCACHE_PTRTTL 600
+
+/** The maximum number of addresses for which the TTL is checked */
+#define DNSCACHE_MAXADDRESSES 16
+
+/**
+ * dnscacheentry_t
+ *
+ * An entry in the DNS cache. Pending entries belong to queries which have
+ * not completed yet; further lookups for the same name are attached to them.
+ */
+typedef struct dnscacheentry_s {
+	char *Key; /**< the key of the entry */
+	int Family; /**< the address family which is being looked up, or 0 for reverse lookups */
+	bool Pending; /**< whether the query is still in progress */
+	int Status; /**< the c-ares status code */
+	hostent *Response; /**< the response, or NULL for negative entries */
+	time_t Expires; /**< when the entry expires */
+	CVector<DnsEventCookie *> Waiters; /**< the lookups which are waiting for the query */
+} dnscacheentry_t;
+
 /**
  * CDnsQuery
  *
@@ -43,7 +77,10 @@ typedef struct {
  */
 class SBNCAPI CDnsQuery {
 	friend void GenericDnsQueryCallback(void *Cookie, int Status, int Timeouts, hostent *HostEntity);
+	friend void DnsCacheSearchCallback(void *Cookie, int Status, int Timeouts, unsigned char *Buffer, int Length);
+	friend void DnsCacheAddrCallback(void *Cookie, int Status, int Timeouts, hostent *HostEntity);
 	friend bool DestroyDnsChannelTimer(time_t Now, void *Cookie);
+	friend void DnsSocketStateCallback(void *Cookie, ares_socket_t Socket, int Readable, int Writable);
 	friend class CDnsSocket;
 
 	DnsEventCookie *m_EventCookie;
@@ -53,9 +90,21 @@ class SBNCAPI CDnsQuery {
 	unsigned int m_PendingQueries; /**< number of pending queries */
 
 	static ares_channel m_DnsChannel; /**< the ares channel object */
+	static CVector<CDnsSocket *> m_Sockets; /**< the sockets c-ares is using */
+	static CVector<CDnsSocket *> m_ClosedSockets; /**< sockets which still need to be destroyed */
+
+	static CHashtable<dnscacheentry_t *, false> *m_Cache; /**< cached and pending lookups */
+	static unsigned int m_CacheHits; /**< the number of lookups which were answered from the cache */
+	static unsigned int m_CacheMisses; /**< the number of lookups which needed a new query */
+	static unsigned int m_CacheCoalesced; /**< the number of lookups which were attached to a pending query */
 
 	void AsyncDnsEvent(int Status, hostent *Response);
 	static ares_channel GetDnsChannel(void);
+
+	bool LookupCache(const char *Key, int Family, dnscacheentry_t **Entry);
+	static void CompleteCacheEntry(dnscacheentry_t *Entry, int Status, hostent *Response, int TTL);
+	static void RemoveCacheEntry(dnscacheentry_t *Entry);
+	static void PurgeCache(void);
 public:
 	CDnsQuery(void *EventInterface, DnsEventFunction EventFunction, int Timeout = 5);
 	~CDnsQuery(void);
@@ -63,9 +112,13 @@ public:
 	void GetHostByName(const char *Host, int Family = AF_INET);
 	void GetHostByAddr(sockaddr *Address);
 
-	static DnsSocketCookie *RegisterSockets(void);
-	static void UnregisterSockets(DnsSocketCookie *Cookie);
 	static void ProcessTimeouts(void);
+	static void ScheduleTimeout(void);
+
+	static unsigned int GetCacheSize(void);
+	static unsigned int GetCacheHits(void);
+	static unsigned int GetCacheMisses(void);
+	static unsigned int GetCacheCoalesced(void);
 };
 
 /**
@@ -22,22 +22,51 @@
 CDnsSocket::CDnsSocket(SOCKET Socket, bool Outbound) {
 	m_Socket = Socket;
 	m_Outbound = Outbound;
+	m_Closed = false;
 
 	g_Bouncer->RegisterSocket(m_Socket, this);
 }
 
 void CDnsSocket::Destroy(void) {
-	g_Bouncer->UnregisterSocket(m_Socket);
+	// the socket is owned by c-ares, it is deleted once c-ares closes it
+	Close();
+}
+
+SOCKET CDnsSocket::GetSocket(void) const {
+	return m_Socket;
+}
+
+void CDnsSocket::SetOutbound(bool Outbound) {
+	m_Outbound = Outbound;
+}
+
+/**
+ * Close
+ *
+ * Unregisters the socket after c-ares has lost interest in it. The object
+ * itself is destroyed later on because the main loop might still be
+ * using it.
+ */
+void CDnsSocket::Close(void) {
+	if (!m_Closed) {
+		g_Bouncer->UnregisterSocket(m_Socket);
+
+		m_Closed = true;
+	}
 }
 
 int CDnsSocket::Read(bool DontProcess) {
-	ares_process_fd(CDnsQuery::GetDnsChannel(), m_Socket, ARES_SOCKET_BAD);
+	if (!m_Closed) {
+		ares_process_fd(CDnsQuery::GetDnsChannel(), m_Socket, ARES_SOCKET_BAD);
+	}
 
 	return 0;
 }
 
 int CDnsSocket::Write(void) {
-	ares_process_fd(CDnsQuery::GetDnsChannel(), ARES_SOCKET_BAD, m_Socket);
+	if (!m_Closed) {
+		ares_process_fd(CDnsQuery::GetDnsChannel(), ARES_SOCKET_BAD, m_Socket);
+	}
 
 	return 0;
 }
@@ -20,15 +20,26 @@
 #ifndef DNSSOCKET_H
 #define DNSSOCKET_H
 
+/**
+ * CDnsSocket
+ *
+ * A socket which is used by c-ares. The socket stays registered for as long
+ * as c-ares is interested in it (see DnsSocketStateCallback).
+ */
 class CDnsSocket : public CSocketEvents {
 private:
         SOCKET m_Socket;
         bool m_Outbound;
+        bool m_Closed;
 public:
         CDnsSocket(SOCKET Socket, bool Outbound);
 
         void Destroy(void);
 
+        SOCKET GetSocket(void) const;
+        void SetOutbound(bool Outbound);
+        void Close(void);
+
         int Read(bool DontProcess = false);
         int Write(void);
         void Error(int ErrorCode);
@@ -39,9 +50,4 @@ public:
         const char *GetClassName(void) const;
 };
 
-typedef struct {
-        CDnsSocket *Sockets[ARES_GETSOCK_MAXNUM];
-	int Count;
-} DnsSocketCookie;
-
 #endif /* DNSSOCKET_H */
@@ -25,9 +25,20 @@
  * Constructs a new flood control object.
  */
 CFloodControl::CFloodControl(void) {
-	m_BytesSent = 0;
 	m_Enabled = true;
 	m_Plugged = false;
+
+	m_Rate = FLOODRATE;
+	m_ConfiguredRate = FLOODRATE;
+	m_Burst = FLOODBURST;
+	m_Penalty = FLOODPENALTY;
+	m_Clock = 0;
+
+	m_Calibrate = false;
+	m_BytesSent = 0;
+	m_ProbeTime = 0;
+	m_MinRoundTrip = 0;
+	m_Throttled = false;
 }
 
 /**
@@ -47,27 +58,43 @@ void CFloodControl::AttachInputQueue(CQueue *Queue, int Priority) {
 	m_Queues.Insert(IrcQueue);
 }
 
+/**
+ * GetNextQueue
+ *
+ * Returns the non-empty queue with the highest priority, or NULL if
+ * all queues are empty.
+ */
+const irc_queue_t *CFloodControl::GetNextQueue(void) const {
+	int LowestPriority = 100;
+	const irc_queue_t *ThatQueue = NULL;
+
+	for (int i = 0; i < m_Queues.GetLength(); i++) {
+		if (m_Queues[i].Priority < LowestPriority && m_Queues[i].Queue->GetLength() > 0) {
+			LowestPriority = m_Queues[i].Priority;
+			ThatQueue = m_Queues.GetAddressOf(i);
+		}
+	}
+
+	return ThatQueue;
+}
+
 /**
  * DequeueItem
  *
- * Removes the next item from the queue and returns it.
+ * Removes the next item from the queue and returns it. Returns NULL
+ * if the queues are empty or if the next item has to be delayed.
  *
  * @param Peek determines whether to actually remove the item
  */
 RESULT<char *> CFloodControl::DequeueItem(bool Peek) {
-	int LowestPriority = 100;
-	irc_queue_t *ThatQueue = NULL;
+	const irc_queue_t *ThatQueue;
+	uint64_t Now;
 
 	if (m_Enabled && m_Plugged) {
 		RETURN(char *, NULL);
 	}
 
-	for (int i = 0; i < m_Queues.GetLength(); i++) {
-		if (m_Queues[i].Priority < LowestPriority && m_Queues[i].Queue->GetLength() > 0) {
-			LowestPriority = m_Queues[i].Priority;
-			ThatQueue = &m_Queues[i];
-		}
-	}
+	ThatQueue = GetNextQueue();
 
 	if (ThatQueue == NULL) {
 		RETURN(char *, NULL);
@@ -85,21 +112,121 @@ RESULT<char *> CFloodControl::DequeueItem(bool Peek) {
 		RETURN(char *, const_cast<char *>((const char *)PeekItem));
 	}
 
-	if (m_Enabled && m_BytesSent > 0 && m_BytesSent + strlen(PeekItem) + 2 + strlen(FLOODMSG) + 2 > FLOODBYTES) {
-		Plug();
+	Now = GetMonotonicTime();
+
+	if (m_Enabled) {
+		if (GetDelay(Now) > 0) {
+			m_Throttled = true;
 
-		RETURN(char *, strdup(FLOODMSG));
+			RETURN(char *, NULL);
+		}
+
+		if (m_Calibrate) {
+			// the probe (or the server's reply) got lost, or the server is lagging badly
+			if (m_ProbeTime != 0 && Now - m_ProbeTime > FLOODPROBETIMEOUT) {
+				m_ProbeTime = 0;
+
+				Calibrate(true);
+			}
+
+			if (m_ProbeTime == 0 && m_BytesSent >= FLOODBYTES) {
+				m_ProbeTime = Now;
+				m_BytesSent = 0;
+
+				Charge(strlen(FLOODMSG) + 2, Now);
+
+				RETURN(char *, strdup(FLOODMSG));
+			}
+		}
 	}
 
 	RESULT<char *> Item = ThatQueue->Queue->DequeueItem();
 
 	THROWIFERROR(char *, Item);
 
+	if (m_Enabled) {
+		Charge(strlen(Item) + 2, Now);
+	}
+
 	m_BytesSent += strlen(Item) + 2;
 
 	RETURN(char *, Item);
 }
 
+/**
+ * Charge
+ *
+ * Accounts for a line which is about to be sent.
+ *
+ * @param Bytes the length of the line (including the CRLF)
+ * @param Now the current time
+ */
+void CFloodControl::Charge(size_t Bytes, uint64_t Now) {
+	if (m_Clock < Now) {
+		m_Clock = Now;
+	}
+
+	m_Clock += m_Penalty + (uint64_t)Bytes * 1000 / m_Rate;
+}
+
+/**
+ * GetDelay
+ *
+ * Returns the number of milliseconds until the bucket has enough room
+ * for another line.
+ *
+ * @param Now the current time
+ */
+int CFloodControl::GetDelay(uint64_t Now) const {
+	uint64_t Window = (uint64_t)m_Burst * 1000 / m_Rate;
+
+	if (m_Clock <= Now + Window) {
+		return 0;
+	} else {
+		return (int)(m_Clock - Now - Window);
+	}
+}
+
+/**
+ * GetDelay
+ *
+ * Returns the number of milliseconds until the next item can be sent, 0 if
+ * it can be sent immediately and -1 if there are no items which could be sent.
+ */
+int CFloodControl::GetDelay(void) const {
+	if ((m_Enabled && m_Plugged) || GetNextQueue() == NULL) {
+		return -1;
+	}
+
+	if (!m_Enabled) {
+		return 0;
+	}
+
+	return GetDelay(GetMonotonicTime());
+}
+
+/**
+ * Calibrate
+ *
+ * Adjusts the rate after a probe has been answered (or lost). The rate
+ * is reduced when the server seems to be lagging and increased slowly if
+ * lines had to be delayed while the server kept up with them.
+ *
+ * @param Lagging whether the server is lagging
+ */
+void CFloodControl::Calibrate(bool Lagging) {
+	unsigned int MinRate = max(m_ConfiguredRate / 4, 1u);
+	unsigned int MaxRate = m_ConfiguredRate * 4;
+
+	if (Lagging) {
+		m_Rate = max(m_Rate * 3 / 4, MinRate);
+	} else if (m_Throttled) {
+		m_Rate = min(m_Rate + m_Rate / 8 + 1, MaxRate);
+	}
+
+	m_Throttled = false;
+}
+
 /**
  * GetQueueSize
  *
@@ -107,10 +234,7 @@ RESULT<char *> CFloodControl::DequeueItem(bool Peek) {
  * could be immediately retrieved using DequeueItem().
  */
 int CFloodControl::GetQueueSize(void) {
-	if (m_Plugged)
-		return 0;
-	else
-		return (GetRealLength() > 0);
+	return (GetDelay() == 0);
 }
 
 /**
@@ -151,10 +275,23 @@ void CFloodControl::Plug(void) {
 /**
  * Unplug
  *
- * Unplugs the queue (i.e. enables processing items).
+ * Unplugs the queue (i.e. enables processing items). This is also called
+ * when the server has answered a probe.
  */
 void CFloodControl::Unplug(void) {
-	m_BytesSent = 0;
+	uint64_t RoundTrip;
+
+	if (m_ProbeTime != 0) {
+		RoundTrip = GetMonotonicTime() - m_ProbeTime;
+		m_ProbeTime = 0;
+
+		if (m_MinRoundTrip == 0 || RoundTrip < m_MinRoundTrip) {
+			m_MinRoundTrip = max(RoundTrip, (uint64_t)1);
+		}
+
+		Calibrate(RoundTrip > m_MinRoundTrip + FLOODLAG);
+	}
+
 	m_Plugged = false;
 }
 
@@ -175,3 +312,45 @@ void CFloodControl::Enable(void) {
 void CFloodControl::Disable(void) {
 	m_Enabled = false;
 }
+
+/**
+ * SetRate
+ *
+ * Sets the parameters for the token bucket.
+ *
+ * @param Rate the rate (in bytes per second), 0 for the default rate
+ * @param Burst the burst size (in bytes), 0 for the default burst size
+ * @param Penalty the penalty for each line (in milliseconds)
+ */
+void CFloodControl::SetRate(unsigned int Rate, unsigned int Burst, unsigned int Penalty) {
+	m_ConfiguredRate = (Rate != 0) ? Rate : FLOODRATE;
+	m_Rate = m_ConfiguredRate;
+	m_Burst = (Burst != 0) ? Burst : FLOODBURST;
+	m_Penalty = Penalty;
+}
+
+/**
+ * GetRate
+ *
+ * Returns the current rate (in bytes per second), which might differ
+ * from the configured rate if calibration is enabled.
+ */
+unsigned int CFloodControl::GetRate(void) const {
+	return m_Rate;
+}
+
+/**
+ * SetCalibration
+ *
+ * Sets whether the rate is calibrated using probes.
+ *
+ * @param Calibrate a boolean flag
+ */
+void CFloodControl::SetCalibration(bool Calibrate) {
+	m_Calibrate = Calibrate;
+
+	if (!Calibrate) {
+		m_Rate = m_ConfiguredRate;
+		m_ProbeTime = 0;
+	}
+}
@@ -20,9 +20,34 @@
 #ifndef FLOODCONTROL_H
 #define FLOODCONTROL_H
 
+/** The command which is used for measuring how quickly the server processes our lines */
 #define FLOODMSG "SBNCFLOODCHECK"
+
+/** The number of bytes which are sent between two calibration probes */
 #define FLOODBYTES 1024
 
+/*
+ * The defaults match the classic ircd fakelag (2 seconds plus 1 second per
+ * 120 bytes for each line), which is the strictest one in common use. Most
+ * ircds kill clients whose unprocessed input exceeds about 1 KB, so that's
+ * the most we send in a single burst.
+ */
+
+/** The default rate (in bytes per second) */
+#define FLOODRATE 120
+
+/** The default burst size (in bytes) */
+#define FLOODBURST 1024
+
+/** The default penalty (in milliseconds) for each line */
+#define FLOODPENALTY 2000
+
+/** The number of milliseconds after which an unanswered probe is considered lost */
+#define FLOODPROBETIMEOUT 30000
+
+/** Probes which take this many milliseconds longer than the fastest probe indicate that the server is lagging */
+#define FLOODLAG 1000
+
 /**
  * irc_queue_t
  *
@@ -36,16 +61,35 @@ typedef struct queue_s {
 /**
  * CFloodControl
  *
- * A queue which tries to avoid "Excess Flood" errors.
+ * A queue which tries to avoid "Excess Flood" errors. Lines are paced
+ * using a token bucket which is modeled on ircd's "fakelag": each line costs
+ * a fixed penalty plus the time it takes to send its bytes at the configured
+ * rate, and lines are only sent while the accumulated cost does not exceed
+ * the burst size. Optionally the rate is calibrated by periodically sending
+ * a bogus command and measuring how long it takes the server to reply.
  */
 class SBNCAPI CFloodControl {
 	CVector<irc_queue_t> m_Queues; /**< a list of queues which have been
 								attached to this object */
-	size_t m_BytesSent; /**< the number of bytes which have recently been sent */
 	bool m_Enabled; /**< determines whether this object is delaying the output */
 	bool m_Plugged; /**< determines whether the queue is plugged */
 
-	void ScheduleItem(void);
+	unsigned int m_Rate; /**< the current rate (in bytes per second) */
+	unsigned int m_ConfiguredRate; /**< the configured rate */
+	unsigned int m_Burst; /**< the burst size (in bytes) */
+	unsigned int m_Penalty; /**< the penalty for each line (in milliseconds) */
+	uint64_t m_Clock; /**< the time at which the bucket will be full again */
+
+	bool m_Calibrate; /**< whether to calibrate the rate */
+	size_t m_BytesSent; /**< the number of bytes which have been sent since the last probe */
+	uint64_t m_ProbeTime; /**< when the current probe was sent, or 0 */
+	uint64_t m_MinRoundTrip; /**< the fastest response to a probe (in milliseconds) */
+	bool m_Throttled; /**< whether lines were delayed since the last probe */
+
+	const irc_queue_t *GetNextQueue(void) const;
+	void Charge(size_t Bytes, uint64_t Now);
+	int GetDelay(uint64_t Now) const;
+	void Calibrate(bool Lagging);
 public:
 #ifndef SWIG
 	CFloodControl(void);
@@ -63,6 +107,12 @@ public:
 
 	void Enable(void);
 	void Disable(void);
+
+	void SetRate(unsigned int Rate, unsigned int Burst, unsigned int Penalty);
+	unsigned int GetRate(void) const;
+	void SetCalibration(bool Calibrate);
+
+	int GetDelay(void) const;
 };
 
 #endif /* FLOODCONTROL_H */
@@ -96,6 +96,27 @@ private:
 	int m_BucketCount; /** bucket count */
 	void (*m_DestructorFunc)(Type Object); /**< the function which should be used for destroying items */
 	int m_LengthCache; /**< (cached) number of items in the hashtable */
+	CArena *m_Arena; /**< the arena which is used for the keys and buckets, or NULL */
+
+	void *AllocMemory(size_t Size) {
+		return m_Arena ? m_Arena->Alloc(Size) : malloc(Size);
+	}
+
+	void *ReallocMemory(void *Block, size_t Size) {
+		return m_Arena ? m_Arena->Realloc(Block, Size) : realloc(Block, Size);
+	}
+
+	char *DupKey(const char *Key) {
+		return m_Arena ? m_Arena->StrDup(Key) : strdup(Key);
+	}
+
+	void FreeMemory(void *Block) {
+		if (m_Arena) {
+			CArena::Free(Block);
+		} else {
+			free(Block);
+		}
+	}
 
 	/**
 	 * Rehash
@@ -110,7 +131,7 @@ private:
 		OldBucketCount = m_BucketCount;
 
 		m_BucketCount *= 2;
-		m_Buckets = (hashlist_t<Type> *)malloc(sizeof(hashlist_t<Type>) * m_BucketCount);
+		m_Buckets = (hashlist_t<Type> *)AllocMemory(sizeof(hashlist_t<Type>) * m_BucketCount);
 
 		if (m_Buckets == NULL) {
 			m_Buckets = OldBuckets;
@@ -131,14 +152,14 @@ private:
 					abort();
 				}
 
-				free(List->Keys[a]);
+				FreeMemory(List->Keys[a]);
 			}
 
-			free(List->Keys);
-			free(List->Values);
+			FreeMemory(List->Keys);
+			FreeMemory(List->Values);
 		}
 
-		free(OldBuckets);
+		FreeMemory(OldBuckets);
 	}
 
 public:
@@ -161,14 +182,21 @@ public:
 		m_DestructorFunc = NULL;
 
 		m_LengthCache = 0;
+
+		m_Arena = NULL;
 	}
 
 	/**
 	 * ~CHashtable
 	 *
-	 * Destructs a hashtable
+	 * Destructs a hashtable. Hashtables which use an arena leave their
+	 * keys and items alone, they're released together with the arena.
 	 */
 	~CHashtable(void) {
+		if (m_Arena != NULL) {
+			return;
+		}
+
 		Clear();
 
 
@@ -185,15 +213,15 @@ public:
 			hashlist_t<Type> *List = &m_Buckets[i];
 
 			for (int a = 0; a < List->Count; a++) {
-				free(List->Keys[a]);
+				FreeMemory(List->Keys[a]);
 
 				if (m_DestructorFunc != NULL) {
 					m_DestructorFunc(List->Values[a]);
 				}
 			}
 
-			free(List->Keys);
-			free(List->Values);
+			FreeMemory(List->Keys);
+			FreeMemory(List->Values);
 		}
 
 		memset(m_Buckets, 0, sizeof(hashlist_t<Type>) * m_BucketCount);
@@ -224,26 +252,26 @@ public:
 
 		List = &m_Buckets[Hash(Key, CaseSensitive) % m_BucketCount];
 
-		dupKey = strdup(Key);
+		dupKey = DupKey(Key);
 
 		if (dupKey == NULL) {
 			THROW(bool, Generic_OutOfMemory, "strdup() failed.");
 		}
 
-		newKeys = (char **)realloc(List->Keys, (List->Count + 1) * sizeof(char *));
+		newKeys = (char **)ReallocMemory(List->Keys, (List->Count + 1) * sizeof(char *));
 
 		if (newKeys == NULL) {
-			free(dupKey);
+			FreeMemory(dupKey);
 
 			THROW(bool, Generic_OutOfMemory, "realloc() failed.");
 		}
 
 		List->Keys = newKeys;
 
-		newValues = (Type *)realloc(List->Values, (List->Count + 1) * sizeof(Type));
+		newValues = (Type *)ReallocMemory(List->Values, (List->Count + 1) * sizeof(Type));
 
 		if (newValues == NULL) {
-			free(dupKey);
+			FreeMemory(dupKey);
 
 			THROW(bool, Generic_OutOfMemory, "realloc() failed.");
 		}
@@ -319,10 +347,10 @@ public:
 				m_DestructorFunc(List->Values[0]);
 			}
 
-			free(List->Keys[0]);
+			FreeMemory(List->Keys[0]);
 
-			free(List->Keys);
-			free(List->Values);
+			FreeMemory(List->Keys);
+			FreeMemory(List->Values);
 			List->Count = 0;
 			List->Keys = NULL;
 			List->Values = NULL;
@@ -331,7 +359,7 @@ public:
 		} else {
 			for (int i = 0; i < List->Count; i++) {
 				if (List->Keys[i] && (CaseSensitive ? strcmp(List->Keys[i], Key) : strcasecmp(List->Keys[i], Key)) == 0) {
-					free(List->Keys[i]);
+					FreeMemory(List->Keys[i]);
 
 					List->Keys[i] = List->Keys[List->Count - 1];
 
@@ -361,6 +389,34 @@ public:
 		return m_LengthCache;
 	}
 
+	/**
+	 * SetArena
+	 *
+	 * Makes the hashtable allocate its keys and buckets from an arena. This
+	 * must be called while the hashtable is still empty. The arena has to
+	 * outlive the hashtable; when the hashtable is destroyed its items aren't
+	 * destroyed, so they should be allocated from the same arena.
+	 *
+	 * @param Arena the arena
+	 */
+	void SetArena(CArena *Arena) {
+		hashlist_t<Type> *Buckets;
+
+		assert(m_LengthCache == 0 && m_Arena == NULL);
+
+		Buckets = (hashlist_t<Type> *)Arena->Alloc(sizeof(hashlist_t<Type>) * m_BucketCount);
+
+		if (Buckets == NULL) {
+			return;
+		}
+
+		memset(Buckets, 0, sizeof(hashlist_t<Type>) * m_BucketCount);
+
+		free(m_Buckets);
+		m_Buckets = Buckets;
+		m_Arena = Arena;
+	}
+
 	/**
 	 * RegisterValueDestructor
 	 *
@@ -51,6 +51,7 @@ CIRCConnection::CIRCConnection(const char *Host, unsigned int Port, CUser *Owner
 
 	m_CurrentNick = NULL;
 	m_Server = NULL;
+	m_SSLSessionKey = NULL;
 	m_ServerVersion = NULL;
 	m_ServerFeat = NULL;
 	m_ServerChanModes = NULL;
@@ -59,6 +60,8 @@ CIRCConnection::CIRCConnection(const char *Host, unsigned int Port, CUser *Owner
 	m_Usermodes = NULL;
 	m_EatPong = false;
 
+	m_CurrentMessage = NULL;
+
 	m_QueueHigh = new CQueue();
 
 	if (AllocFailed(m_QueueHigh)) {
@@ -86,6 +89,14 @@ CIRCConnection::CIRCConnection(const char *Host, unsigned int Port, CUser *Owner
 	if (Host != NULL) {
 		const char *Password = Owner->GetServerPassword();
 
+		if (SSL) {
+			int rc = asprintf(&m_SSLSessionKey, "%s:%u", Host, Port);
+
+			if (RcFailed(rc)) {
+				m_SSLSessionKey = NULL;
+			}
+		}
+
 		if (Password != NULL) {
 			WriteLine("PASS :%s", Password);
 		}
@@ -126,6 +137,11 @@ CIRCConnection::CIRCConnection(const char *Host, unsigned int Port, CUser *Owner
 	m_FloodControl->AttachInputQueue(m_QueueMiddle, 1);
 	m_FloodControl->AttachInputQueue(m_QueueLow, 2);
 
+	if (Owner != NULL) {
+		m_FloodControl->SetRate(Owner->GetFloodRate(), Owner->GetFloodBurst(), Owner->GetFloodPenalty());
+		m_FloodControl->SetCalibration(Owner->GetFloodCalibration());
+	}
+
 	m_PingTimer = g_Bouncer->CreateTimer(180, true, IRCPingTimer, this);
 	m_DelayJoinTimer = NULL;
 	m_NickCatchTimer = NULL;
@@ -144,6 +160,7 @@ CIRCConnection::~CIRCConnection(void) {
 	delete m_Channels;
 
 	free(m_Server);
+	free(m_SSLSessionKey);
 	free(m_ServerVersion);
 	free(m_ServerFeat);
 	free(m_ServerChanModes);
@@ -439,7 +456,7 @@ bool CIRCConnection::ParseLineArgV(int argc, const char **argv) {
 		}
 
 		if (Client == NULL) {
-			bool AppendTS = (GetOwner()->GetConfig()->ReadInteger("user.ts") != 0);
+			bool AppendTS = (CacheGetInteger(*GetOwner()->GetConfigCache(), ts) != 0);
 			const char *AwayReason = GetOwner()->GetAwayText();
 
 			if (AwayReason != NULL) {
@@ -762,7 +779,7 @@ bool CIRCConnection::ParseLineArgV(int argc, const char **argv) {
 		m_EatPong = false;
 
 		return false;
-	} else if (argc > 3 && iRaw == 421) {
+	} else if (argc > 3 && iRaw == 421 && strcasecmp(argv[3], FLOODMSG) == 0) {
 		m_FloodControl->Unplug();
 
 		return false;
@@ -784,10 +801,51 @@ bool CIRCConnection::ParseLineArgV(int argc, const char **argv) {
  * @param argv the tokens
  */
 bool CIRCConnection::ModuleEvent(int argc, const char **argv) {
-	const CVector<CModule *> *Modules = g_Bouncer->GetModules();
+	ircmessage_t LocalMessage;
+	ircmessage_t *Message = m_CurrentMessage;
+
+	if (Message == NULL || Message->ArgV != argv) {
+		Message = &LocalMessage;
+		ParseIRCMessage(Message, NULL, true, argc, argv);
+	}
+
+	const CVector<CModule *> *Modules = g_Bouncer->GetModuleSubscribers(ModuleEvent_IRCMessage, Message->Command.Data);
+
+	if (Modules->GetLength() == 0) {
+		return true;
+	}
+
+	/* the channel is looked up here rather than in ParseLine() because
+	 * the line might have just created or removed it */
+	Message->Channel = NULL;
+
+	switch (Message->CommandId) {
+		case IRCCommand_Privmsg:
+		case IRCCommand_Notice:
+		case IRCCommand_Join:
+		case IRCCommand_Part:
+		case IRCCommand_Kick:
+		case IRCCommand_Mode:
+		case IRCCommand_Topic:
+			if (Message->ParamCount > 0) {
+				Message->Channel = GetChannel(Message->Params[0].Data);
+			}
+
+			break;
+		case IRCCommand_Numeric:
+			/* most channel-related numerics look like "<nick> <channel> ..." or
+			 * "<nick> <type> <channel> ..." (e.g. 353) */
+			for (int i = 1; i < 3 && i < Message->ParamCount && Message->Channel == NULL; i++) {
+				Message->Channel = GetChannel(Message->Params[i].Data);
+			}
+
+			break;
+		default:
+			break;
+	}
 
 	for (int i = 0; i < Modules->GetLength(); i++) {
-		if (!(*Modules)[i]->InterceptIRCMessage(this, argc, argv)) {
+		if (!(*Modules)[i]->InterceptParsedIRCMessage(this, Message)) {
 			return false;
 		}
 	}
@@ -810,10 +868,26 @@ void CIRCConnection::ParseLine(const char *Line) {
 		return;
 	}
 
-	if (Line[0] == ':') {
-		RealLine = Line + 1;
-	} else {
-		RealLine = Line;
+	const char *Tags = NULL;
+
+	/* IRCv3 tags are passed to modules but are otherwise ignored */
+	if (RealLine[0] == '@') {
+		Tags = RealLine + 1;
+		RealLine = strchr(RealLine, ' ');
+
+		if (RealLine == NULL) {
+			return;
+		}
+
+		while (RealLine[0] == ' ') {
+			RealLine++;
+		}
+	}
+
+	bool HasPrefix = (RealLine[0] == ':');
+
+	if (HasPrefix) {
+		RealLine++;
 	}
 
 	tokendata_t Args = ArgTokenize2(RealLine);
@@ -826,7 +900,15 @@ void CIRCConnection::ParseLine(const char *Line) {
 		return;
 	}
 
-	if (ParseLineArgV(argc, argv)) {
+	ircmessage_t Message;
+
+	ParseIRCMessage(&Message, Tags, HasPrefix, argc, argv);
+
+	m_CurrentMessage = &Message;
+	bool Handled = ParseLineArgV(argc, argv);
+	m_CurrentMessage = NULL;
+
+	if (Handled) {
 		if (strcasecmp(argv[0], "ping") == 0 && argc > 1) {
 			int rc = asprintf(&Out, "PONG :%s", argv[1]);
 
@@ -977,11 +1059,15 @@ void CIRCConnection::UpdateChannelConfig(void) {
  * Checks whether there is data which can be sent to the IRC server.
  */
 bool CIRCConnection::HasQueuedData(void) const {
-	if (m_FloodControl->GetQueueSize() > 0) {
+	int Delay = m_FloodControl->GetDelay();
+
+	if (Delay == 0) {
 		return true;
-	} else {
-		return CConnection::HasQueuedData();
+	} else if (Delay > 0) {
+		g_Bouncer->ScheduleWakeup(Delay);
 	}
+
+	return CConnection::HasQueuedData();
 }
 
 /**
@@ -990,17 +1076,16 @@ bool CIRCConnection::HasQueuedData(void) const {
  * Writes data for the socket.
  */
 int CIRCConnection::Write(void) {
-	char *Line = m_FloodControl->DequeueItem();
+	char *Line;
 
-	if (Line != NULL) {
+	// send as many lines as the flood control object lets us
+	while ((Line = m_FloodControl->DequeueItem()) != NULL) {
 		CConnection::WriteUnformattedLine(Line);
-	}
-
-	int ReturnValue = CConnection::Write();
 
-	free(Line);
+		free(Line);
+	}
 
-	return ReturnValue;
+	return CConnection::Write();
 }
 
 /**
@@ -1526,6 +1611,35 @@ int CIRCConnection::SSLVerify(int PreVerifyOk, X509_STORE_CTX *Context) const {
 	return 1;
 }
 
+/**
+ * GetSSLSession
+ *
+ * Returns the user's last SSL session for the IRC server, so that it
+ * can be resumed.
+ */
+SSL_SESSION *CIRCConnection::GetSSLSession(void) const {
+	if (m_SSLSessionKey == NULL || GetOwner() == NULL) {
+		return NULL;
+	}
+
+	return GetOwner()->GetSSLSession(m_SSLSessionKey);
+}
+
+/**
+ * SSLNewSession
+ *
+ * Stores a new SSL session for the IRC server in the user object.
+ *
+ * @param Session the session
+ */
+bool CIRCConnection::SSLNewSession(SSL_SESSION *Session) {
+	if (m_SSLSessionKey == NULL || GetOwner() == NULL) {
+		return false;
+	}
+
+	return GetOwner()->SetSSLSession(m_SSLSessionKey, Session);
+}
+
 /**
  * AsyncDnsFinished
  *
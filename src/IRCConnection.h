@@ -67,6 +67,7 @@ private:
 	char *m_CurrentNick; /**< the current nick for this IRC connection */
 	char *m_Site; /**< the ident\@host of this IRC connection */
 	char *m_Server; /**< the hostname of the IRC server */
+	char *m_SSLSessionKey; /**< the host and port which were used for connecting to the server */
 	char *m_Usermodes; /**< the usermodes */
 
 	CHashtable<CChannel *, false> *m_Channels; /**< the channels this IRC user is on */
@@ -91,6 +92,8 @@ private:
 
 	bool m_EatPong; /**< whether to ignore the next PONG event from the IRC server */
 
+	ircmessage_t *m_CurrentMessage; /**< the line which is currently being processed, or NULL */
+
 	CChannel *AddChannel(const char *Channel);
 	void RemoveChannel(const char *Channel);
 
@@ -153,6 +156,8 @@ public:
 	void Destroy(void);
 
 	virtual int SSLVerify(int PreVerifyOk, X509_STORE_CTX *Context) const;
+	virtual SSL_SESSION *GetSSLSession(void) const;
+	virtual bool SSLNewSession(SSL_SESSION *Session);
 
 	void Kill(const char *Error);
 
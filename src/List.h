@@ -182,6 +182,15 @@ public:
 		return m_Head;
 	}
 
+	/**
+	 * GetTail
+	 *
+	 * Returns the tail of the linked list.
+	 */
+	link_t<Type> *GetTail(void) const {
+		return m_Tail;
+	}
+
 	/**
 	 * Clear
 	 *
@@ -27,8 +27,9 @@
  * @param Filename the filename of the log, can be NULL to indicate that
  *                 any log messages should be discarded
  * @param KeepOpen whether to keep the file open
+ * @param Indexed whether to maintain a full-text index for the log
  */
-CLog::CLog(const char *Filename, bool KeepOpen) {
+CLog::CLog(const char *Filename, bool KeepOpen, bool Indexed) {
 	if (Filename != NULL) {
 		m_Filename = strdup(g_Bouncer->BuildPathLog(Filename));
 
@@ -44,6 +45,14 @@ CLog::CLog(const char *Filename, bool KeepOpen) {
 	m_Inode = 0;
 	m_Dev = 0;
 #endif
+
+	if (Indexed && m_Filename != NULL) {
+		m_Index = new CLogIndex(m_Filename);
+
+		if (AllocFailed(m_Index)) {}
+	} else {
+		m_Index = NULL;
+	}
 }
 
 /**
@@ -52,6 +61,8 @@ CLog::CLog(const char *Filename, bool KeepOpen) {
  * Destructs a log object.
  */
 CLog::~CLog(void) {
+	delete m_Index;
+
 	free(m_Filename);
 
 	if (m_File != NULL) {
@@ -62,71 +73,44 @@ CLog::~CLog(void) {
 /**
  * PlayToUser
  *
- * Sends the log to the specified user.
+ * Sends the log to the specified user. Logs are streamed to the client in
+ * the background (see CLogPlayback) unless the client does not have a socket
+ * or the log is played as the MOTD, in which case the log is sent right away.
  *
  * @param Client the user who should receive the log
  * @param Type specifies how the log should be sent, can be one of:
  *             Log_Notices - use IRC notices
  *             Log_Messages - use IRC messages
  *             Log_Motd - use IRC motd replies
+ * @param Range the part of the log which should be sent, or NULL
+ * @param Trailer a line which is sent after the log, or NULL
  */
-void CLog::PlayToUser(CClientConnection *Client, LogType Type) const {
-	FILE *LogFile;
+void CLog::PlayToUser(CClientConnection *Client, LogType Type, const logrange_t *Range, const char *Trailer) const {
+	CLogPlayback *Playback;
 
-	CIRCConnection *IRC = Client->GetOwner()->GetIRCConnection();
-	const char *Nick = NULL;
-	const char *Server = NULL;
-
-	if (m_File != NULL) {
-		fclose(m_File);
+	if (m_Filename == NULL) {
+		return;
 	}
 
-	if (m_Filename != NULL && (LogFile = fopen(m_Filename, "r")) != NULL) {
-		char Line[500];
-
-		while (!feof(LogFile)) {
-			char *LinePtr = fgets(Line, sizeof(Line), LogFile);
+	Playback = new CLogPlayback(Client, m_Filename, Type, Range, Trailer);
 
-			if (LinePtr == NULL) {
-				continue;
-			}
-			char *TempLinePtr = Line;
-
-			while (*TempLinePtr) {
-				if (*TempLinePtr == '\r' || *TempLinePtr == '\n') {
-					*TempLinePtr = '\0';
-
-					break;
-				}
-
-				TempLinePtr++;
-			}
+	if (AllocFailed(Playback)) {
+		return;
+	}
 
-			if (Type == Log_Notice) {
-				Client->RealNotice(Line);
-			} else if (Type == Log_Message) {
-				Client->Privmsg(Line);
-			} else if (Type == Log_Motd) {
-				if (IRC != NULL) {
-					Nick = IRC->GetCurrentNick();
-					Server = IRC->GetServer();
-				} else {
-					Nick = Client->GetNick();
-					Server = "bouncer.shroudbnc.info";
-				}
-
-				if (Nick != NULL) {
-					Client->WriteLine(":%s 372 %s :%s", Server, Nick, Line);
-				}
-			}
-		}
+	if (!Playback->IsValid()) {
+		delete Playback;
 
-		fclose(LogFile);
-		m_File = NULL;
+		return;
 	}
 
-	if (Type == Log_Motd && Nick != NULL && Server != NULL) {
-		Client->WriteLine(":%s 376 %s :End of /MOTD command.", Server, Nick);
+	if (Type == Log_Motd || Client->GetSocket() == INVALID_SOCKET) {
+		while (Playback->Pump((size_t)-1))
+			; /* empty */
+
+		delete Playback;
+	} else {
+		Client->SetPlayback(Playback);
 	}
 }
 
@@ -144,6 +128,7 @@ void CLog::WriteUnformattedLine(const char *Line) {
 	tm Now;
 	char strNow[100];
 	FILE *LogFile;
+	long Offset = -1;
 #ifndef _WIN32
 	struct stat StatBuf;
 #endif
@@ -224,16 +209,24 @@ void CLog::WriteUnformattedLine(const char *Line) {
 		return;
 	}
 
+	if (m_Index != NULL && fseek(LogFile, 0, SEEK_END) == 0) {
+		Offset = ftell(LogFile);
+	}
+
 	fputs(Out, LogFile);
 	printf("%s", Out);
 
-	free(Out);
-
 	if (!m_KeepOpen) {
 		fclose(LogFile);
 	} else {
 		fflush(m_File);
 	}
+
+	if (m_Index != NULL) {
+		m_Index->Append(Offset, Out, g_CurrentTime);
+	}
+
+	free(Out);
 }
 
 /**
@@ -284,6 +277,10 @@ void CLog::Clear(void) {
 			m_File = LogFile;
 		}
 	}
+
+	if (m_Index != NULL) {
+		m_Index->Reset();
+	}
 }
 
 /**
@@ -327,3 +324,305 @@ const char *CLog::GetFilename(void) const {
 		return NULL;
 	}
 }
+
+/**
+ * Search
+ *
+ * Searches the log using its full-text index. Matching lines are
+ * returned newest first.
+ *
+ * @param Query the query
+ * @param Skip the number of matching lines which should be skipped
+ * @param Count the maximum number of lines to return
+ * @param Results will receive the lines (must be freed by the caller)
+ * @return whether there are more matching lines
+ */
+RESULT<bool> CLog::Search(const logquery_t *Query, unsigned int Skip, unsigned int Count, CVector<char *> *Results) {
+	if (m_Index == NULL) {
+		THROW(bool, Generic_Unknown, "This log cannot be searched.");
+	}
+
+	return m_Index->Search(Query, Skip, Count, Results);
+}
+
+/**
+ * GetIndex
+ *
+ * Returns the full-text index for the log, or NULL if the log
+ * is not indexed.
+ */
+CLogIndex *CLog::GetIndex(void) const {
+	return m_Index;
+}
+
+/**
+ * CLogPlayback
+ *
+ * Constructs a new playback object. Use IsValid() to check whether the
+ * log file could be opened.
+ *
+ * @param Client the client which receives the log
+ * @param Filename the filename of the log
+ * @param Type specifies how the log should be sent
+ * @param Range the part of the log which should be sent, or NULL
+ * @param Trailer a line which is sent after the log, or NULL
+ */
+CLogPlayback::CLogPlayback(CClientConnection *Client, const char *Filename, LogType Type, const logrange_t *Range, const char *Trailer) {
+	m_Client = Client;
+	m_Type = Type;
+
+	if (Range != NULL) {
+		m_Range = *Range;
+	} else {
+		memset(&m_Range, 0, sizeof(m_Range));
+	}
+
+	m_BufferStart = 0;
+	m_BufferEnd = 0;
+	m_Offset = 0;
+	m_SkipLine = false;
+	m_EOF = false;
+	m_Line = 0;
+	m_Sent = 0;
+	m_File = NULL;
+	m_Trailer = NULL;
+
+	m_Buffer = (char *)malloc(PLAYBACK_BUFFERSIZE + 1);
+
+	if (AllocFailed(m_Buffer)) {
+		return;
+	}
+
+	if (Trailer != NULL) {
+		m_Trailer = strdup(Trailer);
+
+		if (AllocFailed(m_Trailer)) {
+			return;
+		}
+	}
+
+	m_File = fopen(Filename, "rb");
+
+	if (m_File == NULL || m_Range.StartOffset <= 0) {
+		return;
+	}
+
+	/* make sure we start at the beginning of a line */
+	if (fseek(m_File, m_Range.StartOffset - 1, SEEK_SET) != 0) {
+		m_EOF = true;
+
+		return;
+	}
+
+	if (fgetc(m_File) != '\n') {
+		m_SkipLine = true;
+	}
+
+	m_Offset = m_Range.StartOffset;
+}
+
+/**
+ * ~CLogPlayback
+ *
+ * Destructs a playback object.
+ */
+CLogPlayback::~CLogPlayback(void) {
+	if (m_File != NULL) {
+		fclose(m_File);
+	}
+
+	free(m_Buffer);
+	free(m_Trailer);
+}
+
+/**
+ * IsValid
+ *
+ * Checks whether the log file could be opened.
+ */
+bool CLogPlayback::IsValid(void) const {
+	return (m_File != NULL);
+}
+
+/**
+ * ReadLine
+ *
+ * Returns the next line from the log file, or NULL if there are no more
+ * lines or the scan limit has been exceeded. Lines which are longer than
+ * PLAYBACK_BUFFERSIZE are truncated.
+ *
+ * @param Scanned the number of bytes which have been read so far, this is
+ *                updated by this function
+ */
+char *CLogPlayback::ReadLine(size_t *Scanned) {
+	while (true) {
+		char *Line = m_Buffer + m_BufferStart;
+		char *NewLine = (char *)memchr(Line, '\n', m_BufferEnd - m_BufferStart);
+
+		if (NewLine != NULL || (m_EOF && m_BufferStart < m_BufferEnd) ||
+				(m_BufferStart == 0 && m_BufferEnd == PLAYBACK_BUFFERSIZE)) {
+			bool SkipLine = m_SkipLine;
+
+			if (NewLine != NULL) {
+				m_BufferStart = NewLine - m_Buffer + 1;
+				m_SkipLine = false;
+			} else {
+				NewLine = m_Buffer + m_BufferEnd;
+				m_BufferStart = m_BufferEnd;
+
+				/* the line didn't fit into the buffer, drop the rest of it */
+				m_SkipLine = !m_EOF;
+			}
+
+			*NewLine = '\0';
+
+			if (NewLine > Line && *(NewLine - 1) == '\r') {
+				*(NewLine - 1) = '\0';
+			}
+
+			if (SkipLine) {
+				continue;
+			}
+
+			return Line;
+		}
+
+		if (m_EOF || *Scanned >= PLAYBACK_MAXSCAN) {
+			return NULL;
+		}
+
+		if (m_BufferStart > 0) {
+			memmove(m_Buffer, m_Buffer + m_BufferStart, m_BufferEnd - m_BufferStart);
+			m_BufferEnd -= m_BufferStart;
+			m_BufferStart = 0;
+		}
+
+		size_t Size = PLAYBACK_BUFFERSIZE - m_BufferEnd;
+
+		if (m_Range.EndOffset > 0 && (long)Size > m_Range.EndOffset - m_Offset) {
+			Size = (m_Range.EndOffset > m_Offset) ? m_Range.EndOffset - m_Offset : 0;
+		}
+
+		size_t Count = (Size > 0) ? fread(m_Buffer + m_BufferEnd, 1, Size, m_File) : 0;
+
+		if (Count == 0) {
+			m_EOF = true;
+		}
+
+		m_BufferEnd += Count;
+		m_Offset += Count;
+		*Scanned += Count;
+	}
+}
+
+/**
+ * SendLine
+ *
+ * Sends a single line to the client.
+ *
+ * @param Line the line
+ */
+void CLogPlayback::SendLine(const char *Line) {
+	const char *Nick, *Server;
+	CIRCConnection *IRC;
+
+	if (m_Type == Log_Notice) {
+		m_Client->RealNotice(Line);
+	} else if (m_Type == Log_Message) {
+		m_Client->Privmsg(Line);
+	} else if (m_Type == Log_Motd) {
+		IRC = (m_Client->GetOwner() != NULL) ? m_Client->GetOwner()->GetIRCConnection() : NULL;
+
+		if (IRC != NULL) {
+			Nick = IRC->GetCurrentNick();
+			Server = IRC->GetServer();
+		} else {
+			Nick = m_Client->GetNick();
+			Server = "bouncer.shroudbnc.info";
+		}
+
+		if (Nick != NULL) {
+			m_Client->WriteLine(":%s 372 %s :%s", Server, Nick, Line);
+		}
+	}
+}
+
+/**
+ * Finish
+ *
+ * Sends the trailer for the log.
+ */
+void CLogPlayback::Finish(void) {
+	const char *Nick, *Server;
+	CIRCConnection *IRC;
+
+	if (m_Type == Log_Motd && m_Sent > 0) {
+		IRC = (m_Client->GetOwner() != NULL) ? m_Client->GetOwner()->GetIRCConnection() : NULL;
+
+		if (IRC != NULL) {
+			Nick = IRC->GetCurrentNick();
+			Server = IRC->GetServer();
+		} else {
+			Nick = m_Client->GetNick();
+			Server = "bouncer.shroudbnc.info";
+		}
+
+		if (Nick != NULL && Server != NULL) {
+			m_Client->WriteLine(":%s 376 %s :End of /MOTD command.", Server, Nick);
+		}
+	}
+
+	if (m_Trailer != NULL) {
+		SendLine(m_Trailer);
+	}
+}
+
+/**
+ * Pump
+ *
+ * Sends lines to the client until its sendq has reached the specified
+ * size. Returns false when the playback has finished.
+ *
+ * @param HighWater the maximum size of the client's sendq
+ */
+bool CLogPlayback::Pump(size_t HighWater) {
+	size_t Scanned = 0;
+	char *Line;
+
+	if (m_File == NULL) {
+		return false;
+	}
+
+	while (m_Client->GetSendqSize() < HighWater) {
+		if (m_Range.LineCount != 0 && m_Sent >= m_Range.LineCount) {
+			Line = NULL;
+		} else {
+			Line = ReadLine(&Scanned);
+		}
+
+		if (Line == NULL) {
+			if (!m_EOF && (m_Range.LineCount == 0 || m_Sent < m_Range.LineCount)) {
+				/* we've hit the scan limit, continue later */
+				return true;
+			}
+
+			Finish();
+
+			fclose(m_File);
+			m_File = NULL;
+
+			return false;
+		}
+
+		m_Line++;
+
+		if (m_Line < m_Range.FirstLine) {
+			continue;
+		}
+
+		SendLine(Line);
+		m_Sent++;
+	}
+
+	return true;
+}
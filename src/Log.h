@@ -31,6 +31,67 @@ typedef enum {
 	Log_Motd,
 } LogType;
 
+/** The client's sendq is refilled once it drops below this many bytes */
+#define PLAYBACK_LOWWATER (16 * 1024)
+
+/** The client's sendq is not filled beyond this many bytes */
+#define PLAYBACK_HIGHWATER (64 * 1024)
+
+/** The size of the read buffer for log playback (and the maximum line length) */
+#define PLAYBACK_BUFFERSIZE (64 * 1024)
+
+/** The maximum number of bytes which are read in a single Pump() call */
+#define PLAYBACK_MAXSCAN (1024 * 1024)
+
+/**
+ * logrange_t
+ *
+ * Describes which part of a log file should be played back. A value of 0
+ * means that there is no limit for the respective field.
+ */
+typedef struct logrange_s {
+	long StartOffset; /**< the byte offset where the playback starts */
+	long EndOffset; /**< the byte offset where the playback stops */
+	unsigned int FirstLine; /**< the first line (1-based, relative to StartOffset) */
+	unsigned int LineCount; /**< the maximum number of lines */
+} logrange_t;
+
+/**
+ * CLogPlayback
+ *
+ * Streams a log file to a client connection. The file is read in large
+ * chunks and the client's sendq is only refilled when it has drained.
+ */
+class SBNCAPI CLogPlayback {
+	CClientConnection *m_Client; /**< the client which receives the log */
+	FILE *m_File; /**< the log file */
+	LogType m_Type; /**< how lines are sent to the client */
+	logrange_t m_Range; /**< which part of the log is played */
+	char *m_Trailer; /**< a line which is sent after the log, or NULL */
+
+	char *m_Buffer; /**< the read buffer */
+	size_t m_BufferStart; /**< the offset of the first unprocessed byte */
+	size_t m_BufferEnd; /**< the number of valid bytes in the buffer */
+	long m_Offset; /**< the file offset of the end of the buffer */
+	bool m_SkipLine; /**< whether to discard data up to the next newline */
+	bool m_EOF; /**< whether the end of the file (or range) has been reached */
+
+	unsigned int m_Line; /**< the number of the current line */
+	unsigned int m_Sent; /**< the number of lines which have been sent */
+
+	char *ReadLine(size_t *Scanned);
+	void SendLine(const char *Line);
+	void Finish(void);
+public:
+#ifndef SWIG
+	CLogPlayback(CClientConnection *Client, const char *Filename, LogType Type, const logrange_t *Range, const char *Trailer);
+	virtual ~CLogPlayback(void);
+#endif /* SWIG */
+
+	bool IsValid(void) const;
+	bool Pump(size_t HighWater = PLAYBACK_HIGHWATER);
+};
+
 /**
  * CLog
  *
@@ -44,18 +105,22 @@ class SBNCAPI CLog {
 	ino_t m_Inode;
 	dev_t m_Dev;
 #endif
+	CLogIndex *m_Index; /**< the full-text index for this log, or NULL */
 public:
 #ifndef SWIG
-	CLog(const char *Filename, bool KeepOpen = false);
+	CLog(const char *Filename, bool KeepOpen = false, bool Indexed = false);
 	virtual ~CLog(void);
 #endif /* SWIG */
 
 	void Clear(void);
 	void WriteLine(const char *Format,...);
 	void WriteUnformattedLine(const char *Line);
-	void PlayToUser(CClientConnection *Client, LogType Type) const;
+	void PlayToUser(CClientConnection *Client, LogType Type, const logrange_t *Range = NULL, const char *Trailer = NULL) const;
 	bool IsEmpty(void) const;
 	const char *GetFilename(void) const;
+
+	RESULT<bool> Search(const logquery_t *Query, unsigned int Skip, unsigned int Count, CVector<char *> *Results);
+	CLogIndex *GetIndex(void) const;
 };
 
 #endif /* LOG_H */
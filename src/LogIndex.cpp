@@ -0,0 +1,1593 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "StdAfx.h"
+
+bool LogIndexCatchupTimer(time_t Now, void *Index);
+void LogIndexCatchupWork(void *Cookie);
+void LogIndexCatchupDone(void *Cookie);
+
+/**
+ * IsWordChar
+ *
+ * Checks whether a character can be part of an indexed word.
+ *
+ * @param Char the character
+ */
+static bool IsWordChar(char Char) {
+	return (isalnum((unsigned char)Char) || (unsigned char)Char >= 0x80);
+}
+
+/**
+ * NextWord
+ *
+ * Returns the next word in a string, or NULL if there are no more words.
+ *
+ * @param Cursor the current position, this is updated to point past the word
+ * @param End the end of the string
+ * @param Length will contain the length of the word
+ */
+static const char *NextWord(const char **Cursor, const char *End, size_t *Length) {
+	const char *Word = *Cursor;
+
+	while (Word < End && !IsWordChar(*Word)) {
+		Word++;
+	}
+
+	if (Word >= End) {
+		*Cursor = End;
+
+		return NULL;
+	}
+
+	*Cursor = Word;
+
+	while (*Cursor < End && IsWordChar(**Cursor)) {
+		(*Cursor)++;
+	}
+
+	*Length = *Cursor - Word;
+
+	return Word;
+}
+
+/**
+ * Checksum
+ *
+ * Updates a FNV-1a checksum.
+ *
+ * @param Checksum the previous checksum
+ * @param Data the data
+ * @param Length the length of the data
+ */
+static uint32_t Checksum(uint32_t Checksum, const void *Data, size_t Length) {
+	const unsigned char *Bytes = (const unsigned char *)Data;
+
+	for (size_t i = 0; i < Length; i++) {
+		Checksum ^= Bytes[i];
+		Checksum *= 16777619;
+	}
+
+	return Checksum;
+}
+
+/**
+ * PostingCompare
+ *
+ * Compares two pending postings (by their hash and then their offset).
+ */
+static int PostingCompare(const void *p1, const void *p2) {
+	const logposting_t *Posting1 = (const logposting_t *)p1, *Posting2 = (const logposting_t *)p2;
+
+	if (Posting1->Hash != Posting2->Hash) {
+		return (Posting1->Hash < Posting2->Hash) ? -1 : 1;
+	}
+
+	if (Posting1->Offset != Posting2->Offset) {
+		return (Posting1->Offset < Posting2->Offset) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * OffsetCompare
+ *
+ * Compares two log offsets.
+ */
+static int OffsetCompare(const void *p1, const void *p2) {
+	uint64_t Offset1 = *(const uint64_t *)p1, Offset2 = *(const uint64_t *)p2;
+
+	if (Offset1 != Offset2) {
+		return (Offset1 < Offset2) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * SegmentSize
+ *
+ * Returns the on-disk size of a segment.
+ *
+ * @param Header the segment's header
+ */
+static long SegmentSize(const logindexheader_t *Header) {
+	return sizeof(logindexheader_t) + Header->TermCount * sizeof(logindexterm_t) +
+		Header->PostingCount * sizeof(uint32_t);
+}
+
+/** the indexes whose files are currently open */
+static CLogIndex *g_OpenIndexes[LOGINDEX_MAXOPENFILES];
+static unsigned int g_OpenIndexCount = 0;
+static unsigned int g_OpenIndexClock = 0;
+
+/**
+ * CLogIndex
+ *
+ * Constructs a new index object. The existing index (if any) is loaded
+ * and brought up to date in the background.
+ *
+ * @param LogFilename the filename of the log
+ */
+CLogIndex::CLogIndex(const char *LogFilename) {
+	m_File = NULL;
+	m_FileUsed = 0;
+	m_Loaded = false;
+	m_Failed = false;
+	m_Damaged = false;
+	m_Filename = NULL;
+	m_Pending = NULL;
+	m_PendingCount = 0;
+	m_PendingAlloc = 0;
+	m_PendingMinTime = 0;
+	m_PendingMaxTime = 0;
+	m_PendingStart = 0;
+	m_IndexedEnd = 0;
+	m_LogSize = 0;
+	m_CatchupTimer = NULL;
+	m_Catchup = NULL;
+
+	m_LogFilename = strdup(LogFilename);
+
+	if (AllocFailed(m_LogFilename)) {
+		return;
+	}
+
+	if (asprintf(&m_Filename, "%s.idx", LogFilename) < 0) {
+		m_Filename = NULL;
+
+		return;
+	}
+
+	/* the catch-up timer calls Update(), which loads the index */
+	m_CatchupTimer = new CTimer(1, true, LogIndexCatchupTimer, this);
+
+	if (AllocFailed(m_CatchupTimer)) {}
+}
+
+/**
+ * ~CLogIndex
+ *
+ * Writes pending postings and destructs the index object.
+ */
+CLogIndex::~CLogIndex(void) {
+	Flush();
+
+	if (m_CatchupTimer != NULL) {
+		m_CatchupTimer->Destroy();
+	}
+
+	/* LogIndexCatchupDone() frees the worker's result */
+	if (m_Catchup != NULL) {
+		m_Catchup->Index = NULL;
+	}
+
+	CloseFile();
+
+	free(m_Pending);
+	free(m_Filename);
+	free(m_LogFilename);
+}
+
+/**
+ * Prepare
+ *
+ * Loads the index unless that has already been done. Returns whether
+ * the index can be used.
+ */
+bool CLogIndex::Prepare(void) {
+	if (!m_Loaded) {
+		m_Loaded = true;
+		m_Failed = (m_Filename == NULL || !Load());
+	}
+
+	return !m_Failed;
+}
+
+/**
+ * OpenFile
+ *
+ * Makes sure that the index file is open. If too many index files are
+ * open the one which hasn't been used for the longest time is closed.
+ */
+bool CLogIndex::OpenFile(void) {
+	unsigned int Oldest = 0;
+	bool Created = false;
+
+	if (m_File != NULL) {
+		m_FileUsed = ++g_OpenIndexClock;
+
+		return true;
+	}
+
+	if (m_Filename == NULL) {
+		return false;
+	}
+
+	if (g_OpenIndexCount >= LOGINDEX_MAXOPENFILES) {
+		for (unsigned int i = 1; i < g_OpenIndexCount; i++) {
+			if (g_OpenIndexes[i]->m_FileUsed < g_OpenIndexes[Oldest]->m_FileUsed) {
+				Oldest = i;
+			}
+		}
+
+		g_OpenIndexes[Oldest]->CloseFile();
+	}
+
+	m_File = fopen(m_Filename, "r+b");
+
+	if (m_File == NULL) {
+		m_File = fopen(m_Filename, "w+b");
+		Created = true;
+	}
+
+	if (m_File == NULL) {
+		return false;
+	}
+
+	if (Created) {
+		SetPermissions(m_Filename, S_IRUSR | S_IWUSR);
+	}
+
+	g_OpenIndexes[g_OpenIndexCount++] = this;
+	m_FileUsed = ++g_OpenIndexClock;
+
+	return true;
+}
+
+/**
+ * CloseFile
+ *
+ * Closes the index file.
+ */
+void CLogIndex::CloseFile(void) {
+	if (m_File == NULL) {
+		return;
+	}
+
+	fclose(m_File);
+	m_File = NULL;
+
+	for (unsigned int i = 0; i < g_OpenIndexCount; i++) {
+		if (g_OpenIndexes[i] == this) {
+			g_OpenIndexes[i] = g_OpenIndexes[--g_OpenIndexCount];
+
+			break;
+		}
+	}
+}
+
+/**
+ * Load
+ *
+ * Opens the index file and validates its segments. Segments which are
+ * damaged (e.g. because the bouncer crashed while writing them) are
+ * discarded; the corresponding part of the log is indexed again.
+ */
+bool CLogIndex::Load(void) {
+	logindexheader_t Header;
+	logindexterm_t *Terms;
+	uint32_t *Postings;
+	logsegment_t Segment;
+	long Offset = 0, Size;
+	uint64_t LogEnd = 0;
+	struct stat StatBuf;
+
+	if (!OpenFile()) {
+		return false;
+	}
+
+	if (fstat(fileno(m_File), &StatBuf) < 0) {
+		return false;
+	}
+
+	Size = StatBuf.st_size;
+
+	while (fseek(m_File, Offset, SEEK_SET) == 0 && fread(&Header, sizeof(Header), 1, m_File) == 1) {
+		if (Header.Magic != LOGINDEX_MAGIC || Header.Version != LOGINDEX_VERSION || Header.Reserved != 0 ||
+				Header.LogStart != LogEnd || Header.LogEnd < Header.LogStart ||
+				Header.TermCount > Header.PostingCount || Header.PostingCount > LOGINDEX_MAXPOSTINGS * 2 ||
+				Offset + SegmentSize(&Header) > Size) {
+			break;
+		}
+
+		Segment.Header = Header;
+		Segment.FileOffset = Offset;
+
+		if (!m_Segments.Insert(Segment)) {
+			break;
+		}
+
+		Offset += SegmentSize(&Header);
+		LogEnd = Header.LogEnd;
+	}
+
+	/* only the last segment can be incomplete, so that's the one we verify */
+	while (m_Segments.GetLength() > 0) {
+		const logsegment_t *Last = m_Segments.GetAddressOf(m_Segments.GetLength() - 1);
+		uint32_t Sum = 2166136261u;
+
+		if (ReadSegment(Last, &Terms, &Postings)) {
+			Sum = Checksum(Sum, Terms, Last->Header.TermCount * sizeof(logindexterm_t));
+			Sum = Checksum(Sum, Postings, Last->Header.PostingCount * sizeof(uint32_t));
+
+			free(Terms);
+			free(Postings);
+
+			if (Sum == Last->Header.Checksum) {
+				break;
+			}
+		}
+
+		Offset = Last->FileOffset;
+		m_Segments.Remove(m_Segments.GetLength() - 1);
+	}
+
+	if (m_Segments.GetLength() > 0) {
+		m_IndexedEnd = m_Segments[m_Segments.GetLength() - 1].Header.LogEnd;
+	} else {
+		Offset = 0;
+		m_IndexedEnd = 0;
+	}
+
+	if (Offset != Size) {
+		Truncate(Offset);
+	}
+
+	m_PendingStart = m_IndexedEnd;
+
+	/* make sure the index still belongs to this log */
+	if (m_IndexedEnd > 0) {
+		FILE *LogFile = fopen(m_LogFilename, "rb");
+
+		if (LogFile == NULL || fseek(LogFile, (long)m_IndexedEnd - 1, SEEK_SET) != 0 || fgetc(LogFile) != '\n') {
+			Reset();
+		}
+
+		if (LogFile != NULL) {
+			fclose(LogFile);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Truncate
+ *
+ * Truncates the index file.
+ *
+ * @param Size the new size
+ */
+void CLogIndex::Truncate(long Size) {
+	if (!OpenFile()) {
+		return;
+	}
+
+	fflush(m_File);
+
+#ifdef _WIN32
+	_chsize(_fileno(m_File), Size);
+#else
+	if (ftruncate(fileno(m_File), Size) < 0) {
+		return;
+	}
+#endif
+}
+
+/**
+ * Reset
+ *
+ * Removes all entries from the index.
+ */
+void CLogIndex::Reset(void) {
+	/* the worker's result is useless now */
+	if (m_Catchup != NULL) {
+		m_Catchup->Index = NULL;
+		m_Catchup = NULL;
+	}
+
+	m_Segments.Clear();
+
+	m_Damaged = false;
+	m_PendingCount = 0;
+	m_PendingMinTime = 0;
+	m_PendingMaxTime = 0;
+	m_PendingStart = 0;
+	m_IndexedEnd = 0;
+	m_LogSize = 0;
+
+	Truncate(0);
+}
+
+/**
+ * Update
+ *
+ * Indexes lines which have been added to the log since the last update. If
+ * more than MaxBytes need to be indexed the rest of the log is indexed in
+ * the background.
+ *
+ * @param MaxBytes the maximum number of bytes to read from the log
+ */
+bool CLogIndex::Update(size_t MaxBytes) {
+	struct stat StatBuf;
+	logcatchup_t *Catchup;
+	CWorkerPool *WorkerPool;
+	bool Failed;
+
+	if (!Prepare()) {
+		return false;
+	}
+
+	/* a worker thread is busy indexing the log, LogIndexCatchupDone() will call us again */
+	if (m_Catchup != NULL) {
+		return true;
+	}
+
+	if (stat(m_LogFilename, &StatBuf) < 0) {
+		StatBuf.st_size = 0;
+	}
+
+	if ((uint64_t)StatBuf.st_size < m_IndexedEnd || m_Damaged) {
+		/* the log has been erased or replaced, or the index is damaged */
+		Reset();
+	}
+
+	m_LogSize = StatBuf.st_size;
+
+	if (m_IndexedEnd == m_LogSize) {
+		return true;
+	}
+
+	Catchup = (logcatchup_t *)malloc(sizeof(logcatchup_t));
+
+	if (AllocFailed(Catchup)) {
+		return false;
+	}
+
+	memset(Catchup, 0, sizeof(logcatchup_t));
+
+	Catchup->Index = this;
+	Catchup->LogFilename = strdup(m_LogFilename);
+	Catchup->Start = m_IndexedEnd;
+	Catchup->MaxBytes = MaxBytes;
+
+	if (AllocFailed(Catchup->LogFilename)) {
+		free(Catchup);
+
+		return false;
+	}
+
+	WorkerPool = (g_Bouncer != NULL) ? g_Bouncer->GetWorkerPool() : NULL;
+
+	if (WorkerPool != NULL && m_LogSize - m_IndexedEnd > LOGINDEX_ASYNCBYTES &&
+			!IsError(WorkerPool->Submit(CWorkerPool::GetShard(m_LogFilename), LogIndexCatchupWork, LogIndexCatchupDone, Catchup))) {
+		m_Catchup = Catchup;
+	} else {
+		LogIndexCatchupWork(Catchup);
+
+		Failed = Catchup->Failed;
+
+		ApplyCatchup(Catchup);
+
+		free(Catchup->Lines);
+		free(Catchup->LogFilename);
+		free(Catchup);
+
+		if (Failed) {
+			return false;
+		}
+	}
+
+	if (m_IndexedEnd < m_LogSize && m_CatchupTimer == NULL) {
+		m_CatchupTimer = new CTimer(1, true, LogIndexCatchupTimer, this);
+
+		if (AllocFailed(m_CatchupTimer)) {}
+	}
+
+	return true;
+}
+
+/**
+ * ApplyCatchup
+ *
+ * Adds the lines which have been scanned by LogIndexCatchupWork() to
+ * the index.
+ *
+ * @param Catchup the scanned lines
+ */
+void CLogIndex::ApplyCatchup(const logcatchup_t *Catchup) {
+	uint64_t Offset = Catchup->Start;
+	size_t i = 0;
+
+	/* somebody else has indexed these lines in the meantime */
+	if (Catchup->Start != m_IndexedEnd) {
+		return;
+	}
+
+	while (i + 3 <= Catchup->Length) {
+		uint32_t Length = Catchup->Lines[i];
+		uint32_t Time = Catchup->Lines[i + 1];
+		uint32_t HashCount = Catchup->Lines[i + 2];
+
+		IndexLine(Offset, Length, &(Catchup->Lines[i + 3]), HashCount, Time);
+
+		Offset += Length;
+		i += 3 + HashCount;
+	}
+}
+
+/**
+ * Append
+ *
+ * Notifies the index about a line which has just been written to the log.
+ *
+ * @param Offset the offset of the line in the log
+ * @param Line the line (including the timestamp)
+ * @param Time the timestamp of the line
+ */
+void CLogIndex::Append(long Offset, const char *Line, time_t Time) {
+	/* the catch-up timer will get to this line eventually */
+	if (m_CatchupTimer != NULL) {
+		return;
+	}
+
+	if (!Prepare()) {
+		return;
+	}
+
+	if (Offset < 0 || (uint64_t)Offset != m_IndexedEnd || m_Damaged) {
+		Update();
+
+		return;
+	}
+
+	AddLine(Offset, strlen(Line), Line, Time);
+
+	if (m_LogSize < m_IndexedEnd) {
+		m_LogSize = m_IndexedEnd;
+	}
+}
+
+/**
+ * AddLine
+ *
+ * Adds the terms of a log line to the pending postings.
+ *
+ * @param Offset the offset of the line in the log
+ * @param Length the number of bytes the line occupies in the log
+ * @param Line the line
+ * @param Time the timestamp of the line, or 0 to parse it from the line
+ */
+void CLogIndex::AddLine(uint64_t Offset, size_t Length, const char *Line, time_t Time) {
+	uint32_t Hashes[LOGINDEX_MAXLINETERMS];
+	unsigned int HashCount;
+	time_t LineTime;
+
+	HashCount = ScanLine(Line, Hashes, &LineTime);
+
+	if (Time == 0) {
+		Time = LineTime;
+	}
+
+	IndexLine(Offset, Length, Hashes, HashCount, Time);
+}
+
+/**
+ * IndexLine
+ *
+ * Adds the terms of a log line to the pending postings.
+ *
+ * @param Offset the offset of the line in the log
+ * @param Length the number of bytes the line occupies in the log
+ * @param Hashes the hashes of the line's terms
+ * @param HashCount the number of hashes
+ * @param Time the timestamp of the line, or 0 if unknown
+ */
+void CLogIndex::IndexLine(uint64_t Offset, size_t Length, const uint32_t *Hashes, unsigned int HashCount, time_t Time) {
+	/* postings are stored relative to the start of their segment */
+	if (m_PendingCount > 0 && Offset + Length - m_PendingStart > LOGINDEX_MAXSPAN) {
+		Flush();
+	}
+
+	for (unsigned int i = 0; i < HashCount; i++) {
+		if (!AddPosting(Offset, Hashes[i])) {
+			break;
+		}
+	}
+
+	if (Time != 0) {
+		if (m_PendingMinTime == 0 || Time < m_PendingMinTime) {
+			m_PendingMinTime = Time;
+		}
+
+		if (Time > m_PendingMaxTime) {
+			m_PendingMaxTime = Time;
+		}
+	}
+
+	m_IndexedEnd = Offset + Length;
+
+	if (m_PendingCount >= LOGINDEX_FLUSHPOSTINGS) {
+		Flush();
+	}
+}
+
+/**
+ * AddPosting
+ *
+ * Adds a pending posting.
+ *
+ * @param Offset the offset of the line
+ * @param Hash the hash of the term
+ */
+bool CLogIndex::AddPosting(uint64_t Offset, uint32_t Hash) {
+	if (m_PendingCount == m_PendingAlloc) {
+		unsigned int NewAlloc = (m_PendingAlloc == 0) ? 256 : m_PendingAlloc * 2;
+		logposting_t *NewPending = (logposting_t *)realloc(m_Pending, NewAlloc * sizeof(logposting_t));
+
+		if (AllocFailed(NewPending)) {
+			return false;
+		}
+
+		m_Pending = NewPending;
+		m_PendingAlloc = NewAlloc;
+	}
+
+	m_Pending[m_PendingCount].Offset = Offset;
+	m_Pending[m_PendingCount].Hash = Hash;
+	m_PendingCount++;
+
+	return true;
+}
+
+/**
+ * Flush
+ *
+ * Writes the pending postings as a new segment.
+ */
+bool CLogIndex::Flush(void) {
+	logindexheader_t Header;
+	logindexterm_t *Terms;
+	uint32_t *Postings;
+	logsegment_t Segment;
+	unsigned int TermCount = 0;
+	long FileOffset = 0;
+	bool ReturnValue;
+
+	if (m_PendingCount == 0) {
+		return true;
+	}
+
+	if (!OpenFile()) {
+		return false;
+	}
+
+	qsort(m_Pending, m_PendingCount, sizeof(logposting_t), PostingCompare);
+
+	Terms = (logindexterm_t *)malloc(m_PendingCount * sizeof(logindexterm_t));
+	Postings = (uint32_t *)malloc(m_PendingCount * sizeof(uint32_t));
+
+	if (AllocFailed(Terms) || AllocFailed(Postings)) {
+		free(Terms);
+		free(Postings);
+
+		return false;
+	}
+
+	for (unsigned int i = 0; i < m_PendingCount; i++) {
+		if (TermCount == 0 || Terms[TermCount - 1].Hash != m_Pending[i].Hash) {
+			Terms[TermCount].Hash = m_Pending[i].Hash;
+			Terms[TermCount].First = i;
+			Terms[TermCount].Count = 0;
+			TermCount++;
+		}
+
+		Terms[TermCount - 1].Count++;
+		Postings[i] = (uint32_t)(m_Pending[i].Offset - m_PendingStart);
+	}
+
+	memset(&Header, 0, sizeof(Header));
+	Header.TermCount = TermCount;
+	Header.PostingCount = m_PendingCount;
+	Header.LogStart = m_PendingStart;
+	Header.LogEnd = m_IndexedEnd;
+	Header.MinTime = (uint32_t)m_PendingMinTime;
+	Header.MaxTime = (uint32_t)m_PendingMaxTime;
+
+	if (m_Segments.GetLength() > 0) {
+		const logsegment_t *Last = m_Segments.GetAddressOf(m_Segments.GetLength() - 1);
+
+		FileOffset = Last->FileOffset + SegmentSize(&Last->Header);
+	}
+
+	ReturnValue = WriteSegment(FileOffset, &Header, Terms, Postings);
+
+	free(Terms);
+	free(Postings);
+
+	/* if writing failed these lines will be indexed again after a restart */
+	m_PendingCount = 0;
+	m_PendingMinTime = 0;
+	m_PendingMaxTime = 0;
+	m_PendingStart = m_IndexedEnd;
+
+	if (!ReturnValue) {
+		return false;
+	}
+
+	Segment.Header = Header;
+	Segment.FileOffset = FileOffset;
+
+	if (!m_Segments.Insert(Segment)) {
+		return false;
+	}
+
+	return MergeTail();
+}
+
+/**
+ * WriteSegment
+ *
+ * Writes a segment to the index file. Anything following the segment
+ * is discarded.
+ *
+ * @param FileOffset the offset of the segment in the index file
+ * @param Header the segment's header, the checksum is updated
+ * @param Terms the term table
+ * @param Postings the postings
+ */
+bool CLogIndex::WriteSegment(long FileOffset, logindexheader_t *Header, const logindexterm_t *Terms, const uint32_t *Postings) {
+	Header->Magic = LOGINDEX_MAGIC;
+	Header->Version = LOGINDEX_VERSION;
+	Header->Reserved = 0;
+	Header->Checksum = Checksum(2166136261u, Terms, Header->TermCount * sizeof(logindexterm_t));
+	Header->Checksum = Checksum(Header->Checksum, Postings, Header->PostingCount * sizeof(uint32_t));
+
+	if (fseek(m_File, FileOffset, SEEK_SET) != 0 ||
+			fwrite(Header, sizeof(logindexheader_t), 1, m_File) != 1 ||
+			fwrite(Terms, sizeof(logindexterm_t), Header->TermCount, m_File) != Header->TermCount ||
+			fwrite(Postings, sizeof(uint32_t), Header->PostingCount, m_File) != Header->PostingCount) {
+		Truncate(FileOffset);
+
+		return false;
+	}
+
+	Truncate(FileOffset + SegmentSize(Header));
+
+	return true;
+}
+
+/**
+ * ReadSegment
+ *
+ * Reads a segment's term table and postings. Fails if a term refers to
+ * postings beyond the end of the segment.
+ *
+ * @param Segment the segment
+ * @param Terms will contain the term table (must be freed by the caller)
+ * @param Postings will contain the postings (must be freed by the caller)
+ */
+bool CLogIndex::ReadSegment(const logsegment_t *Segment, logindexterm_t **Terms, uint32_t **Postings) const {
+	*Terms = (logindexterm_t *)malloc(Segment->Header.TermCount * sizeof(logindexterm_t) + 1);
+	*Postings = (uint32_t *)malloc(Segment->Header.PostingCount * sizeof(uint32_t) + 1);
+
+	if (AllocFailed(*Terms) || AllocFailed(*Postings) ||
+			fseek(m_File, Segment->FileOffset + sizeof(logindexheader_t), SEEK_SET) != 0 ||
+			fread(*Terms, sizeof(logindexterm_t), Segment->Header.TermCount, m_File) != Segment->Header.TermCount ||
+			fread(*Postings, sizeof(uint32_t), Segment->Header.PostingCount, m_File) != Segment->Header.PostingCount) {
+		free(*Terms);
+		free(*Postings);
+
+		return false;
+	}
+
+	for (uint32_t i = 0; i < Segment->Header.TermCount; i++) {
+		if ((uint64_t)(*Terms)[i].First + (*Terms)[i].Count > Segment->Header.PostingCount) {
+			free(*Terms);
+			free(*Postings);
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * MergeTail
+ *
+ * Merges the last two segments as long as they have a similar size.
+ */
+bool CLogIndex::MergeTail(void) {
+	while (m_Segments.GetLength() >= 2 && !m_Damaged) {
+		logsegment_t *Older = m_Segments.GetAddressOf(m_Segments.GetLength() - 2);
+		const logsegment_t *Newer = m_Segments.GetAddressOf(m_Segments.GetLength() - 1);
+		logindexterm_t *OlderTerms, *NewerTerms, *Terms;
+		uint32_t *OlderPostings, *NewerPostings, *Postings;
+		logindexheader_t Header;
+		unsigned int o = 0, n = 0, TermCount = 0, PostingCount = 0;
+		uint32_t Rebase;
+
+		if (Older->Header.PostingCount + Newer->Header.PostingCount > LOGINDEX_MAXPOSTINGS ||
+				Older->Header.PostingCount > 2 * Newer->Header.PostingCount ||
+				Newer->Header.LogEnd - Older->Header.LogStart > LOGINDEX_MAXSPAN) {
+			break;
+		}
+
+		Rebase = (uint32_t)(Newer->Header.LogStart - Older->Header.LogStart);
+
+		/* only the last segment is verified by Load(), so the other one
+		 * might be damaged; the next Update() rebuilds the index */
+		if (!ReadSegment(Older, &OlderTerms, &OlderPostings)) {
+			m_Damaged = true;
+
+			return false;
+		}
+
+		if (!ReadSegment(Newer, &NewerTerms, &NewerPostings)) {
+			free(OlderTerms);
+			free(OlderPostings);
+
+			m_Damaged = true;
+
+			return false;
+		}
+
+		Terms = (logindexterm_t *)malloc((Older->Header.TermCount + Newer->Header.TermCount) * sizeof(logindexterm_t));
+		Postings = (uint32_t *)malloc((Older->Header.PostingCount + Newer->Header.PostingCount) * sizeof(uint32_t));
+
+		if (AllocFailed(Terms) || AllocFailed(Postings)) {
+			free(Terms);
+			free(Postings);
+			free(OlderTerms);
+			free(OlderPostings);
+			free(NewerTerms);
+			free(NewerPostings);
+
+			return false;
+		}
+
+		while (o < Older->Header.TermCount || n < Newer->Header.TermCount) {
+			logindexterm_t *Term = &Terms[TermCount++];
+
+			if (n >= Newer->Header.TermCount || (o < Older->Header.TermCount && OlderTerms[o].Hash < NewerTerms[n].Hash)) {
+				Term->Hash = OlderTerms[o].Hash;
+			} else {
+				Term->Hash = NewerTerms[n].Hash;
+			}
+
+			Term->First = PostingCount;
+			Term->Count = 0;
+
+			/* postings from the older segment come first, so the result stays sorted */
+			if (o < Older->Header.TermCount && OlderTerms[o].Hash == Term->Hash) {
+				memcpy(&Postings[PostingCount], &OlderPostings[OlderTerms[o].First], OlderTerms[o].Count * sizeof(uint32_t));
+				PostingCount += OlderTerms[o].Count;
+				Term->Count += OlderTerms[o].Count;
+				o++;
+			}
+
+			if (n < Newer->Header.TermCount && NewerTerms[n].Hash == Term->Hash) {
+				/* offsets are relative to the start of the segment */
+				for (unsigned int i = 0; i < NewerTerms[n].Count; i++) {
+					Postings[PostingCount + i] = NewerPostings[NewerTerms[n].First + i] + Rebase;
+				}
+
+				PostingCount += NewerTerms[n].Count;
+				Term->Count += NewerTerms[n].Count;
+				n++;
+			}
+		}
+
+		memset(&Header, 0, sizeof(Header));
+		Header.TermCount = TermCount;
+		Header.PostingCount = PostingCount;
+		Header.LogStart = Older->Header.LogStart;
+		Header.LogEnd = Newer->Header.LogEnd;
+		Header.MinTime = Older->Header.MinTime ? Older->Header.MinTime : Newer->Header.MinTime;
+		Header.MaxTime = Newer->Header.MaxTime ? Newer->Header.MaxTime : Older->Header.MaxTime;
+
+		free(OlderTerms);
+		free(OlderPostings);
+		free(NewerTerms);
+		free(NewerPostings);
+
+		/* if we crash while writing the merged segment it fails its checksum
+		 * when the index is loaded and the log is simply indexed again */
+		bool Written = WriteSegment(Older->FileOffset, &Header, Terms, Postings);
+
+		free(Terms);
+		free(Postings);
+
+		m_Segments.Remove(m_Segments.GetLength() - 1);
+
+		if (!Written) {
+			m_Segments.Remove(m_Segments.GetLength() - 1);
+
+			m_IndexedEnd = (m_Segments.GetLength() > 0) ? m_Segments[m_Segments.GetLength() - 1].Header.LogEnd : 0;
+			m_PendingStart = m_IndexedEnd;
+
+			return false;
+		}
+
+		/* Remove() may have moved the list, so we can't use Older here */
+		m_Segments.GetAddressOf(m_Segments.GetLength() - 1)->Header = Header;
+	}
+
+	return !m_Damaged;
+}
+
+/**
+ * FindTerm
+ *
+ * Looks up a term in a segment's term table.
+ *
+ * @param Segment the segment
+ * @param Hash the term's hash
+ * @param Term will contain the term table entry
+ */
+bool CLogIndex::FindTerm(const logsegment_t *Segment, uint32_t Hash, logindexterm_t *Term) const {
+	uint32_t Low = 0, High = Segment->Header.TermCount;
+
+	while (Low < High) {
+		uint32_t Middle = Low + (High - Low) / 2;
+
+		if (fseek(m_File, Segment->FileOffset + sizeof(logindexheader_t) + Middle * sizeof(logindexterm_t), SEEK_SET) != 0 ||
+				fread(Term, sizeof(logindexterm_t), 1, m_File) != 1) {
+			return false;
+		}
+
+		if (Term->Hash == Hash) {
+			return (Term->First + Term->Count <= Segment->Header.PostingCount);
+		} else if (Term->Hash < Hash) {
+			Low = Middle + 1;
+		} else {
+			High = Middle;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * GetPostings
+ *
+ * Returns the offsets of all lines in a segment which contain a term. The
+ * offsets are sorted in ascending order.
+ *
+ * @param Segment the segment
+ * @param Hash the term's hash
+ * @param Count will contain the number of offsets
+ */
+uint64_t *CLogIndex::GetPostings(const logsegment_t *Segment, uint32_t Hash, unsigned int *Count) const {
+	logindexterm_t Term;
+	uint64_t *Postings;
+	uint32_t *RelativePostings;
+
+	*Count = 0;
+
+	if (!FindTerm(Segment, Hash, &Term)) {
+		return NULL;
+	}
+
+	Postings = (uint64_t *)malloc(Term.Count * sizeof(uint64_t));
+
+	if (AllocFailed(Postings)) {
+		return NULL;
+	}
+
+	/* the relative offsets are read into the second half of the buffer and expanded in place */
+	RelativePostings = (uint32_t *)Postings + Term.Count;
+
+	if (fseek(m_File, Segment->FileOffset + sizeof(logindexheader_t) + Segment->Header.TermCount * sizeof(logindexterm_t) +
+			Term.First * sizeof(uint32_t), SEEK_SET) != 0 ||
+			fread(RelativePostings, sizeof(uint32_t), Term.Count, m_File) != Term.Count) {
+		free(Postings);
+
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < Term.Count; i++) {
+		Postings[i] = Segment->Header.LogStart + RelativePostings[i];
+	}
+
+	*Count = Term.Count;
+
+	return Postings;
+}
+
+/**
+ * GetPendingPostings
+ *
+ * Returns the offsets of all pending lines which contain a term.
+ *
+ * @param Hash the term's hash
+ * @param Count will contain the number of offsets
+ */
+uint64_t *CLogIndex::GetPendingPostings(uint32_t Hash, unsigned int *Count) const {
+	uint64_t *Postings = NULL;
+
+	*Count = 0;
+
+	for (unsigned int i = 0; i < m_PendingCount; i++) {
+		if (m_Pending[i].Hash != Hash) {
+			continue;
+		}
+
+		if (Postings == NULL) {
+			Postings = (uint64_t *)malloc((m_PendingCount - i) * sizeof(uint64_t));
+
+			if (AllocFailed(Postings)) {
+				return NULL;
+			}
+		}
+
+		Postings[(*Count)++] = m_Pending[i].Offset;
+	}
+
+	/* the pending postings are only sorted after they've been flushed */
+	if (*Count > 1) {
+		qsort(Postings, *Count, sizeof(uint64_t), OffsetCompare);
+	}
+
+	return Postings;
+}
+
+/**
+ * Search
+ *
+ * Searches the log. Matching lines are returned newest first.
+ *
+ * @param Query the query
+ * @param Skip the number of matching lines which should be skipped
+ * @param Count the maximum number of lines to return
+ * @param Results will receive the lines (must be freed by the caller)
+ * @return whether there are more matching lines
+ */
+RESULT<bool> CLogIndex::Search(const logquery_t *Query, unsigned int Skip, unsigned int Count, CVector<char *> *Results) {
+	uint32_t Hashes[LOGINDEX_MAXLINETERMS];
+	unsigned int HashCount = 0, Matched = 0;
+	const char *Cursor, *End, *Word;
+	size_t WordLength;
+	char Line[LOGINDEX_MAXLINELENGTH + 2];
+	FILE *LogFile;
+	bool More = false;
+
+	if (!Prepare()) {
+		THROW(bool, Generic_Unknown, "The log index is not available.");
+	}
+
+	if (Query->Nick != NULL && Query->Nick[0] != '\0') {
+		Hashes[HashCount++] = HashTerm(Query->Nick, strlen(Query->Nick), true);
+	}
+
+	if (Query->Terms != NULL) {
+		Cursor = Query->Terms;
+		End = Query->Terms + strlen(Query->Terms);
+
+		while (HashCount < LOGINDEX_MAXLINETERMS && (Word = NextWord(&Cursor, End, &WordLength)) != NULL) {
+			if (WordLength >= LOGINDEX_MINTERMLENGTH) {
+				Hashes[HashCount++] = HashTerm(Word, WordLength, false);
+			}
+		}
+	}
+
+	if (HashCount == 0) {
+		THROW(bool, Generic_InvalidArgument, "You need to specify a nick or at least one word with two or more characters.");
+	}
+
+	Update();
+
+	if (!OpenFile()) {
+		THROW(bool, Generic_Unknown, "The log index is not available.");
+	}
+
+	LogFile = fopen(m_LogFilename, "rb");
+
+	if (LogFile == NULL) {
+		RETURN(bool, false);
+	}
+
+	/* i == m_Segments.GetLength() stands for the pending postings, which contain the newest lines */
+	for (int i = m_Segments.GetLength(); i >= 0 && !More; i--) {
+		const logsegment_t *Segment = (i < m_Segments.GetLength()) ? m_Segments.GetAddressOf(i) : NULL;
+		uint64_t *Lists[LOGINDEX_MAXLINETERMS];
+		unsigned int Counts[LOGINDEX_MAXLINETERMS];
+		unsigned int Shortest = 0, k;
+		time_t MinTime, MaxTime;
+		bool Complete = true;
+
+		MinTime = (Segment != NULL) ? Segment->Header.MinTime : m_PendingMinTime;
+		MaxTime = (Segment != NULL) ? Segment->Header.MaxTime : m_PendingMaxTime;
+
+		if ((Query->Until != 0 && MinTime != 0 && MinTime > Query->Until) ||
+				(Query->Since != 0 && MaxTime != 0 && MaxTime < Query->Since)) {
+			continue;
+		}
+
+		for (k = 0; k < HashCount; k++) {
+			if (Segment != NULL) {
+				Lists[k] = GetPostings(Segment, Hashes[k], &Counts[k]);
+			} else {
+				Lists[k] = GetPendingPostings(Hashes[k], &Counts[k]);
+			}
+
+			if (Lists[k] == NULL) {
+				/* at least one of the terms doesn't occur in this segment */
+				Complete = false;
+				k++;
+
+				break;
+			}
+
+			if (Counts[k] < Counts[Shortest]) {
+				Shortest = k;
+			}
+		}
+
+		if (Complete) {
+			for (unsigned int p = Counts[Shortest]; p > 0 && !More; p--) {
+				uint64_t Offset = Lists[Shortest][p - 1];
+				const char *Text, *Nick;
+				size_t NickLength;
+				time_t Time;
+				unsigned int l;
+
+				for (l = 0; l < HashCount; l++) {
+					if (l != Shortest && bsearch(&Offset, Lists[l], Counts[l], sizeof(uint64_t), OffsetCompare) == NULL) {
+						break;
+					}
+				}
+
+				if (l < HashCount) {
+					continue;
+				}
+
+				/* hashes can collide, so the actual line has the final say */
+				if (fseek(LogFile, (long)Offset, SEEK_SET) != 0 || fgets(Line, sizeof(Line), LogFile) == NULL) {
+					continue;
+				}
+
+				Line[strcspn(Line, "\r\n")] = '\0';
+
+				Text = ParseLine(Line, &Time, &Nick, &NickLength);
+
+				if (!MatchLine(Query, Nick, NickLength, Text, Time)) {
+					continue;
+				}
+
+				Matched++;
+
+				if (Matched <= Skip) {
+					continue;
+				}
+
+				if ((unsigned int)Results->GetLength() >= Count) {
+					More = true;
+
+					break;
+				}
+
+				char *DupLine = strdup(Line);
+
+				if (AllocFailed(DupLine)) {
+					continue;
+				}
+
+				if (!Results->Insert(DupLine)) {
+					free(DupLine);
+				}
+			}
+		}
+
+		for (unsigned int l = 0; l < k; l++) {
+			free(Lists[l]);
+		}
+	}
+
+	fclose(LogFile);
+
+	RETURN(bool, More);
+}
+
+/**
+ * GetIndexedSize
+ *
+ * Returns the number of bytes of the log which have been indexed.
+ */
+uint64_t CLogIndex::GetIndexedSize(void) const {
+	return m_IndexedEnd;
+}
+
+/**
+ * GetLogSize
+ *
+ * Returns the size of the log.
+ */
+uint64_t CLogIndex::GetLogSize(void) const {
+	return m_LogSize;
+}
+
+/**
+ * GetSegmentCount
+ *
+ * Returns the number of segments in the index file.
+ */
+unsigned int CLogIndex::GetSegmentCount(void) const {
+	return m_Segments.GetLength();
+}
+
+/**
+ * HashTerm
+ *
+ * Calculates the (case-insensitive) hash of a term.
+ *
+ * @param Term the term
+ * @param Length the length of the term
+ * @param Nick whether the term is a nick
+ */
+uint32_t CLogIndex::HashTerm(const char *Term, size_t Length, bool Nick) {
+	uint32_t Hash = 2166136261u;
+
+	if (Nick) {
+		/* nicks use a different hash space than words */
+		Hash = (Hash ^ 0x01) * 16777619;
+	}
+
+	for (size_t i = 0; i < Length; i++) {
+		Hash ^= (unsigned char)tolower((unsigned char)Term[i]);
+		Hash *= 16777619;
+	}
+
+	return Hash;
+}
+
+/**
+ * ParseLine
+ *
+ * Splits a log line into its timestamp, the sender's nick and the
+ * actual text.
+ *
+ * @param Line the log line
+ * @param Time will contain the timestamp, or 0 if it could not be parsed
+ * @param Nick will contain the sender's nick (not NUL-terminated), or NULL
+ * @param NickLength will contain the length of the nick
+ * @return the text of the log entry
+ */
+const char *CLogIndex::ParseLine(const char *Line, time_t *Time, const char **Nick, size_t *NickLength) {
+	const char *Text = Line, *TimeEnd, *NickEnd;
+
+	*Time = 0;
+	*Nick = NULL;
+	*NickLength = 0;
+
+	if (Line[0] == '[' && (TimeEnd = strstr(Line, "]: ")) != NULL) {
+#ifndef _WIN32
+		char strTime[100];
+		tm LineTm;
+
+		if ((size_t)(TimeEnd - Line) < sizeof(strTime)) {
+			memcpy(strTime, Line + 1, TimeEnd - Line - 1);
+			strTime[TimeEnd - Line - 1] = '\0';
+
+			memset(&LineTm, 0, sizeof(LineTm));
+
+			if (strptime(strTime, "%a %B %d %Y %H:%M:%S", &LineTm) != NULL) {
+				LineTm.tm_isdst = -1;
+				*Time = mktime(&LineTm);
+
+				if (*Time == (time_t)-1) {
+					*Time = 0;
+				}
+			}
+		}
+#endif
+
+		Text = TimeEnd + 3;
+	}
+
+	/* private messages and notices are logged as "nick (host): text" */
+	NickEnd = strchr(Text, ' ');
+
+	if (NickEnd != NULL && NickEnd > Text && NickEnd[1] == '(') {
+		*Nick = Text;
+		*NickLength = NickEnd - Text;
+	}
+
+	return Text;
+}
+
+/**
+ * ScanLine
+ *
+ * Returns the hashes of the distinct terms (the sender's nick and the
+ * words) in a log line. Apart from the time zone which mktime() uses
+ * this does not depend on any global state, so worker threads can use it.
+ *
+ * @param Line the log line
+ * @param Hashes will contain the hashes (LOGINDEX_MAXLINETERMS at most)
+ * @param Time will contain the timestamp, or 0 if it could not be parsed
+ * @return the number of hashes
+ */
+unsigned int CLogIndex::ScanLine(const char *Line, uint32_t *Hashes, time_t *Time) {
+	unsigned int HashCount = 0;
+	const char *Text, *Nick, *Cursor, *End, *Word;
+	size_t NickLength, WordLength;
+
+	Text = ParseLine(Line, Time, &Nick, &NickLength);
+
+	if (Nick != NULL) {
+		Hashes[HashCount++] = HashTerm(Nick, NickLength, true);
+	}
+
+	Cursor = Text;
+	End = Text + strcspn(Text, "\r\n");
+
+	while (HashCount < LOGINDEX_MAXLINETERMS && (Word = NextWord(&Cursor, End, &WordLength)) != NULL) {
+		uint32_t Hash;
+		unsigned int i;
+
+		if (WordLength < LOGINDEX_MINTERMLENGTH) {
+			continue;
+		}
+
+		Hash = HashTerm(Word, WordLength, false);
+
+		for (i = 0; i < HashCount; i++) {
+			if (Hashes[i] == Hash) {
+				break;
+			}
+		}
+
+		if (i == HashCount) {
+			Hashes[HashCount++] = Hash;
+		}
+	}
+
+	return HashCount;
+}
+
+/**
+ * MatchLine
+ *
+ * Checks whether a log entry matches a query.
+ *
+ * @param Query the query
+ * @param Nick the nick of the sender (not NUL-terminated), or NULL
+ * @param NickLength the length of the nick
+ * @param Text the text of the entry
+ * @param Time the timestamp of the entry, or 0 if unknown
+ */
+bool CLogIndex::MatchLine(const logquery_t *Query, const char *Nick, size_t NickLength, const char *Text, time_t Time) {
+	const char *QueryCursor, *QueryEnd, *QueryWord, *TextEnd;
+	size_t QueryWordLength;
+
+	if (Time != 0 && ((Query->Since != 0 && Time < Query->Since) || (Query->Until != 0 && Time > Query->Until))) {
+		return false;
+	}
+
+	if (Query->Nick != NULL && Query->Nick[0] != '\0' &&
+			(Nick == NULL || strlen(Query->Nick) != NickLength || strncasecmp(Query->Nick, Nick, NickLength) != 0)) {
+		return false;
+	}
+
+	if (Query->Terms == NULL) {
+		return true;
+	}
+
+	QueryCursor = Query->Terms;
+	QueryEnd = Query->Terms + strlen(Query->Terms);
+	TextEnd = Text + strlen(Text);
+
+	while ((QueryWord = NextWord(&QueryCursor, QueryEnd, &QueryWordLength)) != NULL) {
+		const char *TextCursor = Text, *TextWord;
+		size_t TextWordLength;
+		bool Found = false;
+
+		while ((TextWord = NextWord(&TextCursor, TextEnd, &TextWordLength)) != NULL) {
+			if (TextWordLength == QueryWordLength && strncasecmp(TextWord, QueryWord, QueryWordLength) == 0) {
+				Found = true;
+
+				break;
+			}
+		}
+
+		if (!Found) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * LogIndexCatchupTimer
+ *
+ * Indexes the next part of a log which hasn't been indexed yet.
+ *
+ * @param Now the current time
+ * @param Index the index
+ */
+bool LogIndexCatchupTimer(time_t Now, void *Index) {
+	CLogIndex *LogIndex = (CLogIndex *)Index;
+
+	LogIndex->Update();
+
+	if (LogIndex->m_IndexedEnd < LogIndex->m_LogSize) {
+		return true;
+	}
+
+	LogIndex->m_CatchupTimer = NULL;
+
+	return false;
+}
+
+/**
+ * AddScannedLine
+ *
+ * Appends a line to a logcatchup_t structure. This runs on worker
+ * threads, so it must not use AllocFailed().
+ *
+ * @param Catchup the structure
+ * @param Length the number of bytes the line occupies in the log
+ * @param Time the timestamp of the line
+ * @param Hashes the hashes of the line's terms
+ * @param HashCount the number of hashes
+ */
+static bool AddScannedLine(logcatchup_t *Catchup, size_t Length, time_t Time, const uint32_t *Hashes, unsigned int HashCount) {
+	if (Catchup->Length + 3 + HashCount > Catchup->Alloc) {
+		size_t NewAlloc = (Catchup->Alloc == 0) ? 4096 : Catchup->Alloc * 2;
+		uint32_t *NewLines = (uint32_t *)realloc(Catchup->Lines, NewAlloc * sizeof(uint32_t));
+
+		if (NewLines == NULL) {
+			return false;
+		}
+
+		Catchup->Lines = NewLines;
+		Catchup->Alloc = NewAlloc;
+	}
+
+	Catchup->Lines[Catchup->Length++] = (uint32_t)Length;
+	Catchup->Lines[Catchup->Length++] = (uint32_t)Time;
+	Catchup->Lines[Catchup->Length++] = HashCount;
+
+	memcpy(&(Catchup->Lines[Catchup->Length]), Hashes, HashCount * sizeof(uint32_t));
+	Catchup->Length += HashCount;
+
+	return true;
+}
+
+/**
+ * LogIndexCatchupWork
+ *
+ * Scans the part of the log which hasn't been indexed yet. This is either
+ * called by Update() or by a worker thread.
+ *
+ * @param Cookie the logcatchup_t structure
+ */
+void LogIndexCatchupWork(void *Cookie) {
+	logcatchup_t *Catchup = (logcatchup_t *)Cookie;
+	char Line[LOGINDEX_MAXLINELENGTH + 2];
+	uint32_t Hashes[LOGINDEX_MAXLINETERMS];
+	unsigned int HashCount;
+	size_t Length, Scanned = 0;
+	time_t Time;
+	FILE *LogFile;
+
+	LogFile = fopen(Catchup->LogFilename, "rb");
+
+	if (LogFile == NULL) {
+		Catchup->Failed = true;
+
+		return;
+	}
+
+	if (fseek(LogFile, (long)Catchup->Start, SEEK_SET) != 0) {
+		fclose(LogFile);
+
+		Catchup->Failed = true;
+
+		return;
+	}
+
+	while (Scanned < Catchup->MaxBytes && fgets(Line, sizeof(Line), LogFile) != NULL) {
+		Length = strlen(Line);
+
+		if (Length == 0 || Line[Length - 1] != '\n') {
+			int Char;
+
+			if (feof(LogFile)) {
+				/* incomplete line, somebody's still writing it */
+				break;
+			}
+
+			/* overlong line, we only index the beginning */
+			while ((Char = fgetc(LogFile)) != EOF) {
+				Length++;
+
+				if (Char == '\n') {
+					break;
+				}
+			}
+
+			if (Char != '\n') {
+				break;
+			}
+		}
+
+		HashCount = CLogIndex::ScanLine(Line, Hashes, &Time);
+
+		if (!AddScannedLine(Catchup, Length, Time, Hashes, HashCount)) {
+			break;
+		}
+
+		Scanned += Length;
+	}
+
+	fclose(LogFile);
+}
+
+/**
+ * LogIndexCatchupDone
+ *
+ * Adds the lines which have been scanned by a worker thread to the
+ * index and continues with the next part of the log.
+ *
+ * @param Cookie the logcatchup_t structure
+ */
+void LogIndexCatchupDone(void *Cookie) {
+	logcatchup_t *Catchup = (logcatchup_t *)Cookie;
+	CLogIndex *Index = Catchup->Index;
+
+	if (Index != NULL) {
+		Index->m_Catchup = NULL;
+
+		Index->ApplyCatchup(Catchup);
+	}
+
+	free(Catchup->Lines);
+	free(Catchup->LogFilename);
+	free(Catchup);
+
+	if (Index != NULL) {
+		Index->Update();
+	}
+}
@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+/** The magic number at the beginning of each index segment ("SBIX") */
+#define LOGINDEX_MAGIC 0x58494253
+
+/** The version of the index format */
+#define LOGINDEX_VERSION 1
+
+/** The number of pending postings which causes a new segment to be written */
+#define LOGINDEX_FLUSHPOSTINGS (64 * 1024)
+
+/** Adjacent segments are not merged if the result would exceed this many postings */
+#define LOGINDEX_MAXPOSTINGS (1024 * 1024)
+
+/** The maximum number of log bytes which can be covered by a single segment */
+#define LOGINDEX_MAXSPAN ((uint64_t)0x80000000)
+
+/** The maximum number of log bytes which are indexed in a single Update() call */
+#define LOGINDEX_CATCHUPBYTES (8 * 1024 * 1024)
+
+/** Updates which need to index more log bytes than this are done by a worker thread (if enabled) */
+#define LOGINDEX_ASYNCBYTES (64 * 1024)
+
+/** The maximum number of index files which are kept open at the same time */
+#define LOGINDEX_MAXOPENFILES 16
+
+/** The maximum number of distinct terms which are indexed for a single line */
+#define LOGINDEX_MAXLINETERMS 128
+
+/** Words which are shorter than this are not indexed */
+#define LOGINDEX_MINTERMLENGTH 2
+
+/** The maximum length of a log line which is considered by the index */
+#define LOGINDEX_MAXLINELENGTH 4096
+
+/** The number of results per page for the "search" command */
+#define LOGINDEX_PAGESIZE 20
+
+/**
+ * logindexheader_t
+ *
+ * The on-disk header of an index segment. It is followed by TermCount
+ * logindexterm_t structures (sorted by their hash) and PostingCount
+ * 32-bit log offsets relative to LogStart (grouped by term, ascending).
+ */
+typedef struct logindexheader_s {
+	uint32_t Magic; /**< LOGINDEX_MAGIC */
+	uint32_t Version; /**< LOGINDEX_VERSION */
+	uint32_t TermCount; /**< the number of terms */
+	uint32_t PostingCount; /**< the number of postings */
+	uint64_t LogStart; /**< the log offset of the first line covered by this segment */
+	uint64_t LogEnd; /**< the log offset after the last line covered by this segment */
+	uint32_t MinTime; /**< the timestamp of the oldest line, 0 if unknown */
+	uint32_t MaxTime; /**< the timestamp of the newest line, 0 if unknown */
+	uint32_t Checksum; /**< a checksum of the term table and the postings */
+	uint32_t Reserved; /**< reserved, must be 0 */
+} logindexheader_t;
+
+/**
+ * logindexterm_t
+ *
+ * An entry in a segment's term table.
+ */
+typedef struct logindexterm_s {
+	uint32_t Hash; /**< the hash of the term */
+	uint32_t First; /**< the index of the term's first posting */
+	uint32_t Count; /**< the number of postings for this term */
+} logindexterm_t;
+
+/**
+ * logposting_t
+ *
+ * A posting which has not been written to disk yet.
+ */
+typedef struct logposting_s {
+	uint64_t Offset; /**< the log offset of the line */
+	uint32_t Hash; /**< the hash of the term */
+} logposting_t;
+
+/**
+ * logsegment_t
+ *
+ * A segment of the index file.
+ */
+typedef struct logsegment_s {
+	logindexheader_t Header; /**< the segment's header */
+	long FileOffset; /**< the offset of the header in the index file */
+} logsegment_t;
+
+/**
+ * logquery_t
+ *
+ * A search query. Only lines which match all criteria are returned.
+ */
+typedef struct logquery_s {
+	const char *Terms; /**< space-separated words, or NULL */
+	const char *Nick; /**< the nick of the sender, or NULL */
+	time_t Since; /**< the earliest timestamp, or 0 */
+	time_t Until; /**< the latest timestamp, or 0 */
+} logquery_t;
+
+class CLogIndex;
+
+/**
+ * logcatchup_t
+ *
+ * A part of the log which is being scanned by Update(), possibly on a
+ * worker thread. For each line Lines contains the number of bytes the line
+ * occupies in the log, its timestamp, the number of terms and the terms'
+ * hashes.
+ */
+typedef struct logcatchup_s {
+	CLogIndex *Index; /**< the index, or NULL if it doesn't need the result anymore */
+	char *LogFilename; /**< the filename of the log */
+	uint64_t Start; /**< the log offset of the first line */
+	size_t MaxBytes; /**< the maximum number of bytes to read from the log */
+	bool Failed; /**< whether the log could not be read */
+	uint32_t *Lines; /**< the scanned lines */
+	size_t Length; /**< the number of used elements in Lines */
+	size_t Alloc; /**< the number of allocated elements in Lines */
+} logcatchup_t;
+
+/**
+ * CLogIndex
+ *
+ * An incrementally updated inverted index for a log file. The index is
+ * stored next to the log (using the suffix ".idx") and consists of
+ * immutable segments which map term hashes to the offsets of the lines
+ * containing them. New lines are collected in memory and appended as a
+ * new segment once enough postings have accumulated; small trailing
+ * segments are merged so that the number of segments grows logarithmically
+ * with the size of the log. The log itself is the authoritative source:
+ * if the index is missing, damaged or out of date the missing part of the
+ * log is (re-)indexed.
+ *
+ * The index is loaded when it is first needed and only a few index files
+ * are kept open at any time (see LOGINDEX_MAXOPENFILES).
+ */
+class SBNCAPI CLogIndex {
+	char *m_LogFilename; /**< the filename of the log */
+	char *m_Filename; /**< the filename of the index */
+	FILE *m_File; /**< the index file, or NULL if it isn't open at the moment */
+	unsigned int m_FileUsed; /**< when the index file was last used, see OpenFile() */
+	bool m_Loaded; /**< whether Load() has been called */
+	bool m_Failed; /**< whether the index could not be loaded */
+	bool m_Damaged; /**< whether a damaged segment was found, the next Update() rebuilds the index */
+
+	CVector<logsegment_t> m_Segments; /**< the segments, oldest first */
+
+	logposting_t *m_Pending; /**< postings which haven't been written yet */
+	unsigned int m_PendingCount; /**< the number of pending postings */
+	unsigned int m_PendingAlloc; /**< the number of allocated pending postings */
+	time_t m_PendingMinTime; /**< the timestamp of the oldest pending line */
+	time_t m_PendingMaxTime; /**< the timestamp of the newest pending line */
+	uint64_t m_PendingStart; /**< the log offset of the first pending line */
+
+	uint64_t m_IndexedEnd; /**< the log offset up to which lines have been indexed */
+	uint64_t m_LogSize; /**< the size of the log the last time we looked */
+
+	CTimer *m_CatchupTimer; /**< used for indexing large logs in the background */
+	logcatchup_t *m_Catchup; /**< the part of the log which is being scanned by a worker thread */
+
+	bool Load(void);
+	bool Prepare(void);
+	bool OpenFile(void);
+	void CloseFile(void);
+	bool Flush(void);
+	bool MergeTail(void);
+	bool WriteSegment(long FileOffset, logindexheader_t *Header, const logindexterm_t *Terms, const uint32_t *Postings);
+	bool ReadSegment(const logsegment_t *Segment, logindexterm_t **Terms, uint32_t **Postings) const;
+	bool FindTerm(const logsegment_t *Segment, uint32_t Hash, logindexterm_t *Term) const;
+	uint64_t *GetPostings(const logsegment_t *Segment, uint32_t Hash, unsigned int *Count) const;
+	uint64_t *GetPendingPostings(uint32_t Hash, unsigned int *Count) const;
+	void AddLine(uint64_t Offset, size_t Length, const char *Line, time_t Time);
+	void IndexLine(uint64_t Offset, size_t Length, const uint32_t *Hashes, unsigned int HashCount, time_t Time);
+	void ApplyCatchup(const logcatchup_t *Catchup);
+	bool AddPosting(uint64_t Offset, uint32_t Hash);
+	void Truncate(long Size);
+
+	friend bool LogIndexCatchupTimer(time_t Now, void *Index);
+	friend void LogIndexCatchupDone(void *Cookie);
+public:
+#ifndef SWIG
+	CLogIndex(const char *LogFilename);
+	virtual ~CLogIndex(void);
+#endif /* SWIG */
+
+	void Reset(void);
+	bool Update(size_t MaxBytes = LOGINDEX_CATCHUPBYTES);
+	void Append(long Offset, const char *Line, time_t Time);
+
+	RESULT<bool> Search(const logquery_t *Query, unsigned int Skip, unsigned int Count, CVector<char *> *Results);
+
+	uint64_t GetIndexedSize(void) const;
+	uint64_t GetLogSize(void) const;
+	unsigned int GetSegmentCount(void) const;
+
+	static uint32_t HashTerm(const char *Term, size_t Length, bool Nick);
+	static const char *ParseLine(const char *Line, time_t *Time, const char **Nick, size_t *NickLength);
+	static unsigned int ScanLine(const char *Line, uint32_t *Hashes, time_t *Time);
+	static bool MatchLine(const logquery_t *Query, const char *Nick, size_t NickLength, const char *Text, time_t Time);
+};
+
+#endif /* LOGINDEX_H */
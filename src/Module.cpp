@@ -30,6 +30,7 @@ CModule::CModule(const char *Filename) {
 
 	m_Far = NULL;
 	m_Image = NULL;
+	m_InterfaceVersion = 0;
 	m_File = strdup(Filename);
 
 	Result = InternalLoad(g_Bouncer->BuildPathModule(Filename));
@@ -113,7 +114,9 @@ bool CModule::InternalLoad(const char *Filename) {
 			(FNGETINTERFACEVERSION)GetProcAddress(m_Image,
 			"bncGetInterfaceVersion");
 
-		if (pfGetInterfaceVersion == NULL || pfGetInterfaceVersion() < INTERFACEVERSION) {
+		m_InterfaceVersion = pfGetInterfaceVersion ? pfGetInterfaceVersion() : 0;
+
+		if (m_InterfaceVersion < MININTERFACEVERSION) {
 			m_Error = strdup("This module was compiled for an earlier version"
 				" of shroudBNC. Please recompile the module and try again.");
 
@@ -245,3 +248,19 @@ void CModule::UserTagModified(const char *Tag, const char *Value) {
 bool CModule::MainLoop(void) {
 	return m_Far->MainLoop();
 }
+
+const modulesubscription_t *CModule::GetSubscriptions(void) {
+	if (m_InterfaceVersion < INTERFACEVERSION_SUBSCRIPTIONS) {
+		return NULL;
+	}
+
+	return m_Far->GetSubscriptions();
+}
+
+bool CModule::InterceptParsedIRCMessage(CIRCConnection *Connection, const ircmessage_t *Message) {
+	if (m_InterfaceVersion < INTERFACEVERSION_PARSEDMESSAGES) {
+		return m_Far->InterceptIRCMessage(Connection, Message->ArgC, Message->ArgV);
+	}
+
+	return m_Far->InterceptParsedIRCMessage(Connection, Message);
+}
@@ -36,6 +36,7 @@ class SBNCAPI CModule : public CModuleFar {
 	char *m_File; /**< the filename of the module */
 	CModuleFar *m_Far; /**< the module's implementation of the CModuleFar class */
 	char *m_Error; /**< the last error */
+	int m_InterfaceVersion; /**< the interface version the module was compiled for */
 
 	bool InternalLoad(const char *Path);
 public:
@@ -76,6 +77,9 @@ public:
 	void UserTagModified(const char *Tag, const char *Value);
 
 	bool MainLoop(void);
+
+	const modulesubscription_t *GetSubscriptions(void);
+	bool InterceptParsedIRCMessage(CIRCConnection *Connection, const ircmessage_t *Message);
 };
 
 #endif /* MODULE_H */
@@ -211,9 +211,39 @@ struct SBNCAPI CModuleFar {
 	/**
 	 * MainLoop
 	 *
-	 * Called in every mainloop iteration. Returns "true" if the module had something to do.
+	 * Called in every mainloop iteration. Returns "true" if the module had something to do,
+	 * in which case the main loop doesn't sleep before the next iteration. Modules should
+	 * prefer sockets (CCore::RegisterSocket), deadlines (CCore::CreateDeadline) and
+	 * wakeup events (CWakeupEvent) and not subscribe to ModuleEvent_MainLoop at all.
 	 */
 	virtual bool MainLoop(void) = 0;
+
+	/**
+	 * GetSubscriptions
+	 *
+	 * Returns the events the module is interested in as a list which is terminated
+	 * by an entry for ModuleEvent_None, or NULL if the module wants to receive all
+	 * events. Events which can't be subscribed to are always delivered. The list
+	 * must remain valid until the function is called again; call
+	 * CCore::RefreshModuleSubscriptions() when the module's subscriptions change.
+	 *
+	 * Only called for modules whose bncGetInterfaceVersion() returns at least
+	 * INTERFACEVERSION_SUBSCRIPTIONS.
+	 */
+	virtual const modulesubscription_t *GetSubscriptions(void) = 0;
+
+	/**
+	 * InterceptParsedIRCMessage
+	 *
+	 * Called instead of InterceptIRCMessage for modules whose bncGetInterfaceVersion()
+	 * returns at least INTERFACEVERSION_PARSEDMESSAGES. Returns "true" if the module
+	 * has handled the line. The message (and everything it points to) is only valid
+	 * until the function returns.
+	 *
+	 * @param Connection the IRC connection
+	 * @param Message the parsed line
+	 */
+	virtual bool InterceptParsedIRCMessage(CIRCConnection *Connection, const ircmessage_t *Message) = 0;
 };
 
 /**
@@ -271,6 +301,14 @@ protected:
 	virtual bool MainLoop(void) {
 		return false;
 	}
+
+	virtual const modulesubscription_t *GetSubscriptions(void) {
+		return NULL;
+	}
+
+	virtual bool InterceptParsedIRCMessage(CIRCConnection *Connection, const ircmessage_t *Message) {
+		return InterceptIRCMessage(Connection, Message->ArgC, Message->ArgV);
+	}
 public:
 	CCore *GetCore(void) {
 		return m_Core;
@@ -32,7 +32,7 @@ CNick::CNick(const char *Nick, CChannel *Owner) {
 
 	SetOwner(Owner);
 
-	m_Nick = strdup(Nick);
+	m_Nick = GetArena()->StrDup(Nick);
 
 	if (AllocFailed(m_Nick)) {}
 
@@ -42,6 +42,8 @@ CNick::CNick(const char *Nick, CChannel *Owner) {
 	m_Server = NULL;
 	m_Creation = g_CurrentTime;
 	m_IdleSince = m_Creation;
+	m_Tags = NULL;
+	m_TagCount = 0;
 }
 
 /**
@@ -50,16 +52,62 @@ CNick::CNick(const char *Nick, CChannel *Owner) {
  * Destroys a nick object.
  */
 CNick::~CNick() {
-	free(m_Nick);
-	free(m_Prefixes);
-	free(m_Site);
-	free(m_Realname);
-	free(m_Server);
-
-	for (int i = 0; i < m_Tags.GetLength(); i++) {
-		free(m_Tags[i].Name);
-		free(m_Tags[i].Value);
+	CArena::Free(m_Nick);
+	CArena::Free(m_Prefixes);
+	CArena::Free(m_Site);
+	CArena::Free(m_Realname);
+	CArena::Free(m_Server);
+
+	for (int i = 0; i < m_TagCount; i++) {
+		CArena::Free(m_Tags[i].Name);
+		CArena::Free(m_Tags[i].Value);
 	}
+
+	CArena::Free(m_Tags);
+}
+
+/**
+ * operator new
+ *
+ * Allocates a nick object from an arena (usually the owning channel's).
+ *
+ * @param Size the size of the object
+ * @param Arena the arena
+ */
+void *CNick::operator new(size_t Size, CArena *Arena) throw() {
+	return Arena->Alloc(Size);
+}
+
+/**
+ * operator delete
+ *
+ * Frees a nick object if its constructor has failed.
+ *
+ * @param Object the object
+ * @param Arena the arena
+ */
+void CNick::operator delete(void *Object, CArena *Arena) {
+	CArena::Free(Object);
+}
+
+/**
+ * operator delete
+ *
+ * Frees a nick object.
+ *
+ * @param Object the object
+ */
+void CNick::operator delete(void *Object) {
+	CArena::Free(Object);
+}
+
+/**
+ * GetArena
+ *
+ * Returns the arena which is used for the nick's attributes.
+ */
+CArena *CNick::GetArena(void) const {
+	return GetOwner()->GetArena();
 }
 
 /**
@@ -74,13 +122,13 @@ bool CNick::SetNick(const char *Nick) {
 
 	assert(Nick != NULL);
 
-	NewNick = strdup(Nick);
+	NewNick = GetArena()->StrDup(Nick);
 
 	if (AllocFailed(NewNick)) {
 		return false;
 	}
 
-	free(m_Nick);
+	CArena::Free(m_Nick);
 	m_Nick = NewNick;
 
 	return true;
@@ -184,7 +232,7 @@ bool CNick::AddPrefix(char Prefix) {
 		return true;
 	}
 
-	Prefixes = (char *)realloc(m_Prefixes, LengthPrefixes + 2);
+	Prefixes = (char *)GetArena()->Realloc(m_Prefixes, LengthPrefixes + 2);
 
 	if (AllocFailed(Prefixes)) {
 		return false;
@@ -216,7 +264,7 @@ bool CNick::RemovePrefix(char Prefix) {
 
 	LengthPrefixes = strlen(m_Prefixes);
 
-	char *Copy = (char *)malloc(LengthPrefixes + 1);
+	char *Copy = (char *)GetArena()->Alloc(LengthPrefixes + 1);
 
 	if (AllocFailed(Copy)) {
 		return false;
@@ -230,7 +278,7 @@ bool CNick::RemovePrefix(char Prefix) {
 
 	Copy[a] = '\0';
 
-	free(m_Prefixes);
+	CArena::Free(m_Prefixes);
 	m_Prefixes = Copy;
 
 	return true;
@@ -247,7 +295,7 @@ bool CNick::SetPrefixes(const char *Prefixes) {
 	char *dupPrefixes;
 
 	if (Prefixes) {
-		dupPrefixes = strdup(Prefixes);
+		dupPrefixes = GetArena()->StrDup(Prefixes);
 
 		if (AllocFailed(dupPrefixes)) {
 			return false;
@@ -256,7 +304,7 @@ bool CNick::SetPrefixes(const char *Prefixes) {
 		dupPrefixes = NULL;
 	}
 
-	free(m_Prefixes);
+	CArena::Free(m_Prefixes);
 	m_Prefixes = dupPrefixes;
 
 	return true;
@@ -288,12 +336,12 @@ const char *CNick::GetPrefixes(void) const {
 		return false; \
 	} \
 \
-	DuplicateValue = strdup(NewValue); \
+	DuplicateValue = GetArena()->StrDup(NewValue); \
 \
 	if (AllocFailed(DuplicateValue)) { \
 		return false; \
 	} \
-	free(Name); \
+	CArena::Free(Name); \
 	Name = DuplicateValue; \
 \
 	return true;
@@ -468,7 +516,7 @@ bool CNick::SetIdleSince(time_t Time) {
  * @param Name the name of the tag
  */
 const char *CNick::GetTag(const char *Name) const {
-	for (int i = 0; i < m_Tags.GetLength(); i++) {
+	for (int i = 0; i < m_TagCount; i++) {
 		if (strcasecmp(m_Tags[i].Name, Name) == 0) {
 			return m_Tags[i].Value;
 		}
@@ -487,17 +535,18 @@ const char *CNick::GetTag(const char *Name) const {
  */
 bool CNick::SetTag(const char *Name, const char *Value) {
 	nicktag_t NewTag;
+	nicktag_t *NewTags;
 
 	if (Name == NULL) {
 		return false;
 	}
 
-	for (int i = 0; i < m_Tags.GetLength(); i++) {
+	for (int i = 0; i < m_TagCount; i++) {
 		if (strcasecmp(m_Tags[i].Name, Name) == 0) {
-			free(m_Tags[i].Name);
-			free(m_Tags[i].Value);
+			CArena::Free(m_Tags[i].Name);
+			CArena::Free(m_Tags[i].Value);
 
-			m_Tags.Remove(i);
+			m_Tags[i] = m_Tags[--m_TagCount];
 
 			break;
 		}
@@ -507,19 +556,29 @@ bool CNick::SetTag(const char *Name, const char *Value) {
 		return true;
 	}
 
-	NewTag.Name = strdup(Name);
+	NewTags = (nicktag_t *)GetArena()->Realloc(m_Tags, (m_TagCount + 1) * sizeof(nicktag_t));
+
+	if (AllocFailed(NewTags)) {
+		return false;
+	}
+
+	m_Tags = NewTags;
+
+	NewTag.Name = GetArena()->StrDup(Name);
 
 	if (AllocFailed(NewTag.Name)) {
 		return false;
 	}
 
-	NewTag.Value = strdup(Value);
+	NewTag.Value = GetArena()->StrDup(Value);
 
 	if (AllocFailed(NewTag.Value)) {
-		free(NewTag.Name);
+		CArena::Free(NewTag.Name);
 
 		return false;
 	}
 
-	return m_Tags.Insert(NewTag);
+	m_Tags[m_TagCount++] = NewTag;
+
+	return true;
 }
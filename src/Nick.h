@@ -35,7 +35,8 @@ typedef struct nicktag_s {
 /**
  * CNick
  *
- * Represents a user on a single channel.
+ * Represents a user on a single channel. Nick objects and their attributes
+ * are allocated from the channel's arena.
  */
 class SBNCAPI CNick : public CObject<CNick, CChannel> {
 	char *m_Nick; /**< the nickname of the user */
@@ -45,8 +46,10 @@ class SBNCAPI CNick : public CObject<CNick, CChannel> {
 	char *m_Server; /**< the server this user is using */
 	time_t m_Creation; /**< a timestamp, when this user object was created */
 	time_t m_IdleSince; /**< a timestamp, when the user last said something */
-	CVector<nicktag_t> m_Tags; /**< any tags which belong to this nick object */
+	nicktag_t *m_Tags; /**< any tags which belong to this nick object */
+	int m_TagCount; /**< the number of tags */
 
+	CArena *GetArena(void) const;
 	const char *InternalGetSite(void) const;
 	const char *InternalGetRealname(void) const;
 	const char *InternalGetServer(void) const;
@@ -54,6 +57,10 @@ public:
 #ifndef SWIG
 	CNick(const char *Nick, CChannel *Owner);
 	virtual ~CNick(void);
+
+	void *operator new(size_t Size, CArena *Arena) throw();
+	void operator delete(void *Object, CArena *Arena);
+	void operator delete(void *Object);
 #endif /* SWIG */
 
 	bool SetNick(const char *Nick);
@@ -19,27 +19,295 @@
 
 #include "StdAfx.h"
 
+/**
+ * CQueue
+ *
+ * Constructs an empty queue.
+ */
+CQueue::CQueue(void) {
+	memset(&m_Urgent, 0, sizeof(m_Urgent));
+	m_Active = NULL;
+	m_TurnStarted = false;
+	m_Count = 0;
+}
+
+/**
+ * ~CQueue
+ *
+ * Destroys the queue and the items which are still in it.
+ */
+CQueue::~CQueue(void) {
+	Clear();
+}
+
+/**
+ * RingReserve
+ *
+ * Makes sure that there is room for at least one more item in a ring buffer.
+ *
+ * @param Ring the ring buffer
+ */
+bool CQueue::RingReserve(queue_ring_t *Ring) {
+	char **NewItems;
+	int NewAllocCount;
+
+	if (Ring->Count < Ring->AllocCount) {
+		return true;
+	}
+
+	if (Ring->AllocCount == 0) {
+		NewAllocCount = QUEUE_INITIAL_SIZE;
+	} else {
+		NewAllocCount = Ring->AllocCount * 2;
+	}
+
+	NewItems = (char **)malloc(NewAllocCount * sizeof(char *));
+
+	if (AllocFailed(NewItems)) {
+		return false;
+	}
+
+	// unwrap the ring buffer so that the first item is at index 0
+	for (int i = 0; i < Ring->Count; i++) {
+		NewItems[i] = Ring->Items[(Ring->Head + i) % Ring->AllocCount];
+	}
+
+	free(Ring->Items);
+
+	Ring->Items = NewItems;
+	Ring->AllocCount = NewAllocCount;
+	Ring->Head = 0;
+
+	return true;
+}
+
+/**
+ * RingClear
+ *
+ * Frees the items in a ring buffer and the buffer itself.
+ *
+ * @param Ring the ring buffer
+ */
+void CQueue::RingClear(queue_ring_t *Ring) {
+	for (int i = 0; i < Ring->Count; i++) {
+		free(Ring->Items[(Ring->Head + i) % Ring->AllocCount]);
+	}
+
+	free(Ring->Items);
+
+	memset(Ring, 0, sizeof(*Ring));
+}
+
+/**
+ * ParseTarget
+ *
+ * Determines the target of an IRC command (i.e. its first argument) and
+ * whether repeated instances of the command can be ignored.
+ *
+ * @param Line the IRC command
+ * @param Target a buffer for the target, which is empty if the command has no arguments
+ * @param Size the size of the buffer
+ * @param Coalesce receives whether identical commands can be merged
+ */
+void CQueue::ParseTarget(const char *Line, char *Target, size_t Size, bool *Coalesce) {
+	const char *Command, *Argument;
+	size_t Length;
+
+	*Target = '\0';
+	*Coalesce = false;
+
+	if (*Line == ':') {
+		Line = strchr(Line, ' ');
+
+		if (Line == NULL) {
+			return;
+		}
+
+		while (*Line == ' ') {
+			Line++;
+		}
+	}
+
+	Command = Line;
+	Length = strcspn(Command, " ");
+
+	if ((Length == 3 && strncasecmp(Command, "WHO", 3) == 0) ||
+			(Length == 5 && strncasecmp(Command, "WHOIS", 5) == 0) ||
+			(Length == 5 && strncasecmp(Command, "NAMES", 5) == 0)) {
+		*Coalesce = true;
+	} else if (Length == 4 && strncasecmp(Command, "MODE", 4) == 0) {
+		*Coalesce = IsModeQuery(Command + Length);
+	}
+
+	Argument = Command + Length;
+
+	while (*Argument == ' ') {
+		Argument++;
+	}
+
+	if (*Argument == ':') {
+		Argument++;
+	}
+
+	Length = min(strcspn(Argument, " "), Size - 1);
+
+	memcpy(Target, Argument, Length);
+	Target[Length] = '\0';
+}
+
+/**
+ * IsModeQuery
+ *
+ * Determines whether the arguments of a MODE command only query the
+ * target's modes (e.g. "MODE #channel" or "MODE #channel +b") rather than
+ * changing them.
+ *
+ * @param Arguments the arguments of the MODE command
+ */
+bool CQueue::IsModeQuery(const char *Arguments) {
+	const char *Modes;
+
+	while (*Arguments == ' ') {
+		Arguments++;
+	}
+
+	// skip the target
+	Arguments += strcspn(Arguments, " ");
+
+	while (*Arguments == ' ') {
+		Arguments++;
+	}
+
+	if (*Arguments == '\0') {
+		return true;
+	}
+
+	Modes = Arguments;
+
+	if (*Modes == ':') {
+		Modes++;
+	}
+
+	if (*Modes == '+') {
+		Modes++;
+	}
+
+	// list modes without an argument return the list
+	if (*Modes == '\0' || *Modes == ' ' || strspn(Modes, "beI") != strcspn(Modes, " ")) {
+		return false;
+	}
+
+	Modes += strcspn(Modes, " ");
+
+	while (*Modes == ' ') {
+		Modes++;
+	}
+
+	return (*Modes == '\0');
+}
+
+/**
+ * GetCost
+ *
+ * Returns the number of bytes which are deducted from a target's deficit
+ * when the line is sent. Lines which are longer than the quantum are treated
+ * as if they fit into a single round.
+ *
+ * @param Line the line
+ */
+int CQueue::GetCost(const char *Line) {
+	return min((int)strlen(Line) + 2, QUEUE_QUANTUM);
+}
+
+/**
+ * RemoveTarget
+ *
+ * Removes a target from the round robin and destroys it.
+ *
+ * @param Target the target
+ */
+void CQueue::RemoveTarget(queue_target_t *Target) {
+	if (m_Active == Target) {
+		m_TurnStarted = false;
+	}
+
+	if (Target->Next == Target) {
+		m_Active = NULL;
+	} else {
+		Target->Previous->Next = Target->Next;
+		Target->Next->Previous = Target->Previous;
+
+		if (m_Active == Target) {
+			m_Active = Target->Next;
+		}
+	}
+
+	m_Targets.Remove(Target->Name);
+
+	m_Count -= Target->Items.Count;
+	RingClear(&Target->Items);
+
+	free(Target->Name);
+	free(Target);
+}
+
+/**
+ * Copy
+ *
+ * Checks whether there is room for another item and duplicates the line.
+ *
+ * @param Line the line
+ */
+RESULT<char *> CQueue::Copy(const char *Line) {
+	char *Item;
+
+	if (Line == NULL) {
+		THROW(char *, Generic_InvalidArgument, "Line cannot be NULL.");
+	}
+
+	// ignore new items if the queue is full
+	if (m_Count >= MAX_QUEUE_SIZE) {
+		THROW(char *, Generic_Unknown, "The queue is full.");
+	}
+
+	Item = strdup(Line);
+
+	if (AllocFailed(Item)) {
+		THROW(char *, Generic_OutOfMemory, "strdup() failed.");
+	}
+
+	RETURN(char *, Item);
+}
+
 /**
  * PeekItems
  *
  * Retrieves the next item from the queue without removing it.
  */
 RESULT<const char *> CQueue::PeekItem(void) const {
-	int LowestPriority = 99999;
-	queue_item_t *ThatItem = NULL;
+	const queue_target_t *Target;
+	const char *Line;
+	int Deficit;
 
-	for (int i = 0; i < m_Items.GetLength(); i++) {
-		if (m_Items[i].Priority < LowestPriority) {
-			LowestPriority = m_Items[i].Priority;
-			ThatItem = m_Items.GetAddressOf(i);
-		}
+	if (m_Urgent.Count > 0) {
+		RETURN(const char *, m_Urgent.Items[m_Urgent.Head]);
 	}
 
-	if (ThatItem != NULL) {
-		RETURN(const char *, ThatItem->Line);
-	} else {
+	if (m_Active == NULL) {
 		THROW(const char *, Generic_Unknown, "The queue is empty.");
 	}
+
+	Target = m_Active;
+	Line = Target->Items.Items[Target->Items.Head];
+	Deficit = Target->Deficit + (m_TurnStarted ? 0 : QUEUE_QUANTUM);
+
+	// the current target has used up its quantum, the next one will get a new one
+	if (Deficit < GetCost(Line)) {
+		Target = Target->Next;
+		Line = Target->Items.Items[Target->Items.Head];
+	}
+
+	RETURN(const char *, Line);
 }
 
 /**
@@ -48,26 +316,53 @@ RESULT<const char *> CQueue::PeekItem(void) const {
  * Retrieves the next item from the queue and removes it.
  */
 RESULT<char *> CQueue::DequeueItem(void) {
-	int Index = 0;
-	queue_item_t *Item = NULL;
+	queue_target_t *Target;
 	char *Line;
+	int Cost;
 
-	for (int i = 0; i < m_Items.GetLength(); i++) {
-		if (Item == NULL || m_Items[i].Priority < Item->Priority) {
-			Item = m_Items.GetAddressOf(i);
-			Index = i;
-		}
-	}
-
-	if (Item != NULL) {
-		Line = Item->Line;
+	if (m_Urgent.Count > 0) {
+		Line = m_Urgent.Items[m_Urgent.Head];
 
-		m_Items.Remove(Index);
+		m_Urgent.Head = (m_Urgent.Head + 1) % m_Urgent.AllocCount;
+		m_Urgent.Count--;
+		m_Count--;
 
 		RETURN(char *, Line);
-	} else {
+	}
+
+	if (m_Active == NULL) {
 		THROW(char *, Generic_Unknown, "The queue is empty.");
 	}
+
+	while (true) {
+		Target = m_Active;
+
+		if (!m_TurnStarted) {
+			Target->Deficit += QUEUE_QUANTUM;
+			m_TurnStarted = true;
+		}
+
+		Line = Target->Items.Items[Target->Items.Head];
+		Cost = GetCost(Line);
+
+		if (Target->Deficit >= Cost) {
+			break;
+		}
+
+		m_Active = Target->Next;
+		m_TurnStarted = false;
+	}
+
+	Target->Items.Head = (Target->Items.Head + 1) % Target->Items.AllocCount;
+	Target->Items.Count--;
+	Target->Deficit -= Cost;
+	m_Count--;
+
+	if (Target->Items.Count == 0) {
+		RemoveTarget(Target);
+	}
+
+	RETURN(char *, Line);
 }
 
 /**
@@ -78,30 +373,85 @@ RESULT<char *> CQueue::DequeueItem(void) {
  * @param Line the item which is to be inserted
  */
 RESULT<bool> CQueue::QueueItem(const char *Line) {
-	queue_item_t Item;
+	char Name[QUEUE_MAXTARGET];
+	bool Coalesce;
+	queue_target_t *Target;
+	queue_ring_t *Items;
 
 	if (Line == NULL) {
 		THROW(bool, Generic_InvalidArgument, "Line cannot be NULL.");
 	}
 
-	// ignore new items if the queue is full
-	if (m_Items.GetLength() >= MAX_QUEUE_SIZE) {
-		THROW(bool, Generic_Unknown, "The queue is full.");
+	ParseTarget(Line, Name, sizeof(Name), &Coalesce);
+
+	Target = m_Targets.Get(Name);
+
+	// there's no point in sending the same query twice (mode changes are never merged)
+	if (Target != NULL && Coalesce) {
+		Items = &Target->Items;
+
+		for (int i = 0; i < Items->Count; i++) {
+			if (strcmp(Items->Items[(Items->Head + i) % Items->AllocCount], Line) == 0) {
+				RETURN(bool, true);
+			}
+		}
 	}
 
-	Item.Line = strdup(Line);
+	RESULT<char *> Item = Copy(Line);
+	THROWIFERROR(bool, Item);
 
-	if (AllocFailed(Item.Line)) {
-		THROW(bool, Generic_OutOfMemory, "strdup() failed.");
+	if (Target == NULL) {
+		Target = (queue_target_t *)malloc(sizeof(queue_target_t));
+
+		if (AllocFailed(Target)) {
+			free(Item);
+
+			THROW(bool, Generic_OutOfMemory, "malloc() failed.");
+		}
+
+		memset(Target, 0, sizeof(queue_target_t));
+
+		Target->Name = strdup(Name);
+
+		if (AllocFailed(Target->Name) || IsError(m_Targets.Add(Name, Target))) {
+			free(Target->Name);
+			free(Target);
+			free(Item);
+
+			THROW(bool, Generic_OutOfMemory, "Could not add target.");
+		}
+
+		// new targets wait for their turn at the end of the round
+		if (m_Active == NULL) {
+			Target->Next = Target;
+			Target->Previous = Target;
+
+			m_Active = Target;
+			m_TurnStarted = false;
+		} else {
+			Target->Next = m_Active;
+			Target->Previous = m_Active->Previous;
+			m_Active->Previous->Next = Target;
+			m_Active->Previous = Target;
+		}
 	}
 
-	Item.Priority = 0;
+	if (!RingReserve(&Target->Items)) {
+		free(Item);
+
+		if (Target->Items.Count == 0) {
+			RemoveTarget(Target);
+		}
 
-	for (int i = 0; i < m_Items.GetLength(); i++) {
-		m_Items[i].Priority--;
+		THROW(bool, Generic_OutOfMemory, "malloc() failed.");
 	}
 
-	return m_Items.Insert(Item);
+	Items = &Target->Items;
+	Items->Items[(Items->Head + Items->Count) % Items->AllocCount] = Item;
+	Items->Count++;
+	m_Count++;
+
+	RETURN(bool, true);
 }
 
 /**
@@ -112,11 +462,21 @@ RESULT<bool> CQueue::QueueItem(const char *Line) {
  * @param Line the item which is to be inserted
  */
 RESULT<bool> CQueue::QueueItemNext(const char *Line) {
-	for (int i = 0; i < m_Items.GetLength(); i++) {
-		m_Items[i].Priority += 2;
+	RESULT<char *> Item = Copy(Line);
+	THROWIFERROR(bool, Item);
+
+	if (!RingReserve(&m_Urgent)) {
+		free(Item);
+
+		THROW(bool, Generic_OutOfMemory, "malloc() failed.");
 	}
 
-	return QueueItem(Line);
+	m_Urgent.Head = (m_Urgent.Head + m_Urgent.AllocCount - 1) % m_Urgent.AllocCount;
+	m_Urgent.Items[m_Urgent.Head] = Item;
+	m_Urgent.Count++;
+	m_Count++;
+
+	RETURN(bool, true);
 }
 
 /**
@@ -125,7 +485,7 @@ RESULT<bool> CQueue::QueueItemNext(const char *Line) {
  * Returns the number of items which are in the queue.
  */
 int CQueue::GetLength(void) const {
-	return m_Items.GetLength();
+	return m_Count;
 }
 
 /**
@@ -134,9 +494,11 @@ int CQueue::GetLength(void) const {
  * Removes all items from the queue.
  */
 void CQueue::Clear(void) {
-	for (int i = 0; i < m_Items.GetLength(); i++) {
-		free(m_Items[i].Line);
+	while (m_Active != NULL) {
+		RemoveTarget(m_Active);
 	}
 
-	m_Items.Clear();
+	RingClear(&m_Urgent);
+
+	m_Count = 0;
 }
@@ -23,24 +23,71 @@
 /** Defines how many items can be stored in a single queue */
 #define MAX_QUEUE_SIZE 500
 
+/** The number of items for which memory is allocated when the first item is queued */
+#define QUEUE_INITIAL_SIZE 4
+
+/** The number of bytes each target may send per round */
+#define QUEUE_QUANTUM 512
+
+/** The maximum length of a target's name which is used for scheduling */
+#define QUEUE_MAXTARGET 128
+
+/**
+ * queue_ring_t
+ *
+ * A ring buffer of strings.
+ */
+typedef struct queue_ring_s {
+	char **Items; /**< the items */
+	int Head; /**< the index of the first item */
+	int Count; /**< the number of items */
+	int AllocCount; /**< the size of the ring buffer */
+} queue_ring_t;
+
 /**
- * queue_item_t
+ * queue_target_t
  *
- * An item from a queue.
+ * The items which are queued for a single target (i.e. a channel or a nick).
  */
-typedef struct queue_item_s {
-	int Priority; /**< the priority of this item; 0 is the highest priority */
-	char *Line; /**< the string which is associated with this item */
-} queue_item_t;
+typedef struct queue_target_s {
+	char *Name; /**< the name of the target */
+	queue_ring_t Items; /**< the items */
+	int Deficit; /**< the number of bytes the target may send in its current round */
+	struct queue_target_s *Next; /**< the next active target */
+	struct queue_target_s *Previous; /**< the previous active target */
+} queue_target_t;
 
 /**
  * CQueue
  *
- * A queue which can be used for storing strings.
+ * A queue which can be used for storing strings. Items are grouped by their
+ * target (the first argument of the IRC command) and the targets are served
+ * using deficit round robin, so a single target with lots of queued items
+ * cannot delay the items for other targets. Items which are inserted at the
+ * front of the queue are sent before all other items. Repeated queries
+ * (MODE, WHO, etc.) for the same target are only queued once.
  */
 class SBNCAPI CQueue {
-	CVector<queue_item_t> m_Items; /**< the items which are in the queue */
+	queue_ring_t m_Urgent; /**< items which were inserted at the front of the queue */
+	CHashtable<queue_target_t *, false> m_Targets; /**< the targets */
+	queue_target_t *m_Active; /**< the target whose turn it is */
+	bool m_TurnStarted; /**< whether the current target has received its quantum */
+	int m_Count; /**< the number of items which are in the queue */
+
+	static bool RingReserve(queue_ring_t *Ring);
+	static void RingClear(queue_ring_t *Ring);
+	static void ParseTarget(const char *Line, char *Target, size_t Size, bool *Coalesce);
+	static bool IsModeQuery(const char *Arguments);
+	static int GetCost(const char *Line);
+
+	void RemoveTarget(queue_target_t *Target);
+	RESULT<char *> Copy(const char *Line);
 public:
+#ifndef SWIG
+	CQueue(void);
+	virtual ~CQueue(void);
+#endif /* SWIG */
+
 	RESULT<char *> DequeueItem(void);
 	RESULT<const char *> PeekItem(void) const;
 	RESULT<bool> QueueItem(const char *Line);
@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "StdAfx.h"
+
+/**
+ * CShardChannel
+ *
+ * Constructs a new shard channel and registers its socket.
+ *
+ * @param Socket the receiving end of the shard's socket pair
+ */
+CShardChannel::CShardChannel(SOCKET Socket) {
+	m_Socket = Socket;
+	m_Received = 0;
+
+	g_Bouncer->RegisterSocket(m_Socket, static_cast<CSocketEvents *>(this));
+}
+
+/**
+ * ~CShardChannel
+ *
+ * Destructs the shard channel.
+ */
+CShardChannel::~CShardChannel(void) {
+	if (g_Bouncer != NULL) {
+		g_Bouncer->UnregisterSocket(m_Socket);
+	}
+
+	closesocket(m_Socket);
+}
+
+/**
+ * GetReceivedCount
+ *
+ * Returns the number of clients which have been handed off to this shard.
+ */
+unsigned int CShardChannel::GetReceivedCount(void) const {
+	return m_Received;
+}
+
+/**
+ * Send
+ *
+ * Hands off a client connection to another shard. The caller still
+ * has to close its copy of the client's socket.
+ *
+ * @param Channel the sending end of the other shard's socket pair
+ * @param Client the client's socket
+ * @param Data the handoff message
+ * @param Length the length of the handoff message
+ */
+bool CShardChannel::Send(SOCKET Channel, SOCKET Client, const char *Data, size_t Length) {
+#ifndef _WIN32
+	msghdr Message;
+	iovec Vector;
+	cmsghdr *Control;
+	char ControlBuffer[CMSG_SPACE(sizeof(int))];
+
+	memset(&Message, 0, sizeof(Message));
+	memset(ControlBuffer, 0, sizeof(ControlBuffer));
+
+	Vector.iov_base = (void *)Data;
+	Vector.iov_len = Length;
+
+	Message.msg_iov = &Vector;
+	Message.msg_iovlen = 1;
+	Message.msg_control = ControlBuffer;
+	Message.msg_controllen = sizeof(ControlBuffer);
+
+	Control = CMSG_FIRSTHDR(&Message);
+	Control->cmsg_level = SOL_SOCKET;
+	Control->cmsg_type = SCM_RIGHTS;
+	Control->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(Control), &Client, sizeof(int));
+
+	return (sendmsg(Channel, &Message, MSG_DONTWAIT) == (ssize_t)Length);
+#else /* _WIN32 */
+	return false;
+#endif /* _WIN32 */
+}
+
+/**
+ * Destroy
+ *
+ * The channel is owned by the core, this does nothing.
+ */
+void CShardChannel::Destroy(void) {
+}
+
+/**
+ * Read
+ *
+ * Accepts clients which have been handed off to this shard.
+ */
+int CShardChannel::Read(bool DontProcess) {
+#ifndef _WIN32
+	char Buffer[SHARD_MAXHANDOFF];
+	char ControlBuffer[CMSG_SPACE(sizeof(int))];
+	const char *Fields[5];
+	msghdr Message;
+	iovec Vector;
+	cmsghdr *Control;
+	ssize_t Length;
+	size_t Offset;
+	SOCKET Client;
+	CClientConnection *ClientObject;
+	unsigned long lTrue = 1;
+
+	while (true) {
+		memset(&Message, 0, sizeof(Message));
+
+		Vector.iov_base = Buffer;
+		Vector.iov_len = sizeof(Buffer);
+
+		Message.msg_iov = &Vector;
+		Message.msg_iovlen = 1;
+		Message.msg_control = ControlBuffer;
+		Message.msg_controllen = sizeof(ControlBuffer);
+
+		Length = recvmsg(m_Socket, &Message, MSG_DONTWAIT);
+
+		if (Length < 0) {
+			break;
+		}
+
+		Client = INVALID_SOCKET;
+
+		for (Control = CMSG_FIRSTHDR(&Message); Control != NULL; Control = CMSG_NXTHDR(&Message, Control)) {
+			if (Control->cmsg_level == SOL_SOCKET && Control->cmsg_type == SCM_RIGHTS) {
+				memcpy(&Client, CMSG_DATA(Control), sizeof(int));
+			}
+		}
+
+		if (Client == INVALID_SOCKET) {
+			continue;
+		}
+
+		Offset = 0;
+
+		for (unsigned int i = 0; i < sizeof(Fields) / sizeof(Fields[0]); i++) {
+			const char *End = (const char *)memchr(Buffer + Offset, '\0', Length - Offset);
+
+			if (End == NULL) {
+				Offset = Length + 1;
+
+				break;
+			}
+
+			Fields[i] = Buffer + Offset;
+			Offset = End - Buffer + 1;
+		}
+
+		if (Offset > (size_t)Length || (Message.msg_flags & MSG_TRUNC)) {
+			g_Bouncer->Log("Received an invalid client handoff from another shard.");
+
+			closesocket(Client);
+
+			continue;
+		}
+
+		ioctlsocket(Client, FIONBIO, &lTrue);
+
+		// destruction is controlled by the main loop
+		ClientObject = new CClientConnection(Client, false, Fields[0]);
+
+		if (AllocFailed(ClientObject)) {
+			closesocket(Client);
+
+			continue;
+		}
+
+		m_Received++;
+
+		ClientObject->Resume(Fields[1], Fields[2], Fields[3], Fields[4], Buffer + Offset, Length - Offset);
+	}
+#endif /* _WIN32 */
+
+	return 0;
+}
+
+int CShardChannel::Write(void) {
+	return 0;
+}
+
+void CShardChannel::Error(int ErrorCode) {
+}
+
+bool CShardChannel::HasQueuedData(void) const {
+	return false;
+}
+
+bool CShardChannel::ShouldDestroy(void) const {
+	return false;
+}
+
+const char *CShardChannel::GetClassName(void) const {
+	return "CShardChannel";
+}
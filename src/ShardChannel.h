@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#ifndef SHARDCHANNEL_H
+#define SHARDCHANNEL_H
+
+/** The maximum number of shard processes */
+#define SHARD_MAXSHARDS 64
+
+/** The maximum size of a client handoff message */
+#define SHARD_MAXHANDOFF 8192
+
+/**
+ * CShardChannel
+ *
+ * Receives client connections which have been handed off to this shard by
+ * another shard process. A handoff is a datagram on a UNIX socket pair which
+ * carries the client's socket (as SCM_RIGHTS ancillary data) and the state
+ * of the client's login: the peer's hostname, the nick, the username, the
+ * password, the requested capabilities (NUL-terminated, in this order) and
+ * whatever data the client has sent after that.
+ */
+class SBNCAPI CShardChannel : public CSocketEvents {
+	SOCKET m_Socket; /**< the receiving end of this shard's socket pair */
+	unsigned int m_Received; /**< the number of clients which have been handed off to us */
+
+public:
+#ifndef SWIG
+	CShardChannel(SOCKET Socket);
+	virtual ~CShardChannel(void);
+#endif /* SWIG */
+
+	unsigned int GetReceivedCount(void) const;
+
+	static bool Send(SOCKET Channel, SOCKET Client, const char *Data, size_t Length);
+
+	// CSocketEvents
+	void Destroy(void);
+	int Read(bool DontProcess = false);
+	int Write(void);
+	void Error(int ErrorCode);
+	bool HasQueuedData(void) const;
+	bool ShouldDestroy(void) const;
+	const char *GetClassName(void) const;
+};
+
+#endif /* SHARDCHANNEL_H */
@@ -37,6 +37,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -86,12 +87,19 @@ typedef lt_dlhandle HMODULE;
 #	include <openssl/ssl.h>
 #	include <openssl/md5.h>
 #	include <openssl/err.h>
+#	include <openssl/rand.h>
+#	include <openssl/hmac.h>
+#	if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#		include <openssl/core_names.h>
+#		include <openssl/params.h>
+#	endif
 #else /* HAVE_LIBSSL */
 typedef void SSL;
 typedef void BIO;
 typedef void SSL_CTX;
 typedef void X509;
 typedef void X509_STORE_CTX;
+typedef void SSL_SESSION;
 #endif /* HAVE_LIBSSL */
 
 #ifndef HAVE_ASPRINTF
@@ -112,6 +120,7 @@ typedef void X509_STORE_CTX;
 #	include "sbnc.h"
 #	include "Result.h"
 #	include "Object.h"
+#	include "Arena.h"
 #	include "Vector.h"
 #	include "List.h"
 #	include "Hashtable.h"
@@ -120,16 +129,21 @@ typedef void X509_STORE_CTX;
 #	include "DnsSocket.h"
 #	include "DnsEvents.h"
 #	include "Timer.h"
+#	include "WakeupEvent.h"
+#	include "WorkerPool.h"
+#	include "ShardChannel.h"
 #	include "FIFOBuffer.h"
 #	include "Queue.h"
 #	include "Connection.h"
 #	include "Config.h"
+#	include "ConfigDatabase.h"
 #	include "Cache.h"
 #	include "Core.h"
 #	include "ClientConnection.h"
 #	include "ClientConnectionMultiplexer.h"
 #	include "IRCConnection.h"
 #	include "User.h"
+#	include "LogIndex.h"
 #	include "Log.h"
 #	include "ModuleFar.h"
 #	include "Module.h"
@@ -55,7 +55,9 @@ CTimer::CTimer(unsigned int Interval, bool Repeat, TimerProc Function, void *Coo
 CTimer::~CTimer(void) {
 	g_Timers->Remove(m_Link);
 
-	RescheduleTimers();
+	/* g_NextCall might now be too early, which merely causes an extra call to
+	 * CallTimers() (which recalculates it) - that's a lot cheaper than
+	 * looking at all the other timers whenever a timer is destroyed */
 }
 
 /**
@@ -47,21 +47,25 @@ CUser::CUser(const char *Name) {
 		g_Bouncer->Fatal();
 	}
 
-	rc = asprintf(&Out, "users/%s.conf", Name);
+	if (g_Bouncer->GetUserDatabase() != NULL) {
+		m_Config = new CConfig(g_Bouncer->GetUserDatabase(), Name, this);
+	} else {
+		rc = asprintf(&Out, "users/%s.conf", Name);
 
-	if (RcFailed(rc)) {
-		g_Bouncer->Fatal();
-	}
+		if (RcFailed(rc)) {
+			g_Bouncer->Fatal();
+		}
 
-	m_Config = new CConfig(Out, this);
+		m_Config = new CConfig(Out, this);
 
-	free(Out);
+		free(Out);
+	}
 
 	if (AllocFailed(m_Config)) {
 		g_Bouncer->Fatal();
 	}
 
-	CacheInitialize(m_ConfigCache, m_Config, "user.");
+	CacheInitialize(m_ConfigCache, m_Config);
 
 	m_IRC = NULL;
 
@@ -75,7 +79,7 @@ CUser::CUser(const char *Name) {
 		g_Bouncer->Fatal();
 	}
 
-	m_Log = new CLog(g_Bouncer->BuildPathConfig(Out));
+	m_Log = new CLog(g_Bouncer->BuildPathConfig(Out), false, true);
 
 	free(Out);
 
@@ -109,13 +113,15 @@ CUser::CUser(const char *Name) {
 		fclose(ClientCert);
 	}
 
+	m_SSLSessions.RegisterValueDestructor(SSL_SESSION_free);
 #endif
 
-	if (IsQuitted() != 2) {
+	/* with the user database these don't need the user's settings to be loaded */
+	if (m_Config->PeekInteger("user.quitted") != 2) {
 		ScheduleReconnect();
 	}
 
-	if (IsAdmin()) {
+	if (m_Config->PeekInteger("user.admin") != 0) {
 		g_Bouncer->GetAdminUsers()->Insert(this);
 	}
 }
@@ -508,6 +514,15 @@ CConfig *CUser::GetConfig(void) {
 	return m_Config;
 }
 
+/**
+ * GetConfigCache
+ *
+ * Returns the cache for this user's settings.
+ */
+CCacheUser *CUser::GetConfigCache(void) {
+	return &m_ConfigCache;
+}
+
 /**
  * Simulate
  *
@@ -695,7 +710,9 @@ void CUser::ScheduleReconnect(int Delay) {
 		return;
 	}
 
-	UnmarkQuitted();
+	if (m_Config->PeekInteger("user.quitted") != 0) {
+		UnmarkQuitted();
+	}
 
 	MaxDelay = Delay;
 	Interval = g_Bouncer->GetInterval();
@@ -718,7 +735,7 @@ void CUser::ScheduleReconnect(int Delay) {
 		RescheduleReconnectTimer();
 	}
 
-	if (GetServer() != NULL && GetClientConnectionMultiplexer() != NULL) {
+	if (m_Clients.GetLength() > 0 && GetServer() != NULL) {
 		char *Out;
 		int rc = asprintf(&Out, "Scheduled reconnect in %d seconds.", (int)(m_ReconnectTime - g_CurrentTime));
 
@@ -1600,6 +1617,39 @@ void CUser::SetDropModes(const char *DropModes) {
 	USER_SETFUNCTION(dropmodes, DropModes);
 }
 
+/**
+ * GetSSLSession
+ *
+ * Returns the SSL session which was last used for the specified IRC
+ * server, or NULL.
+ *
+ * @param Server the server's host and port ("host:port")
+ */
+SSL_SESSION *CUser::GetSSLSession(const char *Server) const {
+#ifdef HAVE_LIBSSL
+	return m_SSLSessions.Get(Server);
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * SetSSLSession
+ *
+ * Stores an SSL session for an IRC server so that it can be resumed when
+ * the user reconnects. The user takes ownership of the session.
+ *
+ * @param Server the server's host and port ("host:port")
+ * @param Session the session
+ */
+bool CUser::SetSSLSession(const char *Server, SSL_SESSION *Session) {
+#ifdef HAVE_LIBSSL
+	return !IsError(m_SSLSessions.Add(Server, Session));
+#else
+	return false;
+#endif
+}
+
 /**
  * GetClientCertificates
  *
@@ -1784,6 +1834,130 @@ void CUser::SetIdent(const char *Ident) {
 	USER_SETFUNCTION(ident, Ident);
 }
 
+/**
+ * GetFloodRate
+ *
+ * Returns the rate (in bytes per second) at which lines are sent to the
+ * IRC server.
+ */
+unsigned int CUser::GetFloodRate(void) const {
+	int Rate = CacheGetInteger(m_ConfigCache, floodrate);
+
+	if (Rate <= 0) {
+		return FLOODRATE;
+	} else {
+		return Rate;
+	}
+}
+
+/**
+ * SetFloodRate
+ *
+ * Sets the rate at which lines are sent to the IRC server.
+ *
+ * @param Rate the rate (in bytes per second), 0 for the default rate
+ */
+void CUser::SetFloodRate(unsigned int Rate) {
+	CacheSetInteger(m_ConfigCache, floodrate, Rate);
+
+	UpdateFloodControl();
+}
+
+/**
+ * GetFloodBurst
+ *
+ * Returns the number of bytes which may be sent to the IRC server
+ * in a single burst.
+ */
+unsigned int CUser::GetFloodBurst(void) const {
+	int Burst = CacheGetInteger(m_ConfigCache, floodburst);
+
+	if (Burst <= 0) {
+		return FLOODBURST;
+	} else {
+		return Burst;
+	}
+}
+
+/**
+ * SetFloodBurst
+ *
+ * Sets the number of bytes which may be sent to the IRC server in a single burst.
+ *
+ * @param Burst the burst size (in bytes), 0 for the default burst size
+ */
+void CUser::SetFloodBurst(unsigned int Burst) {
+	CacheSetInteger(m_ConfigCache, floodburst, Burst);
+
+	UpdateFloodControl();
+}
+
+/**
+ * GetFloodPenalty
+ *
+ * Returns the additional delay (in milliseconds) for each line which
+ * is sent to the IRC server.
+ */
+unsigned int CUser::GetFloodPenalty(void) const {
+	const char *Penalty = CacheGetString(m_ConfigCache, floodpenalty);
+
+	if (Penalty == NULL || atoi(Penalty) < 0) {
+		return FLOODPENALTY;
+	} else {
+		return atoi(Penalty);
+	}
+}
+
+/**
+ * SetFloodPenalty
+ *
+ * Sets the additional delay for each line which is sent to the IRC server.
+ *
+ * @param Penalty the penalty (in milliseconds), NULL for the default penalty
+ */
+void CUser::SetFloodPenalty(const char *Penalty) {
+	CacheSetString(m_ConfigCache, floodpenalty, Penalty);
+
+	UpdateFloodControl();
+}
+
+/**
+ * GetFloodCalibration
+ *
+ * Returns whether the flood control rate is calibrated by measuring
+ * how quickly the IRC server responds to probes.
+ */
+bool CUser::GetFloodCalibration(void) const {
+	return (CacheGetInteger(m_ConfigCache, floodcalibrate) != 0);
+}
+
+/**
+ * SetFloodCalibration
+ *
+ * Sets whether the flood control rate is calibrated using probes.
+ *
+ * @param Calibrate a boolean flag
+ */
+void CUser::SetFloodCalibration(bool Calibrate) {
+	CacheSetInteger(m_ConfigCache, floodcalibrate, Calibrate ? 1 : 0);
+
+	UpdateFloodControl();
+}
+
+/**
+ * UpdateFloodControl
+ *
+ * Applies the user's flood control settings to the current IRC connection.
+ */
+void CUser::UpdateFloodControl(void) {
+	if (m_IRC == NULL) {
+		return;
+	}
+
+	m_IRC->GetFloodControl()->SetRate(GetFloodRate(), GetFloodBurst(), GetFloodPenalty());
+	m_IRC->GetFloodControl()->SetCalibration(GetFloodCalibration());
+}
+
 /**
  * GetTagString
  *
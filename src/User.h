@@ -31,35 +31,51 @@ class CTimer;
 /**
  * Cache: User
  */
-DEFINE_CACHE(User)
-	DEFINE_OPTION_INT(quitted);
-	DEFINE_OPTION_INT(admin);
-	DEFINE_OPTION_INT(port);
-	DEFINE_OPTION_INT(lock);
-	DEFINE_OPTION_INT(seen);
-	DEFINE_OPTION_INT(delayjoin);
-	DEFINE_OPTION_INT(ssl);
-	DEFINE_OPTION_INT(ignsysnotices);
-	DEFINE_OPTION_INT(lean);
-	DEFINE_OPTION_INT(quitaway);
-
-	DEFINE_OPTION_STRING(automodes);
-	DEFINE_OPTION_STRING(dropmodes);
-	DEFINE_OPTION_STRING(password);
-	DEFINE_OPTION_STRING(away);
-	DEFINE_OPTION_STRING(awaynick);
-	DEFINE_OPTION_STRING(nick);
-	DEFINE_OPTION_STRING(realname);
-	DEFINE_OPTION_STRING(server);
-	DEFINE_OPTION_STRING(ip);
-	DEFINE_OPTION_STRING(channels);
-	DEFINE_OPTION_STRING(suspend);
-	DEFINE_OPTION_STRING(spass);
-	DEFINE_OPTION_STRING(ident);
-	DEFINE_OPTION_STRING(awaymessage);
-	DEFINE_OPTION_STRING(channelsort);
-	DEFINE_OPTION_STRING(autobacklog);
-END_DEFINE_CACHE
+/**
+ * USER_OPTIONS
+ *
+ * The cached settings from the user's config (without the "user." prefix).
+ */
+#define USER_OPTIONS(INT, STRING) \
+	INT(quitted) \
+	INT(admin) \
+	INT(port) \
+	INT(lock) \
+	INT(seen) \
+	INT(delayjoin) \
+	INT(ssl) \
+	INT(ignsysnotices) \
+	INT(lean) \
+	INT(quitaway) \
+	INT(ts) \
+	\
+	STRING(automodes) \
+	STRING(dropmodes) \
+	STRING(password) \
+	STRING(away) \
+	STRING(awaynick) \
+	STRING(nick) \
+	STRING(realname) \
+	STRING(server) \
+	STRING(ip) \
+	STRING(channels) \
+	STRING(suspend) \
+	STRING(spass) \
+	STRING(ident) \
+	STRING(awaymessage) \
+	STRING(channelsort) \
+	STRING(autobacklog) \
+	STRING(maxchannels) \
+	STRING(maxnicks) \
+	STRING(maxbans) \
+	STRING(maxkeys) \
+	STRING(maxclients) \
+	INT(floodrate) \
+	INT(floodburst) \
+	STRING(floodpenalty) \
+	INT(floodcalibrate)
+
+DEFINE_CACHE(User, "user.", USER_OPTIONS);
 
 /**
  * client_t
@@ -131,7 +147,7 @@ class SBNCAPI CUser {
 	CVector<client_t> m_Clients; /**< the user's client connections */
 	CIRCConnection *m_IRC; /**< the user's irc connection */
 	CConfig *m_Config; /**< the user's configuration object */
-	mutable CACHE(User) m_ConfigCache; /**< config cache */
+	CCacheUser m_ConfigCache; /**< config cache */
 	CLog *m_Log; /**< the user's log file */
 
 	time_t m_ReconnectTime; /**< when the next connect() attempt is going to be made */
@@ -148,11 +164,15 @@ class SBNCAPI CUser {
 
 	CVector<X509 *> m_ClientCertificates; /**< the client certificates for the user */
 
+	CHashtable<SSL_SESSION *, false> m_SSLSessions; /**< SSL sessions for IRC servers ("host:port") */
+
 	int m_NextProtocolFamily; /**< which protocol family to try next */
 
 	bool PersistCertificates(void);
 
 	void BadLoginPulse(void);
+
+	void UpdateFloodControl(void);
 public:
 #ifndef SWIG
 	CUser(const char *Name);
@@ -161,6 +181,11 @@ public:
 
 	static void RescheduleReconnectTimer(void);
 
+#ifndef SWIG
+	SSL_SESSION *GetSSLSession(const char *Server) const;
+	bool SetSSLSession(const char *Server, SSL_SESSION *Session);
+#endif /* SWIG */
+
 	CClientConnection *GetPrimaryClientConnection(void);
 	CClientConnection *GetClientConnectionMultiplexer(void);
 	CVector<client_t> *GetClientConnections(void);
@@ -178,6 +203,7 @@ public:
 
 	const char *GetUsername(void) const;
 	CConfig *GetConfig(void);
+	CCacheUser *GetConfigCache(void);
 
 	void Simulate(const char *Command, CClientConnection *FakeClient = NULL);
 	const char *SimulateWithResult(const char *Command);
@@ -268,6 +294,15 @@ public:
 	void SetIdent(const char *Ident);
 	const char *GetIdent(void) const;
 
+	void SetFloodRate(unsigned int Rate);
+	unsigned int GetFloodRate(void) const;
+	void SetFloodBurst(unsigned int Burst);
+	unsigned int GetFloodBurst(void) const;
+	void SetFloodPenalty(const char *Penalty);
+	unsigned int GetFloodPenalty(void) const;
+	void SetFloodCalibration(bool Calibrate);
+	bool GetFloodCalibration(void) const;
+
 	const char *GetTagString(const char *Tag) const;
 	int GetTagInteger(const char *Tag) const;
 	bool SetTagString(const char *Tag, const char *Value);
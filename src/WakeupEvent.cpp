@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "StdAfx.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#	include <sys/eventfd.h>
+#endif /* HAVE_SYS_EVENTFD_H */
+
+/**
+ * WakeupInterrupted
+ *
+ * Returns whether the last read or write was interrupted by a signal and
+ * should be retried.
+ */
+static bool WakeupInterrupted(void) {
+#ifndef _WIN32
+	return errno == EINTR;
+#else
+	return false;
+#endif
+}
+
+/**
+ * CWakeupEvent
+ *
+ * Creates a wakeup event and registers it with the main loop. Use
+ * IsValid() to find out whether this was successful.
+ *
+ * @param Proc the function which is called when the event has been signalled
+ * @param Cookie the argument for the function
+ */
+CWakeupEvent::CWakeupEvent(WakeupProc Proc, void *Cookie) {
+	sockaddr_in Address;
+	socklen_t AddressLength = sizeof(Address);
+	unsigned long lTrue = 1;
+
+	m_Proc = Proc;
+	m_Cookie = Cookie;
+	m_EventFd = false;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	m_Socket = eventfd(0, 0);
+
+	if (m_Socket != INVALID_SOCKET) {
+		fcntl(m_Socket, F_SETFL, fcntl(m_Socket, F_GETFL) | O_NONBLOCK);
+		fcntl(m_Socket, F_SETFD, FD_CLOEXEC);
+
+		m_EventFd = true;
+
+		g_Bouncer->RegisterSocket(m_Socket, this);
+
+		return;
+	}
+#endif /* HAVE_SYS_EVENTFD_H */
+
+	// the socket sends datagrams to itself
+	m_Socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (m_Socket == INVALID_SOCKET) {
+		return;
+	}
+
+	memset(&Address, 0, sizeof(Address));
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	Address.sin_port = 0;
+
+	if (bind(m_Socket, (sockaddr *)&Address, sizeof(Address)) != 0 ||
+			getsockname(m_Socket, (sockaddr *)&Address, &AddressLength) != 0 ||
+			connect(m_Socket, (sockaddr *)&Address, sizeof(Address)) != 0) {
+		closesocket(m_Socket);
+		m_Socket = INVALID_SOCKET;
+
+		return;
+	}
+
+	ioctlsocket(m_Socket, FIONBIO, &lTrue);
+
+	g_Bouncer->RegisterSocket(m_Socket, this);
+}
+
+/**
+ * ~CWakeupEvent
+ *
+ * Unregisters and closes the event.
+ */
+CWakeupEvent::~CWakeupEvent(void) {
+	if (m_Socket != INVALID_SOCKET) {
+		g_Bouncer->UnregisterSocket(m_Socket);
+		closesocket(m_Socket);
+	}
+}
+
+/**
+ * IsValid
+ *
+ * Returns whether the event could be created.
+ */
+bool CWakeupEvent::IsValid(void) const {
+	return m_Socket != INVALID_SOCKET;
+}
+
+/**
+ * Signal
+ *
+ * Wakes up the main loop. This function may be called from any thread.
+ */
+void CWakeupEvent::Signal(void) {
+	if (m_Socket == INVALID_SOCKET) {
+		return;
+	}
+
+	// neither of these blocks: if the eventfd counter or the socket's receive
+	// buffer is full the main loop is going to wake up anyway
+#ifdef HAVE_SYS_EVENTFD_H
+	if (m_EventFd) {
+		uint64_t Value = 1;
+
+		while (write(m_Socket, &Value, sizeof(Value)) < 0 && WakeupInterrupted())
+			; // empty
+
+		return;
+	}
+#endif /* HAVE_SYS_EVENTFD_H */
+
+	while (send(m_Socket, "", 1, 0) < 0 && WakeupInterrupted())
+		; // empty
+}
+
+/**
+ * Destroy
+ *
+ * Wakeup events are owned by whoever created them, this does nothing.
+ */
+void CWakeupEvent::Destroy(void) {
+}
+
+/**
+ * Read
+ *
+ * Called when the event has been signalled.
+ */
+int CWakeupEvent::Read(bool DontProcess) {
+	char Buffer[64];
+	int Result;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	if (m_EventFd) {
+		uint64_t Value;
+
+		// this resets the counter
+		do {
+			Result = read(m_Socket, &Value, sizeof(Value));
+		} while (Result < 0 && WakeupInterrupted());
+
+		// the event wasn't signalled
+		if (Result != sizeof(Value)) {
+			return 0;
+		}
+	} else
+#endif /* HAVE_SYS_EVENTFD_H */
+	{
+		do {
+			Result = recv(m_Socket, Buffer, sizeof(Buffer), 0);
+		} while (Result > 0 || (Result < 0 && WakeupInterrupted()));
+	}
+
+	if (m_Proc != NULL) {
+		m_Proc(m_Cookie);
+	}
+
+	return 0;
+}
+
+int CWakeupEvent::Write(void) {
+	return 0;
+}
+
+void CWakeupEvent::Error(int ErrorCode) {
+}
+
+bool CWakeupEvent::HasQueuedData(void) const {
+	return false;
+}
+
+bool CWakeupEvent::ShouldDestroy(void) const {
+	return false;
+}
+
+const char *CWakeupEvent::GetClassName(void) const {
+	return "CWakeupEvent";
+}
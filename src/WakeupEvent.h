@@ -0,0 +1,64 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#ifndef WAKEUPEVENT_H
+#define WAKEUPEVENT_H
+
+/**
+ * WakeupProc
+ *
+ * A function which is called on the main thread after a wakeup event
+ * has been signalled.
+ */
+typedef void (*WakeupProc)(void *Cookie);
+
+/**
+ * CWakeupEvent
+ *
+ * Wakes up the main loop from another thread. Signal() may be called from
+ * any thread; the callback runs on the main thread. Signals which arrive
+ * before the main loop had a chance to run the callback are coalesced.
+ * An eventfd is used where it's available, a loopback socket otherwise.
+ */
+class SBNCAPI CWakeupEvent : public CSocketEvents {
+	SOCKET m_Socket; /**< the eventfd or loopback socket */
+	bool m_EventFd; /**< whether the descriptor is an eventfd */
+
+	WakeupProc m_Proc; /**< the callback */
+	void *m_Cookie; /**< the callback's argument */
+public:
+#ifndef SWIG
+	CWakeupEvent(WakeupProc Proc, void *Cookie);
+	virtual ~CWakeupEvent(void);
+#endif /* SWIG */
+
+	bool IsValid(void) const;
+	void Signal(void);
+
+	// CSocketEvents
+	void Destroy(void);
+	int Read(bool DontProcess = false);
+	int Write(void);
+	void Error(int ErrorCode);
+	bool HasQueuedData(void) const;
+	bool ShouldDestroy(void) const;
+	const char *GetClassName(void) const;
+};
+
+#endif /* WAKEUPEVENT_H */
@@ -0,0 +1,468 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#include "StdAfx.h"
+
+/**
+ * workerlock_t
+ *
+ * A mutex.
+ */
+typedef struct workerlock_s {
+#ifdef _WIN32
+	CRITICAL_SECTION Section;
+#else
+	pthread_mutex_t Mutex;
+#endif
+} workerlock_t;
+
+/**
+ * workerthread_t
+ *
+ * A worker thread and its queue.
+ */
+typedef struct workerthread_s {
+	CWorkerPool *Pool; /**< the pool */
+	workerlock_t Lock; /**< protects the queue */
+#ifdef _WIN32
+	HANDLE Event; /**< signalled when there are new jobs */
+	HANDLE Handle; /**< the thread */
+#else
+	pthread_cond_t Condition; /**< signalled when there are new jobs */
+	pthread_t Handle; /**< the thread */
+#endif
+	workerjob_t *Head; /**< the first job in the queue */
+	workerjob_t *Tail; /**< the last job in the queue */
+	bool Shutdown; /**< whether the thread should exit once the queue is empty */
+} workerthread_t;
+
+static void InitLock(workerlock_t *Lock) {
+#ifdef _WIN32
+	InitializeCriticalSection(&Lock->Section);
+#else
+	pthread_mutex_init(&Lock->Mutex, NULL);
+#endif
+}
+
+static void DestroyLock(workerlock_t *Lock) {
+#ifdef _WIN32
+	DeleteCriticalSection(&Lock->Section);
+#else
+	pthread_mutex_destroy(&Lock->Mutex);
+#endif
+}
+
+static void AcquireLock(workerlock_t *Lock) {
+#ifdef _WIN32
+	EnterCriticalSection(&Lock->Section);
+#else
+	pthread_mutex_lock(&Lock->Mutex);
+#endif
+}
+
+static void ReleaseLock(workerlock_t *Lock) {
+#ifdef _WIN32
+	LeaveCriticalSection(&Lock->Section);
+#else
+	pthread_mutex_unlock(&Lock->Mutex);
+#endif
+}
+
+/**
+ * WaitForJobs
+ *
+ * Waits until a thread's queue has been modified. The caller must
+ * hold the thread's lock.
+ *
+ * @param Thread the thread
+ */
+static void WaitForJobs(workerthread_t *Thread) {
+#ifdef _WIN32
+	ReleaseLock(&Thread->Lock);
+	WaitForSingleObject(Thread->Event, INFINITE);
+	AcquireLock(&Thread->Lock);
+#else
+	pthread_cond_wait(&Thread->Condition, &Thread->Lock.Mutex);
+#endif
+}
+
+/**
+ * NotifyThread
+ *
+ * Wakes up a worker thread.
+ *
+ * @param Thread the thread
+ */
+static void NotifyThread(workerthread_t *Thread) {
+#ifdef _WIN32
+	SetEvent(Thread->Event);
+#else
+	pthread_cond_signal(&Thread->Condition);
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WorkerThreadProc(LPVOID Thread) {
+	return (DWORD)(uintptr_t)CWorkerPool::WorkerThread(Thread);
+}
+#endif
+
+/**
+ * CWorkerPool
+ *
+ * Creates a worker pool. Use GetThreadCount() to find out how many
+ * threads could actually be started.
+ *
+ * @param Threads the number of threads
+ */
+CWorkerPool::CWorkerPool(int Threads) {
+	m_Completed = NULL;
+	m_Signalled = false;
+	m_Pending = 0;
+	m_Processed = 0;
+	m_ThreadCount = 0;
+	m_Threads = NULL;
+	m_Wakeup = NULL;
+
+	m_Lock = (workerlock_t *)malloc(sizeof(workerlock_t));
+
+	if (AllocFailed(m_Lock)) {
+		g_Bouncer->Fatal();
+	}
+
+	InitLock(m_Lock);
+
+	m_Wakeup = new CWakeupEvent(WakeupCallback, this);
+
+	if (AllocFailed(m_Wakeup)) {
+		return;
+	}
+
+	if (!m_Wakeup->IsValid()) {
+		delete m_Wakeup;
+		m_Wakeup = NULL;
+
+		return;
+	}
+
+	if (Threads > WORKERPOOL_MAXTHREADS) {
+		Threads = WORKERPOOL_MAXTHREADS;
+	}
+
+	m_Threads = (workerthread_t *)malloc(sizeof(workerthread_t) * Threads);
+
+	if (AllocFailed(m_Threads)) {
+		return;
+	}
+
+	for (int i = 0; i < Threads; i++) {
+		workerthread_t *Thread = &m_Threads[i];
+
+		Thread->Pool = this;
+		Thread->Head = NULL;
+		Thread->Tail = NULL;
+		Thread->Shutdown = false;
+
+		InitLock(&Thread->Lock);
+
+#ifdef _WIN32
+		Thread->Event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		Thread->Handle = CreateThread(NULL, 0, WorkerThreadProc, Thread, 0, NULL);
+
+		if (Thread->Handle == NULL) {
+			CloseHandle(Thread->Event);
+#else
+		pthread_cond_init(&Thread->Condition, NULL);
+
+		if (pthread_create(&Thread->Handle, NULL, WorkerThread, Thread) != 0) {
+			pthread_cond_destroy(&Thread->Condition);
+#endif
+			DestroyLock(&Thread->Lock);
+
+			break;
+		}
+
+		m_ThreadCount++;
+	}
+}
+
+/**
+ * ~CWorkerPool
+ *
+ * Waits for all queued jobs to finish and destroys the pool. Jobs which
+ * are submitted by "done" functions while the pool is being destroyed are
+ * rejected, so their callers can do the work themselves.
+ */
+CWorkerPool::~CWorkerPool(void) {
+	int ThreadCount = m_ThreadCount;
+
+	for (int i = 0; i < ThreadCount; i++) {
+		workerthread_t *Thread = &m_Threads[i];
+
+		AcquireLock(&Thread->Lock);
+		Thread->Shutdown = true;
+		NotifyThread(Thread);
+		ReleaseLock(&Thread->Lock);
+	}
+
+	for (int i = 0; i < ThreadCount; i++) {
+		workerthread_t *Thread = &m_Threads[i];
+
+#ifdef _WIN32
+		WaitForSingleObject(Thread->Handle, INFINITE);
+#else
+		pthread_join(Thread->Handle, NULL);
+#endif
+	}
+
+	// Submit() fails from now on
+	m_ThreadCount = 0;
+
+	DeliverCompleted();
+
+	for (int i = 0; i < ThreadCount; i++) {
+		workerthread_t *Thread = &m_Threads[i];
+
+#ifdef _WIN32
+		CloseHandle(Thread->Handle);
+		CloseHandle(Thread->Event);
+#else
+		pthread_cond_destroy(&Thread->Condition);
+#endif
+
+		DestroyLock(&Thread->Lock);
+	}
+
+	free(m_Threads);
+
+	delete m_Wakeup;
+
+	DestroyLock(m_Lock);
+	free(m_Lock);
+}
+
+/**
+ * WorkerThread
+ *
+ * The main function for worker threads.
+ *
+ * @param Thread the thread's workerthread_t structure
+ */
+void *CWorkerPool::WorkerThread(void *Thread) {
+	workerthread_t *Worker = (workerthread_t *)Thread;
+	workerjob_t *Job;
+
+	AcquireLock(&Worker->Lock);
+
+	while (true) {
+		while (Worker->Head == NULL && !Worker->Shutdown) {
+			WaitForJobs(Worker);
+		}
+
+		// finish all queued jobs before shutting down
+		if (Worker->Head == NULL) {
+			break;
+		}
+
+		Job = Worker->Head;
+		Worker->Head = Job->Next;
+
+		if (Worker->Head == NULL) {
+			Worker->Tail = NULL;
+		}
+
+		ReleaseLock(&Worker->Lock);
+
+		Job->Work(Job->Cookie);
+
+		Worker->Pool->Complete(Job);
+
+		AcquireLock(&Worker->Lock);
+	}
+
+	ReleaseLock(&Worker->Lock);
+
+	return NULL;
+}
+
+/**
+ * Submit
+ *
+ * Queues a job. Jobs which are submitted using the same shard key are
+ * executed by the same thread in the order in which they were submitted.
+ *
+ * @param Shard the shard key (see GetShard())
+ * @param Work the function which is executed by a worker thread
+ * @param Done a function which is executed by the main thread once the
+ *             job has finished, or NULL
+ * @param Cookie the argument for both functions
+ */
+RESULT<bool> CWorkerPool::Submit(unsigned int Shard, WorkerProc Work, WorkerProc Done, void *Cookie) {
+	workerthread_t *Thread;
+	workerjob_t *Job;
+
+	if (m_ThreadCount == 0) {
+		THROW(bool, Generic_Unknown, "There are no worker threads.");
+	}
+
+	Job = (workerjob_t *)malloc(sizeof(workerjob_t));
+
+	if (AllocFailed(Job)) {
+		THROW(bool, Generic_OutOfMemory, "Out of memory.");
+	}
+
+	Job->Work = Work;
+	Job->Done = Done;
+	Job->Cookie = Cookie;
+	Job->Next = NULL;
+
+	Thread = &m_Threads[Shard % m_ThreadCount];
+
+	AcquireLock(&Thread->Lock);
+
+	if (Thread->Tail != NULL) {
+		Thread->Tail->Next = Job;
+	} else {
+		Thread->Head = Job;
+	}
+
+	Thread->Tail = Job;
+
+	NotifyThread(Thread);
+
+	ReleaseLock(&Thread->Lock);
+
+	m_Pending++;
+
+	RETURN(bool, true);
+}
+
+/**
+ * Complete
+ *
+ * Called by worker threads to put a finished job into the mailbox.
+ *
+ * @param Job the job
+ */
+void CWorkerPool::Complete(workerjob_t *Job) {
+	bool Signal;
+
+	AcquireLock(m_Lock);
+
+	Job->Next = m_Completed;
+	m_Completed = Job;
+
+	Signal = !m_Signalled;
+	m_Signalled = true;
+
+	ReleaseLock(m_Lock);
+
+	if (Signal) {
+		m_Wakeup->Signal();
+	}
+}
+
+/**
+ * DeliverCompleted
+ *
+ * Calls the "done" functions for all finished jobs.
+ */
+void CWorkerPool::DeliverCompleted(void) {
+	workerjob_t *Jobs, *Job, *Ordered = NULL;
+
+	AcquireLock(m_Lock);
+
+	Jobs = m_Completed;
+	m_Completed = NULL;
+	m_Signalled = false;
+
+	ReleaseLock(m_Lock);
+
+	// the mailbox is a stack, restore the order in which the jobs finished
+	while (Jobs != NULL) {
+		Job = Jobs;
+		Jobs = Job->Next;
+
+		Job->Next = Ordered;
+		Ordered = Job;
+	}
+
+	while (Ordered != NULL) {
+		Job = Ordered;
+		Ordered = Job->Next;
+
+		m_Pending--;
+		m_Processed++;
+
+		if (Job->Done != NULL) {
+			Job->Done(Job->Cookie);
+		}
+
+		free(Job);
+	}
+}
+
+/**
+ * GetThreadCount
+ *
+ * Returns the number of worker threads.
+ */
+int CWorkerPool::GetThreadCount(void) const {
+	return m_ThreadCount;
+}
+
+/**
+ * GetPendingCount
+ *
+ * Returns the number of jobs which haven't completed yet.
+ */
+unsigned int CWorkerPool::GetPendingCount(void) const {
+	return m_Pending;
+}
+
+/**
+ * GetProcessedCount
+ *
+ * Returns the number of jobs which have completed.
+ */
+unsigned int CWorkerPool::GetProcessedCount(void) const {
+	return m_Processed;
+}
+
+/**
+ * GetShard
+ *
+ * Returns the shard key for a string (e.g. a username).
+ *
+ * @param Key the string
+ */
+unsigned int CWorkerPool::GetShard(const char *Key) {
+	return (unsigned int)Hash(Key, false);
+}
+
+/**
+ * WakeupCallback
+ *
+ * Called when a worker thread has woken up the main loop.
+ *
+ * @param Pool the worker pool
+ */
+void CWorkerPool::WakeupCallback(void *Pool) {
+	((CWorkerPool *)Pool)->DeliverCompleted();
+}
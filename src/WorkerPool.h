@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * shroudBNC - an object-oriented framework for IRC                            *
+ * Copyright (C) 2005-2014 Gunnar Beutner                                      *
+ *                                                                             *
+ * This program is free software; you can redistribute it and/or               *
+ * modify it under the terms of the GNU General Public License                 *
+ * as published by the Free Software Foundation; either version 2              *
+ * of the License, or (at your option) any later version.                      *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the               *
+ * GNU General Public License for more details.                                *
+ *                                                                             *
+ * You should have received a copy of the GNU General Public License           *
+ * along with this program; if not, write to the Free Software                 *
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA. *
+ *******************************************************************************/
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+/** The maximum number of worker threads */
+#define WORKERPOOL_MAXTHREADS 64
+
+/**
+ * WorkerProc
+ *
+ * A function which is executed for a job. The "work" function runs on a
+ * worker thread and must not touch any of the bouncer's objects (including
+ * g_Bouncer); the "done" function runs on the main thread.
+ */
+typedef void (*WorkerProc)(void *Cookie);
+
+/**
+ * workerjob_t
+ *
+ * A job for the worker pool.
+ */
+typedef struct workerjob_s {
+	WorkerProc Work; /**< the function which runs on the worker thread */
+	WorkerProc Done; /**< the function which runs on the main thread afterwards */
+	void *Cookie; /**< the argument for both functions */
+	struct workerjob_s *Next; /**< the next job in the queue */
+} workerjob_t;
+
+struct workerthread_s;
+struct workerlock_s;
+
+/**
+ * CWorkerPool
+ *
+ * A pool of threads for work which would otherwise stall the main loop.
+ * Each worker has its own queue; jobs are assigned to a worker using a
+ * shard key so that jobs with the same key (e.g. all jobs for one user)
+ * are executed in the order in which they were submitted. Results are
+ * passed back to the main thread through a mailbox which wakes up the
+ * main loop.
+ */
+class SBNCAPI CWorkerPool {
+	struct workerthread_s *m_Threads; /**< the worker threads */
+	int m_ThreadCount; /**< the number of worker threads */
+
+	struct workerlock_s *m_Lock; /**< protects the mailbox */
+	workerjob_t *m_Completed; /**< jobs which have been executed, newest first */
+	CWakeupEvent *m_Wakeup; /**< wakes up the main loop when jobs have completed */
+	bool m_Signalled; /**< whether the main loop has already been woken up */
+
+	unsigned int m_Pending; /**< the number of jobs which haven't completed yet */
+	unsigned int m_Processed; /**< the number of jobs which have completed */
+
+	void Complete(workerjob_t *Job);
+	void DeliverCompleted(void);
+
+	static void WakeupCallback(void *Pool);
+public:
+#ifndef SWIG
+	CWorkerPool(int Threads);
+	virtual ~CWorkerPool(void);
+#endif /* SWIG */
+
+	RESULT<bool> Submit(unsigned int Shard, WorkerProc Work, WorkerProc Done, void *Cookie);
+
+	int GetThreadCount(void) const;
+	unsigned int GetPendingCount(void) const;
+	unsigned int GetProcessedCount(void) const;
+
+	static unsigned int GetShard(const char *Key);
+	static void *WorkerThread(void *Thread);
+};
+
+#endif /* WORKERPOOL_H */
@@ -33,6 +33,7 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -42,6 +43,7 @@
 #include <limits.h>
 #include <termios.h>
 #include <strings.h>
+#include <pthread.h>
 
 typedef int SOCKET;
 
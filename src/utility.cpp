@@ -335,6 +335,155 @@ unsigned int ArgCount2(const tokendata_t& Tokens) {
 	return Tokens.Count;
 }
 
+/**
+ * GetIRCCommandId
+ *
+ * Returns the ID of an IRC command (regardless of its case).
+ *
+ * @param Command the command
+ */
+irc_command_t GetIRCCommandId(const char *Command) {
+	static const struct {
+		const char *Name;
+		irc_command_t Id;
+	} Commands[] = {
+		{ "PRIVMSG", IRCCommand_Privmsg },
+		{ "NOTICE", IRCCommand_Notice },
+		{ "JOIN", IRCCommand_Join },
+		{ "PART", IRCCommand_Part },
+		{ "KICK", IRCCommand_Kick },
+		{ "QUIT", IRCCommand_Quit },
+		{ "NICK", IRCCommand_Nick },
+		{ "MODE", IRCCommand_Mode },
+		{ "TOPIC", IRCCommand_Topic },
+		{ "INVITE", IRCCommand_Invite },
+		{ "KILL", IRCCommand_Kill },
+		{ "PING", IRCCommand_Ping },
+		{ "PONG", IRCCommand_Pong },
+		{ "ERROR", IRCCommand_Error },
+		{ "WALLOPS", IRCCommand_Wallops },
+		{ "AWAY", IRCCommand_Away },
+		{ "CAP", IRCCommand_Cap }
+	};
+
+	if (isdigit((unsigned char)Command[0]) && isdigit((unsigned char)Command[1]) &&
+			isdigit((unsigned char)Command[2]) && Command[3] == '\0') {
+		return IRCCommand_Numeric;
+	}
+
+	for (size_t i = 0; i < sizeof(Commands) / sizeof(Commands[0]); i++) {
+		/* cheap check for the first character before comparing the whole command */
+		if ((Command[0] & ~0x20) == Commands[i].Name[0] && strcasecmp(Command, Commands[i].Name) == 0) {
+			return Commands[i].Id;
+		}
+	}
+
+	return IRCCommand_Unknown;
+}
+
+/**
+ * ParseIRCMessage
+ *
+ * Fills an ircmessage_t structure for a line which has been tokenized
+ * by ArgTokenize2(). The Channel field is set to NULL. No memory is
+ * allocated; the message refers to the tokens and the tags.
+ *
+ * @param Message the message
+ * @param Tags the line's IRCv3 tags without the leading '@' (up to the next
+ *             space), or NULL
+ * @param HasPrefix whether the first token is the line's prefix
+ * @param ArgC the number of tokens
+ * @param ArgV the tokens
+ */
+void ParseIRCMessage(ircmessage_t *Message, const char *Tags, bool HasPrefix, int ArgC, const char **ArgV) {
+	static const char Empty[] = "";
+	int First;
+
+	Message->ArgC = ArgC;
+	Message->ArgV = ArgV;
+
+	Message->Prefix.Data = Message->Nick.Data = Message->User.Data = Message->Host.Data = Empty;
+	Message->Prefix.Length = Message->Nick.Length = Message->User.Length = Message->Host.Length = 0;
+
+	Message->Command.Data = Empty;
+	Message->Command.Length = 0;
+	Message->CommandId = IRCCommand_Unknown;
+	Message->Numeric = 0;
+
+	Message->ParamCount = 0;
+	Message->TagCount = 0;
+	Message->Channel = NULL;
+
+	if (HasPrefix && ArgC > 0) {
+		const char *Prefix = ArgV[0];
+		const char *Bang, *At;
+
+		Message->Prefix.Data = Prefix;
+		Message->Prefix.Length = strlen(Prefix);
+
+		Bang = strchr(Prefix, '!');
+		At = strchr(Bang ? Bang : Prefix, '@');
+
+		Message->Nick.Data = Prefix;
+		Message->Nick.Length = (Bang ? Bang : (At ? At : Prefix + Message->Prefix.Length)) - Prefix;
+
+		if (Bang != NULL) {
+			Message->User.Data = Bang + 1;
+			Message->User.Length = (At ? At : Prefix + Message->Prefix.Length) - (Bang + 1);
+		}
+
+		if (At != NULL) {
+			Message->Host.Data = At + 1;
+			Message->Host.Length = Prefix + Message->Prefix.Length - (At + 1);
+		}
+	}
+
+	First = HasPrefix ? 1 : 0;
+
+	if (ArgC > First) {
+		Message->Command.Data = ArgV[First];
+		Message->Command.Length = strlen(ArgV[First]);
+		Message->CommandId = GetIRCCommandId(ArgV[First]);
+
+		if (Message->CommandId == IRCCommand_Numeric) {
+			Message->Numeric = atoi(ArgV[First]);
+		}
+	}
+
+	for (int i = First + 1; i < ArgC && Message->ParamCount < IRCMESSAGE_MAXPARAMS; i++) {
+		Message->Params[Message->ParamCount].Data = ArgV[i];
+		Message->Params[Message->ParamCount].Length = strlen(ArgV[i]);
+		Message->ParamCount++;
+	}
+
+	while (Tags != NULL && *Tags != '\0' && *Tags != ' ' && Message->TagCount < IRCMESSAGE_MAXTAGS) {
+		irctag_t *Tag = &Message->Tags[Message->TagCount];
+		size_t Length = strcspn(Tags, "; ");
+		const char *Equals = (const char *)memchr(Tags, '=', Length);
+
+		if (Length > 0) {
+			Tag->Key.Data = Tags;
+			Tag->Key.Length = Equals ? (size_t)(Equals - Tags) : Length;
+
+			if (Equals != NULL) {
+				Tag->Value.Data = Equals + 1;
+				Tag->Value.Length = Tags + Length - (Equals + 1);
+			} else {
+				Tag->Value.Data = Empty;
+				Tag->Value.Length = 0;
+			}
+
+			Message->TagCount++;
+		}
+
+		Tags += Length;
+
+		if (*Tags == ';') {
+			Tags++;
+		}
+	}
+}
+
 /**
  * SocketAndConnect
  *
@@ -986,6 +1135,30 @@ void FreeString(char *String) {
 	free(String);
 }
 
+/**
+ * GetMonotonicTime
+ *
+ * Returns the number of milliseconds since some unspecified point in
+ * the past. Unlike time() this is not affected by changes to the system clock.
+ */
+uint64_t GetMonotonicTime(void) {
+#ifdef _WIN32
+	return GetTickCount64();
+#elif defined(CLOCK_MONOTONIC)
+	timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return (uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+#else
+	timeval Now;
+
+	gettimeofday(&Now, NULL);
+
+	return (uint64_t)Now.tv_sec * 1000 + Now.tv_usec / 1000;
+#endif
+}
+
 /**
  * strmcpy
  *
@@ -65,6 +65,93 @@ const char **ArgToArray2(const tokendata_t& Tokens);
 const char *ArgGet2(const tokendata_t& Tokens, unsigned int Arg);
 unsigned int ArgCount2(const tokendata_t& Tokens);
 
+class CChannel;
+
+/** The maximum number of parameters in an ircmessage_t (ArgTokenize2 returns at most 32 tokens) */
+#define IRCMESSAGE_MAXPARAMS 32
+
+/** The maximum number of IRCv3 tags in an ircmessage_t, any further tags are ignored */
+#define IRCMESSAGE_MAXTAGS 32
+
+/**
+ * irc_command_t
+ *
+ * Identifies commonly used IRC commands.
+ */
+typedef enum irc_command_e {
+	IRCCommand_Unknown,
+	IRCCommand_Numeric,
+	IRCCommand_Privmsg,
+	IRCCommand_Notice,
+	IRCCommand_Join,
+	IRCCommand_Part,
+	IRCCommand_Kick,
+	IRCCommand_Quit,
+	IRCCommand_Nick,
+	IRCCommand_Mode,
+	IRCCommand_Topic,
+	IRCCommand_Invite,
+	IRCCommand_Kill,
+	IRCCommand_Ping,
+	IRCCommand_Pong,
+	IRCCommand_Error,
+	IRCCommand_Wallops,
+	IRCCommand_Away,
+	IRCCommand_Cap
+} irc_command_t;
+
+/**
+ * ircspan_t
+ *
+ * A part of a string, which is not necessarily NUL-terminated.
+ */
+typedef struct ircspan_s {
+	const char *Data; /**< the first character, never NULL */
+	size_t Length; /**< the number of characters */
+} ircspan_t;
+
+/**
+ * irctag_t
+ *
+ * An IRCv3 message tag.
+ */
+typedef struct irctag_s {
+	ircspan_t Key; /**< the tag's key (including any vendor prefix) */
+	ircspan_t Value; /**< the tag's value (still escaped), empty if there is none */
+} irctag_t;
+
+/**
+ * ircmessage_t
+ *
+ * A line which was received from an IRC server. It points into the
+ * tokenized line, so it's only valid while the line is being processed.
+ * Unlike the other spans the parameters are NUL-terminated.
+ */
+typedef struct ircmessage_s {
+	int ArgC; /**< the number of tokens (as passed to InterceptIRCMessage) */
+	const char **ArgV; /**< the tokens (as passed to InterceptIRCMessage) */
+
+	ircspan_t Prefix; /**< the prefix without the colon, empty if there is none */
+	ircspan_t Nick; /**< the nick (or server name) in the prefix */
+	ircspan_t User; /**< the username in the prefix, empty if there is none */
+	ircspan_t Host; /**< the host in the prefix, empty if there is none */
+
+	ircspan_t Command; /**< the command */
+	irc_command_t CommandId; /**< the command's ID, regardless of its case */
+	int Numeric; /**< the numeric if CommandId is IRCCommand_Numeric, 0 otherwise */
+
+	int ParamCount; /**< the number of parameters */
+	ircspan_t Params[IRCMESSAGE_MAXPARAMS]; /**< the parameters */
+
+	int TagCount; /**< the number of IRCv3 tags */
+	irctag_t Tags[IRCMESSAGE_MAXTAGS]; /**< the tags */
+
+	CChannel *Channel; /**< the channel the message refers to (if the user is on it), or NULL */
+} ircmessage_t;
+
+SBNCAPI irc_command_t GetIRCCommandId(const char *Command);
+SBNCAPI void ParseIRCMessage(ircmessage_t *Message, const char *Tags, bool HasPrefix, int ArgC, const char **ArgV);
+
 SOCKET SocketAndConnect(const char *Host, unsigned int Port, const char *BindIp = NULL);
 SOCKET SocketAndConnectResolved(const sockaddr *Host, const sockaddr *BindIp, int *error);
 
@@ -84,7 +171,21 @@ SBNCAPI void DeleteCommand(commandlist_t *Commands, const char *Name);
 SBNCAPI int CmpCommandT(const void *pA, const void *pB);
 
 #define BNCVERSION SBNC_VERSION
-#define INTERFACEVERSION 25
+#define INTERFACEVERSION 27
+
+/**
+ * The oldest interface version which modules may have been compiled for. Modules
+ * use inline templates and class layouts from the headers (e.g. CHashtable, CQueue,
+ * CNick and CUser), so this has to be raised to INTERFACEVERSION whenever one of
+ * them changes.
+ */
+#define MININTERFACEVERSION 27
+
+/** The interface version which added CModuleFar::GetSubscriptions */
+#define INTERFACEVERSION_SUBSCRIPTIONS 26
+
+/** The interface version which added CModuleFar::InterceptParsedIRCMessage */
+#define INTERFACEVERSION_PARSEDMESSAGES 27
 
 extern const char *g_ErrorFile;
 extern unsigned int g_ErrorLine;
@@ -111,6 +212,8 @@ int SetPermissions(const char *Filename, int Modes);
 
 void FreeString(char *String);
 
+SBNCAPI uint64_t GetMonotonicTime(void);
+
 void SSL_CTX_set_passwd_cb(SSL_CTX *Context);
 
 #if defined(_DEBUG) && defined(_WIN32)